@@ -0,0 +1,105 @@
+#include <assert.h>
+#include <string.h>
+#include <algorithm>
+
+#include "batch_log.h"
+#include "nvm_node_allocator.h"
+#include "metadb/debug.h"
+
+namespace metadb {
+
+static uint64_t BatchLogChecksum(uint64_t seq, uint32_t len, uint32_t count, const char *rep){
+    uint64_t header[2] = {seq, (static_cast<uint64_t>(len) << 32) | count};
+    return MurmurHash64(rep, len, MurmurHash64(header, sizeof(header)));
+}
+
+bool NvmBatchLogRecord::IsValid(){
+    return magic == BATCH_LOG_MAGIC && len <= BATCH_LOG_MAX_SIZE && checksum == BatchLogChecksum(seq, len, count, rep);
+}
+
+BatchLog::BatchLog(pointer_t area) : cv_(&mu_) {
+    assert(sizeof(NvmBatchLogRecord) == BATCH_LOG_SLOT_SIZE);
+    records_ = static_cast<NvmBatchLogRecord *>(NODE_GET_POINTER(area));
+    for(uint32_t i = 0; i < BATCH_LOG_SLOT_NUM; i++){
+        free_slots_.push_back(i);
+    }
+    seq_.store(1);
+}
+
+BatchLog::~BatchLog(){
+
+}
+
+pointer_t BatchLog::CreateLogArea(){
+    void *area = node_allocator->AllocateAndInit(BATCH_LOG_AREA_SIZE, 0);
+    return NODE_GET_OFFSET(area);
+}
+
+uint32_t BatchLog::AcquireSlot(){
+    MutexLock lock(&mu_);
+    while(free_slots_.empty()){
+        cv_.Wait();
+    }
+    uint32_t slot = free_slots_.back();
+    free_slots_.pop_back();
+    return slot;
+}
+
+void BatchLog::ReleaseSlot(uint32_t slot){
+    MutexLock lock(&mu_);
+    free_slots_.push_back(slot);
+    cv_.Signal();
+}
+
+int BatchLog::Append(const WriteBatch &batch, uint32_t &slot){
+    const string &rep = batch.Rep();
+    if(rep.size() > BATCH_LOG_MAX_SIZE){
+        ERROR_PRINT("write batch too large! size:%lu max:%u count:%u\n", rep.size(), BATCH_LOG_MAX_SIZE, batch.Count());
+        return -1;
+    }
+    slot = AcquireSlot();
+    NvmBatchLogRecord *record = &(records_[slot]);
+    //头部和rep在DRAM中拼好，整条记录一次flush一次fence
+    char buf[BATCH_LOG_SLOT_SIZE];
+    NvmBatchLogRecord *tmp = reinterpret_cast<NvmBatchLogRecord *>(buf);
+    tmp->magic = BATCH_LOG_MAGIC;
+    tmp->seq = seq_.fetch_add(1);
+    tmp->len = rep.size();
+    tmp->count = batch.Count();
+    memcpy(tmp->rep, rep.data(), rep.size());
+    tmp->checksum = BatchLogChecksum(tmp->seq, tmp->len, tmp->count, tmp->rep);
+    node_allocator->nvm_memcpy_persist(record, buf, BATCH_LOG_HEADER_SIZE + rep.size());
+    return 0;
+}
+
+void BatchLog::Finish(uint32_t slot){
+    uint64_t magic = 0;
+    node_allocator->nvm_memcpy_persist(&(records_[slot].magic), &magic, sizeof(uint64_t));
+    ReleaseSlot(slot);
+}
+
+uint64_t BatchLog::Replay(WriteBatch::Handler *handler){
+    vector<pair<uint64_t, uint32_t>> logs;   //seq, slot
+    uint64_t max_seq = 0;
+    for(uint32_t i = 0; i < BATCH_LOG_SLOT_NUM; i++){
+        if(records_[i].IsValid()){
+            logs.push_back(make_pair(records_[i].seq, i));
+            max_seq = std::max(max_seq, records_[i].seq);
+        }
+    }
+    sort(logs.begin(), logs.end());
+    //batch中都是覆盖写和删除，部分执行过再从头执行一遍结果相同
+    for(auto it : logs){
+        NvmBatchLogRecord *record = &(records_[it.second]);
+        DBG_LOG("[batch] replay log slot:%u seq:%lu len:%u count:%u", it.second, record->seq, record->len, record->count);
+        if(WriteBatch::Iterate(Slice(record->rep, record->len), handler) != 0){
+            ERROR_PRINT("replay write batch error! slot:%u seq:%lu\n", it.second, record->seq);
+        }
+        uint64_t magic = 0;
+        node_allocator->nvm_memcpy_persist(&(record->magic), &magic, sizeof(uint64_t));
+    }
+    seq_.store(max_seq + 1);
+    return logs.size();
+}
+
+} // namespace name
@@ -0,0 +1,71 @@
+/**
+ * @Description : WriteBatch的redo日志，整个batch写成一条记录持久化后再逐个执行，重启时重做未完成的batch
+ */
+#ifndef _METADB_BATCH_LOG_H_
+#define _METADB_BATCH_LOG_H_
+
+#include <stdint.h>
+#include <vector>
+#include <atomic>
+
+#include "metadb/write_batch.h"
+#include "format.h"
+#include "../util/lock.h"
+
+using namespace std;
+
+namespace metadb {
+
+#define BATCH_LOG_MAGIC 0x474f4c4843544142ULL    //"BATCHLOG"
+#define BATCH_LOG_SLOT_NUM 16       //日志槽数，即同时执行的batch数上限
+#define BATCH_LOG_SLOT_SIZE 4096
+#define BATCH_LOG_HEADER_SIZE 32
+#define BATCH_LOG_MAX_SIZE (BATCH_LOG_SLOT_SIZE - BATCH_LOG_HEADER_SIZE)    //batch的rep不能超过该值
+#define BATCH_LOG_AREA_SIZE (BATCH_LOG_SLOT_NUM * BATCH_LOG_SLOT_SIZE)
+
+struct NvmBatchLogRecord {
+    uint64_t magic;      //BATCH_LOG_MAGIC且checksum一致说明日志完整，重启时需要重做
+    uint64_t seq;        //重做顺序
+    uint32_t len;
+    uint32_t count;
+    uint64_t checksum;   //seq、len、count和rep的hash，记录一次性写入，magic先于rep落盘时据此丢弃
+    char rep[BATCH_LOG_MAX_SIZE];
+
+    bool IsValid();
+};
+
+class BatchLog {
+public:
+    BatchLog(pointer_t area);   //area为node pool中BATCH_LOG_AREA_SIZE大小的日志区
+    ~BatchLog();
+
+    static pointer_t CreateLogArea();   //新建数据库时分配日志区
+
+    //整个batch写成一条日志，只persist一次，返回日志槽；batch太大返回-1
+    int Append(const WriteBatch &batch, uint32_t &slot);
+    void Finish(uint32_t slot);   //batch执行完，日志失效
+
+    //重启时按seq顺序重做所有完整的日志，返回重做的batch个数
+    uint64_t Replay(WriteBatch::Handler *handler);
+
+private:
+    NvmBatchLogRecord *records_;
+    Mutex mu_;
+    CondVar cv_;
+    vector<uint32_t> free_slots_;
+    std::atomic<uint64_t> seq_;
+
+    uint32_t AcquireSlot();
+    void ReleaseSlot(uint32_t slot);
+};
+
+} // namespace name
+
+
+
+
+
+
+
+
+#endif
@@ -6,6 +6,8 @@
  */
 
 #include "dir_db.h"
+#include "dir_iterator.h"
+#include "metadb/debug.h"
 
 
 namespace metadb {
@@ -17,6 +19,13 @@ DirDB::DirDB(const Option &option) : option_(option) {
     hashtable_ = new DirHashTable(option, 1, option_.DIR_FIRST_HASH_MAX_CAPACITY);
 }
 
+DirDB::DirDB(const Option &option, pointer_t root) : option_(option) {
+    assert(sizeof(LinkNode) == DIR_LINK_NODE_SIZE);
+    assert(sizeof(BptreeIndexNode) == DIR_BPTREE_INDEX_NODE_SIZE);
+    assert(sizeof(BptreeLeafNode) == DIR_BPTREE_LEAF_NODE_SIZE);
+    hashtable_ = new DirHashTable(option, 1, static_cast<NvmHashTableMeta *>(NODE_GET_POINTER(root)));
+}
+
 DirDB::~DirDB(){
     delete hashtable_;
 }
@@ -33,8 +42,24 @@ int DirDB::DirDelete(const inode_id_t key, const Slice &fname){
     return hashtable_->Delete(key, fname);
 }
 
+int DirDB::DirRename(const inode_id_t old_key, const Slice &old_fname, const inode_id_t new_key, const Slice &new_fname){
+    return hashtable_->Rename(old_key, old_fname, new_key, new_fname);
+}
+
+int DirDB::DirDropAll(const inode_id_t key, NvmDirDropRecord *record){
+    return hashtable_->DropKey(key, record);
+}
+
+void DirDB::GetBptreeValues(pointer_t root, vector<inode_id_t> &values){
+    BptreeGetValues(root, values);
+}
+
+void DirDB::ReclaimBptree(pointer_t *root_ref){
+    BptreeReclaim(root_ref);
+}
+
 Iterator* DirDB::DirGetIterator(const inode_id_t target){
-    return hashtable_->DirHashTableGetIterator(target);
+    return new DirSnapshotIterator(hashtable_, target, option_.DIR_ITERATOR_SNAPSHOT_RETRY, option_.DIR_ITERATOR_SEGMENT_NUM, option_.DIR_ITERATOR_FULL_SNAPSHOT);
 }
 
 void DirDB::PrintDir(){
@@ -45,4 +70,67 @@ void DirDB::PrintStats(std::string &stats){
     hashtable_->PrintHashTableStats(stats);
 }
 
+static const uint64_t DIR_RECOVER_BATCH = 64;   //每个线程一次领取的一级hash entry数
+
+struct DirRecoverJob {
+    DirHashTable *hashtable;
+    bool scan_nodes;
+    atomic<uint64_t> next;   //下一个待恢复的entry
+    uint64_t capacity;
+    Mutex mu;      //保护下面的汇总结果
+    vector<DirHashTable *> rehash_tables;
+    uint64_t link_node_nums;
+    uint64_t second_hash_nums;
+    uint64_t nvm_node_nums;
+};
+
+void DirDB::RecoverWork(void *arg){
+    DirRecoverJob *job = static_cast<DirRecoverJob *>(arg);
+    DirRecoverResult result(job->scan_nodes);
+    uint64_t nvm_node_nums = 0;
+    while(true){
+        uint64_t begin = job->next.fetch_add(DIR_RECOVER_BATCH);
+        if(begin >= job->capacity) break;
+        job->hashtable->RecoverRange(begin, begin + DIR_RECOVER_BATCH, result);
+        if(!result.nodes.empty()) node_allocator->RecoverAllocate(result.nodes);   //分批标记，避免收集的节点过多
+        nvm_node_nums += result.nodes.size();
+        result.nodes.clear();
+    }
+    job->mu.Lock();
+    job->rehash_tables.insert(job->rehash_tables.end(), result.rehash_tables.begin(), result.rehash_tables.end());
+    job->link_node_nums += result.link_node_nums;
+    job->second_hash_nums += result.second_hash_nums;
+    job->nvm_node_nums += nvm_node_nums;
+    job->mu.Unlock();
+}
+
+void DirDB::Recover(uint32_t thread_count, bool scan_nodes, std::string &stats){
+    DirRecoverResult root(scan_nodes);
+    hashtable_->RecoverNvmRoot(root);
+    if(!root.nodes.empty()) node_allocator->RecoverAllocate(root.nodes);
+
+    DirRecoverJob job;
+    job.hashtable = hashtable_;
+    job.scan_nodes = scan_nodes;
+    job.next.store(0);
+    job.capacity = hashtable_->GetCapacity();
+    job.link_node_nums = 0;
+    job.second_hash_nums = 0;
+    job.nvm_node_nums = root.nodes.size();
+    ThreadPool::RunParallel(thread_count, &DirDB::RecoverWork, &job);
+    rehash_tables_.swap(job.rehash_tables);
+
+    char buf[1024];
+    snprintf(buf, sizeof(buf), "dir recover: threads:%u first_hash_entrys:%lu second_hashs:%lu link_nodes:%lu nvm_nodes:%lu rehash_tables:%lu\n", \
+            thread_count, job.capacity, job.second_hash_nums, job.link_node_nums, job.nvm_node_nums, rehash_tables_.size());
+    stats.append(buf);
+}
+
+void DirDB::ResumeRehash(){
+    for(auto it : rehash_tables_){
+        it->ResumeRehash();
+    }
+    rehash_tables_.clear();
+}
+
 } // namespace name
\ No newline at end of file
@@ -9,6 +9,7 @@
 
 
 #include <string>
+#include <vector>
 #include "metadb/option.h"
 #include "metadb/slice.h"
 #include "metadb/inode.h"
@@ -20,18 +21,30 @@ namespace metadb {
 class DirDB {
 public:
     DirDB(const Option &option);
+    DirDB(const Option &option, pointer_t root);   //从NVM恢复，root是一级hash的NvmHashTableMeta
     virtual ~DirDB();
 
     virtual int DirPut(const inode_id_t key, const Slice &fname, const inode_id_t value);
     virtual int DirGet(const inode_id_t key, const Slice &fname, inode_id_t &value);
     virtual int DirDelete(const inode_id_t key, const Slice &fname);
+    virtual int DirRename(const inode_id_t old_key, const Slice &old_fname, const inode_id_t new_key, const Slice &new_fname);
+    virtual int DirDropAll(const inode_id_t key, NvmDirDropRecord *record);   //只摘除，摘下的内容记录在record中
+    virtual void GetBptreeValues(pointer_t root, vector<inode_id_t> &values);
+    virtual void ReclaimBptree(pointer_t *root_ref);
     virtual Iterator* DirGetIterator(const inode_id_t target);
 
     virtual void PrintDir();
     virtual void PrintStats(std::string &stats);
+
+    pointer_t GetRoot() { return hashtable_->GetMetaOffset(); }
+    void Recover(uint32_t thread_count, bool scan_nodes, std::string &stats);   //按一级hash entry分区，多线程恢复，scan_nodes时重建node_allocator位图
+    void ResumeRehash();
 private:
     const Option option_;
     DirHashTable *hashtable_;
+    vector<DirHashTable *> rehash_tables_;   //恢复时发现正在rehash的二级hash
+
+    static void RecoverWork(void *arg);
 };
 
 
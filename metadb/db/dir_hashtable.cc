@@ -13,7 +13,7 @@ using namespace std;
 namespace metadb {
 
 HashVersion::~HashVersion() {
-    if(buckets_ != nullptr){   //正常退出
+    if(!nvm_freed_){   //正常退出
         for(uint32_t i = 0; i < capacity_; i++){
             if(IS_SECOND_HASH_POINTER(buckets_[i].root)) {
                 DirHashTable *second_hash = static_cast<DirHashTable *>(buckets_[i].GetSecondHashAddr());
@@ -22,6 +22,7 @@ HashVersion::~HashVersion() {
         }
     }
     delete[] rwlock_;
+    delete[] seqlock_;
 }
 
 DirHashTable::DirHashTable(const Option &option, uint32_t hash_type, uint64_t capacity) : option_(option) {
@@ -32,13 +33,28 @@ DirHashTable::DirHashTable(const Option &option, uint32_t hash_type, uint64_t ca
 
     //init
     version_ = new HashVersion(capacity);
+    meta_ = AllocNvmHashTableMeta();
+    meta_->SetVersionPersist(NODE_GET_OFFSET(version_->buckets_), capacity);
     DBG_LOG("[dir] create hashtable:%p version:%p capacity:%lu", this, version_, capacity);
-    version_->Ref();
 }
 
-DirHashTable::~DirHashTable(){
-    if(version_) version_->Unref();
-    if(rehash_version_) rehash_version_->Unref();
+DirHashTable::DirHashTable(const Option &option, uint32_t hash_type, NvmHashTableMeta *meta) : option_(option) {
+    hash_type_ = hash_type;
+    is_rehash_ = false;
+    rehash_version_ = nullptr;
+    meta_ = meta;
+
+    version_ = new HashVersion(meta_->capacity, static_cast<NvmHashEntry *>(NODE_GET_POINTER(meta_->buckets)));
+    if(meta_->IsRehash()){  //rehash中途退出，两个版本都恢复
+        rehash_version_ = new HashVersion(meta_->rehash_capacity, static_cast<NvmHashEntry *>(NODE_GET_POINTER(meta_->rehash_buckets)));
+        is_rehash_ = true;
+    }
+    DBG_LOG("[dir] recover hashtable:%p version:%p capacity:%lu rehash_version:%p", this, version_, version_->capacity_, rehash_version_);
+}
+
+DirHashTable::~DirHashTable(){   //退出时已没有操作，直接删除
+    if(version_) delete version_;
+    if(rehash_version_) delete rehash_version_;
 }
 
 bool IsSecondHashEntry(NvmHashEntry *entry){
@@ -46,34 +62,26 @@ bool IsSecondHashEntry(NvmHashEntry *entry){
     return IS_SECOND_HASH_POINTER(root);
 }
 
-void DirHashTable::GetVersionAndRefByWrite(bool &is_rehash, HashVersion **version){
-    MutexLock lock(&version_lock_);
-    if(is_rehash_){
-        is_rehash = true;
-        *version = rehash_version_;
-        rehash_version_->Ref();
-    }
-    else {
-        is_rehash = false;
+uint32_t DirHashTable::GetVersion(bool &is_rehash, HashVersion **version, HashVersion **rehash_version){
+    //不加version_lock_也不修改引用计数，没有rehash时操作不写任何共享变量
+    while(true){
+        uint32_t seq = version_seq_.ReadBegin();
+        is_rehash = is_rehash_;
         *version = version_;
-        version_->Ref();
+        *rehash_version = rehash_version_;
+        if(!version_seq_.ReadRetry(seq)) return seq;
     }
 }
 
-void DirHashTable::GetVersionAndRefByRead(bool &is_rehash, HashVersion **version, HashVersion **rehash_version){
-    MutexLock lock(&version_lock_);
-    if(is_rehash_){
-        is_rehash = true;
-        *version = version_;
-        version_->Ref();
-        *rehash_version = rehash_version_;
-        rehash_version_->Ref();
-    }
-    else {
-        is_rehash = false;
-        *version = version_;
-        version_->Ref();
+bool DirHashTable::LockEntryForWrite(HashVersion *version, uint32_t index, uint32_t seq){
+    //获取版本后rehash可能已开始并迁移了该entry，加锁后再检查，避免写入已迁移的旧版本
+    version->rwlock_[index].WriteLock();
+    if(version_seq_.ReadRetry(seq)){
+        version->rwlock_[index].Unlock();
+        return false;
     }
+    version->seqlock_[index].WriteBegin();
+    return true;
 }
 
 inline uint32_t DirHashTable::hash_id(const inode_id_t key, const uint64_t capacity){
@@ -93,9 +101,24 @@ inline uint32_t DirHashTable::hash_id(const inode_id_t key, const uint64_t capac
 
 void DirHashTable::HashEntryDealWithOp(HashVersion *version, uint32_t index, LinkListOp &op){
     NvmHashEntry *entry = &(version->buckets_[index]);
+    //新root和待释放的节点一起写入redo日志，crash后不会出现root已更新但旧节点未释放
+    NodeLogOp log_op;
     if(op.res != entry->root) {
         DBG_LOG("[dir] version:%p entry:%u update new root:%lu old:%lu", version, index, op.res, entry->root);
-        entry->SetRootPersist(op.res);
+        log_op.target = &(entry->root);
+        log_op.value = op.res;
+    }
+    for(auto it : op.free_linknode_list) {
+        log_op.free_nodes.push_back(make_pair(it, static_cast<uint64_t>(DIR_LINK_NODE_SIZE)));
+    }
+    for(auto it : op.free_indexnode_list) {
+        log_op.free_nodes.push_back(make_pair(it, static_cast<uint64_t>(DIR_BPTREE_INDEX_NODE_SIZE)));
+    }
+    for(auto it : op.free_leafnode_list) {
+        log_op.free_nodes.push_back(make_pair(it, static_cast<uint64_t>(DIR_BPTREE_LEAF_NODE_SIZE)));
+    }
+    if(log_op.target != nullptr || !log_op.free_nodes.empty()) {
+        node_allocator->CommitWithLog(log_op);
     }
     uint32_t add_linknode_num = op.add_linknode_list.size();
     uint32_t free_linknode_num = op.free_linknode_list.size();
@@ -109,22 +132,6 @@ void DirHashTable::HashEntryDealWithOp(HashVersion *version, uint32_t index, Lin
         version->node_num_.fetch_sub(free_linknode_num - add_linknode_num);
     }
 
-    if(!op.free_linknode_list.empty()) {  //后续最好原子记录一次操作的所有申请和删除的节点，作为空间管理日志
-        for(auto it : op.free_linknode_list) {
-            node_allocator->Free(it, DIR_LINK_NODE_SIZE);
-        }
-    }
-    if(!op.free_indexnode_list.empty()){
-        for(auto it : op.free_indexnode_list) {
-            node_allocator->Free(it, DIR_BPTREE_INDEX_NODE_SIZE);
-        }
-    }
-    if(!op.free_leafnode_list.empty()){
-        for(auto it : op.free_leafnode_list) {
-            node_allocator->Free(it, DIR_BPTREE_LEAF_NODE_SIZE);
-        }
-    }
-
     if(hash_type_ == 1){  //一级hash，暂时不会扩展，只会生成新的二级hash
         if(NeedHashEntryToSecondHash(entry)){
             AddHashEntryTranToSecondHashJob(version, index);
@@ -139,14 +146,14 @@ void DirHashTable::HashEntryDealWithOp(HashVersion *version, uint32_t index, Lin
     }
 }
 
-int DirHashTable::HashEntryInsertKV(HashVersion *version, uint32_t index, const inode_id_t key, const Slice &fname, const inode_id_t &value){
-    version->rwlock_[index].WriteLock();
+int DirHashTable::HashEntryInsertKV(HashVersion *version, uint32_t index, const inode_id_t key, const Slice &fname, const inode_id_t &value, uint32_t seq){
+    if(!LockEntryForWrite(version, index, seq)) return HASH_VERSION_CHANGED;
     NvmHashEntry *entry = &(version->buckets_[index]);
     pointer_t root = entry->root;
     int res = -1;
     if(IS_SECOND_HASH_POINTER(root)) {   //二级hash
         DirHashTable *second_hash = static_cast<DirHashTable *>(entry->GetSecondHashAddr());
-        version->rwlock_[index].Unlock();
+        version->WriteUnlockEntry(index);
         return second_hash->Put(key, fname, value);
     }
 
@@ -167,39 +174,48 @@ int DirHashTable::HashEntryInsertKV(HashVersion *version, uint32_t index, const
         res = LinkListInsert(op, key, fname, value);
         HashEntryDealWithOp(version, index, op);
     }
-    version->rwlock_[index].Unlock();
+    version->WriteUnlockEntry(index);
     return res;
 }
 
 
 int DirHashTable::Put(const inode_id_t key, const Slice &fname, const inode_id_t value){
+    EpochGuard guard;   //保证操作期间版本不被删除
     bool is_rehash = false;
     HashVersion *version;
-    GetVersionAndRefByWrite(is_rehash, &version);
-    uint32_t index = hash_id(key, version->capacity_);
-    
-    int res = HashEntryInsertKV(version, index, key, fname, value);
-
-    version->Unref();
-    //PrintHashTable();
-    return res;
+    HashVersion *rehash_version;
+    while(true){
+        uint32_t seq = GetVersion(is_rehash, &version, &rehash_version);
+        if(is_rehash) version = rehash_version;   //正在rehash，写入rehash版本
+        uint32_t index = hash_id(key, version->capacity_);
+        
+        int res = HashEntryInsertKV(version, index, key, fname, value, seq);
+        if(res == HASH_VERSION_CHANGED) continue;
+        //PrintHashTable();
+        return res;
+    }
 }
 
 int DirHashTable::HashEntryGetKV(HashVersion *version, uint32_t index, const inode_id_t key, const Slice &fname, inode_id_t &value){
+    //不加读锁，调用者在EpochGuard内，摘除的节点在读者离开前不会被重新分配；读的过程中entry被修改则重读
     NvmHashEntry *entry = &(version->buckets_[index]);
-    pointer_t root = entry->root;
-    int res = -1;
-    if(IS_SECOND_HASH_POINTER(root)) {   //二级hash
-        DirHashTable *second_hash = static_cast<DirHashTable *>(entry->GetSecondHashAddr());
-        return second_hash->Get(key, fname, value);
-    }
-     //可以不加读锁，因为都是MVCC控制，但是不加锁，什么时候删除垃圾节点是一个问题，延时删除可行或引用计数，
-    //暂时简单处理，由于空间分配是往后分配，提前删除没有影响；
-    if(IS_INVALID_POINTER(root)) { 
-        return 2; //未找到
-    } else {  //linklist
-        LinkNode *root_node = static_cast<LinkNode *>(NODE_GET_POINTER(root));
-        return LinkListGet(root_node, key, fname, value);
+    while(true){
+        uint32_t seq = version->seqlock_[index].ReadBegin();
+        pointer_t root = entry->root;
+        if(IS_SECOND_HASH_POINTER(root)) {   //二级hash
+            DirHashTable *second_hash = static_cast<DirHashTable *>(entry->GetSecondHashAddr());
+            if(version->seqlock_[index].ReadRetry(seq)) continue;   //二级hash地址可能还没写入
+            return second_hash->Get(key, fname, value);
+        }
+        int res = 2;   //未找到
+        inode_id_t temp_value;
+        if(!IS_INVALID_POINTER(root)) {  //linklist
+            LinkNode *root_node = static_cast<LinkNode *>(NODE_GET_POINTER(root));
+            res = LinkListGet(root_node, key, fname, temp_value);
+        }
+        if(version->seqlock_[index].ReadRetry(seq)) continue;
+        if(res == 0) value = temp_value;
+        return res;
     }
     return 0;
 }
@@ -224,42 +240,45 @@ Iterator *DirHashTable::HashEntryGetIterator(HashVersion *version, uint32_t inde
 }
 
 int DirHashTable::Get(const inode_id_t key, const Slice &fname, inode_id_t &value){
+    EpochGuard guard;   //读者不加锁，读到的节点和版本在离开前不会被回收
     bool is_rehash = false;
     HashVersion *version;
     HashVersion *rehash_version;
-    GetVersionAndRefByRead(is_rehash, &version, &rehash_version);
-
-    inode_id_t value1;
-    uint32_t index1 = hash_id(key, version->capacity_);
-    int res1 = HashEntryGetKV(version, index1, key, fname, value1);
-    version->Unref();
-
-    //两个版本都查找，如果rehash版本找到，则优先返回rehash版本；
-    if(is_rehash){  //正在rehash，rehash_version也要查找，
-        inode_id_t value2;
-        uint32_t index2 = hash_id(key, rehash_version->capacity_);
-        int res2 = HashEntryGetKV(rehash_version, index2, key, fname, value2);
-        rehash_version->Unref();
-        if(res2 == 0){  //res == 0,意味着找到
-            value = value2;
-            return res2;
-        } 
-    }
-    if(res1 == 0){
-        value = value1;
+    while(true){
+        uint32_t seq = GetVersion(is_rehash, &version, &rehash_version);
+
+        inode_id_t value1;
+        uint32_t index1 = hash_id(key, version->capacity_);
+        int res1 = HashEntryGetKV(version, index1, key, fname, value1);
+
+        //两个版本都查找，如果rehash版本找到，则优先返回rehash版本；
+        if(is_rehash){  //正在rehash，rehash_version也要查找，
+            inode_id_t value2;
+            uint32_t index2 = hash_id(key, rehash_version->capacity_);
+            int res2 = HashEntryGetKV(rehash_version, index2, key, fname, value2);
+            if(res2 == 0){  //res == 0,意味着找到
+                value = value2;
+                return res2;
+            } 
+        }
+        if(res1 == 0){
+            value = value1;
+            return res1;
+        }
+        if(version_seq_.ReadRetry(seq)) continue;   //查找期间rehash结束，kv可能已只在新版本中
+        //PrintHashTable();
+        return res1;   //
     }
-    //PrintHashTable();
-    return res1;   //
 }
 
-int DirHashTable::HashEntryDeleteKV(HashVersion *version, uint32_t index, const inode_id_t key, const Slice &fname){
-    version->rwlock_[index].WriteLock();
+int DirHashTable::HashEntryDeleteKV(HashVersion *version, uint32_t index, const inode_id_t key, const Slice &fname, uint32_t seq){
+    if(!LockEntryForWrite(version, index, seq)) return HASH_VERSION_CHANGED;
     NvmHashEntry *entry = &(version->buckets_[index]);
     pointer_t root = entry->root;
     int res = -1;
     if(IS_SECOND_HASH_POINTER(root)) {  //二级hash
         DirHashTable *second_hash = static_cast<DirHashTable *>(entry->GetSecondHashAddr());
-        version->rwlock_[index].Unlock();
+        version->WriteUnlockEntry(index);
         return second_hash->Delete(key, fname);
     }
     if(IS_INVALID_POINTER(root)) { 
@@ -271,32 +290,132 @@ int DirHashTable::HashEntryDeleteKV(HashVersion *version, uint32_t index, const
         res = LinkListDelete(op, key, fname);
         if(res == 0) HashEntryDealWithOp(version, index, op);
     }
-    version->rwlock_[index].Unlock();
+    version->WriteUnlockEntry(index);
     return res;
 }
 
 int DirHashTable::Delete(const inode_id_t key, const Slice &fname){
+    EpochGuard guard;   //保证操作期间版本不被删除
     bool is_rehash = false;
     HashVersion *version;
     HashVersion *rehash_version;
-    GetVersionAndRefByRead(is_rehash, &version, &rehash_version);  //只是为了获取两个版本
+    while(true){
+        uint32_t seq = GetVersion(is_rehash, &version, &rehash_version);
+
+        uint32_t index = hash_id(key, version->capacity_);
+
+        int res = HashEntryDeleteKV(version, index, key, fname, seq);
+        if(res == HASH_VERSION_CHANGED) continue;   //已删除的部分重做时返回未找到
 
-    uint32_t index = hash_id(key, version->capacity_);
+        if(is_rehash) { //正在rehash，先在version删除，再在rehash_version中删除
+            uint32_t index = hash_id(key, rehash_version->capacity_);
 
-    int res = HashEntryDeleteKV(version, index, key, fname);
+            int res = HashEntryDeleteKV(rehash_version, index, key, fname, seq);
+            if(res == HASH_VERSION_CHANGED) continue;
+
+        }
+        return 0;
+    }
+}
 
-    version->Unref();
+int DirHashTable::HashEntryRenameKV(HashVersion *version, uint32_t index, const inode_id_t old_key, const Slice &old_fname, const inode_id_t new_key, const Slice &new_fname, uint32_t seq){
+    if(!LockEntryForWrite(version, index, seq)) return HASH_VERSION_CHANGED;
+    NvmHashEntry *entry = &(version->buckets_[index]);
+    pointer_t root = entry->root;
+    if(IS_SECOND_HASH_POINTER(root)) {  //二级hash，由二级hash判断是否在同一个entry
+        DirHashTable *second_hash = static_cast<DirHashTable *>(entry->GetSecondHashAddr());
+        version->WriteUnlockEntry(index);
+        return second_hash->Rename(old_key, old_fname, new_key, new_fname);
+    }
+    if(IS_INVALID_POINTER(root)) { 
+        version->WriteUnlockEntry(index);
+        return 2; //未找到
+    }
+    inode_id_t value;
+    if(LinkListGet(static_cast<LinkNode *>(NODE_GET_POINTER(root)), old_key, old_fname, value) != 0){
+        version->WriteUnlockEntry(index);
+        return 2;
+    }
+    //先插入新目录项（已存在则直接覆盖value）再删除旧目录项，两次修改的新root和待释放节点一起提交；
+    //bptree和节点前后指针是原地持久化的，crash原子性由MetaDB::DirRename先写的batch日志保证
+    LinkListOp op;
+    op.root = root;
+    op.res = op.root;
+    LinkListInsert(op, new_key, new_fname, value);
+    op.root = op.res;   //删除从插入后的链表开始
+    int res = LinkListDelete(op, old_key, old_fname);
+    HashEntryDealWithOp(version, index, op);
+    version->WriteUnlockEntry(index);
+    return res;
+}
 
-    if(is_rehash) { //正在rehash，先在version删除，再在rehash_version中删除
-        uint32_t index = hash_id(key, rehash_version->capacity_);
+int DirHashTable::Rename(const inode_id_t old_key, const Slice &old_fname, const inode_id_t new_key, const Slice &new_fname){
+    EpochGuard guard;   //保证操作期间版本不被删除
+    bool is_rehash = false;
+    HashVersion *version;
+    HashVersion *rehash_version;
+    while(true){
+        uint32_t seq = GetVersion(is_rehash, &version, &rehash_version);
+        if(is_rehash) return DIR_RENAME_CROSS_ENTRY;   //rehash期间目录项可能在两个版本中，不原地修改
 
-        int res = HashEntryDeleteKV(rehash_version, index, key, fname);
+        uint32_t index = hash_id(old_key, version->capacity_);
+        if(index != hash_id(new_key, version->capacity_)) return DIR_RENAME_CROSS_ENTRY;
 
-        rehash_version->Unref();
+        int res = HashEntryRenameKV(version, index, old_key, old_fname, new_key, new_fname, seq);
+        if(res == HASH_VERSION_CHANGED) continue;
+        return res;
+    }
+}
 
+int DirHashTable::HashEntryDropKV(HashVersion *version, uint32_t index, const inode_id_t key, NvmDirDropRecord *record, uint32_t seq){
+    if(!LockEntryForWrite(version, index, seq)) return HASH_VERSION_CHANGED;
+    NvmHashEntry *entry = &(version->buckets_[index]);
+    pointer_t root = entry->root;
+    int res = 2;
+    if(IS_SECOND_HASH_POINTER(root)) {  //二级hash
+        DirHashTable *second_hash = static_cast<DirHashTable *>(entry->GetSecondHashAddr());
+        version->WriteUnlockEntry(index);
+        return second_hash->DropKey(key, record);
+    }
+    if(!IS_INVALID_POINTER(root)) {
+        vector<inode_id_t> values;
+        pointer_t bptree = INVALID_POINTER;
+        res = LinkListGetKey(static_cast<LinkNode *>(NODE_GET_POINTER(root)), key, values, bptree);
+        if(res == 0 && record->Append(values, bptree) != 0) res = -1;   //先持久化摘下的内容，crash后不会丢失子inode
+        if(res == 0) {
+            LinkListOp op;
+            op.root = root;
+            op.res = op.root;
+            LinkListDeleteKey(op, key);
+            HashEntryDealWithOp(version, index, op);
+        }
     }
-    return 0;
+    version->WriteUnlockEntry(index);
+    return res;
+}
 
+int DirHashTable::DropKey(const inode_id_t key, NvmDirDropRecord *record){
+    EpochGuard guard;   //保证操作期间版本不被删除
+    bool is_rehash = false;
+    HashVersion *version;
+    HashVersion *rehash_version;
+    while(true){
+        uint32_t seq = GetVersion(is_rehash, &version, &rehash_version);
+
+        uint32_t index = hash_id(key, version->capacity_);
+        int res = HashEntryDropKV(version, index, key, record, seq);
+        if(res == HASH_VERSION_CHANGED) continue;   //已摘除的部分重做时返回未找到，record中已有的保留
+        if(res == -1) return res;
+
+        if(is_rehash) { //正在rehash，key可能同时在两个版本中
+            index = hash_id(key, rehash_version->capacity_);
+            int res2 = HashEntryDropKV(rehash_version, index, key, record, seq);
+            if(res2 == HASH_VERSION_CHANGED) continue;
+            if(res2 == 0 || res2 == -1) res = res2;
+        }
+        if(res == 2 && (record->num != 0 || !IS_INVALID_POINTER(record->bptrees[0]))) res = 0;   //重试前已摘除
+        return res;
+    }
 }
 
 inline bool DirHashTable::NeedHashEntryToSecondHash(NvmHashEntry *entry){
@@ -382,17 +501,21 @@ void DirHashTable::HashEntryTranToSecondHashWork(void *arg){
             MemoryTranToNVMLinkNode(buckets[i], root, nodes_num);
             version->buckets_[i].SetRootPersist(root);
             version->buckets_[i].SetNodeNumPersist(nodes_num);
+            version->node_num_.fetch_add(nodes_num);   //和entry一致，否则之后释放节点时计数下溢，误触发rehash
         }
     }
-    pointer_t old_entry_root = SECOND_HASH_POINTER | NODE_GET_OFFSET(version->buckets_);
+    //转换期间旧链没有修改，读者照常读；root和二级hash地址分两次写入，读者看到中间状态时重读
+    pointer_t old_entry_root = SECOND_HASH_POINTER | NODE_GET_OFFSET(second_hash->meta_);
+    job->version->seqlock_[job->index].WriteBegin();
     entry->SetRootPersist(old_entry_root);
     entry->SetSecondHashPersist(second_hash);
+    job->version->seqlock_[job->index].WriteEnd();
     DBG_LOG("[dir] do tran second hash end, hash:%p version:%p index:%u old entry:%lx", second_hash, job->version, job->index, old_entry_root);
     job->version->rwlock_[job->index].Unlock();
     job->version->node_num_.fetch_sub(free_list.size());
 
-    for(auto it : free_list){
-        node_allocator->Free(it, DIR_LINK_NODE_SIZE);
+    for(auto it : free_list){   //读者可能还在遍历旧链
+        node_allocator->Retire(it, DIR_LINK_NODE_SIZE);
     }
     delete job;
 }
@@ -407,11 +530,20 @@ void DirHashTable::SecondHashDoRehashWork(){
         version_lock_.Unlock();
         return ;
     }
+    version_seq_.WriteBegin();
     rehash_version_ = new HashVersion(version_->capacity_ * 2);
-    version_->Ref();
-    rehash_version_->Ref();
+    meta_->SetRehashVersionPersist(NODE_GET_OFFSET(rehash_version_->buckets_), rehash_version_->capacity_);
     is_rehash_ = true;
+    version_seq_.WriteEnd();
     version_lock_.Unlock();
+    SecondHashRehashMoveWork();
+}
+
+void DirHashTable::SecondHashResumeRehashJob(void *arg){
+    reinterpret_cast<DirHashTable *>(arg)->SecondHashRehashMoveWork();
+}
+
+void DirHashTable::SecondHashRehashMoveWork(){
     DBG_LOG("[dir] second hash rehash start, version:%p rehash_version:%p", version_, rehash_version_);
     //开始逐步迁移数据到rehash_version_中
     for(uint32_t index = 0; index < version_->capacity_; index++){
@@ -424,20 +556,23 @@ void DirHashTable::SecondHashDoRehashWork(){
     //迁移完
     DBG_LOG("[dir] second hash rehash end, version:%p rehash_version:%p", version_, rehash_version_);
     version_lock_.Lock();
+    version_seq_.WriteBegin();
     HashVersion *old_version = version_;
     version_ = rehash_version_;
     rehash_version_ = nullptr;
     is_rehash_ = false;
+    meta_->SetVersionPersist(NODE_GET_OFFSET(version_->buckets_), version_->capacity_);
+    meta_->SetRehashVersionPersist(INVALID_POINTER, 0);
+    version_seq_.WriteEnd();
     version_lock_.Unlock();
 
-    old_version->Unref();   //解除本函数的调用
     old_version->FreeNvmSpace();
-    old_version->Unref();   //删除旧version
+    epoch_manager->Retire(&HashVersion::DeleteVersion, old_version, 0);   //还有操作可能持有旧version，离开后再删除
 }
 
 //rehash时迁移kvs；
 int DirHashTable::RehashInsertKvs(HashVersion *version, uint32_t index, const inode_id_t key, string &kvs){
-    version->rwlock_[index].WriteLock();
+    version->WriteLockEntry(index);
     NvmHashEntry *entry = &(version->buckets_[index]);
     pointer_t root = entry->root;
     int res = -1;
@@ -458,7 +593,7 @@ int DirHashTable::RehashInsertKvs(HashVersion *version, uint32_t index, const in
         res = RehashLinkListInsert(op, key, kvs);
         HashEntryDealWithOp(version, index, op);
     }
-    version->rwlock_[index].Unlock();
+    version->WriteUnlockEntry(index);
     return res;
 }
 
@@ -492,35 +627,85 @@ void DirHashTable::MoveEntryToRehash(HashVersion *version, uint32_t index, HashV
         free_list.push_back(cur);
         cur = cur_node->next;
     }
+    version->seqlock_[index].WriteBegin();   //迁移期间旧链没有修改，只有清空entry时读者需要重读
     entry->SetRootPersist(INVALID_POINTER);  //旧version的entry变为空
     entry->SetNodeNumPersist(0);
+    version->seqlock_[index].WriteEnd();
     version->rwlock_[index].Unlock();
 
     for(auto it : free_list) {
-        node_allocator->Free(it, DIR_LINK_NODE_SIZE);
+        node_allocator->Retire(it, DIR_LINK_NODE_SIZE);
+    }
+}
+
+
+void DirHashTable::RecoverNvmRoot(DirRecoverResult &result){
+    if(!result.scan_nodes) return ;
+    result.nodes.push_back(make_pair(NODE_GET_OFFSET(meta_), static_cast<uint64_t>(sizeof(NvmHashTableMeta))));
+    result.nodes.push_back(make_pair(NODE_GET_OFFSET(version_->buckets_), sizeof(NvmHashEntry) * version_->capacity_));
+    if(rehash_version_ != nullptr){
+        result.nodes.push_back(make_pair(NODE_GET_OFFSET(rehash_version_->buckets_), sizeof(NvmHashEntry) * rehash_version_->capacity_));
+    }
+}
+
+void DirHashTable::RecoverVersionEntries(HashVersion *version, uint64_t begin, uint64_t end, DirRecoverResult &result){
+    for(uint64_t i = begin; i < end && i < version->capacity_; i++){
+        NvmHashEntry *entry = &(version->buckets_[i]);
+        if(IS_SECOND_HASH_POINTER(entry->root)) {   //二级hash，旧的内存地址已经失效，重建后重新写入
+            NvmHashTableMeta *meta = static_cast<NvmHashTableMeta *>(NODE_GET_POINTER((entry->root & (~SECOND_HASH_POINTER))));
+            DirHashTable *second_hash = new DirHashTable(option_, 2, meta);
+            entry->SetSecondHashPersist(second_hash);
+            second_hash->RecoverSecondHash(result);
+            result.second_hash_nums++;
+            continue;
+        }
+        uint32_t link_node_nums = entry->node_num;
+        if(result.scan_nodes){
+            link_node_nums = LinkListRecoverNodes(entry->root, result.nodes);
+            if(link_node_nums != entry->node_num){   //crash时可能未来得及更新
+                entry->SetNodeNumPersist(link_node_nums);
+            }
+        }
+        version->node_num_.fetch_add(link_node_nums);
+        result.link_node_nums += link_node_nums;
+    }
+}
+
+void DirHashTable::RecoverSecondHash(DirRecoverResult &result){
+    RecoverNvmRoot(result);
+    RecoverVersionEntries(version_, 0, version_->capacity_, result);
+    if(is_rehash_){
+        RecoverVersionEntries(rehash_version_, 0, rehash_version_->capacity_, result);
+        result.rehash_tables.push_back(this);
     }
 }
 
+void DirHashTable::RecoverRange(uint64_t begin, uint64_t end, DirRecoverResult &result){
+    RecoverVersionEntries(version_, begin, end, result);
+}
+
+void DirHashTable::ResumeRehash(){
+    if(!is_rehash_) return ;
+    DBG_LOG("[dir] resume rehash, hashtable:%p version:%p rehash_version:%p", this, version_, rehash_version_);
+    thread_pool->Schedule(&DirHashTable::SecondHashResumeRehashJob, this);
+}
 
 Iterator* DirHashTable::DirHashTableGetIterator(const inode_id_t target){
+        EpochGuard guard;
         bool is_rehash = false;
         HashVersion *version;
         HashVersion *rehash_version;
-        GetVersionAndRefByRead(is_rehash, &version, &rehash_version);
+        GetVersion(is_rehash, &version, &rehash_version);
         Iterator* rehash_it = nullptr;
         Iterator* vesion_it = nullptr;
         if(is_rehash){  //正在rehash，先在rehash_version查找，再查找version
             uint32_t index = hash_id(target, rehash_version->capacity_);
             
             rehash_it = HashEntryGetIterator(rehash_version, index, target);
-            
-            rehash_version->Unref();
         }
         uint32_t index = hash_id(target, version->capacity_);
         
         vesion_it = HashEntryGetIterator(version, index, target);
-        
-        version->Unref();
         if(rehash_it != nullptr && vesion_it != nullptr){  //两版本都不为空，合并iterator
             Iterator *two_it[2];
             two_it[0] = rehash_it;
@@ -530,6 +715,108 @@ Iterator* DirHashTable::DirHashTableGetIterator(const inode_id_t target){
         return (rehash_it != nullptr) ? rehash_it : vesion_it;   //
 }
 
+static bool ConsumeScanRetry(uint32_t &retry){
+    if(retry == 0) return false;
+    retry--;
+    return true;
+}
+
+//从iterator当前位置拷贝最多max个目录项，读到写者修改到一半的数据时提前结束，调用者会按seqlock重读
+static void CopyToScanBuffer(Iterator *it, const uint32_t max, DirScanBuffer &buf, bool &more){
+    DirEntryView entries[64];
+    uint32_t copied = 0;
+    while(max == 0 || copied < max){
+        uint32_t want = (max == 0) ? 64 : min(64U, max - copied);
+        uint32_t n = it->NextBatch(entries, want);
+        if(n == 0) break;
+        for(uint32_t i = 0; i < n; i++){
+            if(entries[i].fname.size() > DIR_BPTREE_LEAF_NODE_SIZE) return ;
+            buf.Append(entries[i].hash_fname, entries[i].fname, DirEntryEncode(entries[i].value, entries[i].type));   //buffer中和NVM一样带类型
+        }
+        copied += n;
+    }
+    more = it->Valid();
+}
+
+//两个有序结果按hash_fname合并，hash_fname相同时保留rehash版本，结果保留前max项
+static void MergeScanBuffer(const DirScanBuffer &rehash_buf, bool rehash_more, DirScanBuffer &buf, bool &more, const uint32_t max){
+    DirScanBuffer merged;
+    uint32_t i = 0, j = 0;
+    while(i < rehash_buf.Size() || j < buf.Size()){
+        if(j >= buf.Size() || (i < rehash_buf.Size() && rehash_buf.HashFname(i) <= buf.HashFname(j))){
+            if(j < buf.Size() && rehash_buf.HashFname(i) == buf.HashFname(j)) j++;
+            merged.Append(rehash_buf.HashFname(i), rehash_buf.Fname(i), rehash_buf.Value(i));
+            i++;
+        } else {
+            merged.Append(buf.HashFname(j), buf.Fname(j), buf.Value(j));
+            j++;
+        }
+    }
+    more = more || rehash_more;
+    if(max != 0 && merged.Size() > max){
+        merged.Truncate(max);
+        more = true;
+    }
+    buf.data.swap(merged.data);
+    buf.offsets.swap(merged.offsets);
+}
+
+int DirHashTable::HashEntryScan(HashVersion *version, uint32_t index, const inode_id_t key, const uint64_t start, const uint32_t max, DirScanBuffer &buf, bool &more, uint32_t &retry){
+    NvmHashEntry *entry = &(version->buckets_[index]);
+    while(true){
+        uint32_t seq = version->seqlock_[index].ReadBegin();
+        pointer_t root = entry->root;
+        if(IS_SECOND_HASH_POINTER(root)) {   //二级hash
+            DirHashTable *second_hash = static_cast<DirHashTable *>(entry->GetSecondHashAddr());
+            if(version->seqlock_[index].ReadRetry(seq)) continue;   //二级hash地址可能还没写入
+            return second_hash->Scan(key, start, max, buf, more, retry);
+        }
+        buf.Clear();
+        more = false;
+        if(!IS_INVALID_POINTER(root)) {  //linklist
+            LinkNode *root_node = static_cast<LinkNode *>(NODE_GET_POINTER(root));
+            Iterator *it = LinkListGetIterator(root_node, key);
+            if(it != nullptr){
+                it->Seek(start);
+                CopyToScanBuffer(it, max, buf, more);
+                delete it;
+            }
+        }
+        if(version->seqlock_[index].ReadRetry(seq)){
+            if(!ConsumeScanRetry(retry)) return DIR_SCAN_RETRY_EXCEEDED;
+            continue;
+        }
+        return 0;
+    }
+}
+
+int DirHashTable::Scan(const inode_id_t key, const uint64_t start, const uint32_t max, DirScanBuffer &buf, bool &more, uint32_t &retry){
+    EpochGuard guard;   //拷贝期间读到的节点不会被回收
+    bool is_rehash = false;
+    HashVersion *version;
+    HashVersion *rehash_version;
+    DirScanBuffer rehash_buf;
+    while(true){
+        uint32_t seq = GetVersion(is_rehash, &version, &rehash_version);
+
+        uint32_t index = hash_id(key, version->capacity_);
+        int res = HashEntryScan(version, index, key, start, max, buf, more, retry);
+        if(res != 0) return res;
+        if(is_rehash){  //正在rehash，两个版本分别拷贝后合并
+            bool rehash_more = false;
+            index = hash_id(key, rehash_version->capacity_);
+            res = HashEntryScan(rehash_version, index, key, start, max, rehash_buf, rehash_more, retry);
+            if(res != 0) return res;
+            if(rehash_buf.Size() > 0) MergeScanBuffer(rehash_buf, rehash_more, buf, more, max);
+        }
+        if(version_seq_.ReadRetry(seq)){   //拷贝期间rehash开始或结束，目录项可能已迁移
+            if(!ConsumeScanRetry(retry)) return DIR_SCAN_RETRY_EXCEEDED;
+            continue;
+        }
+        return 0;
+    }
+}
+
 void DirHashTable::PrintVersion(HashVersion *version){
     if(version == nullptr) return ;
     DBG_LOG("[dir] hashtable verion:%p capacity:%lu node_num:%u", version, version->capacity_, version->node_num_.load());
@@ -9,6 +9,7 @@
 
 #include <string>
 #include <atomic>
+#include <vector>
 
 
 #include "metadb/option.h"
@@ -18,9 +19,12 @@
 #include "format.h"
 #include "../util/rwlock.h"
 #include "../util/lock.h"
+#include "../util/seqlock.h"
 #include "nvm_node_allocator.h"
 #include "dir_nvm_node.h"
 #include "thread_pool.h"
+#include "epoch_manager.h"
+#include "super_block.h"
 
 using namespace std;
 
@@ -59,72 +63,161 @@ struct NvmHashEntry {       //如果root执向二级hash地址，则后面8字
 struct HashVersion {
 public:
     NvmHashEntry *buckets_;  //连续数组
-    RWLock *rwlock_;  //连续读写锁
+    RWLock *rwlock_;  //连续读写锁，只有写者使用
+    SeqLock *seqlock_;   //每个entry的修改序号，读者不加锁，序号变化则重读
     uint64_t capacity_;
     atomic<uint64_t> node_num_;   //LinkNode num
-    atomic<uint32_t> refs_;
+    bool nvm_freed_;   //buckets已释放，读者可能还在读，析构时不再访问
 
     HashVersion(uint64_t capacity) {
         capacity_ = capacity;
         rwlock_ = new RWLock[capacity];
+        seqlock_ = new SeqLock[capacity];
         buckets_ = static_cast<NvmHashEntry *>(node_allocator->AllocateAndInit(sizeof(NvmHashEntry) * capacity, 0));
         node_num_.store(0);
-        refs_.store(0);
+        nvm_freed_ = false;
+    }
+
+    HashVersion(uint64_t capacity, NvmHashEntry *buckets) {   //恢复时使用NVM中已有的buckets
+        capacity_ = capacity;
+        rwlock_ = new RWLock[capacity];
+        seqlock_ = new SeqLock[capacity];
+        buckets_ = buckets;
+        node_num_.store(0);
+        nvm_freed_ = false;
     }
 
     virtual ~HashVersion();
 
     void FreeNvmSpace(){
-        node_allocator->Free(buckets_, sizeof(NvmHashEntry) * capacity_);
-        buckets_ = nullptr;
+        node_allocator->Retire(buckets_, sizeof(NvmHashEntry) * capacity_);
+        nvm_freed_ = true;
     }
 
-    void Ref() {
-        refs_.fetch_add(1);
+    void WriteLockEntry(uint32_t index){   //写者修改entry期间读者会重读
+        rwlock_[index].WriteLock();
+        seqlock_[index].WriteBegin();
     }
 
-    void Unref() {
-        refs_.fetch_sub(1);
-        
-        if(refs_.load() == 0){
-            delete this;
-        }
+    void WriteUnlockEntry(uint32_t index){
+        seqlock_[index].WriteEnd();
+        rwlock_[index].Unlock();
+    }
+
+    static void DeleteVersion(void *arg, uint64_t unused){   //rehash结束后由epoch_manager在所有操作离开后调用
+        delete static_cast<HashVersion *>(arg);
+    }
+};
+
+struct DirScanBuffer {   //Scan拷贝出的目录项，每项：|hash_fname 8|value 8|fname_len 4|fname|
+    string data;
+    vector<uint32_t> offsets;
+
+    DirScanBuffer() {}
+    ~DirScanBuffer() {}
+
+    void Clear() {
+        data.clear();
+        offsets.clear();
+    }
+    uint32_t Size() const { return offsets.size(); }
+    void Truncate(uint32_t num) {   //只保留前num项
+        if(num >= offsets.size()) return ;
+        data.resize(offsets[num]);
+        offsets.resize(num);
+    }
+    void Append(const uint64_t hash_fname, const Slice &fname, const inode_id_t value) {
+        uint32_t fname_len = fname.size();
+        offsets.push_back(data.size());
+        data.append(reinterpret_cast<const char *>(&hash_fname), 8);
+        data.append(reinterpret_cast<const char *>(&value), sizeof(inode_id_t));
+        data.append(reinterpret_cast<const char *>(&fname_len), 4);
+        data.append(fname.data(), fname_len);
+    }
+    uint64_t HashFname(uint32_t i) const {
+        uint64_t hash_fname;
+        memcpy(&hash_fname, data.data() + offsets[i], 8);
+        return hash_fname;
+    }
+    inode_id_t Value(uint32_t i) const {
+        inode_id_t value;
+        memcpy(&value, data.data() + offsets[i] + 8, sizeof(inode_id_t));
+        return value;
+    }
+    Slice Fname(uint32_t i) const {
+        uint32_t fname_len;
+        memcpy(&fname_len, data.data() + offsets[i] + 8 + sizeof(inode_id_t), 4);
+        return Slice(data.data() + offsets[i] + 8 + sizeof(inode_id_t) + 4, fname_len);
     }
 };
 
+class DirHashTable;
+
+struct DirRecoverResult {   //恢复时每个线程收集的结果
+    bool scan_nodes;    //为false时分配器已从持久化元数据恢复，不遍历LinkNode链
+    vector<pair<pointer_t, uint64_t>> nodes;   //遍历到的NVM节点，用于重建node_allocator位图
+    vector<DirHashTable *> rehash_tables;      //rehash中途退出的二级hash，恢复完成后继续rehash
+    uint64_t link_node_nums;
+    uint64_t second_hash_nums;
+
+    DirRecoverResult(bool scan) : scan_nodes(scan), link_node_nums(0), second_hash_nums(0) {}
+    ~DirRecoverResult() {}
+};
+
 class DirHashTable {
 public:
     DirHashTable(const Option &option, uint32_t hash_type, uint64_t capacity);
+    DirHashTable(const Option &option, uint32_t hash_type, NvmHashTableMeta *meta);   //从NVM恢复
     virtual ~DirHashTable();
 
     virtual int Put(const inode_id_t key, const Slice &fname, const inode_id_t value);
     virtual int Get(const inode_id_t key, const Slice &fname, inode_id_t &value);
     virtual int Delete(const inode_id_t key, const Slice &fname);
+    //新旧目录项在同一个entry时原地完成，否则返回DIR_RENAME_CROSS_ENTRY，不做任何修改
+    virtual int Rename(const inode_id_t old_key, const Slice &old_fname, const inode_id_t new_key, const Slice &new_fname);
+    //摘除key的所有目录项，摘除前把inline的value和bptree根追加到record并持久化，bptree由调用者回收；不存在返回2
+    virtual int DropKey(const inode_id_t key, NvmDirDropRecord *record);
     virtual Iterator* DirHashTableGetIterator(const inode_id_t target);
+    //拷贝key下hash_fname >= start的最多max个目录项到buf，max为0表示全部；拷贝期间entry被修改则重读，buf是某一时刻的一致结果
+    //more表示之后还有目录项；retry为剩余的重试次数，用完返回DIR_SCAN_RETRY_EXCEEDED
+    virtual int Scan(const inode_id_t key, const uint64_t start, const uint32_t max, DirScanBuffer &buf, bool &more, uint32_t &retry);
 
     
     virtual void PrintHashTable();
     virtual void PrintHashTableStats(std::string &stats);
 
+    //恢复
+    pointer_t GetMetaOffset() { return NODE_GET_OFFSET(meta_); }
+    uint64_t GetCapacity() { return version_->capacity_; }
+    void RecoverNvmRoot(DirRecoverResult &result);   //meta和buckets本身占用的节点
+    void RecoverRange(uint64_t begin, uint64_t end, DirRecoverResult &result);   //恢复version_中[begin, end)的entry
+    void ResumeRehash();   //恢复完成后，继续中途退出的rehash
+
 private:
     const Option option_;
     uint32_t hash_type_;  //1是一级hash，2是二级hash；
+    NvmHashTableMeta *meta_;  //NVM中的根，记录版本的buckets
     
-    Mutex version_lock_;
+    Mutex version_lock_;   //只在rehash开始和结束时使用，读写操作都不加
+    SeqLock version_seq_;   //rehash开始和结束时修改，操作据此判断版本是否切换
     bool is_rehash_;
     HashVersion *version_;
     HashVersion *rehash_version_; //rehash时，这个版本是正在rehash版本；
 
 
     bool IsSecondHashEntry(NvmHashEntry *entry);
-    void GetVersionAndRefByWrite(bool &is_rehash, HashVersion **version);
-    void GetVersionAndRefByRead(bool &is_rehash, HashVersion **version, HashVersion **rehash_version);
+    //调用者在EpochGuard内，版本在离开前不会被删除，返回version_seq_，写者加锁后据此检查版本是否切换
+    uint32_t GetVersion(bool &is_rehash, HashVersion **version, HashVersion **rehash_version);
+    bool LockEntryForWrite(HashVersion *version, uint32_t index, uint32_t seq);   //版本已切换时不加锁，返回false
     inline uint32_t hash_id(const inode_id_t key, const uint64_t capacity);
-    int HashEntryInsertKV(HashVersion *version, uint32_t index, const inode_id_t key, const Slice &fname, const inode_id_t &value);
+    int HashEntryInsertKV(HashVersion *version, uint32_t index, const inode_id_t key, const Slice &fname, const inode_id_t &value, uint32_t seq);
     void HashEntryDealWithOp(HashVersion *version, uint32_t index, LinkListOp &op);
     int HashEntryGetKV(HashVersion *version, uint32_t index, const inode_id_t key, const Slice &fname, inode_id_t &value);
-    int HashEntryDeleteKV(HashVersion *version, uint32_t index, const inode_id_t key, const Slice &fname);
+    int HashEntryDeleteKV(HashVersion *version, uint32_t index, const inode_id_t key, const Slice &fname, uint32_t seq);
+    int HashEntryRenameKV(HashVersion *version, uint32_t index, const inode_id_t old_key, const Slice &old_fname, const inode_id_t new_key, const Slice &new_fname, uint32_t seq);
+    int HashEntryDropKV(HashVersion *version, uint32_t index, const inode_id_t key, NvmDirDropRecord *record, uint32_t seq);
     Iterator *HashEntryGetIterator(HashVersion *version, uint32_t index, const inode_id_t target);
+    int HashEntryScan(HashVersion *version, uint32_t index, const inode_id_t key, const uint64_t start, const uint32_t max, DirScanBuffer &buf, bool &more, uint32_t &retry);
 
     inline bool NeedHashEntryToSecondHash(NvmHashEntry *entry);
     inline bool NeedSecondHashDoRehash();
@@ -132,8 +225,12 @@ private:
     static void HashEntryTranToSecondHashWork(void *arg);
     static void SecondHashDoRehashJob(void *arg);
     void SecondHashDoRehashWork();
+    static void SecondHashResumeRehashJob(void *arg);
+    void SecondHashRehashMoveWork();
     void MoveEntryToRehash(HashVersion *version, uint32_t index, HashVersion *rehash_version);
     int RehashInsertKvs(HashVersion *version, uint32_t index, const inode_id_t key, string &kvs);
+    void RecoverVersionEntries(HashVersion *version, uint64_t begin, uint64_t end, DirRecoverResult &result);
+    void RecoverSecondHash(DirRecoverResult &result);
 
     void PrintVersion(HashVersion *version);
     string PrintVersionStats(HashVersion *version);
@@ -6,6 +6,7 @@
  */
 
 #include "dir_iterator.h"
+#include "metadb/debug.h"
 
 namespace metadb {
 
@@ -27,6 +28,11 @@ void LinkNodeIterator::SeekToFirst() {
     cur_offset_ = key_offset_ + sizeof(inode_id_t) + 4 + 4;
 }
 
+void LinkNodeIterator::Seek(const uint64_t hash_fname){
+    //inline的kvs很小，顺序查找
+    for(SeekToFirst(); Valid() && this->hash_fname() < hash_fname; Next()) ;
+}
+
 void LinkNodeIterator::SeekToLast(){
     assert(0);
 }
@@ -56,7 +62,7 @@ uint64_t LinkNodeIterator::hash_fname() const {
     return *reinterpret_cast<const uint64_t *>(cur_node_->buf + cur_offset_);
 }
 
-inode_id_t LinkNodeIterator::value() const {
+inode_id_t LinkNodeIterator::stored_value() const {
     uint64_t hash_fname;
     uint32_t value_len;
     cur_node_->DecodeBufGetHashfnameAndLen(cur_offset_, hash_fname, value_len);
@@ -66,7 +72,27 @@ inode_id_t LinkNodeIterator::value() const {
     return value;
 }
 
-BptreeIterator::BptreeIterator(BptreeLeafNode *head) : leaf_head_(head) {
+uint32_t LinkNodeIterator::NextBatch(DirEntryView *entries, uint32_t max){
+    uint32_t n = 0;
+    uint64_t hash_fname;
+    uint32_t value_len;
+    while(n < max && Valid()){
+        cur_node_->DecodeBufGetHashfnameAndLen(cur_offset_, hash_fname, value_len);
+        const char *fname = cur_node_->buf + cur_offset_ + 8 + 4;
+        uint32_t fname_len = value_len - sizeof(inode_id_t);
+        entries[n].fname = Slice(fname, fname_len);
+        entries[n].hash_fname = hash_fname;
+        inode_id_t stored = *reinterpret_cast<const inode_id_t *>(fname + fname_len);
+        entries[n].value = DirEntryInode(stored);
+        entries[n].type = DirEntryType(stored);
+        n++;
+        cur_index_++;
+        cur_offset_ += (8 + 4 + value_len);
+    }
+    return n;
+}
+
+BptreeIterator::BptreeIterator(BptreeLeafNode *head, pointer_t root) : leaf_head_(head), root_(root) {
     cur_node_ = leaf_head_;
     cur_index_ = 0;
     cur_offset_ = 0;
@@ -81,6 +107,20 @@ void BptreeIterator::SeekToFirst() {
     cur_offset_ = 0;
 }
 
+void BptreeIterator::Seek(const uint64_t hash_fname){
+    if(IS_INVALID_POINTER(root_)){
+        for(SeekToFirst(); Valid() && this->hash_fname() < hash_fname; Next()) ;
+        return ;
+    }
+    cur_node_ = BptreeSeekLeaf(root_, hash_fname);  //从根向下定位叶节点，叶内顺序查找
+    cur_index_ = 0;
+    cur_offset_ = 0;
+    if(cur_node_ == nullptr) return ;
+    while(Valid() && this->hash_fname() < hash_fname){
+        Next();
+    }
+}
+
 void BptreeIterator::SeekToLast(){
     assert(0);
 }
@@ -93,16 +133,43 @@ void BptreeIterator::Next(){
         cur_node_->DecodeBufGetKeyValuelen(cur_offset_, hash_fname, value_len);
         cur_offset_ += (8 + 4 + value_len);
     } else {
-        if(!IS_INVALID_POINTER(cur_node_->next)) {
-            cur_node_ = static_cast<BptreeLeafNode *>(NODE_GET_POINTER(cur_node_->next));
-            cur_index_ = 0;
-            cur_offset_ = 0;
-        } else {
-            cur_node_ = nullptr;
-            cur_index_ = 0;
-            cur_offset_ = 0;
+        NextLeaf();
+    }
+}
+
+void BptreeIterator::NextLeaf(){
+    if(!IS_INVALID_POINTER(cur_node_->next)) {
+        cur_node_ = static_cast<BptreeLeafNode *>(NODE_GET_POINTER(cur_node_->next));
+    } else {
+        cur_node_ = nullptr;
+    }
+    cur_index_ = 0;
+    cur_offset_ = 0;
+}
+
+uint32_t BptreeIterator::NextBatch(DirEntryView *entries, uint32_t max){
+    uint32_t n = 0;
+    uint64_t hash_fname;
+    uint32_t value_len;
+    while(n < max && Valid()){
+        uint32_t num = cur_node_->num;
+        for(; n < max && cur_index_ < num; n++){   //一个叶节点内连续解码
+            cur_node_->DecodeBufGetKeyValuelen(cur_offset_, hash_fname, value_len);
+            const char *fname = cur_node_->buf + cur_offset_ + 8 + 4;
+            uint32_t fname_len = value_len - sizeof(inode_id_t);
+            entries[n].fname = Slice(fname, fname_len);
+            entries[n].hash_fname = hash_fname;
+            inode_id_t stored = *reinterpret_cast<const inode_id_t *>(fname + fname_len);
+            entries[n].value = DirEntryInode(stored);
+            entries[n].type = DirEntryType(stored);
+            cur_index_++;
+            cur_offset_ += (8 + 4 + value_len);
+        }
+        if(cur_index_ >= num){
+            NextLeaf();
         }
     }
+    return n;
 }
 
 void BptreeIterator::Prev(){
@@ -120,7 +187,7 @@ uint64_t BptreeIterator::hash_fname() const {
     return *reinterpret_cast<const uint64_t *>(cur_node_->buf + cur_offset_);
 }
 
-inode_id_t BptreeIterator::value() const {
+inode_id_t BptreeIterator::stored_value() const {
     uint64_t hash_fname;
     uint32_t value_len;
     cur_node_->DecodeBufGetKeyValuelen(cur_offset_, hash_fname, value_len);
@@ -128,6 +195,104 @@ inode_id_t BptreeIterator::value() const {
     return *reinterpret_cast<inode_id_t *>(cur_node_->buf + value_offset);
 }
 
+DirSnapshotIterator::DirSnapshotIterator(DirHashTable *hashtable, const inode_id_t target, uint32_t snapshot_retry, uint32_t segment_num, bool full_snapshot) 
+                : hashtable_(hashtable), target_(target), snapshot_retry_(snapshot_retry), segment_num_(segment_num), 
+                  loaded_(false), segmented_(!full_snapshot), more_(false), complete_(false) {
+    cur_ = &bufs_[0];
+    pos_ = 0;
+}
+
+void DirSnapshotIterator::Fill(const uint64_t start){
+    DirScanBuffer *next = (cur_ == &bufs_[0]) ? &bufs_[1] : &bufs_[0];
+    if(!segmented_){
+        uint32_t retry = snapshot_retry_;
+        if(hashtable_->Scan(target_, start, 0, *next, more_, retry) == 0){
+            loaded_ = true;
+            complete_ = (start == 0);
+            cur_ = next;
+            pos_ = 0;
+            return ;
+        }
+        segmented_ = true;
+        DBG_LOG("[dir] iterator key:%lu snapshot retry exceeded, scan by segment", target_);
+    }
+    uint32_t retry = UINT32_MAX;   //每段很小，一直重试
+    if(hashtable_->Scan(target_, start, segment_num_, *next, more_, retry) != 0){
+        next->Clear();
+        more_ = false;
+    }
+    loaded_ = true;
+    complete_ = (start == 0 && !more_);   //小目录一段就是整个目录
+    cur_ = next;
+    pos_ = 0;
+}
+
+void DirSnapshotIterator::FillNextSegment(){
+    if(cur_->Size() == 0){   //没有可续读的位置
+        more_ = false;
+        pos_ = 0;
+        return ;
+    }
+    uint64_t last = cur_->HashFname(cur_->Size() - 1);
+    if(last == UINT64_MAX){
+        more_ = false;
+        pos_ = cur_->Size();
+        return ;
+    }
+    Fill(last + 1);
+}
+
+void DirSnapshotIterator::Seek(const uint64_t hash_fname){
+    if(complete_){   //已有整个目录的快照，在快照内二分查找
+        uint32_t left = 0;
+        uint32_t right = cur_->Size();
+        while(left < right){
+            uint32_t mid = left + (right - left) / 2;
+            if(cur_->HashFname(mid) < hash_fname){
+                left = mid + 1;
+            } else {
+                right = mid;
+            }
+        }
+        pos_ = left;
+        return ;
+    }
+    Fill(hash_fname);
+}
+
+void DirSnapshotIterator::SeekToFirst(){
+    Seek(0);
+}
+
+void DirSnapshotIterator::SeekToLast(){
+    assert(0);
+}
+
+void DirSnapshotIterator::Next(){
+    pos_++;
+    if(pos_ >= cur_->Size() && more_){
+        FillNextSegment();
+    }
+}
+
+void DirSnapshotIterator::Prev(){
+    assert(0);
+}
+
+uint32_t DirSnapshotIterator::NextBatch(DirEntryView *entries, uint32_t max){
+    uint32_t n = 0;
+    for(; n < max && pos_ < cur_->Size(); n++, pos_++){
+        entries[n].fname = cur_->Fname(pos_);
+        entries[n].hash_fname = cur_->HashFname(pos_);
+        entries[n].value = DirEntryInode(cur_->Value(pos_));
+        entries[n].type = DirEntryType(cur_->Value(pos_));
+    }
+    if(pos_ >= cur_->Size() && more_){   //换到另一个buffer，本次返回的目录项不受影响
+        FillNextSegment();
+    }
+    return n;
+}
+
 void MergingIterator::FindSmallest() {
     IteratorWrapper* smallest = NULL;
     for (int i = 0; i < n_; i++) {
@@ -15,6 +15,7 @@
 #include "metadb/iterator.h"
 #include "dir_nvm_node.h"
 #include "nvm_node_allocator.h"
+#include "dir_hashtable.h"
 
 using namespace std;
 namespace metadb {
@@ -25,14 +26,17 @@ public:
     ~LinkNodeIterator() {};
 
     bool Valid() const ;
-    //virtual void Seek(const Slice& target) = 0;
+    void Seek(const uint64_t hash_fname);
     void SeekToFirst();
     void SeekToLast();
     void Next();
     void Prev();
     string fname() const ;
     uint64_t hash_fname() const ;
-    inode_id_t value() const ;
+    inode_id_t value() const { return DirEntryInode(stored_value()); }
+    uint8_t type() const { return DirEntryType(stored_value()); }
+    inode_id_t stored_value() const ;   //NVM中保存的value，带有目录项类型
+    uint32_t NextBatch(DirEntryView *entries, uint32_t max);
 private:
     LinkNode *cur_node_;
     uint32_t key_offset_;
@@ -46,20 +50,26 @@ private:
 
 class BptreeIterator : public Iterator {
 public:
-    BptreeIterator(BptreeLeafNode *head);
+    BptreeIterator(BptreeLeafNode *head, pointer_t root = INVALID_POINTER);   //没有root时Seek从头节点顺序查找
     ~BptreeIterator() {};
 
     bool Valid() const ;
-    //virtual void Seek(const Slice& target) = 0;
+    void Seek(const uint64_t hash_fname);
     void SeekToFirst();
     void SeekToLast();
     void Next();
     void Prev();
     string fname() const ;
     uint64_t hash_fname() const ;
-    inode_id_t value() const ;
+    inode_id_t value() const { return DirEntryInode(stored_value()); }
+    uint8_t type() const { return DirEntryType(stored_value()); }
+    inode_id_t stored_value() const ;   //NVM中保存的value，带有目录项类型
+    uint32_t NextBatch(DirEntryView *entries, uint32_t max);
 private:
+    void NextLeaf();
+
     BptreeLeafNode *leaf_head_;
+    pointer_t root_;
     BptreeLeafNode *cur_node_;
     uint32_t cur_index_;
     uint32_t cur_offset_; 
@@ -71,7 +81,7 @@ public:
     ~EmptyIterator() {};
 
     bool Valid() const { return false; }
-    //virtual void Seek(const Slice& target) = 0;
+    void Seek(const uint64_t hash_fname) {};
     void SeekToFirst() {};
     void SeekToLast() {};
     void Next() {};
@@ -79,6 +89,47 @@ public:
     string fname() const { return string(); };
     uint64_t hash_fname() const { return 0; };
     inode_id_t value() const { return 0; };
+    uint8_t type() const { return 0; };
+    uint32_t NextBatch(DirEntryView *entries, uint32_t max) { return 0; };
+};
+
+//DirGetIterator返回的iterator，目录项拷贝到DRAM，不引用NVM节点，也不阻塞写者
+//默认分段拷贝，每段一致，段之间按hash_fname续读，大目录也只占一段的内存；
+//full_snapshot时先拷贝整个目录得到一个时间点的快照，写入频繁重试多次仍失败时改为分段拷贝
+class DirSnapshotIterator : public Iterator {
+public:
+    DirSnapshotIterator(DirHashTable *hashtable, const inode_id_t target, uint32_t snapshot_retry, uint32_t segment_num, bool full_snapshot);
+    ~DirSnapshotIterator() {};
+
+    bool Valid() const { return pos_ < cur_->Size(); }
+    void Seek(const uint64_t hash_fname);
+    void SeekToFirst();
+    void SeekToLast();
+    void Next();
+    void Prev();
+    string fname() const { return cur_->Fname(pos_).ToString(); }
+    uint64_t hash_fname() const { return cur_->HashFname(pos_); }
+    inode_id_t value() const { return DirEntryInode(cur_->Value(pos_)); }
+    uint8_t type() const { return DirEntryType(cur_->Value(pos_)); }
+    uint32_t NextBatch(DirEntryView *entries, uint32_t max);
+
+    bool IsSnapshot() const { return complete_; }   //整个目录是否是同一时刻的快照
+private:
+    void Fill(const uint64_t start);
+    void FillNextSegment();
+
+    DirHashTable *hashtable_;
+    inode_id_t target_;
+    uint32_t snapshot_retry_;
+    uint32_t segment_num_;
+    bool loaded_;
+    bool segmented_;
+    bool more_;
+    bool complete_;   //当前buffer从头拷贝且没有后续段，即整个目录
+
+    DirScanBuffer bufs_[2];   //续读下一段时换到另一个buffer，上一次NextBatch返回的目录项仍有效
+    DirScanBuffer *cur_;
+    uint32_t pos_;
 };
 
 class IteratorWrapper {
@@ -105,9 +156,16 @@ public:
     string fname() const { return iter_->fname(); };
     uint64_t hash_fname() const { return key_; };
     inode_id_t value() const { return iter_->value(); };
+    uint8_t type() const { return iter_->type(); };
     void Next()               { iter_->Next();        Update(); }
+    uint32_t NextBatch(DirEntryView *entries, uint32_t max) {
+        uint32_t n = iter_->NextBatch(entries, max);
+        Update();
+        return n;
+    }
     void Prev()               { iter_->Prev();        Update(); }
 
+    void Seek(const uint64_t hash_fname) { iter_->Seek(hash_fname); Update(); }
     void SeekToFirst()        { iter_->SeekToFirst(); Update(); }
     void SeekToLast()         { iter_->SeekToLast();  Update(); }
 
@@ -144,6 +202,14 @@ public:
         return (current_ != NULL);
     }
 
+    void Seek(const uint64_t hash_fname) {
+        for (int i = 0; i < n_; i++) {
+            children_[i].Seek(hash_fname);
+        }
+        FindSmallest();
+        direction_ = kForward;
+    }
+
     void SeekToFirst() {
         for (int i = 0; i < n_; i++) {
             children_[i].SeekToFirst();
@@ -217,6 +283,17 @@ public:
     string fname() const { return current_->fname(); }
     uint64_t hash_fname() const { return current_->hash_fname(); }
     inode_id_t value() const { return current_->value(); }
+    uint8_t type() const { return current_->type(); }
+
+    uint32_t NextBatch(DirEntryView *entries, uint32_t max) {   //只在rehash期间使用，逐个归并
+        uint32_t n = 0;
+        while(n < max && Valid()){
+            current_->NextBatch(entries + n, 1);
+            n++;
+            FindSmallest();
+        }
+        return n;
+    }
 
 private:
     void FindSmallest();
@@ -6,6 +6,7 @@
  */
 
 #include <queue>
+#include <algorithm>
 
 #include "metadb/debug.h"
 #include "dir_nvm_node.h"
@@ -651,14 +652,19 @@ inode_id_t LinkNodeFindMaxKey(LinkNode *cur){
     uint32_t i = 0;
     for(; i < cur->num; i++){
         cur->DecodeBufGetKeyNumLen(offset, temp_key, key_num, key_len);
-        offset += (sizeof(inode_id_t) + 4 + 4 + key_len);
+        if(key_num == 0){   //value是bptree指针，key_len位置存的是指针
+            offset += (sizeof(inode_id_t) + 4 + 8);
+        } else {
+            offset += (sizeof(inode_id_t) + 4 + 4 + key_len);
+        }
     }
     return temp_key;
 }
 
 //删除Bptree树时，后续处理
-int LinkNodeDeleteBptree(LinkListOp &op, LinkNodeSearchResult &res, LinkNode *cur){
-    uint32_t del_len = sizeof(inode_id_t) + 4 + 8;
+//删除key的整个kvs，value是bptree时只删除指针
+int LinkNodeDeleteKey(LinkListOp &op, LinkNodeSearchResult &res, LinkNode *cur){
+    uint32_t del_len = res.value_is_bptree ? (sizeof(inode_id_t) + 4 + 8) : (sizeof(inode_id_t) + 4 + 4 + res.key_len);
     uint32_t remain_len = cur->len - del_len;
     if(remain_len != 0 && remain_len < LINK_NODE_TRIG_MERGE_SIZE ){ //可能需要合并
         if(!IS_INVALID_POINTER(cur->next)){  
@@ -805,7 +811,7 @@ int LinkNodeDelete(LinkListOp &op, LinkNode *cur, const inode_id_t key, const Sl
         op.AddBptreeOp(bop);
         if(bop.root != bop.res){  //修改根节点
             if(IS_INVALID_POINTER(bop.res)){  //根节点删除了，
-                return LinkNodeDeleteBptree(op, res, cur);
+                return LinkNodeDeleteKey(op, res, cur);
             }
             DBG_LOG("[dir] key:%lu bptree modify new root:%lu old:%lu", key, bop.res, bop.root);
             //根节点替换，直接修改根节点地址
@@ -1082,6 +1088,76 @@ int LinkNodeSearchKey(LinkNodeSearchResult &res, LinkNode *cur, const inode_id_t
     return 1;
 }
 
+static LinkNode *LinkListSearchKey(pointer_t root, const inode_id_t key, LinkNodeSearchResult &res){   //返回key所在的节点
+    pointer_t cur = root;
+    pointer_t prev = root;
+
+    LinkNode *cur_node = static_cast<LinkNode *>(NODE_GET_POINTER(cur));
+    while(!IS_INVALID_POINTER(cur) && compare_inode_id(key, cur_node->min_key) >= 0) {
+        prev = cur;
+        cur = cur_node->next;
+        cur_node = static_cast<LinkNode *>(NODE_GET_POINTER(cur));
+    }
+    LinkNode *search_node = static_cast<LinkNode *>(NODE_GET_POINTER(prev));
+    if(search_node->num == 0 || search_node->len == 0) return nullptr;
+    LinkNodeSearchKey(res, search_node, key);
+    if(!res.key_find) return nullptr;
+    return search_node;
+}
+
+int LinkListGetKey(LinkNode *root, const inode_id_t key, vector<inode_id_t> &values, pointer_t &bptree){
+    LinkNodeSearchResult res;
+    LinkNode *node = LinkListSearchKey(NODE_GET_OFFSET(root), key, res);
+    if(node == nullptr) return 2;
+
+    if(res.value_is_bptree){
+        bptree = node->DecodeBufGetBptree(res.key_offset + sizeof(inode_id_t) + 4);
+    } else {
+        uint64_t hash_fname;
+        uint32_t value_len;
+        inode_id_t value;
+        uint32_t offset = res.key_offset + sizeof(inode_id_t) + 4 + 4;
+        for(uint32_t i = 0; i < res.key_num; i++){
+            node->DecodeBufGetHashfnameAndLen(offset, hash_fname, value_len);
+            node->DecodeBufGetKey(offset + 8 + 4 + value_len - sizeof(inode_id_t), value);
+            values.push_back(value);
+            offset += (8 + 4 + value_len);
+        }
+    }
+    return 0;
+}
+
+int LinkListDeleteKey(LinkListOp &op, const inode_id_t key){
+    LinkNodeSearchResult res;
+    LinkNode *del_node = LinkListSearchKey(op.root, key, res);
+    if(del_node == nullptr) return 2;
+    return LinkNodeDeleteKey(op, res, del_node);   //value是bptree时只摘下根，整棵树由调用者回收
+}
+
+NvmDirDropRecord *AllocDirDropRecord(const inode_id_t key){
+    NvmDirDropRecord *record = static_cast<NvmDirDropRecord *>(node_allocator->AllocateAndInit(DIR_LINK_NODE_SIZE, 0));
+    node_allocator->nvm_memcpy_persist(&(record->key), &key, sizeof(inode_id_t));
+    return record;
+}
+
+int NvmDirDropRecord::Append(const vector<inode_id_t> &new_values, pointer_t bptree){
+    uint32_t new_num = num;
+    for(auto it : new_values){
+        if(find(values, values + num, it) != values + num) continue;
+        if(new_num >= DIR_DROP_RECORD_MAX_VALUES) return -1;
+        values[new_num++] = it;
+    }
+    int bptree_index = -1;
+    if(!IS_INVALID_POINTER(bptree) && bptrees[0] != bptree && bptrees[1] != bptree){
+        bptree_index = IS_INVALID_POINTER(bptrees[0]) ? 0 : 1;
+        if(!IS_INVALID_POINTER(bptrees[bptree_index])) return -1;
+    }
+    if(new_num > num) node_allocator->nvm_persist(values + num, (new_num - num) * sizeof(inode_id_t));
+    if(bptree_index >= 0) node_allocator->nvm_memcpy_persist(&(bptrees[bptree_index]), &bptree, sizeof(pointer_t));
+    if(new_num > num) node_allocator->nvm_memcpy_persist(&num, &new_num, sizeof(uint32_t));   //num最后写入，之前的values都已持久化
+    return 0;
+}
+
 //将迁移rehash_kvs和now_kvs归并成new_kvs
 int LinkKVSMerge(const string &now_kvs, const string &rehash_kvs, string &new_kvs){
     inode_id_t key = MemoryDecodeGetKey(now_kvs.data());
@@ -1172,16 +1248,17 @@ int RehashLinkNodeInsert(LinkListOp &op, LinkNode *cur, const inode_id_t key, st
                 uint32_t offset = sizeof(inode_id_t) + 4 + 4;
                 Slice fname;
                 inode_id_t value;
-                for(uint32_t i = 0; i < res.key_num; i++){
+                for(uint32_t i = 0; i < kvs_key_num; i++){   //res是bptree，key_num为0，按kvs中的个数迁移
                     MemoryDecodeHashkeyValuelen(kvs.data() + offset, hash_fname, value_len);
-                    fname = Slice(kvs.data() + offset + 8, value_len - sizeof(inode_id_t));
-                    value = MemoryDecodeGetKey(kvs.data() + offset + 8 + value_len - sizeof(inode_id_t));
+                    fname = Slice(kvs.data() + offset + 8 + 4, value_len - sizeof(inode_id_t));
+                    value = MemoryDecodeGetKey(kvs.data() + offset + 8 + 4 + value_len - sizeof(inode_id_t));
                     
                     BptreeOnlyInsert(bop, hash_fname, fname, value);
                     if(bop.res != bop.root){
                         bop.root = bop.res;
                         bop.res = bop.root;
                     }
+                    offset += (8 + 4 + value_len);
                 }
                 op.AddBptreeOp(bop);
                 if(bop.res != bptree){  //直接更新根节点
@@ -1201,14 +1278,14 @@ int RehashLinkNodeInsert(LinkListOp &op, LinkNode *cur, const inode_id_t key, st
                 pointer_t head = INVALID_POINTER;
                 BptreeGetLinkHeadNode(res_bptree, head);
                 BptreeLeafNode *head_node = static_cast<BptreeLeafNode *>(NODE_GET_POINTER(head));
-                Iterator *it = new BptreeIterator(head_node);
+                BptreeIterator *it = new BptreeIterator(head_node);
                 uint64_t hash_fname;
-                Slice fname;
+                string fname;   //fname()返回临时string，不能用Slice引用
                 inode_id_t value;
                 for(it->SeekToFirst(); it->Valid(); it->Next()){
                     hash_fname = it->hash_fname();
                     fname = it->fname();
-                    value = it->value();
+                    value = it->stored_value();   //迁移时保留目录项类型
                     BptreeInsert(bop, hash_fname, fname, value);
                     if(bop.res != bop.root){
                         bop.root = bop.res;
@@ -1238,13 +1315,14 @@ int RehashLinkNodeInsert(LinkListOp &op, LinkNode *cur, const inode_id_t key, st
             inode_id_t value;
             for(uint32_t i = 0; i < res.key_num; i++){
                 cur->DecodeBufGetHashfnameAndLen(offset, hash_fname, value_len);
-                fname = Slice(cur->buf + offset + 8, value_len - sizeof(inode_id_t));
-                cur->DecodeBufGetKey(offset + 8 + value_len - sizeof(inode_id_t), value);
+                fname = Slice(cur->buf + offset + 8 + 4, value_len - sizeof(inode_id_t));
+                cur->DecodeBufGetKey(offset + 8 + 4 + value_len - sizeof(inode_id_t), value);
                 BptreeInsert(bop, hash_fname, fname, value);
                 if(bop.res != bop.root){
                     bop.root = bop.res;
                     bop.res = bop.root;
                 }
+                offset += (8 + 4 + value_len);
             }
             op.AddBptreeOp(bop);
 
@@ -1557,7 +1635,78 @@ bool BanirySearchIndex(BptreeIndexNode *cur, const uint64_t hash_key, uint32_t &
     return true;
 }
 
-bool LinearSearchLeaf(BptreeLeafNode *cur, const uint64_t hash_key, uint32_t &key_offset, uint32_t &value_len){
+void BptreeLeafNode::BuildSearchIndex(bool persist){
+    uint32_t index_size = LeafSearchIndexSize(num);
+    if(num == 0 || len + index_size > LEAF_NODE_CAPACITY){  //空闲空间放不下，不建索引
+        if(persist) {
+            InvalidateSearchIndexPersist();
+        } else if(len <= LEAF_SEARCH_INDEX_TAIL_OFFSET){
+            uint32_t magic = 0;
+            node_allocator->nvm_memcpy_nodrain(&(GetSearchIndexTail()->magic), &magic, 4);
+        }
+        return ;
+    }
+    uint16_t entry[LEAF_NODE_CAPACITY / 2];   //前num个是hash前缀，后num个是偏移
+    uint64_t key;
+    uint32_t value_len;
+    uint32_t offset = 0;
+    for(uint32_t i = 0; i < num; i++){
+        DecodeBufGetKeyValuelen(offset, key, value_len);
+        entry[i] = static_cast<uint16_t>(key >> 48);
+        entry[num + i] = static_cast<uint16_t>(offset);
+        offset += (8 + 4 + value_len);
+    }
+    LeafSearchIndexTail tail(num, len, LEAF_SEARCH_INDEX_MAGIC);
+    if(persist){   //原地修改，索引持久化后才写tail
+        node_allocator->nvm_memcpy_persist(GetSearchIndexPrefix(num), entry, num * 4);
+        node_allocator->nvm_memcpy_persist(GetSearchIndexTail(), &tail, sizeof(LeafSearchIndexTail));
+    } else {
+        node_allocator->nvm_memcpy_nodrain(GetSearchIndexPrefix(num), entry, num * 4);
+        node_allocator->nvm_memcpy_nodrain(GetSearchIndexTail(), &tail, sizeof(LeafSearchIndexTail));
+    }
+}
+
+//用叶节点尾部的索引查找，返回false表示索引不可用
+static bool IndexSearchLeaf(BptreeLeafNode *cur, const uint64_t hash_key, bool &key_find, uint32_t &key_offset, uint32_t &value_len){
+    uint32_t num = cur->num;
+    uint32_t len = cur->len;
+    if(!cur->SearchIndexValid(num, len)) return false;
+    const uint16_t *prefix = cur->GetSearchIndexPrefix(num);
+    const uint16_t *offsets = prefix + num;
+    uint16_t target = static_cast<uint16_t>(hash_key >> 48);
+
+    //无分支二分，找第一个前缀>=target的位置，前缀有序所以之前的key都小于hash_key
+    const uint16_t *base = prefix;
+    uint32_t n = num;
+    while(n > 1){
+        uint32_t half = n >> 1;
+        base = (base[half] < target) ? base + half : base;
+        n -= half;
+    }
+    uint32_t i = (base - prefix) + (*base < target);
+
+    uint64_t temp_key;
+    uint32_t len_temp;
+    for(; i < num; i++){   //前缀相同的kv很少，逐个比较完整的hash_key
+        uint32_t offset = offsets[i];
+        if(offset >= len) return false;   //读到写者修改到一半的索引，读者之后会按seqlock重试
+        cur->DecodeBufGetKeyValuelen(offset, temp_key, len_temp);
+        if(temp_key >= hash_key){
+            key_find = (temp_key == hash_key);
+            key_offset = offset;
+            value_len = len_temp;
+            return true;
+        }
+    }
+    key_find = false;
+    key_offset = len;
+    return true;
+}
+
+bool SearchLeaf(BptreeLeafNode *cur, const uint64_t hash_key, uint32_t &key_offset, uint32_t &value_len){
+    bool key_find;
+    if(IndexSearchLeaf(cur, hash_key, key_find, key_offset, value_len)) return key_find;
+    //没有索引（节点太满或者旧版本数据），逐个解码
     uint32_t num = cur->num;
     uint64_t temp_key;
     uint32_t len;
@@ -1595,7 +1744,7 @@ int BptreeSearch(BptreeSearchResult &res, pointer_t root, const uint64_t hash_ke
         }
         else{    //叶子节点查找
             BptreeLeafNode *cur_node = static_cast<BptreeLeafNode *>(NODE_GET_POINTER(cur));
-            res.key_find = LinearSearchLeaf(cur_node, hash_key, res.leaf_key_offset, res.leaf_value_len);
+            res.key_find = SearchLeaf(cur_node, hash_key, res.leaf_key_offset, res.leaf_value_len);
             res.leaf_node = cur;
             break;
         }
@@ -1610,7 +1759,7 @@ int BptreeLeafNodeSplit(const char *buf, uint32_t all_key_num, uint32_t len, vec
     uint32_t split_size = len / 2; //分为两半的size；
     uint32_t key_num = 0;
     while(offset < len) {
-        MemoryDecodeHashkeyValuelen(buf, hash_key, value_len);
+        MemoryDecodeHashkeyValuelen(buf + offset, hash_key, value_len);
         offset += (8 + 4 + value_len);
         key_num++;
         if(offset >= split_size){
@@ -1940,7 +2089,7 @@ int BptreeGet(pointer_t root, const uint64_t hash_key, const Slice &fname, inode
         }
         else{    //叶子节点查找
             BptreeLeafNode *cur_node = static_cast<BptreeLeafNode *>(NODE_GET_POINTER(cur));
-            res.key_find = LinearSearchLeaf(cur_node, hash_key, res.leaf_key_offset, res.leaf_value_len);
+            res.key_find = SearchLeaf(cur_node, hash_key, res.leaf_key_offset, res.leaf_value_len);
             res.leaf_node = cur;
             break;
         }
@@ -2044,7 +2193,7 @@ int BptreeIndexNodeUpdateAndDelete(BptreeOp &op, BptreeSearchResult &res, uint32
                     BptreeIndexNode *next_node = static_cast<BptreeIndexNode *>(NODE_GET_POINTER(father->entry[father_index + 1].pointer));
                     uint32_t entry_num = remain_num + next_node->num;
                     IndexNodeEntry *entrys = new IndexNodeEntry[entry_num];
-                    memcpy(entrys, cur->entry, remain_num * sizeof(IndexNodeEntry));
+                    memcpy(entrys, cur->entry, cur->num * sizeof(IndexNodeEntry));   //先拷贝全部再删除一项，next_node至少有一项，不会越界
                     uint32_t need_move = remain_num - 1 - update_index;
                     if(need_move > 0){
                         memmove(&(entrys[update_index + 1]), &(entrys[update_index + 2]), need_move * sizeof(IndexNodeEntry));
@@ -2064,6 +2213,7 @@ int BptreeIndexNodeUpdateAndDelete(BptreeOp &op, BptreeSearchResult &res, uint32
                     right_node->Flush();
 
                     op.free_indexnode_list.push_back(res.path[level - 1].node);
+                    op.free_indexnode_list.push_back(NODE_GET_OFFSET(next_node));
                     op.add_indexnode_list.push_back(NODE_GET_OFFSET(left_node));
                     op.add_indexnode_list.push_back(NODE_GET_OFFSET(right_node));
 
@@ -2100,6 +2250,7 @@ int BptreeIndexNodeUpdateAndDelete(BptreeOp &op, BptreeSearchResult &res, uint32
                     right_node->Flush();
 
                     op.free_indexnode_list.push_back(res.path[level - 1].node);
+                    op.free_indexnode_list.push_back(NODE_GET_OFFSET(prev_node));
                     op.add_indexnode_list.push_back(NODE_GET_OFFSET(left_node));
                     op.add_indexnode_list.push_back(NODE_GET_OFFSET(right_node));
 
@@ -2202,7 +2353,7 @@ int BptreeIndexNodeDeleteEntry(BptreeOp &op, BptreeSearchResult &res, uint32_t l
                     BptreeIndexNode *next_node = static_cast<BptreeIndexNode *>(NODE_GET_POINTER(father->entry[father_index + 1].pointer));
                     uint32_t entry_num = remain_num + next_node->num;
                     IndexNodeEntry *entrys = new IndexNodeEntry[entry_num];
-                    memcpy(entrys, cur->entry, remain_num * sizeof(IndexNodeEntry));
+                    memcpy(entrys, cur->entry, cur->num * sizeof(IndexNodeEntry));   //先拷贝全部再删除一项，next_node至少有一项，不会越界
                     uint32_t need_move = remain_num - 1 - delete_index;
                     if(need_move > 0){
                         memmove(&(entrys[delete_index]), &(entrys[delete_index + 1]), need_move * sizeof(IndexNodeEntry));
@@ -2220,6 +2371,7 @@ int BptreeIndexNodeDeleteEntry(BptreeOp &op, BptreeSearchResult &res, uint32_t l
                     right_node->Flush();
 
                     op.free_indexnode_list.push_back(res.path[level - 1].node);
+                    op.free_indexnode_list.push_back(NODE_GET_OFFSET(next_node));
                     op.add_indexnode_list.push_back(NODE_GET_OFFSET(left_node));
                     op.add_indexnode_list.push_back(NODE_GET_OFFSET(right_node));
 
@@ -2254,6 +2406,7 @@ int BptreeIndexNodeDeleteEntry(BptreeOp &op, BptreeSearchResult &res, uint32_t l
                     right_node->Flush();
 
                     op.free_indexnode_list.push_back(res.path[level - 1].node);
+                    op.free_indexnode_list.push_back(NODE_GET_OFFSET(prev_node));
                     op.add_indexnode_list.push_back(NODE_GET_OFFSET(left_node));
                     op.add_indexnode_list.push_back(NODE_GET_OFFSET(right_node));
 
@@ -2488,6 +2641,45 @@ int BptreeOnlyInsert(BptreeOp &op, const uint64_t hash_key, const Slice &fname,
     return BptreeInsert(op, hash_key, fname, value);
 }
 
+//已摘除的bptree不会再被修改，只读遍历
+void BptreeGetValues(pointer_t root, vector<inode_id_t> &values){
+    pointer_t head = INVALID_POINTER;
+    BptreeGetLinkHeadNode(root, head);
+    if(!IS_INVALID_POINTER(head)){
+        BptreeLeafNode *head_node = static_cast<BptreeLeafNode *>(NODE_GET_POINTER(head));
+        Iterator *it = new BptreeIterator(head_node);
+        for(it->SeekToFirst(); it->Valid(); it->Next()){
+            values.push_back(it->value());
+        }
+        delete it;
+    }
+}
+
+void BptreeReclaim(pointer_t *root_ref){
+    //根指针和释放的节点一起写日志；节点多到日志放不下时先清空根指针再释放，crash时可能泄漏，由恢复时的全量扫描回收
+    NodeLogOp log_op;
+    log_op.target = root_ref;
+    log_op.value = INVALID_POINTER;
+    BptreeRecoverNodes(*root_ref, log_op.free_nodes);
+    node_allocator->CommitWithLog(log_op);
+}
+
+BptreeLeafNode *BptreeSeekLeaf(pointer_t root, const uint64_t hash_key){
+    pointer_t cur = root;
+    uint32_t index = 0;
+    while(!IS_INVALID_POINTER(cur)){
+        if(IsIndexNode(cur)){  //中间节点查找，小于所有key时index = 0
+            BptreeIndexNode *cur_node = static_cast<BptreeIndexNode *>(NODE_GET_POINTER(cur));
+            BanirySearchIndex(cur_node, hash_key, index);
+            cur = cur_node->entry[index].pointer;
+        }
+        else{
+            return static_cast<BptreeLeafNode *>(NODE_GET_POINTER(cur));
+        }
+    }
+    return nullptr;
+}
+
 int BptreeGetLinkHeadNode(pointer_t root, pointer_t &head){
     pointer_t cur = root;
     while(!IS_INVALID_POINTER(cur)){
@@ -2527,7 +2719,7 @@ Iterator* LinkListGetIterator(LinkNode *root_node, const inode_id_t target){
         if(IS_INVALID_POINTER(head)) return nullptr;
         BptreeLeafNode *head_node = static_cast<BptreeLeafNode *>(NODE_GET_POINTER(head));
 
-        return new BptreeIterator(head_node);
+        return new BptreeIterator(head_node, bptree);
     }
     //linklist
     return new LinkNodeIterator(search, res.key_offset, res.key_num, res.key_len);
@@ -2667,4 +2859,50 @@ void GetLinkListStats(pointer_t root, uint64_t &link_node_nums, uint64_t &index_
     }
 }
 
+void BptreeRecoverNodes(pointer_t root, vector<pair<pointer_t, uint64_t>> &nodes){
+    if(IS_INVALID_POINTER(root)) return;
+    queue<pointer_t> queues;
+    queues.push(root);
+    while(!queues.empty()){
+        pointer_t cur = queues.front();
+        queues.pop();
+        if(IS_INVALID_POINTER(cur)) continue;
+        if(IsIndexNode(cur)){  //中间节点
+            BptreeIndexNode *cur_node = static_cast<BptreeIndexNode *>(NODE_GET_POINTER(cur));
+            for(uint32_t i = 0; i < cur_node->num; i++){
+                queues.push(cur_node->entry[i].pointer);
+            }
+            nodes.push_back(make_pair(cur, static_cast<uint64_t>(DIR_BPTREE_INDEX_NODE_SIZE)));
+        }
+        else{    //叶子节点
+            nodes.push_back(make_pair(cur, static_cast<uint64_t>(DIR_BPTREE_LEAF_NODE_SIZE)));
+        }
+    }
+}
+
+uint32_t LinkListRecoverNodes(pointer_t root, vector<pair<pointer_t, uint64_t>> &nodes){
+    uint32_t link_node_nums = 0;
+    pointer_t cur = root;
+    while(!IS_INVALID_POINTER(cur)) {
+        LinkNode *cur_node = static_cast<LinkNode *>(NODE_GET_POINTER(cur));
+        inode_id_t key;
+        uint32_t key_num, key_len;
+        uint32_t offset = 0;
+        for(uint32_t i = 0; i < cur_node->num; i++){
+            cur_node->DecodeBufGetKeyNumLen(offset, key, key_num, key_len);
+            if(key_num == 0){  //kv是bptree
+                pointer_t bptree = cur_node->DecodeBufGetBptree(offset + sizeof(inode_id_t) + 4);
+                BptreeRecoverNodes(bptree, nodes);
+                offset += sizeof(inode_id_t) + 4 + 8;
+            } else {
+                offset += sizeof(inode_id_t) + 8 + key_len;
+            }
+        }
+        nodes.push_back(make_pair(cur, static_cast<uint64_t>(DIR_LINK_NODE_SIZE)));
+        link_node_nums++;
+        cur = cur_node->next;
+    }
+    return link_node_nums;
+}
+
 } // namespace name
\ No newline at end of file
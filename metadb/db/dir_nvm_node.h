@@ -37,6 +37,24 @@ static const uint32_t LEAF_NODE_TRIG_BALANCE_SIZE = LEAF_NODE_CAPACITY / 4; //
 static const uint32_t INDEX_NODE_TRIG_MERGE_SIZE = (INDEX_NODE_CAPACITY / 2) - 1;  //中间节点触发合并
 static const uint32_t INDEX_NODE_TRIG_BALANCE_SIZE = (INDEX_NODE_CAPACITY + 3) / 4; //中间节点无法和左右节点合并， 但是小于该值时应该和左右节点平衡，即和左右节点合并成两个节点, +3单纯因为向上取整
 
+#define LEAF_SEARCH_INDEX_MAGIC 0x58444e49U    //"INDX"
+static const uint32_t LEAF_SEARCH_INDEX_TAIL_OFFSET = LEAF_NODE_CAPACITY - 8;
+
+//叶节点查找索引，放在buf尾部的空闲空间：|--free--|--hash前缀(2B) * num--|--kv偏移(2B) * num--|--tail(8B)--|
+//前缀按hash_key有序，可二分；空闲空间不够时不建索引，查找退回线性扫描
+struct LeafSearchIndexTail {
+    uint16_t num;     //建索引时的num、len，和节点当前值不一致说明索引已过期
+    uint16_t len;
+    uint32_t magic;
+
+    LeafSearchIndexTail(uint16_t num1, uint16_t len1, uint32_t magic1) : num(num1), len(len1), magic(magic1) {}
+    ~LeafSearchIndexTail() {}
+};
+
+static inline uint32_t LeafSearchIndexSize(uint32_t num){
+    return num * 4 + sizeof(LeafSearchIndexTail);
+}
+
 enum class DirNodeType : uint8_t {
     UNKNOWN_TYPE = 0,
     LINKNODE_TYPE = 1,
@@ -248,6 +266,28 @@ struct BptreeLeafNode {
         return min_key;
     }
 
+    LeafSearchIndexTail *GetSearchIndexTail(){
+        return reinterpret_cast<LeafSearchIndexTail *>(buf + LEAF_SEARCH_INDEX_TAIL_OFFSET);
+    }
+
+    bool SearchIndexValid(uint32_t num_temp, uint32_t len_temp){   //读者先取出num、len再判断，避免前后读到不同的值
+        if(num_temp == 0 || len_temp + LeafSearchIndexSize(num_temp) > LEAF_NODE_CAPACITY) return false;
+        LeafSearchIndexTail *tail = GetSearchIndexTail();
+        return tail->magic == LEAF_SEARCH_INDEX_MAGIC && tail->num == num_temp && tail->len == len_temp;
+    }
+
+    uint16_t *GetSearchIndexPrefix(uint32_t num_temp){   //之后紧跟num_temp个偏移
+        return reinterpret_cast<uint16_t *>(buf + LEAF_NODE_CAPACITY - LeafSearchIndexSize(num_temp));
+    }
+
+    void BuildSearchIndex(bool persist);   //num、len修改后调用
+
+    void InvalidateSearchIndexPersist(){
+        if(len > LEAF_SEARCH_INDEX_TAIL_OFFSET || GetSearchIndexTail()->magic != LEAF_SEARCH_INDEX_MAGIC) return ;   //tail被kv占用或者已无效
+        uint32_t magic = 0;
+        node_allocator->nvm_memcpy_persist(&(GetSearchIndexTail()->magic), &magic, 4);
+    }
+
 
     void Flush(){
         node_allocator->nvm_persist(this, sizeof(BptreeLeafNode));
@@ -260,18 +300,21 @@ struct BptreeLeafNode {
         node_allocator->nvm_memcpy_persist(&type, &t, 1);
     }
 
-    void SetNumAndLenPersist(uint16_t a, uint32_t b){
+    void SetNumAndLenPersist(uint16_t a, uint32_t b){   //原地修改，先让旧索引失效，避免崩溃后旧索引和num、len恰好一致
+        InvalidateSearchIndexPersist();
         char buff[6];
         memcpy(buff, &a, 2);
         memcpy(buff + 2, &b, 4);
         node_allocator->nvm_memmove_persist(&num, buff, 6);
+        BuildSearchIndex(true);
     }
 
-    void SetNumAndLenNodrain(uint16_t a, uint32_t b){
+    void SetNumAndLenNodrain(uint16_t a, uint32_t b){   //新节点，发布前会统一持久化
         char buff[6];
         memcpy(buff, &a, 2);
         memcpy(buff + 2, &b, 4);
         node_allocator->nvm_memcpy_nodrain(&num, buff, 6);
+        BuildSearchIndex(false);
     }
 
     void SetPrevPersist(pointer_t ptr){
@@ -289,6 +332,9 @@ struct BptreeLeafNode {
     }
 
     void SetBufPersist(uint32_t offset, const void *ptr, uint32_t len){
+        if(offset + len > LEAF_NODE_CAPACITY - LeafSearchIndexSize(num)){   //原地追加覆盖了索引
+            InvalidateSearchIndexPersist();
+        }
         node_allocator->nvm_memmove_persist(buf + offset, ptr, len);
     }
     void SetBufNodrain(uint32_t offset, const void *ptr, uint32_t len){
@@ -296,6 +342,26 @@ struct BptreeLeafNode {
     }
 };
 
+#define DIR_DROP_RECORD_MAX_VALUES ((DIR_LINK_NODE_SIZE - 32) / sizeof(inode_id_t))
+
+//DirDropAll摘除的目录项，在摘除前持久化，后台回收完成后才释放；重启时据此继续回收。
+//key的inline目录项都在一个LinkNode中，个数不会超过DIR_DROP_RECORD_MAX_VALUES的一半
+struct NvmDirDropRecord {
+    inode_id_t key;
+    pointer_t bptrees[2];   //摘下的bptree根，rehash期间新旧版本中可能各有一棵
+    uint32_t num;           //values中inline子inode的个数，最后写入
+    uint32_t padding;
+    inode_id_t values[DIR_DROP_RECORD_MAX_VALUES];
+
+    NvmDirDropRecord() {}
+    ~NvmDirDropRecord() {}
+
+    //追加摘下的目录项并持久化，已在记录中的跳过（重启后重新摘除时）；放不下返回-1
+    int Append(const vector<inode_id_t> &new_values, pointer_t bptree);
+};
+
+NvmDirDropRecord *AllocDirDropRecord(const inode_id_t key);
+
 class BptreeOp {
 public:
     pointer_t root;
@@ -350,6 +416,10 @@ LinkNode *AllocLinkNode();
 int LinkListInsert(LinkListOp &op, const inode_id_t key, const Slice &fname, const inode_id_t value);
 int LinkListGet(LinkNode *root, const inode_id_t key, const Slice &fname, inode_id_t &value);
 int LinkListDelete(LinkListOp &op, const inode_id_t key, const Slice &fname);
+//读取key的所有目录项，values返回inline的value，value是bptree时bptree返回其根，不存在返回2
+int LinkListGetKey(LinkNode *root, const inode_id_t key, vector<inode_id_t> &values, pointer_t &bptree);
+//删除key的所有目录项，value是bptree时只删除指针，整棵树由调用者回收，不存在返回2
+int LinkListDeleteKey(LinkListOp &op, const inode_id_t key);
 
 //将kvs转成节点，并返回根节点，节点个数
 int MemoryTranToNVMLinkNode(vector<string> &kvs, pointer_t &root, uint32_t &node_num);  //link 转成bptree时调用
@@ -363,6 +433,9 @@ int BptreeInsert(BptreeOp &op, const uint64_t hash_key, const Slice &fname, cons
 int BptreeGet(pointer_t root, const uint64_t hash_key, const Slice &fname, inode_id_t &value);
 int BptreeDelete(BptreeOp &op, const uint64_t hash_key, const Slice &fname);
 int BptreeGetLinkHeadNode(pointer_t root, pointer_t &head);
+BptreeLeafNode *BptreeSeekLeaf(pointer_t root, const uint64_t hash_key);   //返回可能包含hash_key的叶节点，用于iterator定位
+void BptreeGetValues(pointer_t root, vector<inode_id_t> &values);   //收集已摘下的bptree的所有value
+void BptreeReclaim(pointer_t *root_ref);   //释放*root_ref指向的已摘下的bptree，先持久化清空*root_ref再释放节点
 int BptreeOnlyInsert(BptreeOp &op, const uint64_t hash_key, const Slice &fname, const inode_id_t value);  //只插入，若已存在，则不修改
 
 bool IsIndexNode(pointer_t ptr);
@@ -376,6 +449,10 @@ Iterator* LinkListGetIterator(LinkNode *root_node, const inode_id_t target);
 void PrintLinkList(pointer_t root);
 void GetLinkListStats(pointer_t root, uint64_t &link_node_nums, uint64_t &index_node_nums, uint64_t &leaf_node_num);
 
+//////恢复
+uint32_t LinkListRecoverNodes(pointer_t root, vector<pair<pointer_t, uint64_t>> &nodes);   //收集链表及其bptree所有节点，返回LinkNode个数
+void BptreeRecoverNodes(pointer_t root, vector<pair<pointer_t, uint64_t>> &nodes);
+
 } // namespace name
 
 
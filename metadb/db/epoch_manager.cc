@@ -0,0 +1,155 @@
+#include "epoch_manager.h"
+#include "metadb/debug.h"
+
+namespace metadb {
+
+EpochManager *epoch_manager = nullptr;
+
+int InitEpochManager(){
+    epoch_manager = new EpochManager();
+    return 0;
+}
+
+EpochManager::EpochManager(){
+    global_epoch_.store(1);   //0表示slot不在读临界区
+    retire_nums_.store(0);
+    reclaim_nums_.store(0);
+    pthread_key_create(&slot_key_, &EpochManager::SlotDestructor);
+}
+
+EpochManager::~EpochManager(){
+    //释放函数中可能又延迟释放别的对象（如删除版本时删除二级hash），循环直到全部释放
+    while(true){
+        vector<RetireItem> items;
+        slots_mu_.Lock();
+        items.swap(orphans_);
+        for(auto it : slots_){
+            items.insert(items.end(), it->retired.begin(), it->retired.end());
+            it->retired.clear();
+        }
+        slots_mu_.Unlock();
+        if(items.empty()) break;
+        for(auto &it : items){
+            it.function(it.arg, it.arg2);
+        }
+        reclaim_nums_.fetch_add(items.size());
+    }
+    pthread_key_delete(slot_key_);   //之后线程退出不再回调SlotDestructor
+    for(auto it : slots_){
+        delete it;
+    }
+    slots_.clear();
+}
+
+void EpochManager::SlotDestructor(void *arg){
+    epoch_manager->ReleaseSlot(static_cast<EpochSlot *>(arg));
+}
+
+EpochSlot *EpochManager::GetSlot(){
+    EpochSlot *slot = static_cast<EpochSlot *>(pthread_getspecific(slot_key_));
+    if(slot == nullptr){
+        slot = new EpochSlot();
+        slot->retired.reserve(EPOCH_RECLAIM_BATCH * 2);
+        pthread_setspecific(slot_key_, slot);
+        slots_mu_.Lock();
+        slots_.insert(slot);
+        slots_mu_.Unlock();
+    }
+    return slot;
+}
+
+void EpochManager::ReleaseSlot(EpochSlot *slot){   //线程退出，未回收的对象交给其他线程
+    slots_mu_.Lock();
+    slots_.erase(slot);
+    orphans_.insert(orphans_.end(), slot->retired.begin(), slot->retired.end());
+    slots_mu_.Unlock();
+    delete slot;
+}
+
+void EpochManager::Enter(){
+    EpochSlot *slot = GetSlot();
+    if(slot->depth++ == 0){
+        slot->epoch.store(global_epoch_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);   //之后读到的指针，回收者一定能看到本slot
+    }
+}
+
+void EpochManager::Exit(){
+    EpochSlot *slot = GetSlot();
+    if(--slot->depth == 0){
+        slot->epoch.store(0, std::memory_order_release);
+    }
+}
+
+void EpochManager::Retire(void (*function)(void *, uint64_t), void *arg, uint64_t arg2){
+    EpochSlot *slot = GetSlot();
+    std::atomic_thread_fence(std::memory_order_seq_cst);   //摘除对象的修改先于读取epoch
+    slot->retired.push_back(RetireItem(function, arg, arg2, global_epoch_.load(std::memory_order_relaxed)));
+    retire_nums_.fetch_add(1, std::memory_order_relaxed);
+    if(slot->retired.size() >= EPOCH_RECLAIM_BATCH){
+        Reclaim();
+    }
+}
+
+uint64_t EpochManager::MinActiveEpoch(){
+    uint64_t min_epoch = global_epoch_.load(std::memory_order_relaxed);
+    MutexLock lock(&slots_mu_);
+    for(auto it : slots_){
+        uint64_t epoch = it->epoch.load(std::memory_order_relaxed);
+        if(epoch != 0 && epoch < min_epoch){
+            min_epoch = epoch;
+        }
+    }
+    return min_epoch;
+}
+
+uint64_t EpochManager::ReclaimList(vector<RetireItem> &list, uint64_t min_epoch){   //释放epoch小于min_epoch的对象
+    uint64_t num = 0;
+    while(num < list.size() && list[num].epoch < min_epoch){
+        num++;
+    }
+    if(num == 0) return 0;
+    vector<RetireItem> items(list.begin(), list.begin() + num);   //释放函数可能再调用Retire修改list
+    list.erase(list.begin(), list.begin() + num);
+    for(auto &it : items){
+        it.function(it.arg, it.arg2);
+    }
+    reclaim_nums_.fetch_add(num, std::memory_order_relaxed);
+    return num;
+}
+
+void EpochManager::Reclaim(){
+    global_epoch_.fetch_add(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint64_t min_epoch = MinActiveEpoch();   //之后进入的读者已看不到之前摘除的对象
+    EpochSlot *slot = GetSlot();
+    ReclaimList(slot->retired, min_epoch);
+
+    vector<RetireItem> orphans;
+    slots_mu_.Lock();
+    orphans.swap(orphans_);
+    slots_mu_.Unlock();
+    if(orphans.empty()) return ;
+    ReclaimList(orphans, min_epoch);
+    if(!orphans.empty()){
+        slots_mu_.Lock();
+        orphans_.insert(orphans_.end(), orphans.begin(), orphans.end());
+        slots_mu_.Unlock();
+    }
+}
+
+void EpochManager::PrintEpochStats(string &stats){
+    char buf[1024];
+    uint64_t retire_nums = retire_nums_.load();
+    uint64_t reclaim_nums = reclaim_nums_.load();
+    uint64_t slot_nums = 0;
+    slots_mu_.Lock();
+    slot_nums = slots_.size();
+    slots_mu_.Unlock();
+    snprintf(buf, sizeof(buf), "epoch: global:%lu threads:%lu retired:%lu reclaimed:%lu pending:%lu\n", global_epoch_.load(), slot_nums, \
+            retire_nums, reclaim_nums, retire_nums - reclaim_nums);
+    stats.append(buf);
+}
+
+
+} // namespace name
@@ -0,0 +1,98 @@
+/**
+ * @Description : 基于epoch的延迟回收，读者不加锁遍历NVM节点，被摘除的节点和内存版本等所有读者离开后才真正释放
+ */
+#ifndef _METADB_EPOCH_MANAGER_H_
+#define _METADB_EPOCH_MANAGER_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+#include <set>
+#include <vector>
+#include <string>
+
+#include "../util/lock.h"
+
+using namespace std;
+
+namespace metadb {
+
+#define EPOCH_RECLAIM_BATCH 64      //每个线程延迟释放这么多个对象后尝试回收一次
+
+struct RetireItem {
+    void (*function)(void *, uint64_t);   //真正的释放函数
+    void *arg;
+    uint64_t arg2;
+    uint64_t epoch;    //摘除时的全局epoch
+
+    RetireItem(void (*function1)(void *, uint64_t), void *arg1, uint64_t arg3, uint64_t epoch1) : function(function1), arg(arg1), arg2(arg3), epoch(epoch1) {}
+    ~RetireItem() {}
+};
+
+struct alignas(64) EpochSlot {   //每个线程一个，独占cache line，避免读者之间伪共享
+    atomic<uint64_t> epoch;    //进入时的全局epoch，0表示不在读临界区
+    uint32_t depth;            //嵌套深度，只有本线程修改
+    vector<RetireItem> retired;   //本线程延迟释放的对象，按epoch递增，只有本线程修改
+
+    EpochSlot() : depth(0) {
+        epoch.store(0);
+    }
+    ~EpochSlot() {}
+};
+
+class EpochManager {
+public:
+    EpochManager();
+    ~EpochManager();   //释放所有延迟对象，调用时不能再有读者
+
+    void Enter();    //进入读临界区，可嵌套
+    void Exit();
+
+    //对象已从所有读者可见的位置摘除，等当前所有读者离开后调用function(arg, arg2)
+    void Retire(void (*function)(void *, uint64_t), void *arg, uint64_t arg2);
+    void Reclaim();  //回收本线程可以释放的对象
+
+    void PrintEpochStats(string &stats);
+
+private:
+    atomic<uint64_t> global_epoch_;
+    pthread_key_t slot_key_;
+    Mutex slots_mu_;
+    set<EpochSlot *> slots_;        //所有线程的slot，slots_mu_保护
+    vector<RetireItem> orphans_;    //已退出线程未回收的对象，slots_mu_保护
+
+    //统计
+    atomic<uint64_t> retire_nums_;
+    atomic<uint64_t> reclaim_nums_;
+
+    static void SlotDestructor(void *arg);
+    EpochSlot *GetSlot();
+    void ReleaseSlot(EpochSlot *slot);
+    uint64_t MinActiveEpoch();
+    uint64_t ReclaimList(vector<RetireItem> &list, uint64_t min_epoch);
+};
+
+extern EpochManager *epoch_manager;
+
+extern int InitEpochManager();
+
+class EpochGuard {   //作用域内的读者
+public:
+    EpochGuard() { epoch_manager->Enter(); }
+    ~EpochGuard() { epoch_manager->Exit(); }
+
+private:
+    EpochGuard(const EpochGuard&) = delete;
+    EpochGuard& operator=(const EpochGuard&) = delete;
+};
+
+} // namespace name
+
+
+
+
+
+
+
+
+#endif
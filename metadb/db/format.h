@@ -27,9 +27,17 @@
 
 #define MAX_DIR_BPTREE_LEVEL 8
 
+#define HASH_VERSION_CHANGED -2   //写者加锁后发现rehash开始或结束，需要重新获取版本
+#define DIR_RENAME_CROSS_ENTRY 3   //新旧目录项不在同一个entry，不能原地rename，由调用者通过日志保证原子性
+#define DIR_SCAN_RETRY_EXCEEDED -3   //Scan拷贝期间一直有写者，重试次数用完
+#define DIR_DROP_BATCH_NUM 256       //DirDropAll后台回收子目录时每次取出的目录项数
+
 ////
 #define INODE_HASH_ENTRY_SIZE  256
 #define INODE_FILE_SIZE (4ULL * 1024 * 1024)   //MB
+#define CACHE_LINE_SIZE 64
+#define INODE_MULTIGET_GROUP 32    //批量读inode时一组内的key逐级预取，组内的访存互相重叠
+#define INODE_PREFETCH_VALUE_SIZE 256   //预取value开头这么多字节，覆盖常用的属性部分
 ////
 
 
@@ -0,0 +1,338 @@
+#include <stdio.h>
+#include <algorithm>
+
+#include "inode_cache.h"
+
+namespace metadb {
+
+static inline uint64_t MixKey(const inode_id_t key){
+    uint64_t h = key * 0x9e3779b97f4a7c15ULL;
+    return h ^ (h >> 29);
+}
+
+void FrequencySketch::Init(uint64_t width){
+    uint64_t blocks = 1;
+    while(blocks * CACHE_LINE_SIZE < width) blocks <<= 1;
+    table_.assign(blocks * CACHE_LINE_SIZE, 0);
+    block_mask_ = blocks - 1;
+    additions_ = 0;
+    sample_size_ = blocks * CACHE_LINE_SIZE * 10;   //每个计数平均被加约10次后减半
+}
+
+inline uint8_t *FrequencySketch::Counter(const inode_id_t key, uint32_t row){
+    uint64_t h = MixKey(key);
+    uint64_t block = (h >> 32) & block_mask_;
+    //每行在块内占CACHE_LINE_SIZE/kDepth个计数，用hash的不同位选取
+    uint32_t width = CACHE_LINE_SIZE / kDepth;
+    uint32_t index = row * width + ((h >> (row * 4)) & (width - 1));
+    return &table_[block * CACHE_LINE_SIZE + index];
+}
+
+void FrequencySketch::Increment(const inode_id_t key){
+    bool added = false;
+    for(uint32_t i = 0; i < kDepth; i++){
+        uint8_t *count = Counter(key, i);
+        if(*count < kMaxCount){
+            (*count)++;
+            added = true;
+        }
+    }
+    if(added && ++additions_ >= sample_size_){
+        for(size_t i = 0; i < table_.size(); i++){
+            table_[i] >>= 1;
+        }
+        additions_ /= 2;
+    }
+}
+
+uint32_t FrequencySketch::Estimate(const inode_id_t key){
+    uint32_t res = kMaxCount;
+    for(uint32_t i = 0; i < kDepth; i++){
+        res = std::min(res, static_cast<uint32_t>(*Counter(key, i)));
+    }
+    return res;
+}
+
+InodeCache::InodeCache(uint64_t capacity) : capacity_(capacity){
+    shards_ = new InodeCacheShard[INODE_CACHE_SHARD_NUM];
+    uint64_t per_shard = capacity_ / INODE_CACHE_SHARD_NUM;
+    for(uint32_t i = 0; i < INODE_CACHE_SHARD_NUM; i++){
+        shards_[i].capacity = per_shard;
+        shards_[i].table.resize(INODE_CACHE_MIN_TABLE_SIZE);
+        shards_[i].mask = INODE_CACHE_MIN_TABLE_SIZE - 1;
+        //按每项至少占INODE_CACHE_ENTRY_OVERHEAD估计项数，草图计数个数取其2倍
+        shards_[i].sketch.Init(std::max(per_shard / INODE_CACHE_ENTRY_OVERHEAD * 2, 1024UL));
+    }
+}
+
+InodeCache::~InodeCache(){
+    delete[] shards_;
+}
+
+inline InodeCacheShard *InodeCache::GetShard(const inode_id_t key){
+    //inode id连续分配，混合后取低位，避免和zone的取模分布相关
+    return &shards_[MixKey(key) & (INODE_CACHE_SHARD_NUM - 1)];
+}
+
+static inline uint64_t HomePos(const inode_id_t key, uint64_t mask){
+    return (MixKey(key) >> 6) & mask;   //低位已用于选择分片
+}
+
+inline int64_t InodeCache::Find(InodeCacheShard *shard, const inode_id_t key){
+    uint64_t pos = HomePos(key, shard->mask);
+    while(shard->table[pos].used){
+        if(shard->table[pos].key == key) return pos;
+        pos = (pos + 1) & shard->mask;
+    }
+    return -1;
+}
+
+bool InodeCache::Get(const inode_id_t key, string &value, uint64_t &seq){
+    InodeCacheShard *shard = GetShard(key);
+    shard->mu.Lock();
+    int64_t pos = Find(shard, key);
+    if(pos >= 0){
+        InodeCacheEntry &entry = shard->table[pos];
+        //访问位已置的项在CLOCK下一次扫过前不会被淘汰，不再计数，热点命中省去一次草图访存
+        if(!entry.referenced) shard->sketch.Increment(key);
+        entry.referenced = true;
+        value = entry.value;
+        shard->stats.hits++;
+        shard->mu.Unlock();
+        return true;
+    }
+    shard->sketch.Increment(key);
+    shard->stats.misses++;
+    seq = shard->seq;
+    shard->mu.Unlock();
+    return false;
+}
+
+InodeCacheEntry *InodeCache::Insert(InodeCacheShard *shard, const inode_id_t key){
+    if((shard->count + 1) * 2 > shard->table.size()){
+        vector<InodeCacheEntry> old_table(shard->table.size() * 2);
+        old_table.swap(shard->table);
+        shard->mask = shard->table.size() - 1;
+        for(auto &old : old_table){
+            if(!old.used) continue;
+            uint64_t pos = HomePos(old.key, shard->mask);
+            while(shard->table[pos].used) pos = (pos + 1) & shard->mask;
+            shard->table[pos] = std::move(old);
+        }
+        shard->hand = 0;
+    }
+    uint64_t pos = HomePos(key, shard->mask);
+    while(shard->table[pos].used) pos = (pos + 1) & shard->mask;
+    shard->victim = -1;   //新项没有访问位，可能在指针和原淘汰者之间
+    InodeCacheEntry *entry = &shard->table[pos];
+    entry->key = key;
+    entry->used = true;
+    shard->count++;
+    return entry;
+}
+
+void InodeCache::RemoveEntry(InodeCacheShard *shard, uint64_t pos){
+    shard->victim = -1;   //后续项会前移
+    shard->usage -= Charge(shard->table[pos].value.size());
+    shard->count--;
+    uint64_t next = pos;
+    while(true){
+        next = (next + 1) & shard->mask;
+        InodeCacheEntry &entry = shard->table[next];
+        if(!entry.used) break;
+        uint64_t home = HomePos(entry.key, shard->mask);
+        //home不在(pos, next]之间时，前移到pos后仍能从home探测到
+        bool between = (pos <= next) ? (pos < home && home <= next) : (pos < home || home <= next);
+        if(between) continue;
+        shard->table[pos] = std::move(entry);
+        pos = next;
+    }
+    InodeCacheEntry &entry = shard->table[pos];
+    entry.used = false;
+    entry.referenced = false;
+    string().swap(entry.value);   //释放value占用的内存
+}
+
+uint64_t InodeCache::SelectVictim(InodeCacheShard *shard){
+    shard->victim = -1;
+    while(true){
+        shard->hand &= shard->mask;
+        InodeCacheEntry &entry = shard->table[shard->hand];
+        if(entry.used){
+            if(!entry.referenced) return shard->hand;
+            entry.referenced = false;   //最近访问过，给第二次机会
+        }
+        shard->hand++;
+    }
+}
+
+uint64_t InodeCache::PeekVictim(InodeCacheShard *shard){
+    //指针到上次结果之间的项只可能被命中置位，上次的结果仍无访问位，或本来就是有访问位的项时，CLOCK还会选它
+    if(shard->victim >= 0 && (shard->victim_referenced || !shard->table[shard->victim].referenced)){
+        return shard->victim;
+    }
+    uint64_t first = shard->hand & shard->mask;   //检查范围内都有访问位时，取第一个，和CLOCK清位绕回后的选择一致
+    bool found_first = false;
+    uint32_t checked = 0;
+    uint64_t pos = shard->hand & shard->mask;
+    for(uint64_t i = 0; i <= shard->mask && checked < INODE_CACHE_VICTIM_SCAN; i++, pos = (pos + 1) & shard->mask){
+        InodeCacheEntry &entry = shard->table[pos];
+        if(!entry.used) continue;
+        if(!entry.referenced){
+            shard->victim = pos;
+            shard->victim_referenced = false;
+            return pos;
+        }
+        if(!found_first){
+            first = pos;
+            found_first = true;
+        }
+        checked++;
+    }
+    shard->victim = first;
+    shard->victim_referenced = true;
+    return first;
+}
+
+void InodeCache::CommitVictim(InodeCacheShard *shard, uint64_t victim){
+    uint64_t pos = shard->hand & shard->mask;
+    while(pos != victim){
+        shard->table[pos].referenced = false;   //被扫过的项用掉第二次机会
+        pos = (pos + 1) & shard->mask;
+    }
+    shard->hand = victim;
+    shard->victim = -1;
+}
+
+void InodeCache::EvictUntilFit(InodeCacheShard *shard){
+    while(shard->usage > shard->capacity && shard->count > 0){
+        RemoveEntry(shard, SelectVictim(shard));
+        shard->stats.evictions++;
+    }
+}
+
+bool InodeCache::Admit(InodeCacheShard *shard, const inode_id_t key, const Slice &value, pointer_t addr){
+    uint64_t charge = Charge(value.size());
+    if(charge > shard->capacity){
+        shard->stats.rejects++;
+        return false;
+    }
+    if(shard->usage + charge > shard->capacity && shard->count > 0){
+        //缓存已满，新key只有比CLOCK选出的淘汰者更常被访问才替换它，偶尔扫描一遍的key不会冲掉热点；
+        //被拒绝时不移动CLOCK指针也不清访问位，冷key的未命中不会让热点失去第二次机会
+        uint32_t freq = shard->sketch.Estimate(key);
+        if(freq < INODE_CACHE_MIN_ADMIT_FREQ){   //随机读中只出现一次的key占多数，省去扫描淘汰者
+            shard->stats.rejects++;
+            return false;
+        }
+        uint64_t victim = PeekVictim(shard);
+        if(freq <= shard->sketch.Estimate(shard->table[victim].key)){
+            shard->stats.rejects++;
+            return false;
+        }
+        CommitVictim(shard, victim);
+        RemoveEntry(shard, victim);
+        shard->stats.evictions++;
+    }
+    InodeCacheEntry *entry = Insert(shard, key);
+    entry->value.assign(value.data(), value.size());
+    entry->addr = addr;
+    entry->referenced = false;
+    shard->usage += charge;
+    EvictUntilFit(shard);
+    return true;
+}
+
+void InodeCache::Fill(const inode_id_t key, const Slice &value, pointer_t addr, uint64_t seq){
+    InodeCacheShard *shard = GetShard(key);
+    shard->mu.Lock();
+    if(shard->seq == seq && Find(shard, key) < 0){
+        if(Admit(shard, key, value, addr)) shard->stats.fills++;
+    }
+    shard->mu.Unlock();
+}
+
+void InodeCache::Write(const inode_id_t key, const Slice &value, pointer_t old_addr, pointer_t new_addr){
+    InodeCacheShard *shard = GetShard(key);
+    shard->mu.Lock();
+    int64_t pos = Find(shard, key);
+    if(pos >= 0){
+        InodeCacheEntry &entry = shard->table[pos];
+        if(!IS_INVALID_POINTER(old_addr) && entry.addr == old_addr){   //缓存的正是被覆盖的版本
+            shard->usage = shard->usage - Charge(entry.value.size()) + Charge(value.size());
+            entry.value.assign(value.data(), value.size());
+            entry.addr = new_addr;
+            entry.referenced = true;
+            shard->stats.writes++;
+            EvictUntilFit(shard);
+        } else {   //写者之间的顺序无法确定，或kv被回收搬移过，直接摘除
+            RemoveEntry(shard, pos);
+            shard->stats.invalidations++;
+        }
+    }
+    shard->seq++;   //让写之前开始的读放弃填入
+    shard->mu.Unlock();
+}
+
+void InodeCache::WriteRange(const inode_id_t key, uint32_t offset, const Slice &data, pointer_t old_addr, pointer_t new_addr){
+    InodeCacheShard *shard = GetShard(key);
+    shard->mu.Lock();
+    int64_t pos = Find(shard, key);
+    if(pos >= 0){
+        InodeCacheEntry &entry = shard->table[pos];
+        if(!IS_INVALID_POINTER(old_addr) && entry.addr == old_addr && offset + data.size() <= entry.value.size()){
+            entry.value.replace(offset, data.size(), data.data(), data.size());
+            entry.addr = new_addr;
+            entry.referenced = true;
+            shard->stats.writes++;
+        } else {
+            RemoveEntry(shard, pos);
+            shard->stats.invalidations++;
+        }
+    }
+    shard->seq++;
+    shard->mu.Unlock();
+}
+
+void InodeCache::Erase(const inode_id_t key){
+    InodeCacheShard *shard = GetShard(key);
+    shard->mu.Lock();
+    int64_t pos = Find(shard, key);
+    if(pos >= 0){
+        RemoveEntry(shard, pos);
+        shard->stats.invalidations++;
+    }
+    shard->seq++;
+    shard->mu.Unlock();
+}
+
+void InodeCache::GetStats(InodeCacheStats &stats){
+    for(uint32_t i = 0; i < INODE_CACHE_SHARD_NUM; i++){
+        shards_[i].mu.Lock();
+        stats.hits += shards_[i].stats.hits;
+        stats.misses += shards_[i].stats.misses;
+        stats.fills += shards_[i].stats.fills;
+        stats.writes += shards_[i].stats.writes;
+        stats.rejects += shards_[i].stats.rejects;
+        stats.evictions += shards_[i].stats.evictions;
+        stats.invalidations += shards_[i].stats.invalidations;
+        stats.entries += shards_[i].count;
+        stats.bytes += shards_[i].usage;
+        shards_[i].mu.Unlock();
+    }
+}
+
+void InodeCache::PrintStats(string &stats){
+    InodeCacheStats s;
+    GetStats(s);
+    char buf[1024];
+    uint64_t lookups = s.hits + s.misses;
+    snprintf(buf, sizeof(buf), "Inode cache capacity:%lu MB usage:%.2f MB entries:%lu hits:%lu misses:%lu hit_rate:%.2f%%\n",
+        capacity_ / (1024 * 1024), 1.0 * s.bytes / (1024 * 1024), s.entries, s.hits, s.misses, lookups == 0 ? 0.0 : 100.0 * s.hits / lookups);
+    stats.append(buf);
+    snprintf(buf, sizeof(buf), "Inode cache fills:%lu writes:%lu rejects:%lu evictions:%lu invalidations:%lu\n",
+        s.fills, s.writes, s.rejects, s.evictions, s.invalidations);
+    stats.append(buf);
+}
+
+}
@@ -0,0 +1,129 @@
+/**
+ * @Description : InodeDB前的DRAM value缓存，按key分片；CLOCK淘汰，用频率草图做准入，只让比淘汰者更热的key进入缓存
+ */
+#ifndef _METADB_INODE_CACHE_H_
+#define _METADB_INODE_CACHE_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "metadb/inode.h"
+#include "metadb/slice.h"
+#include "format.h"
+#include "../util/lock.h"
+
+using namespace std;
+
+namespace metadb {
+
+#define INODE_CACHE_SHARD_NUM 64    //分片数，必须为2的幂次
+#define INODE_CACHE_ENTRY_OVERHEAD 128   //每项除value外的大致DRAM开销（表项及空位），计入容量
+#define INODE_CACHE_MIN_TABLE_SIZE 64
+#define INODE_CACHE_MIN_ADMIT_FREQ 2   //缓存已满时，估计访问次数低于此值的key直接拒绝，不再查找淘汰者
+#define INODE_CACHE_VICTIM_SCAN 16   //准入时最多检查这么多个有访问位的表项来找淘汰者，未命中路径的开销有界
+
+class FrequencySketch {   //Count-Min草图，估计key最近的访问次数，计数到一定次数后全部减半以淡化旧的访问
+public:
+    FrequencySketch() : block_mask_(0), additions_(0), sample_size_(0) {}
+    ~FrequencySketch() {}
+
+    void Init(uint64_t width);
+    void Increment(const inode_id_t key);
+    uint32_t Estimate(const inode_id_t key);
+
+private:
+    static const uint32_t kDepth = 4;
+    static const uint8_t kMaxCount = 15;
+    vector<uint8_t> table_;   //按cache line分块，一个key的kDepth个计数都在同一块内，一次访存
+    uint64_t block_mask_;
+    uint64_t additions_;
+    uint64_t sample_size_;
+
+    inline uint8_t *Counter(const inode_id_t key, uint32_t row);
+};
+
+struct InodeCacheEntry {
+    inode_id_t key;
+    pointer_t addr;   //value在NVM中的地址，写者据此判断缓存的是不是被覆盖的那个版本
+    bool referenced;   //CLOCK的访问位，命中时置位
+    bool used;
+    string value;
+
+    InodeCacheEntry() : key(0), addr(INVALID_POINTER), referenced(false), used(false) {}
+};
+
+struct InodeCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t fills;   //读未命中后填入
+    uint64_t writes;   //写穿透原地更新
+    uint64_t rejects;   //准入失败
+    uint64_t evictions;
+    uint64_t invalidations;   //删除或无法确定新旧时摘除
+    uint64_t entries;
+    uint64_t bytes;
+
+    InodeCacheStats() : hits(0), misses(0), fills(0), writes(0), rejects(0), evictions(0), invalidations(0), entries(0), bytes(0) {}
+    ~InodeCacheStats() {}
+};
+
+struct InodeCacheShard {
+    Mutex mu;
+    vector<InodeCacheEntry> table;   //线性探测的开放寻址表，项直接存在表中，命中只访问一个表项和value
+    uint64_t mask;
+    uint64_t count;
+    uint64_t hand;   //CLOCK指针，直接扫描表
+    int64_t victim;   //上次PeekVictim的结果，表项增删或指针移动后置-1，连续拒绝时不再重复扫描
+    bool victim_referenced;   //victim是检查范围内都有访问位时取的第一项
+    FrequencySketch sketch;
+    uint64_t capacity;   //字节
+    uint64_t usage;
+    uint64_t seq;   //每次写加1，读未命中到填入期间有写则放弃填入
+    InodeCacheStats stats;
+
+    InodeCacheShard() : mask(0), count(0), hand(0), victim(-1), victim_referenced(false), capacity(0), usage(0), seq(0) {}
+};
+
+class InodeCache {
+public:
+    explicit InodeCache(uint64_t capacity);   //capacity为字节数
+    ~InodeCache();
+
+    //命中返回true；未命中时seq用于之后的Fill
+    bool Get(const inode_id_t key, string &value, uint64_t &seq);
+    //读NVM得到的value，seq为Get返回的值，期间有写者或已有缓存项则不填入
+    void Fill(const inode_id_t key, const Slice &value, pointer_t addr, uint64_t seq);
+
+    //写NVM成功后调用。缓存的正是被覆盖的old_addr版本时原地更新，否则摘除；未缓存的key不插入，由之后的读填入
+    void Write(const inode_id_t key, const Slice &value, pointer_t old_addr, pointer_t new_addr);
+    //InodeUpdateRange成功后调用，与Write相同，只修改value中[offset, offset + data.size())
+    void WriteRange(const inode_id_t key, uint32_t offset, const Slice &data, pointer_t old_addr, pointer_t new_addr);
+    void Erase(const inode_id_t key);
+
+    void GetStats(InodeCacheStats &stats);   //累加到stats
+    void PrintStats(string &stats);
+
+private:
+    uint64_t capacity_;
+    InodeCacheShard *shards_;
+
+    inline InodeCacheShard *GetShard(const inode_id_t key);
+    //返回key所在的表项下标，不存在返回-1
+    inline int64_t Find(InodeCacheShard *shard, const inode_id_t key);
+    inline uint64_t Charge(size_t value_size) { return value_size + INODE_CACHE_ENTRY_OVERHEAD; }
+    //按准入策略插入，调用者持有shard->mu且key不在缓存中，返回是否插入
+    bool Admit(InodeCacheShard *shard, const inode_id_t key, const Slice &value, pointer_t addr);
+    InodeCacheEntry *Insert(InodeCacheShard *shard, const inode_id_t key);   //返回新表项，负载超过一半时表扩大一倍
+    void RemoveEntry(InodeCacheShard *shard, uint64_t pos);   //删除后把后续探测链上的项前移，不留墓碑
+    uint64_t SelectVictim(InodeCacheShard *shard);   //按CLOCK选出淘汰的表项，不删除；调用者保证缓存非空
+    //找出CLOCK将要淘汰的表项，不移动指针也不清访问位，候选者被拒绝时缓存不变；调用者保证缓存非空
+    uint64_t PeekVictim(InodeCacheShard *shard);
+    void CommitVictim(InodeCacheShard *shard, uint64_t victim);   //候选者胜出后，按CLOCK扫过指针到victim之间的表项
+    void EvictUntilFit(InodeCacheShard *shard);
+};
+
+}
+
+
+#endif
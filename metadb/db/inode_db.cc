@@ -5,36 +5,136 @@
  * @Description : 
  */
 
+#include <set>
+#include <algorithm>
+
 #include "inode_db.h"
 #include "metadb/debug.h"
 
 namespace metadb {
 
-InodeDB::InodeDB(const Option &option, uint64_t capacity) : option_(option), capacity_(capacity){
+InodeDB::InodeDB(const Option &option, uint64_t capacity) : option_(option), capacity_(capacity), cache_(nullptr), gc_limiter_(option.INODE_GC_RATE_LIMIT){
+    metas_ = static_cast<NvmHashTableMeta *>(node_allocator->AllocateAndInit(sizeof(NvmHashTableMeta) * capacity_, 0));
+    zones_ = new InodeZone[capacity_];
+    for(uint32_t i = 0; i < capacity; i++){
+        zones_[i].InitInodeZone(option, i, &(metas_[i]), false, &gc_limiter_);
+    }
+    if(option_.INODE_CACHE_CAPACITY > 0) cache_ = new InodeCache(option_.INODE_CACHE_CAPACITY);
+}
+
+InodeDB::InodeDB(const Option &option, uint64_t capacity, pointer_t root) : option_(option), capacity_(capacity), cache_(nullptr), gc_limiter_(option.INODE_GC_RATE_LIMIT){
+    metas_ = static_cast<NvmHashTableMeta *>(NODE_GET_POINTER(root));
     zones_ = new InodeZone[capacity_];
     for(uint32_t i = 0; i < capacity; i++){
-        zones_[i].InitInodeZone(option, i);
+        zones_[i].InitInodeZone(option, i, &(metas_[i]), true, &gc_limiter_);
     }
+    if(option_.INODE_CACHE_CAPACITY > 0) cache_ = new InodeCache(option_.INODE_CACHE_CAPACITY);
 }
 
 InodeDB::~InodeDB(){
+    delete cache_;
     delete[] zones_;
 }
 
 int InodeDB::InodePut(const inode_id_t key, const Slice &value){
-    return zones_[hash_zone_id(key)].InodePut(key, value);
+    return InodePut(key, value, 0);
+}
+
+int InodeDB::InodePut(const inode_id_t key, const Slice &value, uint32_t attr_size){
+    pointer_t new_addr = INVALID_POINTER;
+    pointer_t old_addr = INVALID_POINTER;
+    int res = zones_[hash_zone_id(key)].InodePut(key, value, attr_size, new_addr, old_addr);
+    if(cache_ == nullptr) return res;
+    if(res == 0 || res == 2){   //写穿透
+        cache_->Write(key, value, old_addr, new_addr);
+    } else {
+        cache_->Erase(key);
+    }
+    return res;
 }
 
 int InodeDB::InodeUpdate(const inode_id_t key, const Slice &new_value){
-    return zones_[hash_zone_id(key)].InodeUpdate(key, new_value);
+    if(cache_ == nullptr) return zones_[hash_zone_id(key)].InodeUpdate(key, new_value);
+    pointer_t new_addr = INVALID_POINTER;
+    pointer_t old_addr = INVALID_POINTER;
+    int res = zones_[hash_zone_id(key)].InodeUpdate(key, new_value, new_addr, old_addr);
+    if(res == 0 || res == 2){
+        cache_->Write(key, new_value, old_addr, new_addr);
+    } else {
+        cache_->Erase(key);
+    }
+    return res;
+}
+
+int InodeDB::InodeUpdateRange(const inode_id_t key, uint32_t offset, const Slice &data){
+    pointer_t new_addr = INVALID_POINTER;
+    pointer_t old_addr = INVALID_POINTER;
+    int res = zones_[hash_zone_id(key)].InodeUpdateRange(key, offset, data, new_addr, old_addr);
+    if(cache_ == nullptr) return res;
+    if(res == 0){
+        cache_->WriteRange(key, offset, data, old_addr, new_addr);
+    } else if(res == -1){
+        cache_->Erase(key);
+    }
+    return res;
 }
 
 int InodeDB::InodeGet(const inode_id_t key, std::string &value){
-    return zones_[hash_zone_id(key)].InodeGet(key, value);
+    if(cache_ == nullptr) return zones_[hash_zone_id(key)].InodeGet(key, value);
+    uint64_t seq;
+    if(cache_->Get(key, value, seq)) return 0;
+    EpochGuard guard;   //读到的地址所在文件在离开前不会被释放
+    NVMInodeFile *file;
+    uint64_t offset;
+    pointer_t addr;
+    int res = zones_[hash_zone_id(key)].InodeLocate(key, file, offset, addr);
+    if(res != 0) return res;
+    res = zones_[hash_zone_id(key)].ReadValue(addr, value);
+    if(res == 0) cache_->Fill(key, value, addr, seq);
+    return res;
+}
+
+int InodeDB::InodeGetAttr(const inode_id_t key, std::string &attr){
+    return zones_[hash_zone_id(key)].InodeGetAttr(key, attr);   //缓存中是完整值，不知道属性的大小，直接读NVM中的属性kv
+}
+
+void InodeDB::InodeMultiGet(const inode_id_t *keys, uint32_t num, std::string *values, int *rets){
+    EpochGuard guard;   //整批读完之前，定位到的文件不会被回收
+    NVMInodeFile *files[INODE_MULTIGET_GROUP];
+    uint64_t offsets[INODE_MULTIGET_GROUP];
+    pointer_t addrs[INODE_MULTIGET_GROUP];
+    uint64_t seqs[INODE_MULTIGET_GROUP];
+    bool hits[INODE_MULTIGET_GROUP];
+    for(uint32_t begin = 0; begin < num; begin += INODE_MULTIGET_GROUP){
+        uint32_t end = std::min(begin + INODE_MULTIGET_GROUP, num);
+        for(uint32_t i = begin; i < end; i++){   //缓存命中的key不再访问NVM
+            hits[i - begin] = (cache_ != nullptr && cache_->Get(keys[i], values[i], seqs[i - begin]));
+            if(hits[i - begin]) rets[i] = 0;
+        }
+        //每一级先对组内所有key发出预取，再进入下一级，key分散在不同zone也能重叠访存
+        for(uint32_t i = begin; i < end; i++){
+            if(!hits[i - begin]) zones_[hash_zone_id(keys[i])].InodePrefetch(keys[i], false);
+        }
+        for(uint32_t i = begin; i < end; i++){
+            if(!hits[i - begin]) zones_[hash_zone_id(keys[i])].InodePrefetch(keys[i], true);
+        }
+        for(uint32_t i = begin; i < end; i++){
+            if(hits[i - begin]) continue;
+            rets[i] = zones_[hash_zone_id(keys[i])].InodeLocate(keys[i], files[i - begin], offsets[i - begin], addrs[i - begin]);
+            if(rets[i] == 0) files[i - begin]->PrefetchKV(offsets[i - begin]);
+        }
+        for(uint32_t i = begin; i < end; i++){
+            if(hits[i - begin] || rets[i] != 0) continue;
+            rets[i] = zones_[hash_zone_id(keys[i])].ReadValue(addrs[i - begin], values[i]);
+            if(cache_ != nullptr && rets[i] == 0) cache_->Fill(keys[i], values[i], addrs[i - begin], seqs[i - begin]);
+        }
+    }
 }
 
 int InodeDB::InodeDelete(const inode_id_t key){
-    return zones_[hash_zone_id(key)].InodeDelete(key);
+    int res = zones_[hash_zone_id(key)].InodeDelete(key);
+    if(cache_ != nullptr) cache_->Erase(key);
+    return res;
 }
 
 inline uint32_t InodeDB::hash_zone_id(const inode_id_t key){
@@ -83,8 +183,95 @@ void InodeDB::PrintInodeStats(std::string &stats){
     snprintf(buf, sizeof(buf), "Inode capacity:%lu all file_nums:%lu write_lens:%lu kv_nums:%lu invalid_kv_nums:%lu hashtable_node_nums:%lu hashtable_kv_nums:%lu\n", capacity_, \
             all_file_nums, all_write_lens, all_kv_nums, all_invalid_kv_nums, all_hashtable_node_nums, all_hashtable_kv_nums);
     stats.append(buf);
+
+    InodeGCStats gc_stats;
+    for(uint64_t i = 0; i < capacity_; i++){
+        zones_[i].GetGCStats(gc_stats);
+    }
+    double write_amplification = gc_stats.user_write_bytes == 0 ? 0 : \
+            static_cast<double>(gc_stats.user_write_bytes + gc_stats.copied_bytes) / gc_stats.user_write_bytes;   //(用户写入+搬移写入)/用户写入
+    snprintf(buf, sizeof(buf), "Inode gc runs:%lu reclaimed_files:%lu compacted_files:%lu reclaimed_bytes:%lu copied_bytes:%lu user_write_bytes:%lu write_amplification:%.3lf\n", \
+            gc_stats.gc_runs, gc_stats.reclaimed_files, gc_stats.compacted_files, gc_stats.reclaimed_bytes, gc_stats.copied_bytes, \
+            gc_stats.user_write_bytes, write_amplification);
+    stats.append(buf);
+    if(cache_ != nullptr) cache_->PrintStats(stats);
     
     stats.append("---------------------\n");
 }
 
+struct InodeRecoverJob {
+    InodeZone *zones;
+    bool scan_nodes;
+    atomic<uint64_t> next;   //下一个待恢复的zone
+    uint64_t capacity;
+    atomic<uint64_t> kv_nums;
+    atomic<uint64_t> file_nums;
+    atomic<uint64_t> nvm_node_nums;
+    Mutex mu;
+    set<uint64_t> file_ids;   //有有效kv的文件
+};
+
+void InodeDB::RecoverWork(void *arg){
+    InodeRecoverJob *job = static_cast<InodeRecoverJob *>(arg);
+    vector<pair<pointer_t, uint64_t>> nodes;
+    vector<uint64_t> file_ids;
+    while(true){
+        uint64_t index = job->next.fetch_add(1);
+        if(index >= job->capacity) break;
+        job->kv_nums.fetch_add(job->zones[index].Recover(job->scan_nodes ? &nodes : nullptr, file_ids));
+        job->file_nums.fetch_add(file_ids.size());
+        if(job->scan_nodes){
+            job->nvm_node_nums.fetch_add(nodes.size());
+            node_allocator->RecoverAllocate(nodes);
+            nodes.clear();
+        } else {
+            job->mu.Lock();
+            job->file_ids.insert(file_ids.begin(), file_ids.end());
+            job->mu.Unlock();
+        }
+        file_ids.clear();
+    }
+}
+
+void InodeDB::Recover(uint32_t thread_count, bool scan_nodes, std::string &stats){
+    if(scan_nodes){
+        vector<pair<pointer_t, uint64_t>> root;
+        root.push_back(make_pair(NODE_GET_OFFSET(metas_), sizeof(NvmHashTableMeta) * capacity_));
+        node_allocator->RecoverAllocate(root);
+    }
+
+    InodeRecoverJob job;
+    job.zones = zones_;
+    job.scan_nodes = scan_nodes;
+    job.next.store(0);
+    job.capacity = capacity_;
+    job.kv_nums.store(0);
+    job.file_nums.store(0);
+    job.nvm_node_nums.store(scan_nodes ? 1 : 0);
+    ThreadPool::RunParallel(thread_count, &InodeDB::RecoverWork, &job);
+
+    uint64_t free_file_nums = 0;
+    if(!scan_nodes){   //分配器中已分配但没有有效kv的文件，crash前未来得及回收
+        vector<pointer_t> files;
+        file_allocator->GetAllocatedBlocks(INODE_FILE_SIZE, files);
+        for(auto it : files){
+            if(job.file_ids.find(GetFileId(it)) == job.file_ids.end()){
+                file_allocator->Free(it, INODE_FILE_SIZE);
+                free_file_nums++;
+            }
+        }
+    }
+
+    char buf[1024];
+    snprintf(buf, sizeof(buf), "inode recover: threads:%u zones:%lu kv_nums:%lu files:%lu free_files:%lu nvm_nodes:%lu\n", \
+            thread_count, capacity_, job.kv_nums.load(), job.file_nums.load(), free_file_nums, job.nvm_node_nums.load());
+    stats.append(buf);
+}
+
+void InodeDB::ResumeRehash(){
+    for(uint64_t i = 0; i < capacity_; i++){
+        zones_[i].ResumeRehash();
+    }
+}
+
 } // namespace name
\ No newline at end of file
@@ -14,25 +14,40 @@
 #include "metadb/inode.h"
 #include "metadb/iterator.h"
 #include "inode_zone.h"
+#include "inode_cache.h"
 
 namespace metadb {
 
 class InodeDB {
 public:
     InodeDB(const Option &option, uint64_t capacity);
+    InodeDB(const Option &option, uint64_t capacity, pointer_t root);   //从NVM恢复，root是所有zone的NvmHashTableMeta数组
     virtual ~InodeDB();
 
     virtual int InodePut(const inode_id_t key, const Slice &value);
+    virtual int InodePut(const inode_id_t key, const Slice &value, uint32_t attr_size);
     virtual int InodeUpdate(const inode_id_t key, const Slice &new_value);
+    virtual int InodeUpdateRange(const inode_id_t key, uint32_t offset, const Slice &data);
     virtual int InodeGet(const inode_id_t key, std::string &value);
+    virtual int InodeGetAttr(const inode_id_t key, std::string &attr);
     virtual int InodeDelete(const inode_id_t key);
+    virtual void InodeMultiGet(const inode_id_t *keys, uint32_t num, std::string *values, int *rets);
 
     virtual void PrintInode();
     virtual void PrintInodeStats(std::string &stats);
+
+    pointer_t GetRoot() { return NODE_GET_OFFSET(metas_); }
+    void Recover(uint32_t thread_count, bool scan_nodes, std::string &stats);   //按zone分区，多线程恢复，scan_nodes时重建分配器位图
+    void ResumeRehash();
 private:
     const Option option_;
     InodeZone *zones_;
     uint64_t capacity_;
+    NvmHashTableMeta *metas_;   //NVM中每个zone的hashtable根
+    InodeCache *cache_;   //INODE_CACHE_CAPACITY为0时为nullptr
+    RateLimiter gc_limiter_;   //所有zone的后台回收共享
+
+    static void RecoverWork(void *arg);
 
     inline uint32_t hash_zone_id(const inode_id_t key);
 };
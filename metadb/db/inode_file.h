@@ -16,8 +16,32 @@
 
 namespace metadb {
 
-static const uint32_t NVM_INODE_FILE_CAPACITY = INODE_FILE_SIZE - 16;
 static const uint32_t NVM_INODE_FILE_HEADER_SIZE = 24;  //头部大小
+static const uint32_t NVM_INODE_FILE_CAPACITY = INODE_FILE_SIZE - NVM_INODE_FILE_HEADER_SIZE;   //保证不写到下一个文件的头部
+
+static inline uint64_t InodeFileKVSize(uint32_t value_len){   //一条kv在文件中占的空间：key|value_len|value
+    return sizeof(inode_id_t) + 4 + value_len;
+}
+
+//value_len的高三位是kv的标记，读长度时要去掉
+static const uint32_t INODE_KV_DELTA = 1U << 31;     //该kv是对前一个值的局部修改，value以InodeDeltaHeader开头
+static const uint32_t INODE_KV_CHAINED = 1U << 30;   //该kv已被之后写入的delta或属性kv引用，回收文件时要沿链判断是否仍有效
+static const uint32_t INODE_KV_ATTR = 1U << 29;      //该kv是值的属性部分，value以InodeAttrHeader开头，数据部分在另一条kv中
+static const uint32_t INODE_KV_LEN_MASK = INODE_KV_ATTR - 1;
+
+struct InodeDeltaHeader {   //delta的value开头，之后是修改的数据
+    pointer_t prev;        //被修改的前一个值，完整值或delta
+    uint32_t offset;       //修改的数据在完整值中的偏移
+    uint32_t value_size;   //完整值的大小，局部修改不改变大小
+    uint32_t depth;        //链上delta的个数，包括自己
+    uint32_t reserved;
+};
+
+struct InodeAttrHeader {   //属性kv的value开头，之后是属性
+    pointer_t data;        //数据部分的kv，数据为空时为INVALID_POINTER
+    uint32_t data_size;
+    uint32_t reserved;
+};
 
 class NVMInodeFile{
 public:
@@ -33,13 +57,14 @@ public:
         return NVM_INODE_FILE_CAPACITY - write_offset;
     }
 
-    int InsertKV(const inode_id_t key, const Slice &value, pointer_t &addr){
-        uint64_t len = sizeof(inode_id_t) + 4 + value.size();
+    int InsertKV(const inode_id_t key, const Slice &value, pointer_t &addr, uint32_t flags = 0){
+        uint64_t len = InodeFileKVSize(value.size());
         if(GetFreeSpace() < len) return -1;
         uint32_t value_len = value.size();
+        uint32_t len_and_flags = value_len | flags;
         char *buffer = new char[len];
         memcpy(buffer, &key, sizeof(inode_id_t));
-        memcpy(buffer + sizeof(inode_id_t), &value_len, 4);
+        memcpy(buffer + sizeof(inode_id_t), &len_and_flags, 4);
         memcpy(buffer + sizeof(inode_id_t) + 4, value.data(), value_len);
         SetBufPersist(write_offset, buffer, len);
         addr = FILE_GET_OFFSET(buf + write_offset);   //addr 是相对file_allocator的相对地址
@@ -49,11 +74,46 @@ public:
 
     int GetKV(uint64_t offset, std::string &value){  //offset是以该类为起始地址的偏移
         uint64_t buf_offset = offset - NVM_INODE_FILE_HEADER_SIZE;
-        uint32_t value_len = *reinterpret_cast<uint32_t *>(buf + buf_offset + sizeof(inode_id_t));
+        uint32_t value_len = *reinterpret_cast<uint32_t *>(buf + buf_offset + sizeof(inode_id_t)) & INODE_KV_LEN_MASK;
         value.assign(buf + buf_offset + sizeof(inode_id_t) + 4, value_len);
         return 0;
     }
 
+    uint32_t GetKVRef(uint64_t offset, Slice &value){   //不拷贝，value指向NVM，返回kv的标记
+        uint64_t buf_offset = offset - NVM_INODE_FILE_HEADER_SIZE;
+        uint32_t len_and_flags = *reinterpret_cast<volatile uint32_t *>(buf + buf_offset + sizeof(inode_id_t));
+        value = Slice(buf + buf_offset + sizeof(inode_id_t) + 4, len_and_flags & INODE_KV_LEN_MASK);
+        return len_and_flags & ~INODE_KV_LEN_MASK;
+    }
+
+    uint32_t GetKVFlags(uint64_t offset){
+        uint64_t buf_offset = offset - NVM_INODE_FILE_HEADER_SIZE;
+        return *reinterpret_cast<volatile uint32_t *>(buf + buf_offset + sizeof(inode_id_t)) & ~INODE_KV_LEN_MASK;
+    }
+
+    void SetKVChainedPersist(uint64_t offset){   //4字节对齐的原子写，之后再让delta可见
+        uint64_t buf_offset = offset - NVM_INODE_FILE_HEADER_SIZE;
+        uint32_t *len_and_flags = reinterpret_cast<uint32_t *>(buf + buf_offset + sizeof(inode_id_t));
+        __atomic_fetch_or(len_and_flags, INODE_KV_CHAINED, __ATOMIC_RELEASE);
+        file_allocator->nvm_persist(len_and_flags, 4);
+    }
+
+    void PrefetchKV(uint64_t offset){   //预取GetKV要读的kv开头部分
+        const char *addr = buf + offset - NVM_INODE_FILE_HEADER_SIZE;
+        for(uint32_t i = 0; i < INODE_PREFETCH_VALUE_SIZE; i += CACHE_LINE_SIZE){
+            __builtin_prefetch(addr + i, 0, 3);
+        }
+    }
+
+    uint64_t GetKVByBufOffset(uint64_t buf_offset, inode_id_t &key, Slice &value, uint32_t &flags){  //按写入顺序遍历用，返回该kv占的空间
+        memcpy(&key, buf + buf_offset, sizeof(inode_id_t));
+        uint32_t len_and_flags = *reinterpret_cast<volatile uint32_t *>(buf + buf_offset + sizeof(inode_id_t));
+        uint32_t value_len = len_and_flags & INODE_KV_LEN_MASK;
+        flags = len_and_flags & ~INODE_KV_LEN_MASK;
+        value = Slice(buf + buf_offset + sizeof(inode_id_t) + 4, value_len);
+        return InodeFileKVSize(value_len);
+    }
+
     void SetNumAndWriteOffsetPersist(uint64_t new_num, uint64_t new_write_offset){
         char buffer[16];
         memcpy(buffer, &new_num, 8);
@@ -84,6 +144,10 @@ static inline uint64_t GetFileOffset(pointer_t addr){   //以INODE_FILE_SIZE划
     return addr % INODE_FILE_SIZE;
 }
 
+static inline NVMInodeFile *GetFileByAddr(pointer_t addr){   //文件按INODE_FILE_SIZE对齐分配，不查files_；调用者保证文件未被释放
+    return static_cast<NVMInodeFile *>(FILE_GET_POINTER(GetFileId(addr) * INODE_FILE_SIZE));
+}
+
 } // namespace name
 
 
@@ -43,10 +43,13 @@ static inline bool slot_get_index(uint16_t slot, uint16_t index){
 void HashEntryLinkSearchKey(InodeHashEntrySearchResult &res, pointer_t root, const inode_id_t key){
     pointer_t cur = root;
     NvmInodeHashEntryNode *cur_node;
+    uint8_t fp = fingerprint_u64(key);
     while(!IS_INVALID_POINTER(cur)) {
         cur_node = static_cast<NvmInodeHashEntryNode *>(NODE_GET_POINTER(cur));
-        for(uint16_t i = 0; i < INODE_HASH_ENTRY_NODE_CAPACITY; i++){
-            if(!slot_get_index(cur_node->slot, i)) continue;
+        uint16_t candidate = cur_node->GetCandidateSlot(fp);   //只比较指纹相同的entry
+        while(candidate != 0){
+            uint16_t i = __builtin_ctz(candidate);
+            candidate &= candidate - 1;
             if(compare_inode_id(cur_node->entry[i].key, key) == 0){
                 res.key_find = true;
                 res.index = i;
@@ -106,6 +109,7 @@ int InodeHashEntryLinkInsert(InodeHashEntryLinkOp &op, const inode_id_t key, con
     uint16_t index;
     FindFreeSpaceOrCreatEntry(op, insert, index);
     NvmInodeHashEntryNode *insert_node = static_cast<NvmInodeHashEntryNode *>(NODE_GET_POINTER(insert));
+    insert_node->SetFingerprintNodrain(index, fingerprint_u64(key));
     insert_node->SetEntryPersistByIndex(index, key,value);
     uint16_t slot = slot_set_index(insert_node->slot, index);
     insert_node->SetNumAndSlotPersist(insert_node->num + 1, slot);
@@ -122,6 +126,7 @@ int InodeHashEntryLinkOnlyInsert(InodeHashEntryLinkOp &op, const inode_id_t key,
     uint16_t index;
     FindFreeSpaceOrCreatEntry(op, insert, index);
     NvmInodeHashEntryNode *insert_node = static_cast<NvmInodeHashEntryNode *>(NODE_GET_POINTER(insert));
+    insert_node->SetFingerprintNodrain(index, fingerprint_u64(key));
     insert_node->SetEntryPersistByIndex(index, key, value);
     uint16_t slot = slot_set_index(insert_node->slot, index);
     insert_node->SetNumAndSlotPersist(insert_node->num + 1, slot);
@@ -140,6 +145,18 @@ int InodeHashEntryLinkUpdate(InodeHashEntryLinkOp &op, const inode_id_t key, con
     return 2; //不存在，无法修改
 }
 
+int InodeHashEntryLinkCompareAndSwap(InodeHashEntryLinkOp &op, const inode_id_t key, const pointer_t expected, const pointer_t new_value){
+    InodeHashEntrySearchResult res;
+    HashEntryLinkSearchKey(res, op.root, key);
+    if(res.key_find){
+        NvmInodeHashEntryNode *node = static_cast<NvmInodeHashEntryNode *>(NODE_GET_POINTER(res.node));
+        if(node->entry[res.index].pointer != expected) return 2;   //已被更新
+        node->SetEntryPointerPersist(res.index, new_value);
+        return 0;
+    }
+    return 2;  //key不存在
+}
+
 int InodeHashEntryLinkGet(pointer_t root, const inode_id_t key, pointer_t &value){
     InodeHashEntrySearchResult res;
     HashEntryLinkSearchKey(res, root, key);
@@ -183,20 +200,31 @@ int InodeHashEntryLinkDelete(InodeHashEntryLinkOp &op, const inode_id_t key, poi
 
 ////
 
-InodeHashTable::InodeHashTable(const Option &option, InodeZone *inode_zone) : option_(option), inode_zone_(inode_zone) {
+InodeHashTable::InodeHashTable(const Option &option, InodeZone *inode_zone, NvmHashTableMeta *meta, bool is_recover) 
+        : option_(option), inode_zone_(inode_zone), meta_(meta) {
     is_rehash_ = false;
     version_ = nullptr;
     rehash_version_ = nullptr;
 
+    if(is_recover){
+        version_ = new InodeHashVersion(meta_->capacity, static_cast<NvmInodeHashEntry *>(NODE_GET_POINTER(meta_->buckets)));
+        if(meta_->IsRehash()){  //rehash中途退出，两个版本都恢复
+            rehash_version_ = new InodeHashVersion(meta_->rehash_capacity, static_cast<NvmInodeHashEntry *>(NODE_GET_POINTER(meta_->rehash_buckets)));
+            is_rehash_ = true;
+        }
+        DBG_LOG("inode:%u recover hashtable:%p version:%p capacity:%lu rehash_version:%p", inode_zone_->get_zone_id(), this, version_, version_->capacity_, rehash_version_);
+        return ;
+    }
     //init
     version_ = new InodeHashVersion(option_.INODE_HASHTABLE_INIT_SIZE);
-    version_->Ref();
+    meta_->SetRehashVersionPersist(INVALID_POINTER, 0);
+    meta_->SetVersionPersist(NODE_GET_OFFSET(version_->buckets_), version_->capacity_);
     DBG_LOG("inode:%u create hashtable:%p version:%p capacity:%lu", inode_zone_->get_zone_id(), this, version_, option_.INODE_HASHTABLE_INIT_SIZE);
 }
 
-InodeHashTable::~InodeHashTable(){
-    if(version_) version_->Unref();
-    if(rehash_version_) rehash_version_->Unref();
+InodeHashTable::~InodeHashTable(){   //退出时已没有操作，直接删除
+    if(version_) delete version_;
+    if(rehash_version_) delete rehash_version_;
 }
 
 inline uint32_t InodeHashTable::hash_id(const inode_id_t key, const uint64_t capacity){
@@ -213,8 +241,17 @@ inline bool InodeHashTable::NeedRehash(InodeHashVersion *version){
 
 void InodeHashTable::HashEntryDealWithOp(InodeHashVersion *version, uint32_t index, InodeHashEntryLinkOp &op){
     NvmInodeHashEntry *entry = &(version->buckets_[index]);
+    //新root和待释放的节点一起写入redo日志，crash后不会出现root已更新但旧节点未释放
+    NodeLogOp log_op;
     if(op.res != entry->root) {
-        entry->SetRootPersist(op.res);
+        log_op.target = &(entry->root);
+        log_op.value = op.res;
+    }
+    for(auto it : op.del_list) {
+        log_op.free_nodes.push_back(make_pair(it, static_cast<uint64_t>(INODE_HASH_ENTRY_SIZE)));
+    }
+    if(log_op.target != nullptr || !log_op.free_nodes.empty()) {
+        node_allocator->CommitWithLog(log_op);
     }
     uint32_t add_num = op.add_list.size();
     uint32_t del_num = op.del_list.size();
@@ -226,12 +263,6 @@ void InodeHashTable::HashEntryDealWithOp(InodeHashVersion *version, uint32_t ind
         version->node_num_.fetch_sub(del_num - add_num);
     }
 
-    if(!op.del_list.empty()) {  //后续最好原子记录一次操作的所有申请和删除的节点，作为空间管理日志
-        for(auto it : op.del_list) {
-            node_allocator->Free(it, INODE_HASH_ENTRY_SIZE);
-        }
-    }
-
     if(NeedRehash(version)){
         //rehash
         DBG_LOG("[inode] add rehash job, version:%p node_num:%lu", version, version->node_num_.load());
@@ -240,162 +271,264 @@ void InodeHashTable::HashEntryDealWithOp(InodeHashVersion *version, uint32_t ind
     
 }
 
-void InodeHashTable::GetVersionAndRefByWrite(bool &is_rehash, InodeHashVersion **version){
-    MutexLock lock(&version_lock_);
-    if(is_rehash_){
-        is_rehash = true;
-        *version = rehash_version_;
-        rehash_version_->Ref();
-    }
-    else {
-        is_rehash = false;
+uint32_t InodeHashTable::GetVersion(bool &is_rehash, InodeHashVersion **version, InodeHashVersion **rehash_version){
+    //不加version_lock_也不修改引用计数，没有rehash时操作不写任何共享变量
+    while(true){
+        uint32_t seq = version_seq_.ReadBegin();
+        is_rehash = is_rehash_;
         *version = version_;
-        version_->Ref();
+        *rehash_version = rehash_version_;
+        if(!version_seq_.ReadRetry(seq)) return seq;
     }
 }
 
-void InodeHashTable::GetVersionAndRef(bool &is_rehash, InodeHashVersion **version, InodeHashVersion **rehash_version){
-    MutexLock lock(&version_lock_);
-    if(is_rehash_){
-        is_rehash = true;
-        *version = version_;
-        version_->Ref();
-        *rehash_version = rehash_version_;
-        rehash_version_->Ref();
-    }
-    else {
-        is_rehash = false;
-        *version = version_;
-        version_->Ref();
+bool InodeHashTable::LockEntryForWrite(InodeHashVersion *version, uint32_t index, uint32_t seq){
+    //获取版本后rehash可能已开始并迁移了该entry，加锁后再检查，避免写入已迁移的旧版本
+    version->rwlock_[index].WriteLock();
+    if(version_seq_.ReadRetry(seq)){
+        version->rwlock_[index].Unlock();
+        return false;
     }
+    version->seqlock_[index].WriteBegin();
+    return true;
 }
 
-int InodeHashTable::HashEntryInsertKV(InodeHashVersion *version, uint32_t index, const inode_id_t key, const pointer_t value, pointer_t &old_value){
-    version->rwlock_[index].WriteLock();
+int InodeHashTable::HashEntryInsertKV(InodeHashVersion *version, uint32_t index, const inode_id_t key, const pointer_t value, pointer_t &old_value, uint32_t seq){
+    if(!LockEntryForWrite(version, index, seq)) return HASH_VERSION_CHANGED;
     NvmInodeHashEntry *entry = &(version->buckets_[index]);
     InodeHashEntryLinkOp op;
     op.root = entry->root;
     op.res = entry->root;
     int res = InodeHashEntryLinkInsert(op, key, value, old_value);
     HashEntryDealWithOp(version, index, op);
-    version->rwlock_[index].Unlock();
+    version->WriteUnlockEntry(index);
     return res;
 
 }
 
 int InodeHashTable::HashEntryOnlyInsertKV(InodeHashVersion *version, uint32_t index, const inode_id_t key, const pointer_t value){
-    version->rwlock_[index].WriteLock();
+    version->WriteLockEntry(index);
     NvmInodeHashEntry *entry = &(version->buckets_[index]);
     InodeHashEntryLinkOp op;
     op.root = entry->root;
     op.res = entry->root;
     int res = InodeHashEntryLinkOnlyInsert(op, key, value);
     if(res == 0) HashEntryDealWithOp(version, index, op);
-    version->rwlock_[index].Unlock();
+    version->WriteUnlockEntry(index);
     return res;
 }
 
-int InodeHashTable::HashEntryUpdateKV(InodeHashVersion *version, uint32_t index, const inode_id_t key, const pointer_t new_value, pointer_t &old_value){
-    version->rwlock_[index].WriteLock();
+int InodeHashTable::HashEntryUpdateKV(InodeHashVersion *version, uint32_t index, const inode_id_t key, const pointer_t new_value, pointer_t &old_value, uint32_t seq){
+    if(!LockEntryForWrite(version, index, seq)) return HASH_VERSION_CHANGED;
     NvmInodeHashEntry *entry = &(version->buckets_[index]);
     InodeHashEntryLinkOp op;
     op.root = entry->root;
     op.res = entry->root;
     int res = InodeHashEntryLinkUpdate(op, key, new_value, old_value);
     if(res == 0) HashEntryDealWithOp(version, index, op);
-    version->rwlock_[index].Unlock();
+    version->WriteUnlockEntry(index);
     return res;
 }
 
 int InodeHashTable::HashEntryGetKV(InodeHashVersion *version, uint32_t index, const inode_id_t key, pointer_t &value){
-    //version->rwlock_[index].ReadLock();  //可以不加读锁，因为都是MVCC控制，但是不加锁，什么时候删除垃圾节点是一个问题，延时删除可行或引用计数，
-                                                //暂时简单处理，由于空间分配是往后分配，提前删除没有影响；
+    //不加读锁，调用者在EpochGuard内，摘除的节点在读者离开前不会被重新分配；
+    //节点内的槽位是原地复用的，读的过程中entry被修改则重读，避免读到旧key和新pointer
+    NvmInodeHashEntry *entry = &(version->buckets_[index]);
+    while(true){
+        uint32_t seq = version->seqlock_[index].ReadBegin();
+        pointer_t temp_value;
+        int res =  InodeHashEntryLinkGet(entry->root, key, temp_value);
+        if(version->seqlock_[index].ReadRetry(seq)) continue;
+        if(res == 0) value = temp_value;
+        return res;
+    }
+}
+
+int InodeHashTable::HashEntryCompareAndSwapKV(InodeHashVersion *version, uint32_t index, const inode_id_t key, const pointer_t expected, const pointer_t new_value, uint32_t seq){
+    if(!LockEntryForWrite(version, index, seq)) return HASH_VERSION_CHANGED;
     NvmInodeHashEntry *entry = &(version->buckets_[index]);
-    int res =  InodeHashEntryLinkGet(entry->root, key, value);
-    //version->rwlock_[index].Unlock();
+    InodeHashEntryLinkOp op;
+    op.root = entry->root;
+    op.res = entry->root;
+    int res = InodeHashEntryLinkCompareAndSwap(op, key, expected, new_value);
+    version->WriteUnlockEntry(index);
     return res;
 }
 
-int InodeHashTable::HashEntryDeleteKV(InodeHashVersion *version, uint32_t index, const inode_id_t key, pointer_t &value){
-    version->rwlock_[index].WriteLock();
+int InodeHashTable::HashEntryDeleteKV(InodeHashVersion *version, uint32_t index, const inode_id_t key, pointer_t &value, uint32_t seq){
+    if(!LockEntryForWrite(version, index, seq)) return HASH_VERSION_CHANGED;
     NvmInodeHashEntry *entry = &(version->buckets_[index]);
     InodeHashEntryLinkOp op;
     op.root = entry->root;
     op.res = entry->root;
     int res = InodeHashEntryLinkDelete(op, key, value);
     if(res == 0) HashEntryDealWithOp(version, index, op);
-    version->rwlock_[index].Unlock();
+    version->WriteUnlockEntry(index);
     return res;
 }
 
 int InodeHashTable::Put(const inode_id_t key, const pointer_t value, pointer_t &old_value){
+    EpochGuard guard;   //保证操作期间版本不被删除
     bool is_rehash = false;
     InodeHashVersion *version;
-    GetVersionAndRefByWrite(is_rehash, &version);
-    uint32_t index = hash_id(key, version->capacity_);
+    InodeHashVersion *rehash_version;
+    while(true){
+        uint32_t seq = GetVersion(is_rehash, &version, &rehash_version);
+        if(is_rehash) version = rehash_version;   //正在rehash，写入rehash版本
+        uint32_t index = hash_id(key, version->capacity_);
 
-    int res = HashEntryInsertKV(version, index, key, value, old_value);
-    
-    version->Unref();
-    return res;
+        int res = HashEntryInsertKV(version, index, key, value, old_value, seq);
+        if(res == HASH_VERSION_CHANGED) continue;
+        return res;
+    }
 }
 
 int InodeHashTable::Get(const inode_id_t key, pointer_t &value){
+    EpochGuard guard;   //读者不加锁，读到的节点和版本在离开前不会被回收
     bool is_rehash = false;
     InodeHashVersion *version;
     InodeHashVersion *rehash_version;
-    GetVersionAndRef(is_rehash, &version, &rehash_version);
+    while(true){
+        uint32_t seq = GetVersion(is_rehash, &version, &rehash_version);
 
-    pointer_t value1;
-    uint32_t index1 = hash_id(key, version->capacity_);
-    int res1 = HashEntryGetKV(version, index1, key, value1);
-    version->Unref();
-    
-    //两个版本都查找，如果rehash版本找到，则优先返回rehash版本；
-    if(is_rehash){  //正在rehash，在rehash_version也查找
-        pointer_t value2;
-        uint32_t index2 = hash_id(key, rehash_version->capacity_);
-        int res2 = HashEntryGetKV(rehash_version, index2, key, value2);
-        rehash_version->Unref();
-        if(res2 == 0) {  //res == 0,意味着找到
-            value = value2;
-            return res2;
+        pointer_t value1;
+        uint32_t index1 = hash_id(key, version->capacity_);
+        int res1 = HashEntryGetKV(version, index1, key, value1);
+        
+        //两个版本都查找，如果rehash版本找到，则优先返回rehash版本；
+        if(is_rehash){  //正在rehash，在rehash_version也查找
+            pointer_t value2;
+            uint32_t index2 = hash_id(key, rehash_version->capacity_);
+            int res2 = HashEntryGetKV(rehash_version, index2, key, value2);
+            if(res2 == 0) {  //res == 0,意味着找到
+                value = value2;
+                return res2;
+            }
+        }
+        if(res1 == 0){
+            value = value1;
+            return res1;
         }
+        if(version_seq_.ReadRetry(seq)) continue;   //查找期间rehash结束，kv可能已只在新版本中
+        return res1;   
+    }
+}
+
+static inline void PrefetchHashEntry(NvmInodeHashEntry *entry, bool node){
+    if(!node){
+        __builtin_prefetch(entry, 0, 3);
+        return;
     }
-    if(res1 == 0){
-        value = value1;
+    pointer_t root = entry->root;
+    if(IS_INVALID_POINTER(root)) return;
+    char *addr = static_cast<char *>(NODE_GET_POINTER(root));
+    for(uint32_t i = 0; i < INODE_HASH_ENTRY_SIZE; i += CACHE_LINE_SIZE){
+        __builtin_prefetch(addr + i, 0, 3);
+    }
+}
+
+void InodeHashTable::Prefetch(const inode_id_t key, bool node){
+    //只是提示，不检查版本是否切换，预取到旧版本只是浪费一次访存
+    bool is_rehash = false;
+    InodeHashVersion *version;
+    InodeHashVersion *rehash_version;
+    GetVersion(is_rehash, &version, &rehash_version);
+    PrefetchHashEntry(&(version->buckets_[hash_id(key, version->capacity_)]), node);
+    if(is_rehash){
+        PrefetchHashEntry(&(rehash_version->buckets_[hash_id(key, rehash_version->capacity_)]), node);
     }
-    return res1;   
 }
 
 int InodeHashTable::Update(const inode_id_t key, const pointer_t new_value, pointer_t &old_value){
+    EpochGuard guard;   //保证操作期间版本不被删除
     bool is_rehash = false;
     InodeHashVersion *version;
-    GetVersionAndRefByWrite(is_rehash, &version);
-    uint32_t index = hash_id(key, version->capacity_);
-    
-    int res = HashEntryInsertKV(version, index, key, new_value, old_value);
-    
-    version->Unref();
-    return res;
+    InodeHashVersion *rehash_version;
+    while(true){
+        uint32_t seq = GetVersion(is_rehash, &version, &rehash_version);
+        if(is_rehash) version = rehash_version;
+        uint32_t index = hash_id(key, version->capacity_);
+        
+        int res = HashEntryInsertKV(version, index, key, new_value, old_value, seq);
+        if(res == HASH_VERSION_CHANGED) continue;
+        return res;
+    }
 }
 
 int InodeHashTable::Delete(const inode_id_t key, pointer_t &value1, pointer_t &value2){
+    EpochGuard guard;   //保证操作期间版本不被删除
     bool is_rehash = false;
     InodeHashVersion *version;
     InodeHashVersion *rehash_version;
-    GetVersionAndRef(is_rehash, &version, &rehash_version);  //只是为了获取两个版本
-
-    uint32_t index = hash_id(key, version->capacity_);
-    int res1 = HashEntryDeleteKV(version, index, key, value1);
-    version->Unref();
+    int res1 = 2;
     int res2 = 2;
-    if(is_rehash) { //正在rehash，先在version删除，再在rehash_version中删除
-        uint32_t index = hash_id(key, rehash_version->capacity_);
-        res2 = HashEntryDeleteKV(rehash_version, index, key, value2);
-        rehash_version->Unref();
+    while(true){   //版本切换时重做，已删除的值保留在value1/value2中
+        uint32_t seq = GetVersion(is_rehash, &version, &rehash_version);
+
+        pointer_t value;
+        uint32_t index = hash_id(key, version->capacity_);
+        int res = HashEntryDeleteKV(version, index, key, value, seq);
+        if(res == HASH_VERSION_CHANGED) continue;
+        if(res == 0){
+            res1 = 0;
+            value1 = value;
+        }
+        if(is_rehash) { //正在rehash，先在version删除，再在rehash_version中删除
+            uint32_t index = hash_id(key, rehash_version->capacity_);
+            res = HashEntryDeleteKV(rehash_version, index, key, value, seq);
+            if(res == HASH_VERSION_CHANGED) continue;
+            if(res == 0){
+                res2 = 0;
+                value2 = value;
+            }
+        }
+        return res1 & res2;  //有一个为0则为0
+    }
+}
+
+bool InodeHashTable::HasValue(const inode_id_t key, const pointer_t value){
+    EpochGuard guard;
+    bool is_rehash = false;
+    InodeHashVersion *version;
+    InodeHashVersion *rehash_version;
+    while(true){
+        uint32_t seq = GetVersion(is_rehash, &version, &rehash_version);
+        //先查旧版本再查rehash版本，两次查找之间被迁移的值一定能在rehash版本中找到
+        pointer_t value1;
+        uint32_t index1 = hash_id(key, version->capacity_);
+        if(HashEntryGetKV(version, index1, key, value1) == 0 && value1 == value) return true;
+        if(is_rehash){
+            pointer_t value2;
+            uint32_t index2 = hash_id(key, rehash_version->capacity_);
+            if(HashEntryGetKV(rehash_version, index2, key, value2) == 0 && value2 == value) return true;
+        }
+        if(version_seq_.ReadRetry(seq)) continue;   //查找期间版本切换，重查
+        return false;
+    }
+}
+
+int InodeHashTable::CompareAndSwap(const inode_id_t key, const pointer_t expected, const pointer_t new_value){
+    EpochGuard guard;   //保证操作期间版本不被删除
+    bool is_rehash = false;
+    InodeHashVersion *version;
+    InodeHashVersion *rehash_version;
+    bool swapped = false;
+    while(true){   //版本切换时重做，已修改的entry不会再等于expected
+        uint32_t seq = GetVersion(is_rehash, &version, &rehash_version);
+
+        //和HasValue一样先改旧版本，迁移中的值要么已带着new_value迁移，要么在rehash版本中能找到
+        uint32_t index = hash_id(key, version->capacity_);
+        int res = HashEntryCompareAndSwapKV(version, index, key, expected, new_value, seq);
+        if(res == HASH_VERSION_CHANGED) continue;
+        if(res == 0) swapped = true;
+        if(is_rehash){   //恢复后继续的rehash中，同一个值可能同时在两个版本中
+            uint32_t index = hash_id(key, rehash_version->capacity_);
+            res = HashEntryCompareAndSwapKV(rehash_version, index, key, expected, new_value, seq);
+            if(res == HASH_VERSION_CHANGED) continue;
+            if(res == 0) swapped = true;
+        }
+        return swapped ? 0 : 2;
     }
-    return res1 & res2;  //有一个为0则为0
 }
 
 void InodeHashTable::BackgroundRehashWrapper(void *arg){
@@ -408,12 +541,20 @@ void InodeHashTable::BackgroundRehash(){
         version_lock_.Unlock();
         return ;
     }
+    version_seq_.WriteBegin();
     rehash_version_ = new InodeHashVersion(version_->capacity_ * 2);
-    version_->Ref();
-    rehash_version_->Ref();
+    meta_->SetRehashVersionPersist(NODE_GET_OFFSET(rehash_version_->buckets_), rehash_version_->capacity_);
     is_rehash_ = true;
+    version_seq_.WriteEnd();
     version_lock_.Unlock();
+    RehashMoveWork();
+}
 
+void InodeHashTable::ResumeRehashWrapper(void *arg){
+    reinterpret_cast<InodeHashTable *>(arg)->RehashMoveWork();
+}
+
+void InodeHashTable::RehashMoveWork(){
     DBG_LOG("[inode] second hash rehash start, version:%p rehash_version:%p", version_, rehash_version_);
 
     //开始逐步迁移数据到rehash_version_中
@@ -424,14 +565,18 @@ void InodeHashTable::BackgroundRehash(){
     //迁移完
     DBG_LOG("[inode] second hash rehash end, version:%p rehash_version:%p", version_, rehash_version_);
     version_lock_.Lock();
+    version_seq_.WriteBegin();
     InodeHashVersion *old_version = version_;
     version_ = rehash_version_;
     rehash_version_ = nullptr;
     is_rehash_ = false;
+    meta_->SetVersionPersist(NODE_GET_OFFSET(version_->buckets_), version_->capacity_);
+    meta_->SetRehashVersionPersist(INVALID_POINTER, 0);
+    version_seq_.WriteEnd();
     version_lock_.Unlock();
 
-    old_version->Unref();   //解除本函数的调用
-    old_version->Unref();   //删除旧version
+    old_version->FreeNvmSpace();   //旧buckets已不在meta中
+    epoch_manager->Retire(&InodeHashVersion::DeleteVersion, old_version, 0);   //还有操作可能持有旧version，离开后再删除
     
 }
 
@@ -454,19 +599,72 @@ void InodeHashTable::MoveEntryToRehash(InodeHashVersion *version, uint32_t index
             key_index = hash_id(key, rehash_version->capacity_);
             res = HashEntryOnlyInsertKV(rehash_version, key_index, key, value);
             if(res == 2){  //说明新插入了相同key，旧value废弃
-                inode_zone_->DeleteFlie(value);
+                pointer_t now_value = INVALID_POINTER;
+                {
+                    EpochGuard guard;   //rehash_version的entry没有加锁
+                    HashEntryGetKV(rehash_version, key_index, key, now_value);
+                }
+                if(now_value != value) {   //恢复后继续rehash时，可能是上次已迁移的同一value
+                    inode_zone_->DeleteValue(value);
+                }
             }
 
         }
         free_list.push_back(cur);
         cur = cur_node->next;
     }
+    version->seqlock_[index].WriteBegin();   //迁移期间旧链没有修改，只有清空entry时读者需要重读
     entry->SetRootPersist(INVALID_POINTER);  //旧version的entry变为空
+    version->seqlock_[index].WriteEnd();
     version->rwlock_[index].Unlock();
 
     for(auto it : free_list) {
-        node_allocator->Free(it, INODE_HASH_ENTRY_SIZE);
+        node_allocator->Retire(it, INODE_HASH_ENTRY_SIZE);
+    }
+}
+
+uint64_t InodeHashTable::RecoverVersion(InodeHashVersion *version, InodeHashVersion *dedup_version, vector<pair<pointer_t, uint64_t>> *nodes, map<uint64_t, uint64_t> &file_kv_nums){
+    if(nodes != nullptr) nodes->push_back(make_pair(NODE_GET_OFFSET(version->buckets_), sizeof(NvmInodeHashEntry) * version->capacity_));
+    uint64_t kv_nums = 0;
+    uint64_t node_nums = 0;
+    for(uint32_t i = 0; i < version->capacity_; i++){
+        pointer_t cur = version->buckets_[i].root;
+        NvmInodeHashEntryNode *cur_node;
+        while(!IS_INVALID_POINTER(cur)) {
+            cur_node = static_cast<NvmInodeHashEntryNode *>(NODE_GET_POINTER(cur));
+            for(uint16_t j = 0; j < INODE_HASH_ENTRY_NODE_CAPACITY; j++){
+                if(!slot_get_index(cur_node->slot, j)) continue;
+                if(dedup_version != nullptr){  //rehash中途退出，同一个value可能同时在两个版本中
+                    pointer_t value;
+                    inode_id_t key = cur_node->entry[j].key;
+                    if(HashEntryGetKV(dedup_version, hash_id(key, dedup_version->capacity_), key, value) == 0 && value == cur_node->entry[j].pointer){
+                        continue;
+                    }
+                }
+                InodeZone::CountValue(cur_node->entry[j].pointer, file_kv_nums);   //delta链上的kv都有效
+                kv_nums++;
+            }
+            if(nodes != nullptr) nodes->push_back(make_pair(cur, static_cast<uint64_t>(INODE_HASH_ENTRY_SIZE)));
+            node_nums++;
+            cur = cur_node->next;
+        }
     }
+    version->node_num_.store(node_nums);
+    return kv_nums;
+}
+
+uint64_t InodeHashTable::Recover(vector<pair<pointer_t, uint64_t>> *nodes, map<uint64_t, uint64_t> &file_kv_nums){
+    uint64_t kv_nums = RecoverVersion(version_, nullptr, nodes, file_kv_nums);
+    if(is_rehash_){
+        kv_nums += RecoverVersion(rehash_version_, version_, nodes, file_kv_nums);
+    }
+    return kv_nums;
+}
+
+void InodeHashTable::ResumeRehash(){
+    if(!is_rehash_) return ;
+    DBG_LOG("[inode] resume rehash, hashtable:%p version:%p rehash_version:%p", this, version_, rehash_version_);
+    thread_pool->Schedule(&InodeHashTable::ResumeRehashWrapper, this);
 }
 
 string PrintSlot(uint16_t slot, uint16_t num){
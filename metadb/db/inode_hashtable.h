@@ -10,6 +10,7 @@
 #include <string>
 #include <atomic>
 #include <vector>
+#include <map>
 
 
 #include "metadb/option.h"
@@ -19,8 +20,12 @@
 #include "format.h"
 #include "../util/rwlock.h"
 #include "../util/lock.h"
+#include "../util/seqlock.h"
+#include "../util/fingerprint.h"
 #include "nvm_node_allocator.h"
 #include "thread_pool.h"
+#include "epoch_manager.h"
+#include "super_block.h"
 
 using namespace std;
 
@@ -38,12 +43,12 @@ struct InodeKeyPointer{
 };
 
 static const uint32_t INODE_HASH_ENTRY_NODE_CAPACITY = (INODE_HASH_ENTRY_SIZE - 32) / sizeof(InodeKeyPointer);
+static const uint32_t INODE_HASH_FINGERPRINT_NUM = 12;   //节点头中原padding的12个字节，只能存前12个entry的指纹
 
 struct NvmInodeHashEntryNode {       //无序存储key
     uint16_t num;
     uint16_t slot;   //从低位开始，1标志存在key
-    uint32_t padding;  //暂时没用
-    uint64_t padding2;  //暂时没用
+    uint8_t fingerprint[INODE_HASH_FINGERPRINT_NUM];  //前12个entry的key指纹，和num、slot在同一个16字节内，一次SIMD比较
     pointer_t prev;    //
     pointer_t next;
     InodeKeyPointer entry[INODE_HASH_ENTRY_NODE_CAPACITY];
@@ -53,6 +58,15 @@ struct NvmInodeHashEntryNode {       //无序存储key
     uint32_t GetFreeSpace() {
         return INODE_HASH_ENTRY_NODE_CAPACITY - num;
     }
+    uint16_t GetCandidateSlot(uint8_t fp) const {   //可能等于key的entry，其余entry不用读key所在的cache line
+        uint32_t mask = fingerprint_match16(this, fp) >> 4;   //跳过num和slot的4个字节
+        mask |= ~((1U << INODE_HASH_FINGERPRINT_NUM) - 1);   //没有指纹的entry都要比较
+        return static_cast<uint16_t>(mask & slot);
+    }
+    void SetFingerprintNodrain(uint32_t index, uint8_t fp){   //在slot置位之前写入
+        if(index >= INODE_HASH_FINGERPRINT_NUM) return ;
+        node_allocator->nvm_memcpy_nodrain(&(fingerprint[index]), &fp, 1);
+    }
     void Flush(){
         node_allocator->nvm_persist(this, sizeof(NvmInodeHashEntryNode));
     }
@@ -116,37 +130,48 @@ struct NvmInodeHashEntry {
 struct InodeHashVersion {
 public:
     NvmInodeHashEntry *buckets_;  //连续数组
-    RWLock *rwlock_;  //连续读写锁
+    RWLock *rwlock_;  //连续读写锁，只有写者使用
+    SeqLock *seqlock_;   //每个entry的修改序号，读者不加锁，序号变化则重读
     uint64_t capacity_;
     atomic<uint64_t> node_num_;   //LinkNode num
-    atomic<uint32_t> refs_;
 
     InodeHashVersion(uint64_t capacity) {
         capacity_ = capacity;
         rwlock_ = new RWLock[capacity];
+        seqlock_ = new SeqLock[capacity];
         buckets_ = static_cast<NvmInodeHashEntry *>(node_allocator->AllocateAndInit(sizeof(NvmInodeHashEntry) * capacity, 0));
         node_num_.store(0);
-        refs_.store(0);
+    }
+
+    InodeHashVersion(uint64_t capacity, NvmInodeHashEntry *buckets) {   //恢复时使用NVM中已有的buckets
+        capacity_ = capacity;
+        rwlock_ = new RWLock[capacity];
+        seqlock_ = new SeqLock[capacity];
+        buckets_ = buckets;
+        node_num_.store(0);
     }
 
     virtual ~InodeHashVersion() {
         delete[] rwlock_;
+        delete[] seqlock_;
+    }
+
+    void FreeNvmSpace(){   //读者可能还在读buckets_，DRAM中延迟回收
+        node_allocator->Retire(buckets_, sizeof(NvmInodeHashEntry) * capacity_);
     }
 
-    void FreeNvmSpace(){
-        node_allocator->Free(buckets_, sizeof(NvmInodeHashEntry) * capacity_);
+    void WriteLockEntry(uint32_t index){   //写者修改entry期间读者会重读
+        rwlock_[index].WriteLock();
+        seqlock_[index].WriteBegin();
     }
 
-    void Ref() {
-        refs_.fetch_add(1);
+    void WriteUnlockEntry(uint32_t index){
+        seqlock_[index].WriteEnd();
+        rwlock_[index].Unlock();
     }
 
-    void Unref() {
-        refs_.fetch_sub(1);
-        
-        if(refs_.load() == 0){
-            delete this;
-        }
+    static void DeleteVersion(void *arg, uint64_t unused){   //rehash结束后由epoch_manager在所有操作离开后调用
+        delete static_cast<InodeHashVersion *>(arg);
     }
 };
 
@@ -164,41 +189,60 @@ struct InodeHashEntryLinkOp{
 
 class InodeHashTable {
 public:
-    InodeHashTable(const Option &option, InodeZone *inode_zone);
+    InodeHashTable(const Option &option, InodeZone *inode_zone, NvmHashTableMeta *meta, bool is_recover);   //is_recover为true时从meta恢复
     virtual ~InodeHashTable();
 
     virtual int Put(const inode_id_t key, const pointer_t value, pointer_t &old_value);
     virtual int Get(const inode_id_t key, pointer_t &value);
     virtual int Update(const inode_id_t key, const pointer_t new_value, pointer_t &old_value);
     virtual int Delete(const inode_id_t key, pointer_t &value1, pointer_t &value2);  //正在rehash时，先删旧版本，再删新版本，可能会删两个值，如果中间又插入的话
+    //批量读用，只发出预取：node为false预取key所在的bucket，为true预取bucket指向的第一个节点；调用者在EpochGuard内
+    void Prefetch(const inode_id_t key, bool node);
+
+    //文件回收用：key在任一版本中仍指向value时返回true；正在rehash时旧版本中未迁移的值也算
+    bool HasValue(const inode_id_t key, const pointer_t value);
+    //只有key当前指向expected时才改为new_value，成功返回0，key已被修改或删除返回2；正在rehash时两个版本中等于expected的都修改
+    int CompareAndSwap(const inode_id_t key, const pointer_t expected, const pointer_t new_value);
 
     void PrintHashTable();
     string PrintHashTableStats(uint64_t &hashtable_node_nums, uint64_t &hashtable_kv_nums);
 
+    //恢复，统计每个文件id中有效kv个数，返回kv个数；nodes不为空时收集所有NVM节点
+    uint64_t Recover(vector<pair<pointer_t, uint64_t>> *nodes, map<uint64_t, uint64_t> &file_kv_nums);
+    bool IsRehash() { return is_rehash_; }
+    void ResumeRehash();   //恢复完成后，继续中途退出的rehash
+
 private:
     const Option option_;
     InodeZone *inode_zone_;    //主要扩展时可以会调用删除旧地址值
+    NvmHashTableMeta *meta_;   //NVM中的根，记录版本的buckets
     
-    Mutex version_lock_;
+    Mutex version_lock_;   //只在rehash开始和结束时使用，读写操作都不加
+    SeqLock version_seq_;   //rehash开始和结束时修改，操作据此判断版本是否切换
     bool is_rehash_;
     InodeHashVersion *version_;
     InodeHashVersion *rehash_version_; //rehash时，这个版本是正在rehash版本；
 
 
-    void GetVersionAndRefByWrite(bool &is_rehash, InodeHashVersion **version);
-    void GetVersionAndRef(bool &is_rehash, InodeHashVersion **version, InodeHashVersion **rehash_version);
+    //调用者在EpochGuard内，版本在离开前不会被删除，返回version_seq_，写者加锁后据此检查版本是否切换
+    uint32_t GetVersion(bool &is_rehash, InodeHashVersion **version, InodeHashVersion **rehash_version);
+    bool LockEntryForWrite(InodeHashVersion *version, uint32_t index, uint32_t seq);   //版本已切换时不加锁，返回false
     inline uint32_t hash_id(const inode_id_t key, const uint64_t capacity);
     void HashEntryDealWithOp(InodeHashVersion *version, uint32_t index, InodeHashEntryLinkOp &op);
-    int HashEntryInsertKV(InodeHashVersion *version, uint32_t index, const inode_id_t key, const pointer_t value, pointer_t &old_value);
+    int HashEntryInsertKV(InodeHashVersion *version, uint32_t index, const inode_id_t key, const pointer_t value, pointer_t &old_value, uint32_t seq);
     int HashEntryOnlyInsertKV(InodeHashVersion *version, uint32_t index, const inode_id_t key, const pointer_t value);  //已存在则不插入
-    int HashEntryUpdateKV(InodeHashVersion *version, uint32_t index, const inode_id_t key, const pointer_t new_value, pointer_t &old_value);
+    int HashEntryUpdateKV(InodeHashVersion *version, uint32_t index, const inode_id_t key, const pointer_t new_value, pointer_t &old_value, uint32_t seq);
     int HashEntryGetKV(InodeHashVersion *version, uint32_t index, const inode_id_t key, pointer_t &value);
-    int HashEntryDeleteKV(InodeHashVersion *version, uint32_t index, const inode_id_t key, pointer_t &value);
+    int HashEntryCompareAndSwapKV(InodeHashVersion *version, uint32_t index, const inode_id_t key, const pointer_t expected, const pointer_t new_value, uint32_t seq);
+    int HashEntryDeleteKV(InodeHashVersion *version, uint32_t index, const inode_id_t key, pointer_t &value, uint32_t seq);
     inline bool NeedRehash(InodeHashVersion *version);
 
     static void BackgroundRehashWrapper(void *arg);
     void BackgroundRehash();
+    static void ResumeRehashWrapper(void *arg);
+    void RehashMoveWork();
     void MoveEntryToRehash(InodeHashVersion *version, uint32_t index, InodeHashVersion *rehash_version);
+    uint64_t RecoverVersion(InodeHashVersion *version, InodeHashVersion *dedup_version, vector<pair<pointer_t, uint64_t>> *nodes, map<uint64_t, uint64_t> &file_kv_nums);
 
     void PrintVersion(InodeHashVersion *version);
     int PrintEntry(pointer_t root);
@@ -213,6 +257,7 @@ int InodeHashEntryLinkInsert(InodeHashEntryLinkOp &op, const inode_id_t key, con
 int InodeHashEntryLinkOnlyInsert(InodeHashEntryLinkOp &op, const inode_id_t key, const pointer_t value);   //存在既不插入
 int InodeHashEntryLinkUpdate(InodeHashEntryLinkOp &op, const inode_id_t key, const pointer_t new_value, pointer_t &old_value);
 int InodeHashEntryLinkGet(pointer_t root, const inode_id_t key, pointer_t &value);
+int InodeHashEntryLinkCompareAndSwap(InodeHashEntryLinkOp &op, const inode_id_t key, const pointer_t expected, const pointer_t new_value);  //不等于expected则不修改
 int InodeHashEntryLinkDelete(InodeHashEntryLinkOp &op, const inode_id_t key, const pointer_t &value);
 
 
@@ -4,21 +4,62 @@
  * @Contact     : 993096281@qq.com
  * @Description : 
  */
+#include <algorithm>
+#include <cstddef>
+
 #include "inode_zone.h"
+#include "thread_pool.h"
 #include "metadb/debug.h"
 
 namespace metadb {
 
-InodeZone::InodeZone(const Option &option, uint32_t zone_id) : option_(option), zone_id_(zone_id) {
+//从链头走到不是delta的kv，deltas从新到旧，返回该kv的标记
+static uint32_t GetBaseKV(pointer_t addr, vector<Slice> &deltas, Slice &base){
+    uint32_t flags = GetFileByAddr(addr)->GetKVRef(GetFileOffset(addr), base);
+    while(flags & INODE_KV_DELTA){
+        deltas.push_back(base);
+        InodeDeltaHeader header;
+        memcpy(&header, base.data(), sizeof(InodeDeltaHeader));
+        flags = GetFileByAddr(header.prev)->GetKVRef(GetFileOffset(header.prev), base);
+    }
+    return flags;
+}
+
+//从旧到新应用delta，超出value的部分忽略（只读属性时）
+static void ApplyDeltas(const vector<Slice> &deltas, std::string &value){
+    for(auto it = deltas.rbegin(); it != deltas.rend(); ++it){
+        InodeDeltaHeader header;
+        memcpy(&header, it->data(), sizeof(InodeDeltaHeader));
+        if(header.offset >= value.size()) continue;
+        size_t len = std::min(it->size() - sizeof(InodeDeltaHeader), value.size() - header.offset);
+        value.replace(header.offset, len, it->data() + sizeof(InodeDeltaHeader), len);
+    }
+}
+
+InodeZone::InodeZone(const Option &option, uint32_t zone_id, NvmHashTableMeta *meta, bool is_recover, RateLimiter *gc_limiter) : option_(option), zone_id_(zone_id) {
     write_file_ = nullptr;
-    hashtable_ = new InodeHashTable(option, this);
+    gc_limiter_ = gc_limiter;
+    InitGC();
+    hashtable_ = new InodeHashTable(option, this, meta, is_recover);
 }
 
-void InodeZone::InitInodeZone(const Option &option, uint32_t zone_id){
+void InodeZone::InitInodeZone(const Option &option, uint32_t zone_id, NvmHashTableMeta *meta, bool is_recover, RateLimiter *gc_limiter){
     zone_id_ = zone_id;
     write_file_ = nullptr;
+    gc_limiter_ = gc_limiter;
     option_ = option;
-    hashtable_ = new InodeHashTable(option, this);
+    InitGC();
+    hashtable_ = new InodeHashTable(option, this, meta, is_recover);
+}
+
+void InodeZone::InitGC(){
+    gc_scheduled_.store(false);
+    gc_runs_.store(0);
+    reclaimed_files_.store(0);
+    compacted_files_.store(0);
+    reclaimed_bytes_.store(0);
+    copied_bytes_.store(0);
+    user_write_bytes_.store(0);
 }
 
 InodeZone::~InodeZone(){
@@ -82,36 +123,81 @@ void InodeZone::FilesMapDelete(uint64_t id){
     locks_mu_.Lock();
     auto it_lock = files_locks_.find(id);
     if(it_lock != files_locks_.end()){
+        lock = it_lock->second;
         files_locks_.erase(it_lock);
     }
     locks_mu_.Unlock();
-    if(file != nullptr) file_allocator->Free(file, INODE_FILE_SIZE);
-    if(lock != nullptr) delete lock;
+    //读者可能刚从hashtable拿到该文件中的地址，或者正在等文件锁，离开后再释放
+    if(file != nullptr) epoch_manager->Retire(&InodeZone::FreeFileCallback, file, 0);
+    if(lock != nullptr) epoch_manager->Retire(&InodeZone::DeleteLockCallback, lock, 0);
+}
+
+void InodeZone::FreeFileCallback(void *arg, uint64_t unused){
+    file_allocator->Free(arg, INODE_FILE_SIZE);
+}
+
+void InodeZone::DeleteLockCallback(void *arg, uint64_t unused){
+    delete static_cast<Mutex *>(arg);
 }
 
-pointer_t InodeZone::WriteFile(const inode_id_t key, const Slice &value){
+pointer_t InodeZone::WriteFile(const inode_id_t key, const Slice &value, uint32_t flags){
+    NVMInodeFile *full_file = nullptr;
     write_mu_.Lock();
     if(write_file_ == nullptr){
         write_file_ = AllocNVMInodeFlie();
         FilesMapInsert(write_file_);
     }
     pointer_t key_addr = 0;
-    if(write_file_->InsertKV(key, value, key_addr) != 0){
+    if(write_file_->InsertKV(key, value, key_addr, flags) != 0){
+        full_file = write_file_;
         write_file_ = AllocNVMInodeFlie();
         FilesMapInsert(write_file_);
-        write_file_->InsertKV(key, value, key_addr);
+        write_file_->InsertKV(key, value, key_addr, flags);
     }
     write_mu_.Unlock();
+    if(full_file != nullptr) MaybeScheduleGC(full_file);   //写满前已有很多kv失效
     return key_addr;
 }
 
+pointer_t InodeZone::WriteValue(const inode_id_t key, const Slice &value, uint32_t attr_size, uint64_t &write_bytes){
+    if(attr_size == 0){
+        write_bytes = InodeFileKVSize(value.size());
+        return WriteFile(key, value);
+    }
+    attr_size = std::min(static_cast<size_t>(attr_size), value.size());
+    InodeAttrHeader header;
+    header.data = INVALID_POINTER;
+    header.data_size = value.size() - attr_size;
+    header.reserved = 0;
+    write_bytes = 0;
+    if(header.data_size > 0){   //数据kv写入时就已被属性kv引用
+        header.data = WriteFile(key, Slice(value.data() + attr_size, header.data_size), INODE_KV_CHAINED);
+        write_bytes += InodeFileKVSize(header.data_size);
+    }
+    string attr(reinterpret_cast<const char *>(&header), sizeof(InodeAttrHeader));
+    attr.append(value.data(), attr_size);
+    write_bytes += InodeFileKVSize(attr.size());
+    return WriteFile(key, attr, INODE_KV_ATTR);
+}
+
 int InodeZone::InodePut(const inode_id_t key, const Slice &value){
-    pointer_t key_offset = WriteFile(key, value);
+    pointer_t new_addr;
+    pointer_t old_addr;
+    return InodePut(key, value, 0, new_addr, old_addr);
+}
+
+int InodeZone::InodePut(const inode_id_t key, const Slice &value, uint32_t attr_size, pointer_t &new_addr, pointer_t &old_addr){
+    EpochGuard guard;   //old_value所在文件可能正在被后台回收
+    uint64_t write_bytes;
+    pointer_t key_offset = WriteValue(key, value, attr_size, write_bytes);
+    user_write_bytes_.fetch_add(write_bytes, std::memory_order_relaxed);
     pointer_t old_value = INVALID_POINTER;
     int res = hashtable_->Put(key, key_offset, old_value);
     if(res == 2){  //key以存在
-        DeleteFlie(old_value);
+        DeleteValue(old_value);
     }
+    new_addr = key_offset;
+    old_addr = (res == 2) ? old_value : INVALID_POINTER;
     return res;
 }
 
@@ -123,19 +209,103 @@ int InodeZone::ReadFile(pointer_t addr, std::string &value){
         ERROR_PRINT("not find file! addr:%lu id:%lu offset:%lu\n", addr, id, offset);
         return 2;
     }
-    return file->GetKV(offset, value);
+    return ReadValue(addr, value);
+}
+
+int InodeZone::ReadValue(pointer_t addr, std::string &value, uint32_t *attr_size){
+    //从链头走到完整值，再从旧到新依次应用delta；链头在hashtable中时，链上的kv都不会被回收
+    vector<Slice> deltas;
+    Slice kv_value;
+    uint32_t flags = GetBaseKV(addr, deltas, kv_value);
+    uint32_t size = 0;
+    if(flags & INODE_KV_ATTR){   //属性和数据分开存放，拼成完整值
+        InodeAttrHeader header;
+        memcpy(&header, kv_value.data(), sizeof(InodeAttrHeader));
+        size = kv_value.size() - sizeof(InodeAttrHeader);
+        value.reserve(size + header.data_size);
+        value.assign(kv_value.data() + sizeof(InodeAttrHeader), size);
+        if(!IS_INVALID_POINTER(header.data)){
+            Slice data;
+            GetFileByAddr(header.data)->GetKVRef(GetFileOffset(header.data), data);
+            value.append(data.data(), data.size());
+        }
+    } else {
+        value.assign(kv_value.data(), kv_value.size());
+    }
+    ApplyDeltas(deltas, value);
+    if(attr_size != nullptr) *attr_size = size;
+    return 0;
+}
+
+int InodeZone::ReadAttr(pointer_t addr, std::string &attr){
+    vector<Slice> deltas;
+    Slice kv_value;
+    uint32_t flags = GetBaseKV(addr, deltas, kv_value);
+    if(!(flags & INODE_KV_ATTR)) return ReadValue(addr, attr);
+    attr.assign(kv_value.data() + sizeof(InodeAttrHeader), kv_value.size() - sizeof(InodeAttrHeader));
+    ApplyDeltas(deltas, attr);   //只保留落在属性中的修改
+    return 0;
+}
+
+pointer_t InodeZone::NextKV(pointer_t addr){
+    Slice kv_value;
+    uint32_t flags = GetFileByAddr(addr)->GetKVRef(GetFileOffset(addr), kv_value);
+    pointer_t next = INVALID_POINTER;
+    if(flags & INODE_KV_DELTA){
+        memcpy(&next, kv_value.data() + offsetof(InodeDeltaHeader, prev), sizeof(pointer_t));
+    } else if(flags & INODE_KV_ATTR){
+        memcpy(&next, kv_value.data() + offsetof(InodeAttrHeader, data), sizeof(pointer_t));
+    }
+    return next;
+}
+
+void InodeZone::CountValue(pointer_t addr, map<uint64_t, uint64_t> &file_kv_nums){
+    while(!IS_INVALID_POINTER(addr)){
+        file_kv_nums[GetFileId(addr)]++;
+        addr = NextKV(addr);
+    }
+}
+
+int InodeZone::InodeLocate(const inode_id_t key, NVMInodeFile *&file, uint64_t &offset, pointer_t &addr){
+    addr = INVALID_POINTER;
+    while(true){
+        pointer_t old_addr = addr;
+        int res = hashtable_->Get(key, addr);
+        if(res != 0) return res;
+        file = FilesMapGet(GetFileId(addr));
+        if(file != nullptr){
+            offset = GetFileOffset(addr);
+            return 0;
+        }
+        if(addr == old_addr) break;
+        //文件刚被后台回收，kv已搬到新地址，重新查找
+    }
+    ERROR_PRINT("not find file! addr:%lu id:%lu offset:%lu\n", addr, GetFileId(addr), GetFileOffset(addr));
+    return 2;
 }
 
 int InodeZone::InodeGet(const inode_id_t key, std::string &value){
+    EpochGuard guard;   //读到的地址所在文件在离开前不会被释放
+    NVMInodeFile *file;
+    uint64_t offset;
     pointer_t addr;
-    int res = hashtable_->Get(key, addr);
-    if(res == 0){
-        res = ReadFile(addr, value);
-    }
-    return res;
+    int res = InodeLocate(key, file, offset, addr);
+    if(res != 0) return res;
+    return ReadValue(addr, value);
+}
+
+int InodeZone::InodeGetAttr(const inode_id_t key, std::string &attr){
+    EpochGuard guard;   //读到的地址所在文件在离开前不会被释放
+    NVMInodeFile *file;
+    uint64_t offset;
+    pointer_t addr;
+    int res = InodeLocate(key, file, offset, addr);
+    if(res != 0) return res;
+    return ReadAttr(addr, attr);
 }
 
 int InodeZone::DeleteFlie(pointer_t value_addr){
+    EpochGuard guard;   //文件锁在离开前不会被删除
     uint64_t id = GetFileId(value_addr);
     uint64_t offset = GetFileOffset(value_addr);
     Mutex *file_lock;
@@ -146,38 +316,292 @@ int InodeZone::DeleteFlie(pointer_t value_addr){
     }
     file_lock->Lock();
     file->SetInvalidNumPersist(file->invalid_num + 1);
+    //在文件锁内判断，只有最后一个无效kv的删除者能拿到回收权
+    bool reclaim = (file != write_file_ && file->num == file->invalid_num && AcquireGCFile(id));
     file_lock->Unlock();
-    if(file != write_file_ && file->num == file->invalid_num){  //直接回收
-        FilesMapDelete(id);
+    if(reclaim){  //直接回收
+        ReclaimFile(id, file, 0);
+    } else {
+        MaybeScheduleGC(file);
     }
     return 0;
 }
 
 int InodeZone::InodeDelete(const inode_id_t key){
+    EpochGuard guard;   //删除的值所在文件可能正在被后台回收
     pointer_t value_addr1 = INVALID_POINTER;
     pointer_t value_addr2 = INVALID_POINTER;
     int res = hashtable_->Delete(key, value_addr1, value_addr2);
     int res1 = 0;
     int res2 = 0;
     if(!IS_INVALID_POINTER(value_addr1)){
-        res1 = DeleteFlie(value_addr1);
+        res1 = DeleteValue(value_addr1);
     }
     if(!IS_INVALID_POINTER(value_addr2)){
-        res2 = DeleteFlie(value_addr2);
+        res2 = DeleteValue(value_addr2);
     }
     return res1 | res2;  //两个都没问题才返回0；
 }
 
 int InodeZone::InodeUpdate(const inode_id_t key, const Slice &new_value){
+    pointer_t new_addr;
+    pointer_t old_addr;
+    return InodeUpdate(key, new_value, new_addr, old_addr);
+}
+
+int InodeZone::InodeUpdate(const inode_id_t key, const Slice &new_value, pointer_t &new_addr, pointer_t &old_addr){
+    EpochGuard guard;   //old_value所在文件可能正在被后台回收
+    user_write_bytes_.fetch_add(InodeFileKVSize(new_value.size()), std::memory_order_relaxed);
     pointer_t key_offset = WriteFile(key, new_value);
     pointer_t old_value = INVALID_POINTER;
     int res = hashtable_->Update(key, key_offset, old_value);
     if(res == 2){  //key以存在
-        DeleteFlie(old_value);
+        DeleteValue(old_value);
+    }
+    new_addr = key_offset;
+    old_addr = (res == 2) ? old_value : INVALID_POINTER;
+    return res;
+}
+
+int InodeZone::InodeUpdateRange(const inode_id_t key, uint32_t offset, const Slice &data, pointer_t &new_addr, pointer_t &old_addr){
+    EpochGuard guard;   //链上的kv所在文件可能正在被后台回收
+    while(true){
+        NVMInodeFile *file;
+        uint64_t file_offset;
+        pointer_t head;
+        int res = InodeLocate(key, file, file_offset, head);
+        if(res != 0) return res;
+        Slice head_value;
+        uint32_t flags = file->GetKVRef(file_offset, head_value);
+        InodeDeltaHeader header;
+        uint32_t attr_size = 0;
+        if(flags & INODE_KV_DELTA){
+            memcpy(&header, head_value.data(), sizeof(InodeDeltaHeader));
+        } else if(flags & INODE_KV_ATTR){
+            InodeAttrHeader attr_header;
+            memcpy(&attr_header, head_value.data(), sizeof(InodeAttrHeader));
+            attr_size = head_value.size() - sizeof(InodeAttrHeader);
+            header.value_size = attr_size + attr_header.data_size;
+            header.depth = 0;
+        } else {
+            header.value_size = head_value.size();
+            header.depth = 0;
+        }
+        if(static_cast<uint64_t>(offset) + data.size() > header.value_size) return -1;
+
+        pointer_t addr;
+        uint64_t write_bytes = 0;
+        bool attr_only = (static_cast<uint64_t>(offset) + data.size() <= attr_size);
+        bool merge = (!attr_only && header.depth >= option_.INODE_DELTA_CHAIN_MAX);
+        if(attr_only){   //只改属性，写一条新的属性kv，仍引用原来的数据kv
+            string attr(head_value.data(), head_value.size());
+            attr.replace(sizeof(InodeAttrHeader) + offset, data.size(), data.data(), data.size());
+            write_bytes = InodeFileKVSize(attr.size());
+            addr = WriteFile(key, attr, INODE_KV_ATTR);
+        } else if(merge){   //链太长，读的时候要走太多kv，合并成完整值
+            string value;
+            uint32_t value_attr_size;
+            ReadValue(head, value, &value_attr_size);
+            value.replace(offset, data.size(), data.data(), data.size());
+            addr = WriteValue(key, value, value_attr_size, write_bytes);
+        } else {
+            InodeDeltaHeader new_header;
+            new_header.prev = head;
+            new_header.offset = offset;
+            new_header.value_size = header.value_size;
+            new_header.depth = header.depth + 1;
+            new_header.reserved = 0;
+            string delta(reinterpret_cast<const char *>(&new_header), sizeof(InodeDeltaHeader));
+            delta.append(data.data(), data.size());
+            if(!(flags & INODE_KV_CHAINED)){   //先持久化引用标记，delta可见后回收文件时才能找到它
+                file->SetKVChainedPersist(file_offset);
+                write_bytes += 4;
+            }
+            write_bytes += InodeFileKVSize(delta.size());
+            addr = WriteFile(key, delta, INODE_KV_DELTA);
+        }
+        user_write_bytes_.fetch_add(write_bytes, std::memory_order_relaxed);
+        //hashtable中8字节地址的原子修改是提交点，crash时未提交的kv在恢复时按无效统计
+        if(hashtable_->CompareAndSwap(key, head, addr) == 0){
+            if(attr_only){
+                DeleteFlie(head);   //数据kv仍被新的属性kv引用
+            } else if(merge){
+                DeleteValue(head);
+            }
+            new_addr = addr;
+            old_addr = head;
+            return 0;
+        }
+        //期间有其他写者或后台回收修改了该key，重新读链头；delta和新属性kv引用的是仍有效的kv，只删除自己
+        if(merge){
+            DeleteValue(addr);
+        } else {
+            DeleteFlie(addr);
+        }
+    }
+}
+
+int InodeZone::DeleteValue(pointer_t value_addr, uint64_t keep_file_id){
+    EpochGuard guard;   //标记无效后文件可能被回收，先读出链上的下一个地址
+    int res = 0;
+    while(!IS_INVALID_POINTER(value_addr)){
+        pointer_t next = NextKV(value_addr);
+        if(GetFileId(value_addr) != keep_file_id) res |= DeleteFlie(value_addr);
+        value_addr = next;
     }
     return res;
 }
 
+bool InodeZone::FindChainHead(const inode_id_t key, pointer_t addr, pointer_t &head){
+    if(hashtable_->Get(key, head) != 0) return false;
+    pointer_t cur = head;
+    while(cur != addr){
+        cur = NextKV(cur);
+        if(IS_INVALID_POINTER(cur)) return false;
+    }
+    return true;
+}
+
+bool InodeZone::AcquireGCFile(uint64_t id){
+    MutexLock lock(&gc_mu_);
+    return gc_files_.insert(id).second;
+}
+
+void InodeZone::ReclaimFile(uint64_t id, NVMInodeFile *file, uint64_t moved_bytes){
+    reclaimed_bytes_.fetch_add(file->write_offset - moved_bytes, std::memory_order_relaxed);
+    reclaimed_files_.fetch_add(1, std::memory_order_relaxed);
+    FilesMapDelete(id);
+    gc_mu_.Lock();
+    gc_files_.erase(id);   //空间释放后id才可能被新文件复用
+    gc_mu_.Unlock();
+}
+
+void InodeZone::MaybeScheduleGC(NVMInodeFile *file){
+    if(option_.INODE_GC_INVALID_RATIO <= 0 || gc_scheduled_.load(std::memory_order_relaxed)) return;
+    if(file == write_file_ || file->num == 0) return;   //正在写的文件不回收
+    if(static_cast<double>(file->invalid_num) < option_.INODE_GC_INVALID_RATIO * file->num) return;
+    bool expected = false;
+    if(gc_scheduled_.compare_exchange_strong(expected, true)){
+        DBG_LOG("[inode] zone:%u add gc job, num:%lu invalid_num:%lu", zone_id_, file->num, file->invalid_num);
+        thread_pool->Schedule(&InodeZone::BackgroundGCWrapper, this);
+    }
+}
+
+void InodeZone::BackgroundGCWrapper(void *arg){
+    reinterpret_cast<InodeZone *>(arg)->BackgroundGC();
+}
+
+void InodeZone::BackgroundGC(){
+    gc_runs_.fetch_add(1, std::memory_order_relaxed);
+    vector<pair<double, uint64_t>> candidates;   //无效比例，文件id
+    write_mu_.Lock();   //写满换文件时先持有write_mu_再改files_，这里顺序相同
+    files_mu_.Lock();
+    for(auto it : files_){
+        NVMInodeFile *file = it.second;
+        if(file == write_file_ || file->num == 0) continue;
+        double ratio = static_cast<double>(file->invalid_num) / file->num;
+        if(ratio >= option_.INODE_GC_INVALID_RATIO) candidates.push_back(make_pair(ratio, it.first));
+    }
+    files_mu_.Unlock();
+    write_mu_.Unlock();
+    sort(candidates.rbegin(), candidates.rend());   //无效比例高的先回收，需要搬移的kv少
+
+    for(auto it : candidates){
+        if(!AcquireGCFile(it.second)) continue;   //最后一个kv已被删除，直接回收了
+        NVMInodeFile *file = FilesMapGet(it.second);
+        uint64_t moved_bytes = CompactFile(file);
+        compacted_files_.fetch_add(1, std::memory_order_relaxed);
+        DBG_LOG("[inode] zone:%u gc file:%lu num:%lu invalid_num:%lu write_offset:%lu moved:%lu", zone_id_, it.second, file->num, \
+                file->invalid_num, file->write_offset, moved_bytes);
+        ReclaimFile(it.second, file, moved_bytes);
+    }
+    //文件空间大，不等攒够一批再释放；这里不在读临界区内，本轮摘除的文件在已有读者离开后即可释放。
+    //前台删除最后一个kv直接回收的文件在调用者的EpochGuard内摘除，留给之后的批量回收
+    epoch_manager->Reclaim();
+    gc_scheduled_.store(false);
+}
+
+uint64_t InodeZone::CompactFile(NVMInodeFile *file){
+    //文件不再写入，hashtable中指向该文件的kv搬到正在写的文件，用CompareAndSwap修改地址；
+    //搬移期间被更新或删除的kv修改失败，新写入的拷贝直接标记无效，结束后hashtable中没有指向该文件的地址
+    //delta链或数据kv在该文件中时，把整个值合并后重新写入（分开存放的仍分开写），其他文件中被引用的kv标记无效
+    uint64_t moved_bytes = 0;
+    uint64_t end = file->write_offset;
+    uint64_t offset = 0;
+    uint64_t file_id = GetFileId(FILE_GET_OFFSET(file));
+    while(offset < end){
+        inode_id_t key;
+        Slice value;
+        uint32_t flags;
+        pointer_t addr = FILE_GET_OFFSET(file->buf + offset);
+        uint64_t len = file->GetKVByBufOffset(offset, key, value, flags);
+        offset += len;
+
+        uint64_t kv_copied_bytes = 0;
+        while(true){
+            EpochGuard guard;   //链上其他文件中的kv可能同时被前台标记无效并回收
+            pointer_t head = addr;
+            if(!hashtable_->HasValue(key, addr)){
+                //不是链头，只有被delta或属性kv引用过的kv才可能仍有效
+                if(!(file->GetKVFlags(GetFileOffset(addr)) & INODE_KV_CHAINED) || !FindChainHead(key, addr, head)) break;
+            }
+            bool chained = (head != addr || (flags & INODE_KV_DELTA));
+            pointer_t new_addr;
+            uint64_t copy_len = len;
+            if(chained){
+                string merged;
+                uint32_t attr_size;
+                ReadValue(head, merged, &attr_size);
+                new_addr = WriteValue(key, merged, attr_size, copy_len);
+            } else {   //属性kv直接拷贝，仍引用原来的数据kv
+                new_addr = WriteFile(key, value, flags & INODE_KV_ATTR);
+            }
+            copied_bytes_.fetch_add(copy_len, std::memory_order_relaxed);
+            kv_copied_bytes += copy_len;
+            if(hashtable_->CompareAndSwap(key, head, new_addr) == 0){
+                moved_bytes += len;
+                if(chained) DeleteValue(head, file_id);
+                break;
+            }
+            if(chained){
+                DeleteValue(new_addr);
+            } else {
+                DeleteFlie(new_addr);
+            }
+            //期间被更新或删除；被追加了delta时该kv仍在链上，重新找链头
+            if(!(file->GetKVFlags(GetFileOffset(addr)) & INODE_KV_CHAINED)) break;
+        }
+        gc_limiter_->Request(kv_copied_bytes);   //按拷贝的字节数限速，所有zone共享速率；不在EpochGuard内睡眠
+    }
+    return moved_bytes;
+}
+
+void InodeZone::GetGCStats(InodeGCStats &stats){
+    stats.gc_runs += gc_runs_.load(std::memory_order_relaxed);
+    stats.reclaimed_files += reclaimed_files_.load(std::memory_order_relaxed);
+    stats.compacted_files += compacted_files_.load(std::memory_order_relaxed);
+    stats.reclaimed_bytes += reclaimed_bytes_.load(std::memory_order_relaxed);
+    stats.copied_bytes += copied_bytes_.load(std::memory_order_relaxed);
+    stats.user_write_bytes += user_write_bytes_.load(std::memory_order_relaxed);
+}
+
+uint64_t InodeZone::Recover(vector<pair<pointer_t, uint64_t>> *nodes, vector<uint64_t> &file_ids){
+    map<uint64_t, uint64_t> file_kv_nums;   //文件id -> 有效kv个数
+    uint64_t kv_nums = hashtable_->Recover(nodes, file_kv_nums);
+    for(auto it : file_kv_nums){
+        NVMInodeFile *file = static_cast<NVMInodeFile *>(FILE_GET_POINTER(it.first * INODE_FILE_SIZE));
+        if(file->num - file->invalid_num != it.second){   //crash时写入了value但未更新索引，或者未来得及标记无效
+            DBG_LOG("[inode] zone:%u recover file:%lu num:%lu invalid_num:%lu valid:%lu", zone_id_, it.first, file->num, file->invalid_num, it.second);
+            file->SetInvalidNumPersist(file->num - it.second);
+        }
+        if(nodes != nullptr) file_allocator->RecoverAllocate(FILE_GET_OFFSET(file), INODE_FILE_SIZE);
+        FilesMapInsert(file);
+        file_ids.push_back(it.first);
+    }
+    //没有有效kv的文件不再恢复，空间直接回收
+    return kv_nums;
+}
+
 void InodeZone::PrintZone(){
     hashtable_->PrintHashTable();
     uint64_t nums = 0;
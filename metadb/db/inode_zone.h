@@ -9,6 +9,8 @@
 
 #include <string>
 #include <map>
+#include <set>
+#include <atomic>
 
 #include "metadb/option.h"
 #include "metadb/slice.h"
@@ -17,28 +19,71 @@
 #include "inode_hashtable.h"
 #include "inode_file.h"
 #include "../util/lock.h"
+#include "../util/rate_limiter.h"
 #include "nvm_file_allocator.h"
+#include "epoch_manager.h"
 
 using namespace std;
 
 namespace metadb {
 
+struct InodeGCStats {   //后台回收文件的统计，多个zone累加
+    uint64_t gc_runs;   //后台回收任务执行次数
+    uint64_t reclaimed_files;   //回收的文件个数，包括无效kv已满直接回收的
+    uint64_t compacted_files;   //搬移有效kv后回收的文件个数
+    uint64_t reclaimed_bytes;   //回收文件中无效kv占用的字节数
+    uint64_t copied_bytes;   //搬移有效kv写入的字节数
+    uint64_t user_write_bytes;   //put/update写入的字节数
+
+    InodeGCStats() : gc_runs(0), reclaimed_files(0), compacted_files(0), reclaimed_bytes(0), copied_bytes(0), user_write_bytes(0) {}
+    ~InodeGCStats() {}
+};
+
 class InodeZone {   //一级hash的分区，包含一个hashtable存储key-offset，包含多个文件存储value
 public: 
-    InodeZone(const Option &option, uint32_t zone_id);
+    //gc_limiter由所有zone共享，后台回收的拷贝总速率不超过INODE_GC_RATE_LIMIT
+    InodeZone(const Option &option, uint32_t zone_id, NvmHashTableMeta *meta, bool is_recover, RateLimiter *gc_limiter);
     InodeZone() {}
-    void InitInodeZone(const Option &option, uint32_t zone_id);
+    void InitInodeZone(const Option &option, uint32_t zone_id, NvmHashTableMeta *meta, bool is_recover, RateLimiter *gc_limiter);
     virtual ~InodeZone();
 
     virtual int InodePut(const inode_id_t key, const Slice &value);
     virtual int InodeUpdate(const inode_id_t key, const Slice &new_value);
+    //同上，返回新值的地址和被覆盖的旧值地址（key原来不存在时为INVALID_POINTER），供缓存判断新旧；
+    //attr_size不为0时value的前attr_size字节作为属性kv，之后的数据另写一条kv，由属性kv引用
+    int InodePut(const inode_id_t key, const Slice &value, uint32_t attr_size, pointer_t &new_addr, pointer_t &old_addr);
+    int InodeUpdate(const inode_id_t key, const Slice &new_value, pointer_t &new_addr, pointer_t &old_addr);
+    //把值中[offset, offset + data.size())改为data，只追加一条delta，用CompareAndSwap修改hashtable使其生效；
+    //链上delta达到INODE_DELTA_CHAIN_MAX时合并成完整值写入；分开存放的值只改属性时写一条新的属性kv。
+    //key不存在返回2，超出值的范围返回-1
+    int InodeUpdateRange(const inode_id_t key, uint32_t offset, const Slice &data, pointer_t &new_addr, pointer_t &old_addr);
     virtual int InodeGet(const inode_id_t key, std::string &value);
+    int InodeGetAttr(const inode_id_t key, std::string &attr);   //只读属性kv，值没有分开存放时返回完整值
     virtual int InodeDelete(const inode_id_t key);
 
+    void InodePrefetch(const inode_id_t key, bool node) { hashtable_->Prefetch(key, node); }
+    //找到key的值所在的文件和偏移，不拷贝value；调用者在EpochGuard内，返回的文件在离开前不会被释放
+    int InodeLocate(const inode_id_t key, NVMInodeFile *&file, uint64_t &offset, pointer_t &addr);
+
     int DeleteFlie(pointer_t value_addr);   ////在文件中删除该地址，标记无效kv的个数
+    //值被覆盖或删除时调用，该值引用的delta链和数据kv都标记无效；keep_file_id中的kv不标记，用于正在回收的文件
+    int DeleteValue(pointer_t value_addr, uint64_t keep_file_id = UINT64_MAX);
+    //读addr处的值，是delta时沿链合并出完整值，属性和数据分开存放时拼接起来，attr_size返回属性的大小（没有分开为0）；
+    //调用者在EpochGuard内
+    int ReadValue(pointer_t addr, std::string &value, uint32_t *attr_size = nullptr);
+    int ReadAttr(pointer_t addr, std::string &attr);   //同ReadValue，只读属性，不访问数据kv
+    //恢复用，统计addr处的值引用的每个kv所在的文件
+    static void CountValue(pointer_t addr, map<uint64_t, uint64_t> &file_kv_nums);
+    static pointer_t NextKV(pointer_t addr);   //addr处的kv引用的kv：delta的前一个值或属性kv的数据kv，没有时为INVALID_POINTER
     uint32_t get_zone_id() { return zone_id_; }
     int GetValueByAddr(pointer_t addr, string &value) { return ReadFile(addr, value); }
 
+    //恢复，遍历hashtable重建files_，返回kv个数，file_ids为有有效kv的文件；nodes不为空时收集NVM节点并标记文件空间
+    uint64_t Recover(vector<pair<pointer_t, uint64_t>> *nodes, vector<uint64_t> &file_ids);
+    void ResumeRehash() { hashtable_->ResumeRehash(); }
+
+    void GetGCStats(InodeGCStats &stats);   //累加到stats
+
     void PrintZone();
     string PrintZoneStats(uint64_t &file_nums, uint64_t &write_lens, uint64_t &kv_nums, uint64_t &invalid_kv_nums, uint64_t &hashtable_node_nums, uint64_t &hashtable_kv_nums);
 private: 
@@ -54,14 +99,38 @@ private:
     map<uint64_t, Mutex *> files_locks_;   //对NVMInodeFile的invalid_num进行操作时需要原子操作，加一个锁,
     Mutex locks_mu_;   //files_locks_的锁
 
+    set<uint64_t> gc_files_;   //正在回收的文件id，删除kv直接回收和后台回收只有一方能拿到
+    Mutex gc_mu_;   //gc_files_的锁，可以在文件锁内加
+    std::atomic<bool> gc_scheduled_;   //已有后台回收任务
+    RateLimiter *gc_limiter_;   //InodeDB所有，各zone共享
+    std::atomic<uint64_t> gc_runs_;
+    std::atomic<uint64_t> reclaimed_files_;
+    std::atomic<uint64_t> compacted_files_;
+    std::atomic<uint64_t> reclaimed_bytes_;
+    std::atomic<uint64_t> copied_bytes_;
+    std::atomic<uint64_t> user_write_bytes_;
+
     void FilesMapInsert(NVMInodeFile *file);   //files_操作
     NVMInodeFile *FilesMapGet(uint64_t id);   //files_操作,  
     NVMInodeFile *FilesMapGetAndGetLock(uint64_t id, Mutex **lock);   //files_操作,  lock也返回文件的锁
-    void FilesMapDelete(uint64_t id);         //files_操作
+    void FilesMapDelete(uint64_t id);         //files_操作，文件空间延迟到读者离开后释放
 
-    pointer_t WriteFile(const inode_id_t key, const Slice &value);   //返回的是地址
+    pointer_t WriteFile(const inode_id_t key, const Slice &value, uint32_t flags = 0);   //返回的是地址
+    //写入完整值，attr_size不为0时属性和数据分开写入，返回属性kv的地址，write_bytes为写入的字节数
+    pointer_t WriteValue(const inode_id_t key, const Slice &value, uint32_t attr_size, uint64_t &write_bytes);
     int ReadFile(uint64_t offset, std::string &value);
 
+    void InitGC();
+    bool AcquireGCFile(uint64_t id);   //拿到文件的回收权，已被拿走返回false
+    void ReclaimFile(uint64_t id, NVMInodeFile *file, uint64_t moved_bytes);   //文件中已没有有效kv，删除并延迟释放
+    void MaybeScheduleGC(NVMInodeFile *file);   //文件无效比例达到阈值时调度后台回收
+    static void BackgroundGCWrapper(void *arg);
+    void BackgroundGC();
+    uint64_t CompactFile(NVMInodeFile *file);   //搬移有效kv，返回搬移的字节数
+    bool FindChainHead(const inode_id_t key, pointer_t addr, pointer_t &head);   //addr被key的当前值引用时返回true，head为链头
+    static void FreeFileCallback(void *arg, uint64_t unused);
+    static void DeleteLockCallback(void *arg, uint64_t unused);
+
 };
 
 
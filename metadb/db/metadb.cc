@@ -5,10 +5,16 @@
  * @Description : 
  */
 
+#include <sys/time.h>
+#include <unistd.h>
+
 #include "metadb.h"
+#include "metadb/debug.h"
 #include "nvm_node_allocator.h"
 #include "nvm_file_allocator.h"
 #include "thread_pool.h"
+#include "epoch_manager.h"
+#include "super_block.h"
 
 namespace metadb {
 
@@ -17,34 +23,348 @@ int DB::Open(const Option &option, const std::string &name, DB **dbptr){
     return 0;
 }
 
-MetaDB::MetaDB(const Option &option, const std::string &name) : option_(option), db_name_(name) {
+class MetaDBBatchHandler : public WriteBatch::Handler {   //逐个执行batch中的修改
+public:
+    MetaDBBatchHandler(DirDB *dir_db, InodeDB *inode_db) : dir_db_(dir_db), inode_db_(inode_db) {}
+
+    //覆盖已存在的key、删除不存在的key都不算错误
+    virtual int DirPut(const inode_id_t key, const Slice &fname, const inode_id_t value){
+        return dir_db_->DirPut(key, fname, value) == -1 ? -1 : 0;
+    }
+    virtual int DirDelete(const inode_id_t key, const Slice &fname){
+        return dir_db_->DirDelete(key, fname) == -1 ? -1 : 0;
+    }
+    virtual int InodePut(const inode_id_t key, const Slice &value){
+        return inode_db_->InodePut(key, value) == -1 ? -1 : 0;
+    }
+    virtual int InodePut(const inode_id_t key, const Slice &value, uint32_t attr_size){
+        return inode_db_->InodePut(key, value, attr_size) == -1 ? -1 : 0;
+    }
+    virtual int InodeDelete(const inode_id_t key){
+        return inode_db_->InodeDelete(key) == -1 ? -1 : 0;
+    }
+
+private:
+    DirDB *dir_db_;
+    InodeDB *inode_db_;
+};
+
+static uint64_t NowMicros() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return static_cast<uint64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+MetaDB::MetaDB(const Option &option, const std::string &name) : option_(option), db_name_(name), drop_cv_(&drop_mu_) {
     option_.Print();
+    pending_drop_jobs_.store(0);
+    dropped_inodes_.store(0);
+    uint64_t start_micros = NowMicros();
     if(!option.node_allocator_path.empty()) InitNVMNodeAllocator(option.node_allocator_path, option.node_allocator_size);
     if(!option.file_allocator_path.empty()) InitNVMFileAllocator(option.file_allocator_path, option.file_allocator_size);
     InitThreadPool(option.thread_pool_count);
-    dir_db_ = new DirDB(option);
-    inode_db_ = new InodeDB(option, option.INODE_MAX_ZONE_NUM);
+    InitEpochManager();
+    if(option_.use_existing_db && GetSuperBlock()->IsValid()){
+        RecoverDB(start_micros);
+    } else {
+        CreateDB();
+    }
+}
+
+void MetaDB::CreateDB(){
+    MetaDBSuperBlock *super_block = GetSuperBlock();
+    super_block->SetMagicPersist(0);    //先置为无效，根都持久化后再写magic
+    node_allocator->ResetMeta();
+    if(file_allocator != nullptr) file_allocator->ResetMeta();
+    dir_db_ = new DirDB(option_);
+    inode_db_ = new InodeDB(option_, option_.INODE_MAX_ZONE_NUM);
+    pointer_t log_area = BatchLog::CreateLogArea();
+    batch_log_ = new BatchLog(log_area);
+    node_allocator->SyncMeta();
+    if(file_allocator != nullptr) file_allocator->SyncMeta();
+    super_block->SetRootsPersist(option_.DIR_FIRST_HASH_MAX_CAPACITY, option_.INODE_MAX_ZONE_NUM, dir_db_->GetRoot(), inode_db_->GetRoot());
+    super_block->SetBatchLogPersist(log_area);
+    super_block->ClearDropRecordsPersist();
+    for(uint32_t i = 0; i < METADB_DROP_SLOT_NUM; i++){
+        free_drop_slots_.push_back(i);
+    }
+    super_block->SetMagicPersist(METADB_SUPER_BLOCK_MAGIC);
+}
+
+void MetaDB::RecoverDB(uint64_t start_micros){
+    MetaDBSuperBlock *super_block = GetSuperBlock();
+    if(super_block->dir_first_hash_capacity != option_.DIR_FIRST_HASH_MAX_CAPACITY || super_block->inode_zone_num != option_.INODE_MAX_ZONE_NUM){
+        //hash函数依赖这两个值，不一致无法恢复
+        ERROR_PRINT("option not match existing db! DIR_FIRST_HASH_MAX_CAPACITY:%lu(db:%lu) INODE_MAX_ZONE_NUM:%lu(db:%lu)", option_.DIR_FIRST_HASH_MAX_CAPACITY, \
+                super_block->dir_first_hash_capacity, option_.INODE_MAX_ZONE_NUM, super_block->inode_zone_num);
+        exit(-1);
+    }
+    uint32_t thread_count = option_.recovery_thread_count;
+    if(thread_count == 0){
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        thread_count = (cpus > 0) ? static_cast<uint32_t>(cpus) : 1;
+    }
+    char buf[1024];
+    recovery_stats_.append("--------Recovery--------\n");
+    uint64_t open_micros = NowMicros();
+    snprintf(buf, sizeof(buf), "phase open pool: %.3f ms\n", (open_micros - start_micros) / 1000.0);
+    recovery_stats_.append(buf);
+
+    //默认从持久化的分配器元数据恢复，元数据无效或者指定全量扫描时遍历所有可达节点重建
+    bool scan_nodes = option_.recovery_scan_nodes;
+    uint64_t replay_nums = 0;
+    if(!scan_nodes && (node_allocator->LoadMeta(replay_nums) != 0 || file_allocator == nullptr || file_allocator->LoadMeta() != 0)){
+        scan_nodes = true;
+    }
+    if(scan_nodes){
+        node_allocator->ResetMeta();
+        if(file_allocator != nullptr) file_allocator->ResetMeta();
+    }
+    uint64_t alloc_micros = NowMicros();
+    snprintf(buf, sizeof(buf), "phase allocator: %.3f ms scan_nodes:%d replay_logs:%lu\n", (alloc_micros - open_micros) / 1000.0, scan_nodes, replay_nums);
+    recovery_stats_.append(buf);
+
+    dir_db_ = new DirDB(option_, super_block->dir_root);
+    dir_db_->Recover(thread_count, scan_nodes, recovery_stats_);
+    uint64_t dir_micros = NowMicros();
+    snprintf(buf, sizeof(buf), "phase dir: %.3f ms\n", (dir_micros - alloc_micros) / 1000.0);
+    recovery_stats_.append(buf);
+
+    inode_db_ = new InodeDB(option_, option_.INODE_MAX_ZONE_NUM, super_block->inode_roots);
+    inode_db_->Recover(thread_count, scan_nodes, recovery_stats_);
+    uint64_t inode_micros = NowMicros();
+    snprintf(buf, sizeof(buf), "phase inode: %.3f ms\n", (inode_micros - dir_micros) / 1000.0);
+    recovery_stats_.append(buf);
+
+    pointer_t log_area = super_block->batch_log;
+    if(scan_nodes && !IS_INVALID_POINTER(log_area)){
+        vector<pair<pointer_t, uint64_t>> log_nodes(1, make_pair(log_area, static_cast<uint64_t>(BATCH_LOG_AREA_SIZE)));
+        node_allocator->RecoverAllocate(log_nodes);
+    }
+    if(scan_nodes){   //未回收完的DirDropAll记录和摘下的bptree已不能从hashtable到达
+        vector<pair<pointer_t, uint64_t>> drop_nodes;
+        for(uint32_t i = 0; i < METADB_DROP_SLOT_NUM; i++){
+            if(IS_INVALID_POINTER(super_block->drop_records[i])) continue;
+            NvmDirDropRecord *record = static_cast<NvmDirDropRecord *>(NODE_GET_POINTER(super_block->drop_records[i]));
+            drop_nodes.push_back(make_pair(super_block->drop_records[i], static_cast<uint64_t>(DIR_LINK_NODE_SIZE)));
+            BptreeRecoverNodes(record->bptrees[0], drop_nodes);
+            BptreeRecoverNodes(record->bptrees[1], drop_nodes);
+        }
+        node_allocator->RecoverAllocate(drop_nodes);
+    }
+
+    //分配器位图重建完成后才能继续rehash，rehash会申请新空间
+    if(scan_nodes){
+        node_allocator->SyncMeta();
+        if(file_allocator != nullptr) file_allocator->SyncMeta();
+    }
+    if(file_allocator != nullptr) file_allocator->FinishRecovery();
+    dir_db_->ResumeRehash();
+    inode_db_->ResumeRehash();
+
+    //dir和inode都恢复完后重做未完成的batch
+    uint64_t replay_batches = 0;
+    if(IS_INVALID_POINTER(log_area)){   //没有日志区的旧数据库
+        log_area = BatchLog::CreateLogArea();
+        super_block->SetBatchLogPersist(log_area);
+        batch_log_ = new BatchLog(log_area);
+    } else {
+        batch_log_ = new BatchLog(log_area);
+        MetaDBBatchHandler handler(dir_db_, inode_db_);
+        replay_batches = batch_log_->Replay(&handler);
+    }
+    //继续crash前未完成的DirDropAll，子inode可能已部分删除，重复删除没有影响
+    uint64_t resume_drops = 0;
+    for(uint32_t i = 0; i < METADB_DROP_SLOT_NUM; i++){
+        if(IS_INVALID_POINTER(super_block->drop_records[i])){
+            free_drop_slots_.push_back(i);
+        } else {
+            ScheduleDrop(i, true);
+            resume_drops++;
+        }
+    }
+    uint64_t end_micros = NowMicros();
+    snprintf(buf, sizeof(buf), "phase finish: %.3f ms replay_batches:%lu resume_drops:%lu\n", (end_micros - inode_micros) / 1000.0, replay_batches, resume_drops);
+    recovery_stats_.append(buf);
+    snprintf(buf, sizeof(buf), "recovery total: %.3f ms\n", (end_micros - start_micros) / 1000.0);
+    recovery_stats_.append(buf);
+    recovery_stats_.append("------------------------\n");
+
+    fprintf(stdout, "%s", recovery_stats_.c_str());
+    fflush(stdout);
 }
 
 MetaDB::~MetaDB(){
+    while(pending_drop_jobs_.load() > 0){   //线程池关闭时会丢弃未执行的任务，摘除的子树就无法回收了
+        usleep(1000);
+    }
     if(thread_pool) delete thread_pool;
     delete dir_db_;
     delete inode_db_;
+    delete batch_log_;
+    if(epoch_manager) delete epoch_manager;   //延迟回收的节点还给node_allocator
+    epoch_manager = nullptr;
     if(node_allocator) delete node_allocator;
     if(file_allocator) delete file_allocator;
 }
-int MetaDB::DirPut(const inode_id_t key, const Slice &fname, const inode_id_t value){
-    return dir_db_->DirPut(key, fname, value);
+int MetaDB::DirPut(const inode_id_t key, const Slice &fname, const inode_id_t value, const uint8_t type){
+    return dir_db_->DirPut(key, fname, DirEntryEncode(value, type));
 }
 
 int MetaDB::DirGet(const inode_id_t key, const Slice &fname, inode_id_t &value){
-    return dir_db_->DirGet(key, fname, value);
+    int res = dir_db_->DirGet(key, fname, value);
+    if(res == 0) value = DirEntryInode(value);
+    return res;
 }
 
 int MetaDB::DirDelete(const inode_id_t key, const Slice &fname){
     return dir_db_->DirDelete(key, fname);
 }
 
+int MetaDB::DirRename(const inode_id_t old_key, const Slice &old_fname, const inode_id_t new_key, const Slice &new_fname){
+    inode_id_t replaced;
+    return DirRename(old_key, old_fname, new_key, new_fname, replaced, false);
+}
+
+int MetaDB::DirRename(const inode_id_t old_key, const Slice &old_fname, const inode_id_t new_key, const Slice &new_fname, inode_id_t &replaced, bool delete_replaced){
+    replaced = INVALID_INODE_ID_KEY;
+    inode_id_t value;
+    int res = dir_db_->DirGet(old_key, old_fname, value);
+    if(res != 0) return res;
+    if(old_key == new_key && old_fname == new_fname) return 0;
+    inode_id_t target;
+    if(dir_db_->DirGet(new_key, new_fname, target) == 0 && DirEntryInode(target) != DirEntryInode(value)){
+        replaced = DirEntryInode(target);
+    }
+    //插入、删除和被覆盖inode的删除先写成一条日志，crash后整体重做；同一entry内的原地修改不是一次持久化完成的
+    //（bptree叶节点原地插入、链表和叶节点的前后指针立即持久化），不能只靠最后修改entry的root保证原子
+    WriteBatch batch;
+    batch.DirPut(new_key, new_fname, DirEntryInode(value), DirEntryType(value));
+    batch.DirDelete(old_key, old_fname);
+    if(delete_replaced && replaced != INVALID_INODE_ID_KEY) batch.InodeDelete(replaced);
+    uint32_t slot;
+    if(batch_log_->Append(batch, slot) != 0) return -1;
+    //同一个entry时加一次锁完成插入和删除，读者不会看到新旧目录项同时存在或同时消失
+    res = dir_db_->DirRename(old_key, old_fname, new_key, new_fname);
+    if(res == DIR_RENAME_CROSS_ENTRY){
+        MetaDBBatchHandler handler(dir_db_, inode_db_);
+        res = batch.Iterate(&handler);
+    } else if(res == 0 && delete_replaced && replaced != INVALID_INODE_ID_KEY){
+        res = (inode_db_->InodeDelete(replaced) == -1) ? -1 : 0;
+    }
+    batch_log_->Finish(slot);
+    return res;
+}
+
+struct DirDropJob {
+    MetaDB *db;
+    uint32_t slot;   //superblock中记录的槽
+    bool resume;     //重启后继续，摘除可能还没有完成
+
+    DirDropJob(MetaDB *a, uint32_t b, bool c) : db(a), slot(b), resume(c) {}
+    ~DirDropJob() {}
+};
+
+uint32_t MetaDB::AcquireDropSlot(){
+    MutexLock lock(&drop_mu_);
+    while(free_drop_slots_.empty()){
+        drop_cv_.Wait();
+    }
+    uint32_t slot = free_drop_slots_.back();
+    free_drop_slots_.pop_back();
+    return slot;
+}
+
+void MetaDB::ReleaseDropSlot(uint32_t slot, NvmDirDropRecord *record){
+    NodeLogOp log_op;   //清空槽和释放记录一起生效
+    log_op.target = &(GetSuperBlock()->drop_records[slot]);
+    log_op.value = INVALID_POINTER;
+    log_op.free_nodes.push_back(make_pair(NODE_GET_OFFSET(record), static_cast<uint64_t>(DIR_LINK_NODE_SIZE)));
+    node_allocator->CommitWithLog(log_op);
+    MutexLock lock(&drop_mu_);
+    free_drop_slots_.push_back(slot);
+    drop_cv_.Signal();
+}
+
+void MetaDB::ScheduleDrop(uint32_t slot, bool resume){
+    pending_drop_jobs_.fetch_add(1);
+    thread_pool->Schedule(&MetaDB::DirDropAllWork, new DirDropJob(this, slot, resume));
+}
+
+int MetaDB::DirDropAll(const inode_id_t key){
+    //摘下的目录项先写入记录并挂到superblock，crash后重启从记录继续回收
+    uint32_t slot = AcquireDropSlot();
+    NvmDirDropRecord *record = AllocDirDropRecord(key);
+    GetSuperBlock()->SetDropRecordPersist(slot, NODE_GET_OFFSET(record));
+    int res = dir_db_->DirDropAll(key, record);   //摘除后目录立即为空，只修改一个LinkNode
+    if(res != 0){
+        ReleaseDropSlot(slot, record);
+        return res;
+    }
+    ScheduleDrop(slot, false);
+    return 0;
+}
+
+//后台回收：先删除记录中的子inode及其子树，再释放摘下的bptree，最后释放记录；
+//中途crash时记录仍在，重启后从头再做一遍，已删除的inode和目录项不存在，重复删除没有影响
+void MetaDB::DirDropAllWork(void *arg){
+    DirDropJob *job = static_cast<DirDropJob *>(arg);
+    MetaDB *db = job->db;
+    NvmDirDropRecord *record = static_cast<NvmDirDropRecord *>(NODE_GET_POINTER(GetSuperBlock()->drop_records[job->slot]));
+    if(job->resume) db->dir_db_->DirDropAll(record->key, record);   //crash在摘除之前，重新摘除
+    uint64_t inode_nums = 0;
+    for(uint32_t i = 0; i < record->num; i++){
+        inode_nums += db->DropChild(DirEntryInode(record->values[i]));
+    }
+    for(uint32_t i = 0; i < 2; i++){
+        if(IS_INVALID_POINTER(record->bptrees[i])) continue;
+        vector<inode_id_t> values;
+        db->dir_db_->GetBptreeValues(record->bptrees[i], values);   //子inode都删除后才释放bptree，之前crash可以重新遍历
+        for(auto it : values){
+            inode_nums += db->DropChild(it);
+        }
+        db->dir_db_->ReclaimBptree(&(record->bptrees[i]));
+    }
+    db->ReleaseDropSlot(job->slot, record);
+    DBG_LOG("[metadb] dir drop all finish, key:%lu delete inodes:%lu", record->key, inode_nums);
+    db->dropped_inodes_.fetch_add(inode_nums);
+    db->pending_drop_jobs_.fetch_sub(1);
+    delete job;
+}
+
+uint64_t MetaDB::DropChild(const inode_id_t key){
+    uint64_t inode_nums = DropDirEntries(key);   //普通文件没有目录项
+    if(option_.drop_inode_callback != nullptr){
+        std::string value;
+        if(inode_db_->InodeGet(key, value) == 0) option_.drop_inode_callback(option_.drop_inode_callback_arg, key, value);
+    }
+    inode_db_->InodeDelete(key);
+    return inode_nums + 1;
+}
+
+//子目录已不能从路径到达，逐个删除其目录项；目录项在子inode删除之后才删除，crash后从记录重新遍历还能找到
+uint64_t MetaDB::DropDirEntries(const inode_id_t key){
+    uint64_t inode_nums = 0;
+    vector<DirEntryView> entries(DIR_DROP_BATCH_NUM);   //子树可能很深，不放在栈上
+    vector<pair<string, inode_id_t>> batch;
+    while(true){
+        Iterator *it = dir_db_->DirGetIterator(key);
+        it->SeekToFirst();
+        uint32_t n = it->NextBatch(entries.data(), DIR_DROP_BATCH_NUM);
+        batch.clear();
+        for(uint32_t i = 0; i < n; i++){
+            batch.push_back(make_pair(entries[i].fname.ToString(), entries[i].value));
+        }
+        delete it;
+        if(batch.empty()) break;
+        for(auto &e : batch){
+            inode_nums += DropChild(e.second);
+            dir_db_->DirDelete(key, e.first);
+        }
+    }
+    return inode_nums;
+}
+
 Iterator* MetaDB::DirGetIterator(const inode_id_t target){
     return dir_db_->DirGetIterator(target);
 }
@@ -53,14 +373,41 @@ int MetaDB::InodePut(const inode_id_t key, const Slice &value){
     return inode_db_->InodePut(key, value);
 }
 
+int MetaDB::InodePut(const inode_id_t key, const Slice &value, uint32_t attr_size){
+    return inode_db_->InodePut(key, value, attr_size);
+}
+
 int MetaDB::InodeUpdate(const inode_id_t key, const Slice &new_value){
     return inode_db_->InodeUpdate(key, new_value);
 }
 
+int MetaDB::InodeUpdateRange(const inode_id_t key, uint32_t offset, const Slice &data){
+    return inode_db_->InodeUpdateRange(key, offset, data);
+}
+
+int MetaDB::Write(const WriteBatch &batch){
+    if(batch.Count() == 0) return 0;
+    uint32_t slot;
+    if(batch_log_->Append(batch, slot) != 0) return -1;
+    //日志已持久化，中途crash重启后会重做整个batch
+    MetaDBBatchHandler handler(dir_db_, inode_db_);
+    int res = batch.Iterate(&handler);
+    batch_log_->Finish(slot);
+    return res;
+}
+
 int MetaDB::InodeGet(const inode_id_t key, std::string &value){
     return inode_db_->InodeGet(key, value);
 }
 
+int MetaDB::InodeGetAttr(const inode_id_t key, std::string &attr){
+    return inode_db_->InodeGetAttr(key, attr);
+}
+
+void MetaDB::InodeMultiGet(const inode_id_t *keys, uint32_t num, std::string *values, int *rets){
+    inode_db_->InodeMultiGet(keys, num, values, rets);
+}
+
 int MetaDB::InodeDelete(const inode_id_t key){
     return inode_db_->InodeDelete(key);
 }
@@ -87,15 +434,21 @@ void MetaDB::PrintInodeStats(std::string &stats){
 
 void MetaDB::PrintNodeAllocStats(std::string &stats){
     if(node_allocator != nullptr) node_allocator->PrintNodeAllocatorStats(stats);
+    if(epoch_manager != nullptr) epoch_manager->PrintEpochStats(stats);
 }
 void MetaDB::PrintFileAllocStats(std::string &stats){
     if(file_allocator != nullptr) file_allocator->PrintFileAllocatorStats(stats);
 }
 
 void MetaDB::PrintAllStats(std::string &stats){
+    stats.append(recovery_stats_);
     dir_db_->PrintStats(stats);
+    char buf[256];
+    snprintf(buf, sizeof(buf), "dir drop: pending jobs:%lu dropped inodes:%lu\n", pending_drop_jobs_.load(), dropped_inodes_.load());
+    stats.append(buf);
     inode_db_->PrintInodeStats(stats);
     if(node_allocator != nullptr) node_allocator->PrintNodeAllocatorStats(stats);
+    if(epoch_manager != nullptr) epoch_manager->PrintEpochStats(stats);
     if(file_allocator != nullptr) file_allocator->PrintFileAllocatorStats(stats);
 }
 
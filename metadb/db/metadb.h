@@ -10,6 +10,7 @@
 #include "metadb/db.h"
 #include "inode_db.h"
 #include "dir_db.h"
+#include "batch_log.h"
 
 using namespace std;
 namespace metadb {
@@ -19,16 +20,24 @@ public:
     MetaDB(const Option &option, const std::string &name);
     virtual ~MetaDB();
 
-    virtual int DirPut(const inode_id_t key, const Slice &fname, const inode_id_t value);
+    virtual int DirPut(const inode_id_t key, const Slice &fname, const inode_id_t value, const uint8_t type = 0);
     virtual int DirGet(const inode_id_t key, const Slice &fname, inode_id_t &value);
     virtual int DirDelete(const inode_id_t key, const Slice &fname);
+    virtual int DirRename(const inode_id_t old_key, const Slice &old_fname, const inode_id_t new_key, const Slice &new_fname);
+    virtual int DirRename(const inode_id_t old_key, const Slice &old_fname, const inode_id_t new_key, const Slice &new_fname, inode_id_t &replaced, bool delete_replaced);
+    virtual int DirDropAll(const inode_id_t key);
     virtual Iterator* DirGetIterator(const inode_id_t target);
 
     virtual int InodePut(const inode_id_t key, const Slice &value);
+    virtual int InodePut(const inode_id_t key, const Slice &value, uint32_t attr_size);
     virtual int InodeUpdate(const inode_id_t key, const Slice &new_value);
+    virtual int InodeUpdateRange(const inode_id_t key, uint32_t offset, const Slice &data);
     virtual int InodeGet(const inode_id_t key, std::string &value);
+    virtual int InodeGetAttr(const inode_id_t key, std::string &attr);
+    virtual void InodeMultiGet(const inode_id_t *keys, uint32_t num, std::string *values, int *rets);
     virtual int InodeDelete(const inode_id_t key);
 
+    virtual int Write(const WriteBatch &batch);
     virtual void WaitForBGJob();
 
 
@@ -46,6 +55,22 @@ private:
     const string db_name_;
     DirDB *dir_db_;
     InodeDB *inode_db_;
+    BatchLog *batch_log_;
+    string recovery_stats_;   //恢复各阶段耗时
+    atomic<uint64_t> pending_drop_jobs_;   //未完成的目录回收任务，关闭前等待完成
+    atomic<uint64_t> dropped_inodes_;
+    Mutex drop_mu_;
+    CondVar drop_cv_;
+    vector<uint32_t> free_drop_slots_;   //superblock中空闲的drop_records槽，drop_mu_保护
+
+    void CreateDB();
+    void RecoverDB(uint64_t start_micros);
+    uint32_t AcquireDropSlot();
+    void ReleaseDropSlot(uint32_t slot, NvmDirDropRecord *record);   //清空槽并释放记录
+    void ScheduleDrop(uint32_t slot, bool resume);
+    static void DirDropAllWork(void *arg);
+    uint64_t DropChild(const inode_id_t key);   //删除子inode及其子树，返回删除的inode数
+    uint64_t DropDirEntries(const inode_id_t key);
 };
 
 
@@ -38,6 +38,23 @@ static inline uint64_t GetOffset(void *addr){
     return GetOffset(FILE_GET_OFFSET(addr));
 }
 
+void NvmGroupMeta::SetTypePersist(NVMGroupBlockType new_type){
+    uint64_t value = static_cast<uint64_t>(new_type);
+    file_allocator->nvm_memcpy_persist(&type, &value, sizeof(uint64_t));
+}
+
+void NVMGroupManager::PersistBitmap(uint64_t index, uint64_t num){
+    uint64_t begin = index >> 3;
+    uint64_t end = (index + num - 1) >> 3;
+    file_allocator->nvm_memcpy_persist(meta_->bitmap + begin, bitmap_->get_bitmap() + begin, end - begin + 1);
+}
+
+void NVMGroupManager::SyncMeta(){
+    MutexLock lock(&mu_);
+    file_allocator->nvm_memcpy_persist(meta_->bitmap, bitmap_->get_bitmap(), bitmap_->get_capacity());
+    meta_->SetTypePersist(type_);
+}
+
 
 NVMFileAllocator::NVMFileAllocator(const std::string path, uint64_t size){
     pmemaddr_ = static_cast<char *>(pmem_map_file(path.c_str(), size, PMEM_FILE_CREATE, 0666, &mapped_len_, &is_pmem_));
@@ -49,10 +66,17 @@ NVMFileAllocator::NVMFileAllocator(const std::string path, uint64_t size){
         DBG_LOG("file allocator ok. path:%s size:%lu mapped_len:%lu is_pmem:%d addr:%p", path.c_str(), size, mapped_len_, is_pmem_, pmemaddr_);
     }
     assert(size == mapped_len_);
-    capacity_ = size;
 
-    bitmap_ = new BitMap(capacity_ / FILE_BASE_SIZE);
-    last_allocate_ = START_ALLOCATOR_INDEX;
+    //尾部依次为元数据头部、每个group的NvmGroupMeta
+    uint64_t group_num = mapped_len_ / FILE_BASE_SIZE;
+    while(group_num > 0 && group_num * FILE_BASE_SIZE + NVM_FILE_ALLOCATOR_META_SIZE + group_num * sizeof(NvmGroupMeta) > mapped_len_){
+        group_num--;
+    }
+    capacity_ = group_num * FILE_BASE_SIZE;
+    meta_ = reinterpret_cast<NvmFileAllocatorMeta *>(pmemaddr_ + mapped_len_ - NVM_FILE_ALLOCATOR_META_SIZE - group_num * sizeof(NvmGroupMeta));
+    group_metas_ = reinterpret_cast<NvmGroupMeta *>(reinterpret_cast<char *>(meta_) + NVM_FILE_ALLOCATOR_META_SIZE);
+
+    bitmap_ = new BitMapTree(capacity_ / FILE_BASE_SIZE, START_ALLOCATOR_INDEX);
     for(uint32_t i = 0; i < MAX_GROUP_BLOCK_TYPE; i++){
         groups_[i] = nullptr;
     }
@@ -68,39 +92,19 @@ NVMFileAllocator::~NVMFileAllocator(){
 }
 
 uint64_t NVMFileAllocator::GetFreeIndex(){
-    //mu_.Lock();
     MutexLock lock(&bitmap_mu_);
-    uint64_t i = last_allocate_;
-    uint64_t max = capacity_ / FILE_BASE_SIZE;
-
-    for(; i < max;){
-        if(!bitmap_->get(i)) {
-            last_allocate_ = i + 1;
-            bitmap_->set(i);
-            return i;
-        }
-        i++;
-    }
-    last_allocate_ = START_ALLOCATOR_INDEX;
-    i = last_allocate_;
-
-    for(; i < max;){
-        if(!bitmap_->get(i)) {
-            last_allocate_ = i + 1;
-            bitmap_->set(i);
-            return i;
-        }
-        i++;
+    uint64_t i = bitmap_->find(1);
+    if(i == BITMAP_TREE_NOT_FOUND){
+        ERROR_PRINT("file allocate failed, no free space!\n");
+        exit(-1);
     }
-    ERROR_PRINT("file allocate failed, no free space!\n");
-    exit(-1);
-    return 0;
-
+    bitmap_->set(i);
+    return i;
 }
 
 void NVMFileAllocator::SetFreeIndex(uint64_t index){
     MutexLock lock(&bitmap_mu_);
-    bitmap_->set(index);
+    bitmap_->clr(index);
 }
 
 NVMGroupBlockType NVMFileAllocator::SelectGroup(uint64_t size){
@@ -159,13 +163,22 @@ NVMGroupBlockType NVMFileAllocator::SelectGroup(uint64_t size){
 
 NVMGroupManager *NVMFileAllocator::CreateNVMGroupManager(NVMGroupBlockType type){
     uint64_t index = GetFreeIndex();
-    NVMGroupManager *ret = new NVMGroupManager(index, type);
+    NvmGroupMeta *meta = &(group_metas_[index]);
+    nvm_memset_persist(meta->bitmap, 0, sizeof(meta->bitmap));
+    meta->SetTypePersist(type);
+    NVMGroupManager *ret = new NVMGroupManager(index, type, meta, false);
     map_mu_.Lock();
     map_groups_.insert(pair<uint64_t, NVMGroupManager *>(index, ret));
     map_mu_.Unlock();
     return ret;
 }
 
+void NVMFileAllocator::ReleaseNVMGroupManager(NVMGroupManager *group){   //group已从map_groups_中删除
+    group_metas_[group->GetId()].SetTypePersist(NVMGroupBlockType::UNKNOWN_TYPE);
+    SetFreeIndex(group->GetId());
+    delete group;
+}
+
 
 void *NVMFileAllocator::Allocate(uint64_t size){
     uint8_t type = static_cast<uint8_t>(SelectGroup(size));
@@ -200,17 +213,131 @@ void NVMFileAllocator::Free(pointer_t addr, uint64_t len){
     uint8_t type = static_cast<uint8_t>(SelectGroup(len));
     uint64_t id = GetId(addr);
     uint64_t offset = GetOffset(addr);
+    NVMGroupManager *release = nullptr;
     map_mu_.Lock();
     auto it = map_groups_.find(id);
     it->second->Free(offset, len);
     if(it->second->FreeSpace() == FILE_BASE_SIZE && it->second != groups_[type]){
+        release = it->second;
         map_groups_.erase(it);
     }
     map_mu_.Unlock();
+    if(release != nullptr) ReleaseNVMGroupManager(release);
     //DBG_LOG("Flie free: addr:%lu len:%lu type:%u id:%lu offset:%lu", addr, len, type, id, offset);
     free_size.fetch_add(len, std::memory_order_relaxed);
 }
 
+void NVMFileAllocator::RecoverAllocate(pointer_t addr, uint64_t len){
+    NVMGroupBlockType type = SelectGroup(len);
+    uint64_t id = GetId(addr);
+    uint64_t offset = GetOffset(addr);
+    bitmap_mu_.Lock();
+    bitmap_->set(id);
+    bitmap_mu_.Unlock();
+
+    NVMGroupManager *group = nullptr;
+    map_mu_.Lock();
+    auto it = map_groups_.find(id);
+    if(it == map_groups_.end()){
+        group = new NVMGroupManager(id, type, &(group_metas_[id]), false);
+        map_groups_.insert(pair<uint64_t, NVMGroupManager *>(id, group));
+    } else {
+        group = it->second;
+    }
+    map_mu_.Unlock();
+    if(group->GetType() != type){
+        ERROR_PRINT("file recover group type error! addr:%lu len:%lu id:%lu\n", addr, len, id);
+        return ;
+    }
+    group->RecoverAllocate(offset, len);
+    allocate_size.fetch_add(len, std::memory_order_relaxed);
+}
+
+int NVMFileAllocator::LoadMeta(){
+    if(meta_->magic != NVM_FILE_ALLOCATOR_MAGIC || meta_->pool_size != mapped_len_ || meta_->group_num != capacity_ / FILE_BASE_SIZE){
+        DBG_LOG("[alloc] file allocator meta invalid, magic:%lx pool_size:%lu group_num:%lu", meta_->magic, meta_->pool_size, meta_->group_num);
+        return -1;
+    }
+    uint64_t group_num = capacity_ / FILE_BASE_SIZE;
+    uint64_t used = 0;
+    MutexLock lock(&map_mu_);
+    for(uint64_t i = 0; i < group_num; i++){
+        NVMGroupBlockType type = static_cast<NVMGroupBlockType>(group_metas_[i].type);
+        if(type == NVMGroupBlockType::UNKNOWN_TYPE) continue;
+        NVMGroupManager *group = new NVMGroupManager(i, type, &(group_metas_[i]), true);
+        if(group->FreeSpace() == FILE_BASE_SIZE){   //释放group时crash，类型未清除
+            group_metas_[i].SetTypePersist(NVMGroupBlockType::UNKNOWN_TYPE);
+            delete group;
+            continue;
+        }
+        bitmap_->set(i);
+        map_groups_.insert(pair<uint64_t, NVMGroupManager *>(i, group));
+        used += FILE_BASE_SIZE - group->FreeSpace();
+    }
+    allocate_size.store(used);
+    free_size.store(0);
+    return 0;
+}
+
+void NVMFileAllocator::ResetMeta(){
+    uint64_t magic = 0;
+    nvm_memcpy_persist(&(meta_->magic), &magic, sizeof(uint64_t));
+    uint64_t group_num = capacity_ / FILE_BASE_SIZE;
+    for(uint64_t i = 0; i < group_num; i++){
+        group_metas_[i].SetTypePersist(NVMGroupBlockType::UNKNOWN_TYPE);
+    }
+    map_mu_.Lock();
+    for(auto it : map_groups_){
+        delete it.second;
+    }
+    map_groups_.clear();
+    map_mu_.Unlock();
+    for(uint32_t i = 0; i < MAX_GROUP_BLOCK_TYPE; i++){
+        groups_[i] = nullptr;
+    }
+    bitmap_mu_.Lock();
+    bitmap_->reset();
+    bitmap_mu_.Unlock();
+    allocate_size.store(0);
+    free_size.store(0);
+}
+
+void NVMFileAllocator::SyncMeta(){
+    map_mu_.Lock();
+    for(auto it : map_groups_){
+        it.second->SyncMeta();
+    }
+    map_mu_.Unlock();
+    NvmFileAllocatorMeta meta;
+    meta.magic = 0;
+    meta.pool_size = mapped_len_;
+    meta.group_num = capacity_ / FILE_BASE_SIZE;
+    nvm_memcpy_persist(meta_, &meta, sizeof(NvmFileAllocatorMeta));
+    meta.magic = NVM_FILE_ALLOCATOR_MAGIC;
+    nvm_memcpy_persist(&(meta_->magic), &(meta.magic), sizeof(uint64_t));   //最后写magic
+}
+
+void NVMFileAllocator::GetAllocatedBlocks(uint64_t size, vector<pointer_t> &addrs){
+    NVMGroupBlockType type = SelectGroup(size);
+    MutexLock lock(&map_mu_);
+    for(auto it : map_groups_){
+        if(it.second->GetType() == type){
+            it.second->GetAllocatedBlocks(addrs);
+        }
+    }
+}
+
+void NVMFileAllocator::FinishRecovery(){
+    map_mu_.Lock();
+    for(auto it : map_groups_){
+        uint8_t type = static_cast<uint8_t>(it.second->GetType());
+        if(groups_[type] == nullptr && it.second->FreeSpace() > 0){
+            groups_[type] = it.second;
+        }
+    }
+    map_mu_.Unlock();
+}
+
 void NVMFileAllocator::PrintFileAllocatorStats(string &stats){
     char buf[1024];
     stats.append("--------File Alloc--------\n");
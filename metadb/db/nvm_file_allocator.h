@@ -15,7 +15,7 @@
 
 #include "metadb/libnvm.h"
 #include "../util/lock.h"
-#include "../util/bitmap.h"
+#include "../util/bitmap_tree.h"
 #include "format.h"
 
 #define FILE_GET_OFFSET(dst) (reinterpret_cast<char *>(dst) - metadb::file_pool_pointer)     //void *-> offset
@@ -23,6 +23,10 @@
 
 #define MAX_GROUP_BLOCK_TYPE  11
 
+#define NVM_FILE_ALLOCATOR_MAGIC 0x434f4c4c41454c46ULL   //"FLEALLOC"
+#define NVM_FILE_ALLOCATOR_META_SIZE 4096     //元数据头部大小，后面是每个group的NvmGroupMeta
+#define NVM_GROUP_BITMAP_SIZE ((FILE_BASE_SIZE / 1024 >> 3) + 8)   //按最小的1KB块划分时位图的字节数
+
 using namespace std;
 
 namespace metadb {
@@ -76,76 +80,46 @@ static inline uint64_t GetNVMGroupBlockSize(NVMGroupBlockType type){
 }
 
 
+struct NvmFileAllocatorMeta {   //位于file pool尾部
+    uint64_t magic;
+    uint64_t pool_size;
+    uint64_t group_num;
+};
+
+struct NvmGroupMeta {    //每个group在NVM中的类型和位图，类型为UNKNOWN_TYPE表示group未分配
+    uint64_t type;
+    char bitmap[NVM_GROUP_BITMAP_SIZE];
+
+    void SetTypePersist(NVMGroupBlockType new_type);
+};
+
 class NVMGroupManager {
 public:
-    NVMGroupManager(uint64_t id, NVMGroupBlockType type) : id_(id), type_(type) {
+    NVMGroupManager(uint64_t id, NVMGroupBlockType type, NvmGroupMeta *meta, bool is_load) : id_(id), type_(type), meta_(meta) {
         uint64_t block_size = GetNVMGroupBlockSize(type);
         free_blocks_ = FILE_BASE_SIZE / block_size;
-        bitmap_ = new BitMap(FILE_BASE_SIZE / block_size);
-        last_allocate_ = 0;
+        bitmap_ = new BitMapTree(FILE_BASE_SIZE / block_size);
+        if(is_load){   //从NVM中加载位图
+            bitmap_->load(meta_->bitmap, bitmap_->get_capacity());
+            free_blocks_ -= bitmap_->count();
+        }
     }
     ~NVMGroupManager() {
         delete bitmap_;
     }
     uint64_t GetId() { return id_; }
+    NVMGroupBlockType GetType() { return type_; }
 
     int Allocate(uint64_t size){
         MutexLock lock(&mu_);
-        int i = last_allocate_;
         uint64_t block_size = GetNVMGroupBlockSize(type_);
-        uint64_t max = FILE_BASE_SIZE / block_size;
         uint64_t need = (size + block_size - 1) / block_size;
-        uint64_t ok = 0;
-        for(; i < max;){
-            if(!bitmap_->get(i)) {
-                ok = 1;
-                while(ok < need && (i + ok) < max && !bitmap_->get(i + ok)){
-                    ok++;
-                }
-                if(ok >= need){  //申请成功
-                    last_allocate_ = i + ok;
-                    for(int j = 0; j < need; j++){
-                        bitmap_->set(i + j);
-                    }
-                    free_blocks_ -= need;
-                    return i * block_size;
-                }
-                else if((i + ok) >= max){  //地址超过
-                    break;
-                }
-                else{  //申请失败
-                    i += ok;
-                }
-            }
-            i++;
-        }
-        last_allocate_ = 0;
-        i = last_allocate_;
-
-        for(; i < max;){
-            if(!bitmap_->get(i)) {
-                ok = 1;
-                while(ok < need && (i + ok) < max && !bitmap_->get(i + ok)){
-                    ok++;
-                }
-                if(ok >= need){  //申请成功
-                    last_allocate_ = i + ok;
-                    for(uint64_t j = 0; j < need; j++){
-                        bitmap_->set(i + j);
-                    }
-                    free_blocks_ -= need;
-                    return i * block_size;
-                }
-                else if((i + ok) >= max){  //地址超过
-                    break;
-                }
-                else{  //申请失败
-                    i += ok;
-                }
-            }
-            i++;
-        }
-        return -1;  //申请失败
+        uint64_t i = bitmap_->find(need);
+        if(i == BITMAP_TREE_NOT_FOUND) return -1;  //申请失败
+        bitmap_->set_range(i, need);
+        PersistBitmap(i, need);
+        free_blocks_ -= need;
+        return i * block_size;
     }
 
     void Free(uint64_t offset, uint64_t size){
@@ -153,16 +127,39 @@ public:
         uint64_t block_size = GetNVMGroupBlockSize(type_);
         uint64_t index = offset / block_size;  //offset一定是block_size的倍数
         uint64_t num = (size + block_size - 1) / block_size;
+        bitmap_->clr_range(index, num);
+        PersistBitmap(index, num);
+        free_blocks_ += num;
+    }
+
+    void RecoverAllocate(uint64_t offset, uint64_t size){   //恢复时标记已分配的块，SyncMeta时写入NVM
+        MutexLock lock(&mu_);
+        uint64_t block_size = GetNVMGroupBlockSize(type_);
+        uint64_t index = offset / block_size;
+        uint64_t num = (size + block_size - 1) / block_size;
         for(uint64_t i = 0; i < num; i++){
-            bitmap_->clr(index + i);
+            if(!bitmap_->get(index + i)){
+                bitmap_->set(index + i);
+                free_blocks_--;
+            }
         }
-        free_blocks_ += num;
     }
 
     uint64_t FreeSpace() {
         uint64_t block_size = GetNVMGroupBlockSize(type_);
         return free_blocks_ * block_size;
     }
+
+    void GetAllocatedBlocks(vector<pointer_t> &addrs){   //所有已分配块的地址
+        MutexLock lock(&mu_);
+        uint64_t block_size = GetNVMGroupBlockSize(type_);
+        uint64_t max = FILE_BASE_SIZE / block_size;
+        for(uint64_t i = 0; i < max; i++){
+            if(bitmap_->get(i)) addrs.push_back(id_ * FILE_BASE_SIZE + i * block_size);
+        }
+    }
+
+    void SyncMeta();   //位图和类型整体写入NVM
     
 private:
     uint64_t id_;  //在nvm中的index；
@@ -172,8 +169,10 @@ private:
     //uint64_t max_block_;   //划分为block后的最大block num
     //uint64_t block_size_;
     Mutex mu_;     //操作的锁
-    BitMap *bitmap_;  //group内部的位图
-    uint64_t last_allocate_;
+    BitMapTree *bitmap_;  //group内部的位图
+    NvmGroupMeta *meta_;   //NVM中对应的位图
+
+    void PersistBitmap(uint64_t index, uint64_t num);   //调用者持有mu_
 };
 
 class NVMFileAllocator {
@@ -188,14 +187,23 @@ public:
     void Free(pointer_t addr, uint64_t len);
     char *GetPmemAddr() { return pmemaddr_; }
 
+    //持久化的分配信息
+    int LoadMeta();      //从NVM加载每个group的位图，元数据无效返回-1
+    void ResetMeta();    //清空分配信息，并标记NVM中的元数据无效
+    void SyncMeta();     //把所有group的位图整体写入NVM，并标记元数据有效
+
+    void RecoverAllocate(pointer_t addr, uint64_t len);   //恢复时标记已分配空间，完成后需要SyncMeta
+    void FinishRecovery();   //恢复完成，未满的group继续用于分配
+    void GetAllocatedBlocks(uint64_t size, vector<pointer_t> &addrs);   //size对应类型的group中所有已分配块
+
     //统计
     void PrintFileAllocatorStats(string &stats);
 
     void Sync(){
         if (is_pmem_)
-            pmem_persist(pmemaddr_, capacity_);
+            pmem_persist(pmemaddr_, mapped_len_);
         else
-            pmem_msync(pmemaddr_, capacity_);
+            pmem_msync(pmemaddr_, mapped_len_);
     }
 
     inline void nvm_persist(void *pmemdest, size_t len){
@@ -265,11 +273,12 @@ public:
 private:
     char* pmemaddr_;
     uint64_t mapped_len_;
-    uint64_t capacity_;
+    uint64_t capacity_;   //可分配的大小，尾部是元数据
     int is_pmem_;
+    NvmFileAllocatorMeta *meta_;
+    NvmGroupMeta *group_metas_;   //每个group一个
     Mutex bitmap_mu_;     //bitmap_的锁
-    BitMap *bitmap_;  //划分为64MB后的group位图
-    uint64_t last_allocate_;
+    BitMapTree *bitmap_;  //划分为64MB后的group位图
 
     NVMGroupManager * groups_[MAX_GROUP_BLOCK_TYPE];   //groups_不用vector，正在分配的NVMGroupManager
     Mutex groups_mu_[MAX_GROUP_BLOCK_TYPE];  //对groups_[i]进行操作的锁，
@@ -285,6 +294,7 @@ private:
 
     uint64_t GetFreeIndex();
     void SetFreeIndex(uint64_t index);
+    void ReleaseNVMGroupManager(NVMGroupManager *group);
     NVMGroupBlockType SelectGroup(uint64_t size);
     NVMGroupManager *CreateNVMGroupManager(NVMGroupBlockType type);
 
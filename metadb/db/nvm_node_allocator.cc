@@ -7,6 +7,7 @@
 
 #include <assert.h>
 #include "nvm_node_allocator.h"
+#include "epoch_manager.h"
 #include "metadb/debug.h"
 
 namespace metadb {
@@ -20,7 +21,7 @@ int InitNVMNodeAllocator(const std::string path, uint64_t size){
     return 0;
 }
 
-NVMNodeAllocator::NVMNodeAllocator(const std::string path, uint64_t size){
+NVMNodeAllocator::NVMNodeAllocator(const std::string path, uint64_t size) : log_cv_(&log_mu_) {
     pmemaddr_ = static_cast<char *>(pmem_map_file(path.c_str(), size, PMEM_FILE_CREATE, 0666, &mapped_len_, &is_pmem_));
                 
     if (pmemaddr_ == nullptr) {
@@ -30,10 +31,28 @@ NVMNodeAllocator::NVMNodeAllocator(const std::string path, uint64_t size){
         DBG_LOG("node allocator ok. path:%s size:%lu mapped_len:%lu is_pmem:%d addr:%p", path.c_str(), size, mapped_len_, is_pmem_, pmemaddr_);
     }
     assert(size == mapped_len_);
-    capacity_ = size;
 
-    bitmap_ = new BitMap(capacity_ / NODE_BASE_SIZE);
-    last_allocate_ = START_ALLOCATOR_INDEX;
+    //尾部依次为元数据头部、持久化位图、redo日志，位图覆盖整个pool，尾部的块不会被分配
+    uint64_t bitmap_size = ((mapped_len_ / NODE_BASE_SIZE) >> 3) + 1;
+    uint64_t bitmap_space = (bitmap_size + NODE_BASE_SIZE - 1) & (~(NODE_BASE_SIZE - 1));
+    uint64_t meta_space = NVM_NODE_ALLOCATOR_META_SIZE + bitmap_space + NVM_ALLOC_LOG_SLOT_NUM * NVM_ALLOC_LOG_SLOT_SIZE;
+    assert(meta_space < mapped_len_);
+    capacity_ = (mapped_len_ - meta_space) & (~(NODE_BASE_SIZE - 1));
+    bitmap_ = new BitMapTree(mapped_len_ / NODE_BASE_SIZE, START_ALLOCATOR_INDEX, capacity_ / NODE_BASE_SIZE);   //第0块是超级块
+    assert(bitmap_->get_capacity() == bitmap_size);
+    meta_ = reinterpret_cast<NvmNodeAllocatorMeta *>(pmemaddr_ + capacity_);
+    nvm_bitmap_ = reinterpret_cast<char *>(meta_) + NVM_NODE_ALLOCATOR_META_SIZE;
+    logs_ = reinterpret_cast<NvmAllocLogRecord *>(nvm_bitmap_ + bitmap_space);
+    assert(sizeof(NvmAllocLogRecord) == NVM_ALLOC_LOG_SLOT_SIZE);
+    for(uint32_t i = 0; i < NVM_ALLOC_LOG_SLOT_NUM; i++){
+        free_log_slots_.push_back(i);
+    }
+    pthread_key_create(&cache_key_, &NVMNodeAllocator::ThreadCacheDestructor);
+    for(int cls = 0; cls < NODE_CACHE_CLASS_NUM; cls++){
+        retired_hits_[cls] = 0;
+        retired_misses_[cls] = 0;
+        retired_drains_[cls] = 0;
+    }
 
     allocate_size.store(0);
     free_size.store(0);
@@ -41,86 +60,162 @@ NVMNodeAllocator::NVMNodeAllocator(const std::string path, uint64_t size){
 
 NVMNodeAllocator::~NVMNodeAllocator(){
     //PrintBitmap();
+    pthread_key_delete(cache_key_);   //之后线程退出不再回调ThreadCacheDestructor
+    for(auto it : caches_){
+        delete it;
+    }
+    caches_.clear();
     Sync();
     pmem_unmap(pmemaddr_, mapped_len_);
     delete bitmap_;
 }
 
+uint64_t NVMNodeAllocator::FindFreeIndex(uint64_t need){   //调用者持有mu_，只修改DRAM位图，失败返回0
+    uint64_t i = bitmap_->find(need);
+    if(i == BITMAP_TREE_NOT_FOUND) return 0;
+    bitmap_->set_range(i, need);
+    return i;
+}
+
 uint64_t NVMNodeAllocator::GetFreeIndex(uint64_t size){
-    //mu_.Lock();
-    MutexLock lock(&mu_);
-    uint64_t i = last_allocate_;
-    uint64_t max = capacity_ / NODE_BASE_SIZE;
     uint64_t need = size / NODE_BASE_SIZE;
-    uint64_t ok = 0;
-    for(; i < max;){
-        if(!bitmap_->get(i)) {
-            ok = 1;
-            while(ok < need && (i + ok) < max && !bitmap_->get(i + ok)){
-                ok++;
-            }
-            if(ok >= need){  //申请成功
-                last_allocate_ = i + ok;
-                for(uint64_t j = 0; j < need; j++){
-                    bitmap_->set(i + j);
-                }
-                //mu_.Unlock();
-                return i;
-            }
-            else if((i + ok) >= max){  //地址超过
-                break;
-            }
-            else{  //申请失败
-                i += ok;
-            }
-        }
-        i++;
+    mu_.Lock();
+    uint64_t i = FindFreeIndex(need);
+    mu_.Unlock();
+    if(i == 0){
+        ERROR_PRINT("node allocate failed, no free space! size:%lu\n", size);
+        exit(-1);
     }
-    last_allocate_ = START_ALLOCATOR_INDEX;
-    i = last_allocate_;
+    SetNvmBitmap(i, need, true);
+    return i;
+}
 
-    for(; i < max;){
-        if(!bitmap_->get(i)) {
-            ok = 1;
-            while(ok < need && (i + ok) < max && !bitmap_->get(i + ok)){
-                ok++;
-            }
-            if(ok >= need){  //申请成功
-                last_allocate_ = i + ok;
-                for(uint64_t j = 0; j < need; j++){
-                    bitmap_->set(i + j);
-                }
-                //mu_.Unlock();
-                return i;
-            }
-            else if((i + ok) >= max){  //地址超过
-                break;
-            }
-            else{  //申请失败
-                i += ok;
-            }
+void NVMNodeAllocator::SetFreeIndex(uint64_t index, uint64_t num){   //只修改DRAM位图
+    MutexLock lock(&mu_);
+    bitmap_->clr_range(index, num);
+}
+
+//NVM位图只记录已交给使用者的块，线程缓存中的块只在DRAM位图中置位，所以按位原子修改，不从DRAM位图拷贝
+void NVMNodeAllocator::SetNvmBitmap(uint64_t index, uint64_t num, bool is_set){
+    for(uint64_t k = index; k < index + num; k++){
+        uint8_t *byte = reinterpret_cast<uint8_t *>(nvm_bitmap_ + (k >> 3));
+        uint8_t mask = static_cast<uint8_t>(1 << (k & 7));
+        if(is_set){
+            __atomic_fetch_or(byte, mask, __ATOMIC_RELAXED);
+        } else {
+            __atomic_fetch_and(byte, static_cast<uint8_t>(~mask), __ATOMIC_RELAXED);
         }
-        i++;
     }
-    ERROR_PRINT("node allocate failed, no free space! size:%lu\n", size);
-    exit(-1);
-    return 0;
+    nvm_persist(nvm_bitmap_ + (index >> 3), ((index + num - 1) >> 3) - (index >> 3) + 1);
+}
+
+static inline int NodeCacheClass(uint64_t blocks){   //定长节点对应的线程缓存，-1表示不缓存
+    switch (blocks) {
+        case 1:
+            return 0;    //256B，B+树索引节点、inode hash节点
+        case 2:
+            return 1;    //512B，LinkNode
+        case 4:
+            return 2;    //1024B，B+树叶子节点
+        default:
+            return -1;
+    }
+}
+
+static inline uint64_t NodeCacheClassBlocks(int cls){
+    return 1ULL << cls;
+}
+
+void NVMNodeAllocator::ThreadCacheDestructor(void *arg){
+    NodeThreadCache *cache = static_cast<NodeThreadCache *>(arg);
+    node_allocator->ReleaseThreadCache(cache);
+}
 
+NodeThreadCache *NVMNodeAllocator::GetThreadCache(){
+    NodeThreadCache *cache = static_cast<NodeThreadCache *>(pthread_getspecific(cache_key_));
+    if(cache == nullptr){
+        cache = new NodeThreadCache();
+        pthread_setspecific(cache_key_, cache);
+        caches_mu_.Lock();
+        caches_.insert(cache);
+        caches_mu_.Unlock();
+    }
+    return cache;
+}
+
+void NVMNodeAllocator::ReleaseThreadCache(NodeThreadCache *cache){   //线程退出，缓存的块还给全局位图
+    caches_mu_.Lock();
+    caches_.erase(cache);
+    for(int cls = 0; cls < NODE_CACHE_CLASS_NUM; cls++){
+        retired_hits_[cls] += cache->hits[cls].load(std::memory_order_relaxed);
+        retired_misses_[cls] += cache->misses[cls].load(std::memory_order_relaxed);
+        retired_drains_[cls] += cache->drains[cls].load(std::memory_order_relaxed);
+    }
+    caches_mu_.Unlock();
+    cache->mu.Lock();
+    for(int cls = 0; cls < NODE_CACHE_CLASS_NUM; cls++){
+        DrainCache(cache, cls, cache->free_index[cls].size());
+    }
+    cache->mu.Unlock();
+    delete cache;
 }
 
-void NVMNodeAllocator::SetFreeIndex(uint64_t offset, uint64_t len){
+void NVMNodeAllocator::RefillCache(NodeThreadCache *cache, int cls){   //调用者持有cache->mu
+    uint64_t blocks = NodeCacheClassBlocks(cls);
     MutexLock lock(&mu_);
-    uint64_t index = offset / NODE_BASE_SIZE;
-    uint64_t num = len / NODE_BASE_SIZE;
-    for(uint64_t i = 0; i < num; i++){
-        bitmap_->clr(index + i);
+    uint64_t run = FindFreeIndex(blocks * NODE_CACHE_BATCH);   //优先整段取，只更新一次位图树
+    if(run != 0){
+        for(uint32_t n = NODE_CACHE_BATCH; n > 0; n--){   //低地址的节点先分配
+            cache->free_index[cls].push_back(run + (n - 1) * blocks);
+        }
+        return ;
+    }
+    for(uint32_t n = 0; n < NODE_CACHE_BATCH; n++){
+        uint64_t i = FindFreeIndex(blocks);
+        if(i == 0) break;
+        cache->free_index[cls].push_back(i);
     }
-    //DBG_LOG("Node Free: offset:%lu, len:%lu", offset, len);
+}
+
+void NVMNodeAllocator::DrainCache(NodeThreadCache *cache, int cls, uint64_t num){   //调用者持有cache->mu
+    if(num == 0) return ;
+    uint64_t blocks = NodeCacheClassBlocks(cls);
+    vector<uint64_t> &list = cache->free_index[cls];
+    MutexLock lock(&mu_);
+    for(uint64_t n = 0; n < num && !list.empty(); n++){
+        uint64_t index = list.back();
+        list.pop_back();
+        bitmap_->clr_range(index, blocks);
+    }
+    cache->drains[cls].fetch_add(1, std::memory_order_relaxed);
 }
 
 void *NVMNodeAllocator::Allocate(uint64_t size){  
     uint64_t allocated = (size + NODE_BASE_SIZE - 1) & (~(NODE_BASE_SIZE - 1));  //保证按照NODE_BASE_SIZE分配
-    uint64_t index = GetFreeIndex(allocated);
+    uint64_t index = 0;
+    int cls = NodeCacheClass(allocated / NODE_BASE_SIZE);
+    if(cls >= 0){   //定长节点先从线程缓存中取，缓存空时从全局位图批量取
+        NodeThreadCache *cache = GetThreadCache();
+        cache->mu.Lock();
+        if(cache->free_index[cls].empty()){
+            cache->misses[cls].fetch_add(1, std::memory_order_relaxed);
+            RefillCache(cache, cls);
+        } else {
+            cache->hits[cls].fetch_add(1, std::memory_order_relaxed);
+        }
+        if(!cache->free_index[cls].empty()){
+            index = cache->free_index[cls].back();
+            cache->free_index[cls].pop_back();
+        }
+        cache->mu.Unlock();
+        if(index == 0){
+            ERROR_PRINT("node allocate failed, no free space! size:%lu\n", size);
+            exit(-1);
+        }
+        SetNvmBitmap(index, allocated / NODE_BASE_SIZE, true);
+    } else {
+        index = GetFreeIndex(allocated);
+    }
     //DBG_LOG("Node Allocate: size:%lu allocated:%lu index:%lu offset:%lu", size, allocated, index, index * NODE_BASE_SIZE);
     allocate_size.fetch_add(allocated, std::memory_order_relaxed);
     return static_cast<void *>(pmemaddr_ + index * NODE_BASE_SIZE);
@@ -134,19 +229,209 @@ void *NVMNodeAllocator::AllocateAndInit(uint64_t size, int c){
 }
 
 void NVMNodeAllocator::Free(void *addr, uint64_t len){
+    Free(static_cast<pointer_t>(static_cast<char *>(addr) - pmemaddr_), len);
+}
+
+void NVMNodeAllocator::Free(pointer_t addr, uint64_t len){
     uint64_t allocated = (len + NODE_BASE_SIZE - 1) & (~(NODE_BASE_SIZE - 1));  //保证按照NODE_BASE_SIZE分配
-    uint64_t offset = static_cast<char *>(addr) - pmemaddr_;
+    uint64_t offset = addr;
     assert(offset < capacity_);
-    SetFreeIndex(offset, allocated);
+    SetNvmBitmap(offset / NODE_BASE_SIZE, allocated / NODE_BASE_SIZE, false);
+    ReleaseIndex(offset / NODE_BASE_SIZE, allocated / NODE_BASE_SIZE);
     free_size.fetch_add(allocated, std::memory_order_relaxed);
 }
 
-void NVMNodeAllocator::Free(pointer_t addr, uint64_t len){
-    uint64_t allocated = (len + NODE_BASE_SIZE - 1) & (~(NODE_BASE_SIZE - 1));  //保证按照NODE_BASE_SIZE分配
+void NVMNodeAllocator::Retire(void *addr, uint64_t len){
+    Retire(static_cast<pointer_t>(static_cast<char *>(addr) - pmemaddr_), len);
+}
+
+//NVM位图立即清除，crash后节点直接是空闲的；DRAM中等所有读者离开后才放回，避免读者遍历时被重新分配覆盖
+void NVMNodeAllocator::Retire(pointer_t addr, uint64_t len){
+    uint64_t allocated = (len + NODE_BASE_SIZE - 1) & (~(NODE_BASE_SIZE - 1));
     uint64_t offset = addr;
     assert(offset < capacity_);
-    SetFreeIndex(offset, allocated);
+    SetNvmBitmap(offset / NODE_BASE_SIZE, allocated / NODE_BASE_SIZE, false);
     free_size.fetch_add(allocated, std::memory_order_relaxed);
+    if(epoch_manager == nullptr){
+        ReleaseIndex(offset / NODE_BASE_SIZE, allocated / NODE_BASE_SIZE);
+        return ;
+    }
+    epoch_manager->Retire(&NVMNodeAllocator::RetireCallback, reinterpret_cast<void *>(offset / NODE_BASE_SIZE), allocated / NODE_BASE_SIZE);
+}
+
+void NVMNodeAllocator::RetireCallback(void *arg, uint64_t num){
+    node_allocator->ReleaseIndex(reinterpret_cast<uint64_t>(arg), num);
+}
+
+void NVMNodeAllocator::ReleaseIndex(uint64_t index, uint64_t num){   //只修改DRAM，调用前NVM位图已清除
+    int cls = NodeCacheClass(num);
+    if(cls >= 0){   //放回线程缓存，DRAM位图保持置位，缓存过多时批量还给全局位图
+        NodeThreadCache *cache = GetThreadCache();
+        cache->mu.Lock();
+        cache->free_index[cls].push_back(index);
+        if(cache->free_index[cls].size() > 2 * NODE_CACHE_BATCH){
+            DrainCache(cache, cls, NODE_CACHE_BATCH);
+        }
+        cache->mu.Unlock();
+    } else {
+        SetFreeIndex(index, num);
+    }
+}
+
+uint32_t NVMNodeAllocator::AcquireLogSlot(){
+    MutexLock lock(&log_mu_);
+    while(free_log_slots_.empty()){
+        log_cv_.Wait();
+    }
+    uint32_t slot = free_log_slots_.back();
+    free_log_slots_.pop_back();
+    return slot;
+}
+
+void NVMNodeAllocator::ReleaseLogSlot(uint32_t slot){
+    MutexLock lock(&log_mu_);
+    free_log_slots_.push_back(slot);
+    log_cv_.Signal();
+}
+
+void NVMNodeAllocator::CommitWithLog(NodeLogOp &op){
+    bool need_log = !op.free_nodes.empty() && op.free_nodes.size() <= NVM_ALLOC_LOG_MAX_NODES;
+    for(auto &it : op.free_nodes){
+        if(((it.second + NODE_BASE_SIZE - 1) / NODE_BASE_SIZE) > NVM_ALLOC_LOG_MAX_BLOCKS){
+            need_log = false;
+        }
+    }
+    if(!need_log){   //没有释放的节点，直接修改即可；日志放不下的退化为先修改再释放，crash时可能泄漏
+        if(op.target != nullptr) nvm_memcpy_persist(op.target, &op.value, sizeof(uint64_t));
+        for(auto &it : op.free_nodes){
+            Retire(it.first, it.second);
+        }
+        return ;
+    }
+
+    uint32_t slot = AcquireLogSlot();
+    NvmAllocLogRecord *record = &(logs_[slot]);
+    uint64_t buf[NVM_ALLOC_LOG_SLOT_SIZE / 8];
+    buf[0] = (op.target == nullptr) ? INVALID_POINTER : NODE_GET_OFFSET(op.target);
+    buf[1] = op.value;
+    buf[2] = op.free_nodes.size();
+    for(uint32_t i = 0; i < op.free_nodes.size(); i++){
+        buf[3 + i] = op.free_nodes[i].first | ((op.free_nodes[i].second + NODE_BASE_SIZE - 1) / NODE_BASE_SIZE);
+    }
+    nvm_memcpy_persist(&(record->target), buf, (3 + op.free_nodes.size()) * sizeof(uint64_t));
+    uint64_t valid = 1;
+    nvm_memcpy_persist(&(record->valid), &valid, sizeof(uint64_t));   //日志生效
+
+    if(op.target != nullptr) nvm_memcpy_persist(op.target, &op.value, sizeof(uint64_t));
+    for(auto &it : op.free_nodes){   //节点可能正被无锁读者遍历，延迟回收
+        Retire(it.first, it.second);
+    }
+
+    valid = 0;
+    nvm_memcpy_persist(&(record->valid), &valid, sizeof(uint64_t));
+    ReleaseLogSlot(slot);
+}
+
+uint64_t NVMNodeAllocator::ReplayLog(){   //只在加载元数据时调用，直接修改NVM位图
+    uint64_t replay_nums = 0;
+    for(uint32_t i = 0; i < NVM_ALLOC_LOG_SLOT_NUM; i++){
+        NvmAllocLogRecord *record = &(logs_[i]);
+        if(record->valid == 0) continue;
+        DBG_LOG("[alloc] replay log slot:%u target:%lu value:%lu num:%lu", i, record->target, record->value, record->num);
+        if(!IS_INVALID_POINTER(record->target)){
+            nvm_memcpy_persist(NODE_GET_POINTER(record->target), &(record->value), sizeof(uint64_t));
+        }
+        for(uint64_t j = 0; j < record->num && j < NVM_ALLOC_LOG_MAX_NODES; j++){
+            uint64_t index = (record->free_nodes[j] & (~(NODE_BASE_SIZE - 1))) / NODE_BASE_SIZE;
+            uint64_t blocks = record->free_nodes[j] & (NODE_BASE_SIZE - 1);
+            for(uint64_t k = index; k < index + blocks; k++){
+                nvm_bitmap_[k >> 3] &= ~(1 << (k & 7));
+            }
+            nvm_persist(nvm_bitmap_ + (index >> 3), ((index + blocks - 1) >> 3) - (index >> 3) + 1);
+        }
+        uint64_t valid = 0;
+        nvm_memcpy_persist(&(record->valid), &valid, sizeof(uint64_t));
+        replay_nums++;
+    }
+    return replay_nums;
+}
+
+int NVMNodeAllocator::LoadMeta(uint64_t &replay_nums){
+    replay_nums = 0;
+    if(meta_->magic != NVM_NODE_ALLOCATOR_MAGIC || meta_->pool_size != mapped_len_ || meta_->bitmap_size != static_cast<uint64_t>(bitmap_->get_capacity())){
+        DBG_LOG("[alloc] node allocator meta invalid, magic:%lx pool_size:%lu bitmap_size:%lu", meta_->magic, meta_->pool_size, meta_->bitmap_size);
+        return -1;
+    }
+    replay_nums = ReplayLog();
+    ClearThreadCaches();
+    MutexLock lock(&mu_);
+    bitmap_->load(nvm_bitmap_, bitmap_->get_capacity());
+    allocate_size.store(bitmap_->count() * NODE_BASE_SIZE);
+    free_size.store(0);
+    return 0;
+}
+
+void NVMNodeAllocator::ResetMeta(){
+    uint64_t magic = 0;
+    nvm_memcpy_persist(&(meta_->magic), &magic, sizeof(uint64_t));
+    for(uint32_t i = 0; i < NVM_ALLOC_LOG_SLOT_NUM; i++){
+        nvm_memcpy_persist(&(logs_[i].valid), &magic, sizeof(uint64_t));
+    }
+    ClearThreadCaches();
+    MutexLock lock(&mu_);
+    bitmap_->reset();
+    allocate_size.store(0);
+    free_size.store(0);
+}
+
+void NVMNodeAllocator::ClearThreadCaches(){   //丢弃所有线程缓存中的块，只在重建位图前调用
+    MutexLock lock(&caches_mu_);
+    for(auto it : caches_){
+        it->mu.Lock();
+        for(int cls = 0; cls < NODE_CACHE_CLASS_NUM; cls++){
+            it->free_index[cls].clear();
+        }
+        it->mu.Unlock();
+    }
+}
+
+void NVMNodeAllocator::SyncMeta(){
+    mu_.Lock();
+    nvm_memcpy_persist(nvm_bitmap_, bitmap_->get_bitmap(), bitmap_->get_capacity());
+    mu_.Unlock();
+    caches_mu_.Lock();
+    for(auto it : caches_){   //线程缓存中的块没有交给使用者，NVM中不能置位
+        it->mu.Lock();
+        for(int cls = 0; cls < NODE_CACHE_CLASS_NUM; cls++){
+            for(auto index : it->free_index[cls]){
+                SetNvmBitmap(index, NodeCacheClassBlocks(cls), false);
+            }
+        }
+        it->mu.Unlock();
+    }
+    caches_mu_.Unlock();
+    NvmNodeAllocatorMeta meta;
+    meta.magic = 0;
+    meta.pool_size = mapped_len_;
+    meta.bitmap_size = bitmap_->get_capacity();
+    nvm_memcpy_persist(meta_, &meta, sizeof(NvmNodeAllocatorMeta));
+    meta.magic = NVM_NODE_ALLOCATOR_MAGIC;
+    nvm_memcpy_persist(&(meta_->magic), &(meta.magic), sizeof(uint64_t));   //最后写magic
+}
+
+void NVMNodeAllocator::RecoverAllocate(const vector<pair<pointer_t, uint64_t>> &nodes){
+    uint64_t recovered = 0;
+    mu_.Lock();
+    for(auto &it : nodes){   //只改DRAM位图，SyncMeta时整体写入NVM
+        uint64_t allocated = (it.second + NODE_BASE_SIZE - 1) & (~(NODE_BASE_SIZE - 1));
+        assert(it.first < capacity_);
+        uint64_t index = it.first / NODE_BASE_SIZE;
+        uint64_t num = allocated / NODE_BASE_SIZE;
+        bitmap_->set_range(index, num);
+        recovered += allocated;
+    }
+    mu_.Unlock();
+    allocate_size.fetch_add(recovered, std::memory_order_relaxed);
 }
 
 void NVMNodeAllocator::PrintNodeAllocatorStats(string &stats){
@@ -164,12 +449,52 @@ void NVMNodeAllocator::PrintNodeAllocatorStats(string &stats){
     double use = alloc - free;
     snprintf(buf, sizeof(buf), "alloc:%.3f KB free:%.3f KB use:%.3f KB \n", alloc, free, use);
     stats.append(buf);
+
+    mu_.Lock();
+    snprintf(buf, sizeof(buf), "bitmap tree: depth:%u free_blocks:%lu max_free_run:%lu\n", bitmap_->get_depth(), bitmap_->free_count(), bitmap_->max_free_run());
+    mu_.Unlock();
+    stats.append(buf);
+
+    uint64_t hits[NODE_CACHE_CLASS_NUM], misses[NODE_CACHE_CLASS_NUM], drains[NODE_CACHE_CLASS_NUM], cached[NODE_CACHE_CLASS_NUM];
+    uint64_t thread_nums = 0;
+    caches_mu_.Lock();
+    for(int cls = 0; cls < NODE_CACHE_CLASS_NUM; cls++){
+        hits[cls] = retired_hits_[cls];
+        misses[cls] = retired_misses_[cls];
+        drains[cls] = retired_drains_[cls];
+        cached[cls] = 0;
+    }
+    for(auto it : caches_){
+        it->mu.Lock();
+        for(int cls = 0; cls < NODE_CACHE_CLASS_NUM; cls++){
+            hits[cls] += it->hits[cls].load(std::memory_order_relaxed);
+            misses[cls] += it->misses[cls].load(std::memory_order_relaxed);
+            drains[cls] += it->drains[cls].load(std::memory_order_relaxed);
+            cached[cls] += it->free_index[cls].size();
+        }
+        it->mu.Unlock();
+        thread_nums++;
+    }
+    caches_mu_.Unlock();
+    snprintf(buf, sizeof(buf), "thread cache: threads:%lu batch:%u\n", thread_nums, NODE_CACHE_BATCH);
+    stats.append(buf);
+    for(int cls = 0; cls < NODE_CACHE_CLASS_NUM; cls++){
+        uint64_t total = hits[cls] + misses[cls];
+        snprintf(buf, sizeof(buf), "  size:%lu hits:%lu misses:%lu hit_rate:%.2f%% drains:%lu cached:%lu\n", NodeCacheClassBlocks(cls) * NODE_BASE_SIZE, \
+                hits[cls], misses[cls], (total == 0) ? 0.0 : 100.0 * hits[cls] / total, drains[cls], cached[cls]);
+        stats.append(buf);
+    }
     stats.append("--------------------------\n");
 }
 
+uint64_t NVMNodeAllocator::GetFreeSpace(){
+    MutexLock lock(&mu_);
+    return bitmap_->free_count() * NODE_BASE_SIZE;
+}
+
 void NVMNodeAllocator::PrintBitmap(){
     uint64_t max = capacity_ / NODE_BASE_SIZE;
-    DBG_LOG("[bitmap] capacity:%u", bitmap_->get_capacity());
+    DBG_LOG("[bitmap] capacity:%lu", bitmap_->get_capacity());
     for(uint64_t i = 0; i < max; i += 64){
         string temp;
         for(uint64_t j = 0; j < 64 && (i + j) < max;j++){
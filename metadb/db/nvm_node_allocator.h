@@ -8,12 +8,15 @@
 #define _METADB_NVM_NODE_ALLOCATOR_H_
 
 #include <stdint.h>
+#include <pthread.h>
 #include <string>
 #include <atomic>
+#include <vector>
+#include <set>
 
 #include "metadb/libnvm.h"
 #include "../util/lock.h"
-#include "../util/bitmap.h"
+#include "../util/bitmap_tree.h"
 #include "format.h"
 
 #define NODE_GET_OFFSET(dst) (reinterpret_cast<char *>(dst) - metadb::node_pool_pointer)     //void *-> offset
@@ -27,6 +30,56 @@ class NVMNodeAllocator;
 extern char *node_pool_pointer;
 extern NVMNodeAllocator *node_allocator;
 
+#define NVM_NODE_ALLOCATOR_MAGIC 0x434f4c4c4145444eULL   //"NEDALLOC"
+#define NVM_NODE_ALLOCATOR_META_SIZE 256      //元数据头部大小
+#define NVM_ALLOC_LOG_SLOT_NUM 64             //redo日志槽数，即同时进行的带日志操作数上限
+#define NVM_ALLOC_LOG_SLOT_SIZE 1024
+#define NVM_ALLOC_LOG_HEADER_SIZE 32
+#define NVM_ALLOC_LOG_MAX_NODES ((NVM_ALLOC_LOG_SLOT_SIZE - NVM_ALLOC_LOG_HEADER_SIZE) / 8)
+#define NVM_ALLOC_LOG_MAX_BLOCKS 255          //日志中每个节点的块数存在offset的低8位
+
+struct NvmNodeAllocatorMeta {    //位于node pool尾部，后面依次是持久化位图和redo日志
+    uint64_t magic;
+    uint64_t pool_size;     //映射的文件大小，不一致说明不是同一个pool
+    uint64_t bitmap_size;   //位图字节数
+};
+
+struct NvmAllocLogRecord {   //一次操作的redo日志：改写target处的8字节，并释放free_nodes
+    uint64_t valid;      //非0说明日志完整，重启时需要重做
+    pointer_t target;    //node pool中的偏移，INVALID_POINTER表示只释放节点
+    uint64_t value;
+    uint64_t num;
+    uint64_t free_nodes[NVM_ALLOC_LOG_MAX_NODES];   //offset | 块数
+};
+
+#define NODE_CACHE_CLASS_NUM 3    //线程缓存的定长节点：256B、512B、1024B
+#define NODE_CACHE_BATCH 32       //线程缓存每次从全局位图取的节点数，缓存超过2倍时归还同样个数
+
+struct NodeThreadCache {   //每个线程的定长节点缓存，缓存中的块只在DRAM位图中置位
+    Mutex mu;    //基本只有所属线程使用，统计和重建位图时其它线程也会访问
+    vector<uint64_t> free_index[NODE_CACHE_CLASS_NUM];   //块的index
+    atomic<uint64_t> hits[NODE_CACHE_CLASS_NUM];
+    atomic<uint64_t> misses[NODE_CACHE_CLASS_NUM];
+    atomic<uint64_t> drains[NODE_CACHE_CLASS_NUM];
+
+    NodeThreadCache() {
+        for(int i = 0; i < NODE_CACHE_CLASS_NUM; i++){
+            free_index[i].reserve(2 * NODE_CACHE_BATCH + 1);
+            hits[i].store(0);
+            misses[i].store(0);
+            drains[i].store(0);
+        }
+    }
+};
+
+struct NodeLogOp {   //需要原子完成的修改，由CommitWithLog写日志后执行
+    void *target;    //8字节的修改位置，nullptr表示只释放节点
+    uint64_t value;
+    vector<pair<pointer_t, uint64_t>> free_nodes;   //<offset, len>
+
+    NodeLogOp() : target(nullptr), value(0) {}
+};
+
 class NVMNodeAllocator {
 public:
     NVMNodeAllocator(const std::string path, uint64_t size);
@@ -37,17 +90,33 @@ public:
 
     void Free(void *addr, uint64_t len);
     void Free(pointer_t addr, uint64_t len);
+    //节点可能还在被无锁读者访问，NVM中立即释放，DRAM中由epoch_manager延迟到读者离开后再分配
+    void Retire(void *addr, uint64_t len);
+    void Retire(pointer_t addr, uint64_t len);
     char *GetPmemAddr() { return pmemaddr_; }
 
+    //先写redo日志，再修改target并释放节点（Retire），crash后重启时重做，保证修改和释放同时生效
+    void CommitWithLog(NodeLogOp &op);
+
+    //持久化的分配信息
+    int LoadMeta(uint64_t &replay_nums);   //从NVM加载位图并重做未完成的日志，元数据无效返回-1
+    void ResetMeta();    //清空分配信息，并标记NVM中的元数据无效
+    void SyncMeta();     //把DRAM位图整体写入NVM，并标记元数据有效
+
+    //恢复时把遍历到的可达节点标记为已分配，pair为<offset, len>，完成后需要SyncMeta
+    void RecoverAllocate(const vector<pair<pointer_t, uint64_t>> &nodes);
+
     //统计
     void PrintNodeAllocatorStats(string &stats);
+    uint64_t GetCapacity() { return capacity_; }
+    uint64_t GetFreeSpace();   //全局位图中的空闲空间，不含线程缓存
     void PrintBitmap();
 
     void Sync(){
         if (is_pmem_)
-            pmem_persist(pmemaddr_, capacity_);
+            pmem_persist(pmemaddr_, mapped_len_);
         else
-            pmem_msync(pmemaddr_, capacity_);
+            pmem_msync(pmemaddr_, mapped_len_);
     }
 
     inline void nvm_persist(void *pmemdest, size_t len){
@@ -117,19 +186,45 @@ public:
 private:
     char* pmemaddr_;
     uint64_t mapped_len_;
-    uint64_t capacity_;
+    uint64_t capacity_;   //可分配的大小，尾部是元数据
     int is_pmem_;
     Mutex mu_;
-    BitMap *bitmap_;
-
-    uint64_t last_allocate_;
+    BitMapTree *bitmap_;    //DRAM位图，带空闲段索引
+
+    NvmNodeAllocatorMeta *meta_;
+    char *nvm_bitmap_;    //NVM中的位图，和bitmap_逐字节对应
+    NvmAllocLogRecord *logs_;
+    Mutex log_mu_;
+    CondVar log_cv_;
+    vector<uint32_t> free_log_slots_;
+
+    pthread_key_t cache_key_;   //每个线程的NodeThreadCache
+    Mutex caches_mu_;
+    set<NodeThreadCache *> caches_;   //所有线程缓存，caches_mu_保护
+    uint64_t retired_hits_[NODE_CACHE_CLASS_NUM];   //已退出线程的统计，caches_mu_保护
+    uint64_t retired_misses_[NODE_CACHE_CLASS_NUM];
+    uint64_t retired_drains_[NODE_CACHE_CLASS_NUM];
 
     //统计
     atomic<uint64_t> allocate_size;
     atomic<uint64_t> free_size;
 
+    uint64_t FindFreeIndex(uint64_t need);
     uint64_t GetFreeIndex(uint64_t size);
-    void SetFreeIndex(uint64_t offset, uint64_t len);
+    void SetFreeIndex(uint64_t index, uint64_t num);
+    void ReleaseIndex(uint64_t index, uint64_t num);
+    static void RetireCallback(void *arg, uint64_t num);
+    void SetNvmBitmap(uint64_t index, uint64_t num, bool is_set);
+
+    static void ThreadCacheDestructor(void *arg);
+    NodeThreadCache *GetThreadCache();
+    void ReleaseThreadCache(NodeThreadCache *cache);
+    void RefillCache(NodeThreadCache *cache, int cls);
+    void DrainCache(NodeThreadCache *cache, int cls, uint64_t num);
+    void ClearThreadCaches();
+    uint32_t AcquireLogSlot();
+    void ReleaseLogSlot(uint32_t slot);
+    uint64_t ReplayLog();
 
 };
 
@@ -0,0 +1,107 @@
+/**
+ * @Description : NVM中的根结构，重启时从这里找到所有hashtable
+ */
+#ifndef _METADB_SUPER_BLOCK_H_
+#define _METADB_SUPER_BLOCK_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include "format.h"
+#include "nvm_node_allocator.h"
+
+namespace metadb {
+
+#define METADB_SUPER_BLOCK_MAGIC 0x4244415445444d53ULL    //"SMDETADB"
+#define METADB_SUPER_BLOCK_OFFSET 0     //node pool的第0块，START_ALLOCATOR_INDEX保证不会被分配
+#define METADB_DROP_SLOT_NUM 16         //同时进行的DirDropAll个数上限，superblock不能超过NODE_BASE_SIZE
+
+struct NvmHashTableMeta {     //hashtable在NVM中的根，记录当前版本和正在rehash版本的buckets
+    pointer_t buckets;
+    uint64_t capacity;
+    pointer_t rehash_buckets;   //不为空说明正在rehash
+    uint64_t rehash_capacity;
+
+    NvmHashTableMeta() : buckets(INVALID_POINTER), capacity(0), rehash_buckets(INVALID_POINTER), rehash_capacity(0) {}
+    ~NvmHashTableMeta() {}
+
+    bool IsRehash() {
+        return !IS_INVALID_POINTER(rehash_buckets) && rehash_buckets != buckets;
+    }
+
+    void SetVersionPersist(pointer_t new_buckets, uint64_t new_capacity){
+        char buff[16];
+        memcpy(buff, &new_buckets, 8);
+        memcpy(buff + 8, &new_capacity, 8);
+        node_allocator->nvm_memcpy_persist(&buckets, buff, 16);
+    }
+
+    void SetRehashVersionPersist(pointer_t new_buckets, uint64_t new_capacity){
+        char buff[16];
+        memcpy(buff, &new_buckets, 8);
+        memcpy(buff + 8, &new_capacity, 8);
+        node_allocator->nvm_memcpy_persist(&rehash_buckets, buff, 16);
+    }
+};
+
+static inline NvmHashTableMeta *AllocNvmHashTableMeta(){
+    return static_cast<NvmHashTableMeta *>(node_allocator->AllocateAndInit(sizeof(NvmHashTableMeta), 0));
+}
+
+struct MetaDBSuperBlock {
+    uint64_t magic;       //最后写入，magic有效说明下面的根都已持久化
+    uint64_t dir_first_hash_capacity;
+    uint64_t inode_zone_num;
+    pointer_t dir_root;       //一级DirHashTable的NvmHashTableMeta
+    pointer_t inode_roots;    //NvmHashTableMeta数组，每个InodeZone一个
+    pointer_t batch_log;      //WriteBatch的redo日志区，旧版本创建的数据库为INVALID_POINTER
+    pointer_t drop_records[METADB_DROP_SLOT_NUM];   //未回收完的DirDropAll记录（NvmDirDropRecord），空闲为INVALID_POINTER
+
+    bool IsValid() {
+        return magic == METADB_SUPER_BLOCK_MAGIC;
+    }
+
+    void SetMagicPersist(uint64_t new_magic){
+        node_allocator->nvm_memcpy_persist(&magic, &new_magic, 8);
+    }
+
+    void SetRootsPersist(uint64_t dir_capacity, uint64_t zone_num, pointer_t dir, pointer_t inode){
+        char buff[32];
+        memcpy(buff, &dir_capacity, 8);
+        memcpy(buff + 8, &zone_num, 8);
+        memcpy(buff + 16, &dir, 8);
+        memcpy(buff + 24, &inode, 8);
+        node_allocator->nvm_memcpy_persist(&dir_first_hash_capacity, buff, 32);
+    }
+
+    void SetBatchLogPersist(pointer_t log){
+        node_allocator->nvm_memcpy_persist(&batch_log, &log, 8);
+    }
+
+    void SetDropRecordPersist(uint32_t slot, pointer_t record){
+        node_allocator->nvm_memcpy_persist(&(drop_records[slot]), &record, 8);
+    }
+
+    void ClearDropRecordsPersist(){
+        pointer_t records[METADB_DROP_SLOT_NUM];
+        for(uint32_t i = 0; i < METADB_DROP_SLOT_NUM; i++){
+            records[i] = INVALID_POINTER;
+        }
+        node_allocator->nvm_memcpy_persist(drop_records, records, sizeof(records));
+    }
+};
+
+static inline MetaDBSuperBlock *GetSuperBlock(){
+    return static_cast<MetaDBSuperBlock *>(NODE_GET_POINTER(METADB_SUPER_BLOCK_OFFSET));
+}
+
+} // namespace name
+
+
+
+
+
+
+
+
+#endif
@@ -100,6 +100,17 @@ public:
         return t;
     }
 
+    static void RunParallel(uint32_t count, void (*function)(void*), void* arg) {   //新建count个线程运行同一任务，等待全部结束
+        vector<pthread_t> threads;
+        threads.reserve(count);
+        for(uint32_t i = 0; i < count; i++) {
+            threads.push_back(StartThread(function, arg));
+        }
+        for(auto it : threads){
+            pthread_join(it, NULL);
+        }
+    }
+
     void WaitForBGJob(){  //等待后台任务完成
         while(true){
             mu_.Lock();
@@ -0,0 +1,106 @@
+#include <string.h>
+
+#include "metadb/write_batch.h"
+
+namespace metadb {
+
+static const uint32_t WRITE_BATCH_OP_HEADER_SIZE = 1 + sizeof(inode_id_t) + 4;   //type|key|len
+
+WriteBatch::WriteBatch() : count_(0) {}
+
+WriteBatch::~WriteBatch() {}
+
+void WriteBatch::AppendOp(WriteBatchOpType type, const inode_id_t key, const Slice &data){
+    char buf[WRITE_BATCH_OP_HEADER_SIZE];
+    uint32_t len = data.size();
+    buf[0] = static_cast<char>(type);
+    memcpy(buf + 1, &key, sizeof(inode_id_t));
+    memcpy(buf + 1 + sizeof(inode_id_t), &len, 4);
+    rep_.append(buf, WRITE_BATCH_OP_HEADER_SIZE);
+    rep_.append(data.data(), data.size());
+    count_++;
+}
+
+void WriteBatch::DirPut(const inode_id_t key, const Slice &fname, const inode_id_t value, const uint8_t type){
+    AppendOp(WriteBatchOpType::kDirPut, key, fname);
+    inode_id_t stored = DirEntryEncode(value, type);
+    rep_.append(reinterpret_cast<const char *>(&stored), sizeof(inode_id_t));
+}
+
+void WriteBatch::DirDelete(const inode_id_t key, const Slice &fname){
+    AppendOp(WriteBatchOpType::kDirDelete, key, fname);
+}
+
+void WriteBatch::InodePut(const inode_id_t key, const Slice &value){
+    AppendOp(WriteBatchOpType::kInodePut, key, value);
+}
+
+void WriteBatch::InodePut(const inode_id_t key, const Slice &value, uint32_t attr_size){
+    AppendOp(WriteBatchOpType::kInodePutAttr, key, value);
+    rep_.append(reinterpret_cast<const char *>(&attr_size), 4);
+}
+
+void WriteBatch::InodeDelete(const inode_id_t key){
+    AppendOp(WriteBatchOpType::kInodeDelete, key, Slice());
+}
+
+void WriteBatch::Clear(){
+    rep_.clear();
+    count_ = 0;
+}
+
+int WriteBatch::Iterate(Handler *handler) const {
+    return Iterate(Slice(rep_), handler);
+}
+
+int WriteBatch::Iterate(const Slice &rep, Handler *handler){
+    const char *p = rep.data();
+    const char *end = rep.data() + rep.size();
+    while(p < end){
+        if(static_cast<uint64_t>(end - p) < WRITE_BATCH_OP_HEADER_SIZE) return -1;
+        WriteBatchOpType type = static_cast<WriteBatchOpType>(p[0]);
+        inode_id_t key;
+        uint32_t len;
+        memcpy(&key, p + 1, sizeof(inode_id_t));
+        memcpy(&len, p + 1 + sizeof(inode_id_t), 4);
+        p += WRITE_BATCH_OP_HEADER_SIZE;
+        if(static_cast<uint64_t>(end - p) < len) return -1;
+        Slice data(p, len);
+        p += len;
+
+        int res = 0;
+        switch(type){
+            case WriteBatchOpType::kDirPut: {
+                if(static_cast<uint64_t>(end - p) < sizeof(inode_id_t)) return -1;
+                inode_id_t value;
+                memcpy(&value, p, sizeof(inode_id_t));
+                p += sizeof(inode_id_t);
+                res = handler->DirPut(key, data, value);
+                break;
+            }
+            case WriteBatchOpType::kDirDelete:
+                res = handler->DirDelete(key, data);
+                break;
+            case WriteBatchOpType::kInodePut:
+                res = handler->InodePut(key, data);
+                break;
+            case WriteBatchOpType::kInodeDelete:
+                res = handler->InodeDelete(key);
+                break;
+            case WriteBatchOpType::kInodePutAttr: {
+                if(static_cast<uint64_t>(end - p) < 4) return -1;
+                uint32_t attr_size;
+                memcpy(&attr_size, p, 4);
+                p += 4;
+                res = handler->InodePut(key, data, attr_size);
+                break;
+            }
+            default:
+                return -1;
+        }
+        if(res == -1) return -1;
+    }
+    return 0;
+}
+
+} // namespace name
@@ -12,6 +12,7 @@
 #include "metadb/option.h"
 #include "metadb/slice.h"
 #include "metadb/iterator.h"
+#include "metadb/write_batch.h"
 #include "metadb/debug.h"
 
 
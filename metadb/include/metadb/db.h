@@ -13,6 +13,7 @@
 #include "metadb/slice.h"
 #include "metadb/inode.h"
 #include "metadb/iterator.h"
+#include "metadb/write_batch.h"
 
 namespace metadb {
 
@@ -24,15 +25,36 @@ public:
     DB() { };
     virtual ~DB() { };
 
-    virtual int DirPut(const inode_id_t key, const Slice &fname, const inode_id_t value) = 0;
+    //type和目录项一起保存，遍历目录时不用再读inode，value不能超过MAX_INODE_ID_KEY
+    virtual int DirPut(const inode_id_t key, const Slice &fname, const inode_id_t value, const uint8_t type = 0) = 0;
     virtual int DirGet(const inode_id_t key, const Slice &fname, inode_id_t &value) = 0;
     virtual int DirDelete(const inode_id_t key, const Slice &fname) = 0;
+    //原子地将目录项(old_key, old_fname)改名为(new_key, new_fname)，新目录项已存在则覆盖；旧目录项不存在返回2
+    virtual int DirRename(const inode_id_t old_key, const Slice &old_fname, const inode_id_t new_key, const Slice &new_fname) = 0;
+    //同上，replaced返回被覆盖的目录项指向的inode，没有覆盖时为INVALID_INODE_ID_KEY；
+    //delete_replaced为true时被覆盖的inode和改名写在同一条日志中删除，crash后不会留下没有目录项的inode
+    virtual int DirRename(const inode_id_t old_key, const Slice &old_fname, const inode_id_t new_key, const Slice &new_fname, inode_id_t &replaced, bool delete_replaced) = 0;
+    //删除目录key下的所有目录项，前台只摘除目录项，子inode及其子树由后台回收；摘下的内容先持久化，crash后重启继续回收；
+    //删除子inode前调用Option::drop_inode_callback；目录为空返回2
+    virtual int DirDropAll(const inode_id_t key) = 0;
+    //遍历目录target，iterator遍历的是拷贝到DRAM的目录项，不受并发写影响，也不阻塞写者；
+    //默认按段拷贝，每段是一个时间点的快照，Option::DIR_ITERATOR_FULL_SNAPSHOT时整个目录是一个快照
     virtual Iterator* DirGetIterator(const inode_id_t target) = 0;
 
     virtual int InodePut(const inode_id_t key, const Slice &value) = 0;
+    //value的前attr_size字节是属性，与之后的数据分开存放：InodeGetAttr只读属性，只修改属性的InodeUpdateRange不重写数据
+    virtual int InodePut(const inode_id_t key, const Slice &value, uint32_t attr_size) = 0;
     virtual int InodeGet(const inode_id_t key, std::string &value) = 0;
+    //只读value的属性部分；value不是按属性和数据分开写入的，返回整个value
+    virtual int InodeGetAttr(const inode_id_t key, std::string &attr) = 0;
+    //只修改value中[offset, offset + data.size())的字节，持久化的只有修改的部分；key不存在返回2，越界返回-1
+    virtual int InodeUpdateRange(const inode_id_t key, uint32_t offset, const Slice &data) = 0;
+    //批量读num个inode，rets[i]为keys[i]的返回值，与InodeGet相同；批内预取，适合遍历目录后读所有子inode
+    virtual void InodeMultiGet(const inode_id_t *keys, uint32_t num, std::string *values, int *rets) = 0;
     virtual int InodeDelete(const inode_id_t key) = 0;
 
+    //batch中的修改原子生效，crash后重启时重做未完成的batch
+    virtual int Write(const WriteBatch &batch) = 0;
 
     virtual void WaitForBGJob() = 0;
     ///统计
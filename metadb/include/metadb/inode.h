@@ -9,13 +9,27 @@
 
 #include <stdint.h>
 #define INVALID_INODE_ID_KEY  0
-#define MAX_INODE_ID_KEY UINT64_MAX
+#define DIR_ENTRY_TYPE_SHIFT 56   //目录项value的高8位保存目录项类型，inode id只使用低56位
+#define MAX_INODE_ID_KEY ((1ULL << DIR_ENTRY_TYPE_SHIFT) - 1)
 #define MAX_FNAME_LEN 180
 
 namespace metadb {
 
 typedef uint64_t inode_id_t;
 
+//目录项在NVM中保存的value：|type 8bit|inode id 56bit|，type由上层定义，0表示未知
+static inline inode_id_t DirEntryEncode(inode_id_t value, uint8_t type) {
+    return (value & MAX_INODE_ID_KEY) | (static_cast<uint64_t>(type) << DIR_ENTRY_TYPE_SHIFT);
+}
+
+static inline inode_id_t DirEntryInode(inode_id_t stored) {
+    return stored & MAX_INODE_ID_KEY;
+}
+
+static inline uint8_t DirEntryType(inode_id_t stored) {
+    return static_cast<uint8_t>(stored >> DIR_ENTRY_TYPE_SHIFT);
+}
+
 static inline int compare_inode_id(inode_id_t a, inode_id_t b) {
     if(a < b) {
         return -1;
@@ -15,20 +15,31 @@
 using namespace std;
 namespace metadb {
 
+struct DirEntryView {   //NextBatch返回的目录项，fname指向iterator内部的缓冲区，下一次NextBatch、Seek或释放iterator前有效
+    Slice fname;
+    uint64_t hash_fname;
+    inode_id_t value;  //子inode，不带类型
+    uint8_t type;      //DirPut时写入的目录项类型
+};
+
 class Iterator {
 public:
     Iterator() {};
     virtual ~Iterator() {};
 
     virtual bool Valid() const = 0;
-    //virtual void Seek(const Slice& target) = 0;
+    virtual void Seek(const uint64_t hash_fname) = 0;   //目录项按hash_fname有序，定位到第一个hash_fname >= 目标的目录项
     virtual void SeekToFirst() = 0;
     virtual void SeekToLast() = 0;
     virtual void Next() = 0;
     virtual void Prev() = 0;
     virtual string fname() const = 0;
     virtual uint64_t hash_fname() const = 0;
-    virtual inode_id_t value() const = 0;
+    virtual inode_id_t value() const = 0;   //子inode，类型由type()单独返回
+    virtual uint8_t type() const = 0;
+
+    //从当前位置最多取max个目录项并前移，返回取到的个数，不为fname分配内存
+    virtual uint32_t NextBatch(DirEntryView *entries, uint32_t max) = 0;
 };
 
 
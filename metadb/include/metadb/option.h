@@ -11,6 +11,8 @@
 #include <stdint.h>
 #include <string>
 
+#include "metadb/inode.h"
+
 using namespace std;
 namespace metadb {
 
@@ -20,16 +22,30 @@ public:
     uint64_t DIR_LINKNODE_TRAN_SECOND_HASH_NUM = 16;   //dir中linknode 个数超过该值，转成二级hash
     uint64_t DIR_SECOND_HASH_INIT_SIZE = 16;   //dir中转成二级hash初始大小
     double DIR_SECOND_HASH_TRIG_REHASH_TIMES = 1.5;  //dir中二级hash节点个数达到多少倍进行扩展
+    bool DIR_ITERATOR_FULL_SNAPSHOT = false;   //true时iterator先拷贝整个目录做时间点快照，内存随目录大小增长；默认分段拷贝
+    uint32_t DIR_ITERATOR_SNAPSHOT_RETRY = 8;   //iterator拷贝整个目录做时间点快照的最大重试次数，超过后改为分段拷贝
+    uint32_t DIR_ITERATOR_SEGMENT_NUM = 4096;   //分段拷贝时每段的目录项数，每段是一个时间点的快照
 
     uint64_t INODE_MAX_ZONE_NUM = 1024;   //inode 存储的一级hash最大数，inode id通过hash到一个一个zone里面
     uint64_t INODE_HASHTABLE_INIT_SIZE = 64;  //inode存储的hashtable的初始大小
     double INODE_HASHTABLE_TRIG_REHASH_TIMES = 1.5;  //inode存储的hashtable的node num 已经是capacity的INODE_HASHTABLE_TRIG_REHASH_TIMES倍，触发rehash
+    double INODE_GC_INVALID_RATIO = 0.5;   //inode文件中无效kv的比例达到该值时后台回收文件，0代表不回收
+    uint64_t INODE_GC_RATE_LIMIT = 64ULL * 1024 * 1024;   //所有zone的后台回收每秒总共最多拷贝的字节数，0代表不限速
+    uint64_t INODE_CACHE_CAPACITY = 0;   //DRAM中inode value缓存的字节数，0代表不缓存；读集中在能装下的热点上时开启，均匀随机读时未命中的开销大于收益
+    uint32_t INODE_DELTA_CHAIN_MAX = 4;   //InodeUpdateRange写入的delta链最大长度，达到后合并成完整value
     
     string node_allocator_path = "/pmem0/test/node.pool";
     uint64_t node_allocator_size = 80ULL * 1024 * 1024 * 1024;   //GB
     string file_allocator_path = "/pmem0/test/file.pool";
     uint64_t file_allocator_size = 80ULL * 1024 * 1024 * 1024;   //GB
     uint32_t thread_pool_count = 2;
+    bool use_existing_db = false;   //true时node pool中有有效的superblock则恢复已有数据；默认重新初始化，调用者的其他持久状态（如NSFS的inode计数）需自行保证能恢复
+    uint32_t recovery_thread_count = 0;   //恢复时的并行线程数，0代表使用所有cpu核
+    bool recovery_scan_nodes = false;   //恢复时不使用持久化的分配器元数据，遍历所有可达节点重建，可回收crash时泄漏的空间
+    //DirDropAll后台删除每个子inode前调用，value为inode的值，调用者据此释放DB之外的资源（如大文件的数据文件）；
+    //重启后继续未完成的回收时也会调用，可能对同一个inode调用多次
+    void (*drop_inode_callback)(void *arg, const inode_id_t key, const std::string &value) = nullptr;
+    void *drop_inode_callback_arg = nullptr;
 
     Option() {}
     ~Option() {}
@@ -41,13 +57,19 @@ public:
             DIR_FIRST_HASH_MAX_CAPACITY, DIR_LINKNODE_TRAN_SECOND_HASH_NUM);
         fprintf(stdout, "DIR_SECOND_HASH_INIT_SIZE:%lu DIR_SECOND_HASH_TRIG_REHASH_TIMES:%lf \n",  \
             DIR_SECOND_HASH_INIT_SIZE, DIR_SECOND_HASH_TRIG_REHASH_TIMES);
+        fprintf(stdout, "DIR_ITERATOR_FULL_SNAPSHOT:%d DIR_ITERATOR_SNAPSHOT_RETRY:%u DIR_ITERATOR_SEGMENT_NUM:%u \n",  \
+            DIR_ITERATOR_FULL_SNAPSHOT, DIR_ITERATOR_SNAPSHOT_RETRY, DIR_ITERATOR_SEGMENT_NUM);
         fprintf(stdout, "INODE_MAX_ZONE_NUM:%lu INODE_HASHTABLE_INIT_SIZE:%lu INODE_HASHTABLE_TRIG_REHASH_TIMES:%lf\n",  \
             INODE_MAX_ZONE_NUM, INODE_HASHTABLE_INIT_SIZE, INODE_HASHTABLE_TRIG_REHASH_TIMES);
+        fprintf(stdout, "INODE_GC_INVALID_RATIO:%lf INODE_GC_RATE_LIMIT:%lu MB/s\n",  \
+            INODE_GC_INVALID_RATIO, INODE_GC_RATE_LIMIT / (1024 * 1024));
+        fprintf(stdout, "INODE_CACHE_CAPACITY:%lu MB INODE_DELTA_CHAIN_MAX:%u\n", INODE_CACHE_CAPACITY / (1024 * 1024), INODE_DELTA_CHAIN_MAX);
         fprintf(stdout, "node_allocator_path:%s node_allocator_size:%lu MB\n",  \
             node_allocator_path.c_str(), node_allocator_size / (1024 * 1024));
         fprintf(stdout, "file_allocator_path:%s file_allocator_size:%lu MB\n",  \
             file_allocator_path.c_str(), file_allocator_size / (1024 * 1024));
         fprintf(stdout, "thread_pool_count:%u \n", thread_pool_count);
+        fprintf(stdout, "use_existing_db:%d recovery_thread_count:%u recovery_scan_nodes:%d \n", use_existing_db, recovery_thread_count, recovery_scan_nodes);
 
         fprintf(stdout, "------------------------------------\n");
         fflush(stdout);
@@ -0,0 +1,70 @@
+/**
+ * @Description : 多个dir/inode修改组成一个batch，由DB::Write原子地完成，crash后要么全部生效要么全部不生效
+ */
+#ifndef _METADB_WRITE_BATCH_H_
+#define _METADB_WRITE_BATCH_H_
+
+#include <stdint.h>
+#include <string>
+
+#include "metadb/slice.h"
+#include "metadb/inode.h"
+
+namespace metadb {
+
+enum class WriteBatchOpType : uint8_t {
+    kDirPut = 1,
+    kDirDelete = 2,
+    kInodePut = 3,
+    kInodeDelete = 4,
+    kInodePutAttr = 5,   //属性和数据分开存放的InodePut
+};
+
+class WriteBatch {
+public:
+    WriteBatch();
+    ~WriteBatch();
+
+    //按加入顺序执行，同一个key的多个修改以最后一个为准
+    void DirPut(const inode_id_t key, const Slice &fname, const inode_id_t value, const uint8_t type = 0);
+    void DirDelete(const inode_id_t key, const Slice &fname);
+    void InodePut(const inode_id_t key, const Slice &value);
+    void InodePut(const inode_id_t key, const Slice &value, uint32_t attr_size);   //同DB::InodePut
+    void InodeDelete(const inode_id_t key);
+
+    void Clear();
+    uint32_t Count() const { return count_; }
+    uint64_t ApproximateSize() const { return rep_.size(); }   //写入redo日志的大小
+
+    class Handler {   //遍历batch时每个修改的回调，返回-1停止遍历
+    public:
+        virtual ~Handler() {}
+        virtual int DirPut(const inode_id_t key, const Slice &fname, const inode_id_t value) = 0;   //value已带有目录项类型
+        virtual int DirDelete(const inode_id_t key, const Slice &fname) = 0;
+        virtual int InodePut(const inode_id_t key, const Slice &value) = 0;
+        virtual int InodePut(const inode_id_t key, const Slice &value, uint32_t attr_size) = 0;
+        virtual int InodeDelete(const inode_id_t key) = 0;
+    };
+    int Iterate(Handler *handler) const;
+
+    //rep为 type(1)|key(8)|len(4)|data|value(8，只有DirPut)|attr_size(4，只有InodePutAttr)，依次排列
+    const std::string &Rep() const { return rep_; }
+    static int Iterate(const Slice &rep, Handler *handler);   //格式错误返回-1
+
+private:
+    std::string rep_;
+    uint32_t count_;
+
+    void AppendOp(WriteBatchOpType type, const inode_id_t key, const Slice &data);
+};
+
+} // namespace name
+
+
+
+
+
+
+
+
+#endif
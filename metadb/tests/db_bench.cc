@@ -17,12 +17,15 @@
 #include <ctype.h>
 #include <assert.h>
 #include <string>
+#include <vector>
 #include <stdint.h>
 
 #include "../util/histogram.h"
 #include "../util/lock.h"
 #include "../include/metadb/all_header.h"
 #include "../db/thread_pool.h"
+#include "../db/nvm_node_allocator.h"
+#include "../db/inode_hashtable.h"
 
 using namespace std;
 using namespace metadb;
@@ -35,12 +38,30 @@ static const char* FLAGS_benchmarks =
     //"inode_fillrandom,"
     //"dir_readrandom,"
     //"inode_readrandom,"
+    //"inode_getattr,"     //同inode_readrandom，调用InodeGetAttr只读属性，inode_fillrandom时指定attr_size才有区别
+    //"inode_readhot,"     //90%的读落在前hot_ratio比例的key上，测试热点inode缓存
     //"dir_deleterandom,"
     //"inode_deleterandom,"
     //"dir_updaterandom,"
     //"inode_updaterandom,"
+    //"inode_patchfull,"    //在inode_fillrandom之后测试，修改value中patch_size字节：InodeGet后InodePut整个value，报告每次修改持久化的字节数
+    //"inode_patchrange,"   //同inode_patchfull，调用InodeUpdateRange只写入修改的字节
     //"dir_rangewrite,"  //为了dir_rangeread测试写入数据
     //"dir_rangeread,"
+    //"node_allocfill,"   //直接向node_allocator分配节点直到pool用到90%，按使用率统计分配延迟
+    //"dir_readscaling,"   //读线程数从1翻倍到FLAGS_scaling_max_threads，测试读吞吐的扩展性
+    //"inode_readscaling,"
+    //"inode_nodesearch,"   //DRAM中测试inode hash节点内查找，比较逐个比较key和指纹过滤
+    //"create_separate,"   //模拟创建文件：DirPut和InodePut分别调用
+    //"create_batch,"      //模拟创建文件：DirPut和InodePut放在一个WriteBatch中原子写入
+    //"rename_separate,"   //在create_*之后测试，DirGet、DirPut、DirDelete分别调用完成rename
+    //"rename_native,"     //在create_*之后测试，调用DirRename完成rename
+    //"drop_separate,"     //在create_*之后测试，删除整个目录：遍历目录，逐个DirDelete和InodeDelete
+    //"drop_native,"       //在create_*之后测试，删除整个目录：调用DirDropAll，只统计前台摘除的时间
+    //"readdir_iter,"      //在create_*之后测试，逐个Next读取目录项，每个目录项算一次op，目录大小由dir_files指定
+    //"readdir_batch,"     //同readdir_iter，用NextBatch批量读取目录项
+    //"readdir_stat,"      //模拟ls -l：NextBatch读取目录项后逐个InodeGet读子inode
+    //"readdir_plus,"      //同readdir_stat，用InodeMultiGet批量读子inode，模拟readdirplus
 
 static const char* FLAGS_db_path = "/home/lzw/ceshi";  //暂时没用
 
@@ -58,12 +79,27 @@ static uint64_t FLAGS_updates = 10000;
 
 static uint64_t FLAGS_range_len = 1000;
 
+//dir_fillrandom等随机测试中每个目录的文件数，1表示每个key只有一个fname，大于1时测试大目录（bptree）
+static uint64_t FLAGS_dir_files = 1;
+
+//inode_readhot中热点key占FLAGS_nums的比例
+static double FLAGS_hot_ratio = 0.05;
+
 // 测试线程个数，每个线程根据
 static int FLAGS_threads = 1;
 
+//readscaling测试的最大读线程数
+static int FLAGS_scaling_max_threads = 64;
+
 //value大小
 static int FLAGS_value_size = 8;  //目录树fname长度，inode stat长度 
 
+//inode_patch*每次修改的字节数，不超过value_size
+static int FLAGS_patch_size = 16;
+
+//inode value前attr_size字节作为属性与数据分开存放，0不分开；不为0时inode_patch*只修改属性部分
+static int FLAGS_attr_size = 0;
+
 static int FLAGS_histogram = 1;   //0关闭，1开启 
 
 //key 大小
@@ -77,11 +113,20 @@ static double FLAGS_k_DIR_SECOND_HASH_TRIG_REHASH_TIMES = 0;
 static uint64_t FLAGS_k_INODE_MAX_ZONE_NUM = 0;   
 static uint64_t FLAGS_k_INODE_HASHTABLE_INIT_SIZE = 0;  
 static double FLAGS_k_INODE_HASHTABLE_TRIG_REHASH_TIMES = 0; 
+static double FLAGS_k_INODE_GC_INVALID_RATIO = -1;   //小于0使用默认值，0关闭回收
+static double FLAGS_k_INODE_GC_RATE_LIMIT_MB = -1;   //MB/s，小于0使用默认值，0不限速
+static uint64_t FLAGS_k_INODE_CACHE_CAPACITY_MB = 0;   //0不缓存
+static int FLAGS_k_INODE_DELTA_CHAIN_MAX = -1;   //小于0使用默认值
 static string FLAGS_k_node_allocator_path;
 static uint64_t FLAGS_k_node_allocator_size = 0;   
 static string FLAGS_k_file_allocator_path;
 static uint64_t FLAGS_k_file_allocator_size = 0;   
 static uint32_t FLAGS_k_thread_pool_count = 0;
+static uint32_t FLAGS_k_recovery_thread_count = 0;
+static int FLAGS_k_recovery_scan_nodes = 0;
+
+//1表示打开已有的pool并恢复，0表示重新格式化
+static int FLAGS_use_existing_db = 0;
 
 
 
@@ -376,6 +421,7 @@ void PrintHeader() {
     fprintf(stdout, "Deletes:    %lu \n", (FLAGS_deletes) ? FLAGS_deletes : FLAGS_nums);
     fprintf(stdout, "Updates:    %lu \n", (FLAGS_updates) ? FLAGS_updates : FLAGS_nums);
     fprintf(stdout, "RangeLen:   %lu \n", (FLAGS_range_len) ? FLAGS_range_len : FLAGS_nums);
+    fprintf(stdout, "DirFiles:   %lu \n", FLAGS_dir_files);
     fprintf(stdout, "------------------------------------------------\n");
     fflush(stdout);
 }
@@ -388,11 +434,18 @@ void SetOption(Option & option){
     if(FLAGS_k_INODE_MAX_ZONE_NUM != 0) option.INODE_MAX_ZONE_NUM = FLAGS_k_INODE_MAX_ZONE_NUM;
     if(FLAGS_k_INODE_HASHTABLE_INIT_SIZE != 0) option.INODE_HASHTABLE_INIT_SIZE = FLAGS_k_INODE_HASHTABLE_INIT_SIZE;
     if(FLAGS_k_INODE_HASHTABLE_TRIG_REHASH_TIMES > 0) option.INODE_HASHTABLE_TRIG_REHASH_TIMES = FLAGS_k_INODE_HASHTABLE_TRIG_REHASH_TIMES;
+    if(FLAGS_k_INODE_GC_INVALID_RATIO >= 0) option.INODE_GC_INVALID_RATIO = FLAGS_k_INODE_GC_INVALID_RATIO;
+    if(FLAGS_k_INODE_GC_RATE_LIMIT_MB >= 0) option.INODE_GC_RATE_LIMIT = FLAGS_k_INODE_GC_RATE_LIMIT_MB * 1024 * 1024;
+    if(FLAGS_k_INODE_CACHE_CAPACITY_MB != 0) option.INODE_CACHE_CAPACITY = FLAGS_k_INODE_CACHE_CAPACITY_MB * 1024 * 1024;
+    if(FLAGS_k_INODE_DELTA_CHAIN_MAX >= 0) option.INODE_DELTA_CHAIN_MAX = FLAGS_k_INODE_DELTA_CHAIN_MAX;
     if(!FLAGS_k_node_allocator_path.empty()) option.node_allocator_path = FLAGS_k_node_allocator_path;
     if(FLAGS_k_node_allocator_size != 0) option.node_allocator_size = FLAGS_k_node_allocator_size;
     if(!FLAGS_k_file_allocator_path.empty()) option.file_allocator_path = FLAGS_k_file_allocator_path;
     if(FLAGS_k_file_allocator_size != 0) option.file_allocator_size = FLAGS_k_file_allocator_size;
     if(FLAGS_k_thread_pool_count != 0) option.thread_pool_count = FLAGS_k_thread_pool_count;
+    if(FLAGS_k_recovery_thread_count != 0) option.recovery_thread_count = FLAGS_k_recovery_thread_count;
+    option.recovery_scan_nodes = (FLAGS_k_recovery_scan_nodes != 0);
+    option.use_existing_db = (FLAGS_use_existing_db != 0);
 }
 
 void ThreadBody(void* v){
@@ -473,7 +526,7 @@ void DirRandomWrite(ThreadState* thread){
     for(int i = 0; i < nums; i++){
         //id = Random64(&seed);
         id = Random64(&seed) % FLAGS_nums;
-        key = id;
+        key = id / FLAGS_dir_files;
         value = id;
         snprintf(fname, FLAGS_value_size + 1, "%0*llu", FLAGS_value_size, id);
 
@@ -505,7 +558,11 @@ void InodeRandomWrite(ThreadState* thread){
         key = id;
         snprintf(value, FLAGS_value_size + 1, "%0*llu", FLAGS_value_size, id);
 
-        ret = thread->db->InodePut(key, Slice(value, FLAGS_value_size));
+        if(FLAGS_attr_size > 0){
+            ret = thread->db->InodePut(key, Slice(value, FLAGS_value_size), FLAGS_attr_size);
+        } else {
+            ret = thread->db->InodePut(key, Slice(value, FLAGS_value_size));
+        }
         if(ret != 0 && ret != 2){
             fprintf(stderr, "inode put error! key:%lu value:%.*s \n", key, FLAGS_value_size, value);
             fflush(stderr);
@@ -518,6 +575,258 @@ void InodeRandomWrite(ThreadState* thread){
     thread->stats.AddBytes(bytes);
 }
 
+void CreateFiles(ThreadState* thread, bool use_batch){   //父目录key为id/FLAGS_dir_files，文件inode为id
+    uint32_t seed = thread->tid + 1000;
+    uint64_t nums = FLAGS_nums / FLAGS_threads;
+
+    char *fname = new char[FLAGS_value_size + 1];
+    char *value = new char[FLAGS_value_size + 1];
+    uint64_t id = 0;
+    uint64_t bytes = 0;
+    int ret = 0;
+    WriteBatch batch;
+    for(int i = 0; i < nums; i++){
+        id = Random64(&seed) % FLAGS_nums;
+        inode_id_t parent = id / FLAGS_dir_files;
+        snprintf(fname, FLAGS_value_size + 1, "%0*llu", FLAGS_value_size, id);
+        snprintf(value, FLAGS_value_size + 1, "%0*llu", FLAGS_value_size, id);
+
+        if(use_batch){
+            batch.Clear();
+            batch.DirPut(parent, Slice(fname, FLAGS_value_size), id);
+            batch.InodePut(id, Slice(value, FLAGS_value_size));
+            ret = thread->db->Write(batch);
+        } else {
+            ret = thread->db->DirPut(parent, Slice(fname, FLAGS_value_size), id);
+            if(ret == 0 || ret == 2) ret = thread->db->InodePut(id, Slice(value, FLAGS_value_size));
+        }
+        if(ret != 0 && ret != 2){
+            fprintf(stderr, "create error! parent:%lu fname:%.*s id:%lu\n", parent, FLAGS_value_size, fname, id);
+            fflush(stderr);
+            exit(1);
+        }
+        bytes += (FLAGS_key_size + FLAGS_value_size + FLAGS_key_size) + (FLAGS_key_size + FLAGS_value_size);
+        thread->stats.FinishedOp(1, kBenchmarkWriteType);
+    }
+    delete[] fname;
+    delete[] value;
+    thread->stats.AddBytes(bytes);
+}
+
+void CreateSeparate(ThreadState* thread){
+    CreateFiles(thread, false);
+}
+
+void CreateBatch(ThreadState* thread){
+    CreateFiles(thread, true);
+}
+
+void RenameFiles(ThreadState* thread, bool use_native){   //id为偶数时在同一目录下改名，奇数时移到下一个目录
+    uint32_t seed = thread->tid + 1000;
+    uint64_t nums = FLAGS_nums / FLAGS_threads;
+
+    char *fname = new char[FLAGS_value_size + 1];
+    char *new_fname = new char[FLAGS_value_size + 1];
+    uint64_t id = 0;
+    uint64_t bytes = 0;
+    int ret = 0;
+    for(int i = 0; i < nums; i++){
+        id = Random64(&seed) % FLAGS_nums;
+        inode_id_t parent = id / FLAGS_dir_files;
+        inode_id_t new_parent = parent + (id & 1);
+        snprintf(fname, FLAGS_value_size + 1, "%0*llu", FLAGS_value_size, id);
+        snprintf(new_fname, FLAGS_value_size + 1, "r%0*llu", FLAGS_value_size - 1, id);
+
+        if(use_native){
+            ret = thread->db->DirRename(parent, Slice(fname, FLAGS_value_size), new_parent, Slice(new_fname, FLAGS_value_size));
+        } else {
+            inode_id_t value;
+            ret = thread->db->DirGet(parent, Slice(fname, FLAGS_value_size), value);
+            if(ret == 0) ret = thread->db->DirPut(new_parent, Slice(new_fname, FLAGS_value_size), value);
+            if(ret == 0 || ret == 2) ret = thread->db->DirDelete(parent, Slice(fname, FLAGS_value_size));
+        }
+        if(ret != 0 && ret != 2){
+            fprintf(stderr, "rename error! parent:%lu fname:%.*s new_parent:%lu\n", parent, FLAGS_value_size, fname, new_parent);
+            fflush(stderr);
+            exit(1);
+        }
+        bytes += (FLAGS_key_size + FLAGS_value_size) * 2;
+        thread->stats.FinishedOp(1, kBenchmarkWriteType);
+    }
+    delete[] fname;
+    delete[] new_fname;
+    thread->stats.AddBytes(bytes);
+}
+
+void RenameSeparate(ThreadState* thread){
+    RenameFiles(thread, false);
+}
+
+void RenameNative(ThreadState* thread){
+    RenameFiles(thread, true);
+}
+
+void DropDirs(ThreadState* thread, bool use_native){   //每个线程删除连续的一段目录，每个目录算一次op
+    uint64_t dir_nums = (FLAGS_nums + FLAGS_dir_files - 1) / FLAGS_dir_files;
+    uint64_t per_thread = (dir_nums + FLAGS_threads - 1) / FLAGS_threads;
+    uint64_t begin = thread->tid * per_thread;
+    uint64_t end = std::min(begin + per_thread, dir_nums);
+
+    uint64_t bytes = 0;
+    int ret = 0;
+    vector<pair<string, inode_id_t>> kvs;
+    for(inode_id_t parent = begin; parent < end; parent++){
+        if(use_native){
+            ret = thread->db->DirDropAll(parent);
+        } else {
+            kvs.clear();
+            Iterator *it = thread->db->DirGetIterator(parent);
+            if(it != nullptr){
+                for(it->SeekToFirst(); it->Valid(); it->Next()){
+                    kvs.push_back(make_pair(it->fname(), it->value()));
+                }
+                delete it;
+            }
+            ret = kvs.empty() ? 2 : 0;
+            for(auto &kv : kvs){
+                ret = thread->db->DirDelete(parent, Slice(kv.first));
+                if(ret == 0 || ret == 2) ret = thread->db->InodeDelete(kv.second);
+                if(ret != 0 && ret != 2) break;
+            }
+        }
+        if(ret != 0 && ret != 2){
+            fprintf(stderr, "drop error! parent:%lu\n", parent);
+            fflush(stderr);
+            exit(1);
+        }
+        bytes += FLAGS_key_size;
+        thread->stats.FinishedOp(1, kBenchmarkWriteType);
+    }
+    thread->stats.AddBytes(bytes);
+}
+
+void DropSeparate(ThreadState* thread){
+    DropDirs(thread, false);
+}
+
+void DropNative(ThreadState* thread){
+    DropDirs(thread, true);
+}
+
+void ReadDirs(ThreadState* thread, bool use_batch){   //每个线程遍历连续的一段目录，每个目录项算一次op
+    static const uint32_t kBatchSize = 128;
+    uint64_t dir_nums = (FLAGS_nums + FLAGS_dir_files - 1) / FLAGS_dir_files;
+    uint64_t per_thread = (dir_nums + FLAGS_threads - 1) / FLAGS_threads;
+    uint64_t begin = thread->tid * per_thread;
+    uint64_t end = std::min(begin + per_thread, dir_nums);
+
+    DirEntryView entries[kBatchSize];
+    string fname;
+    uint64_t found = 0;
+    uint64_t bytes = 0;
+    uint64_t check = 0;   //使用读到的结果，避免被优化掉
+    for(inode_id_t parent = begin; parent < end; parent++){
+        uint64_t num = 0;
+        Iterator *it = thread->db->DirGetIterator(parent);
+        if(it != nullptr){
+            if(use_batch){
+                it->SeekToFirst();
+                uint32_t n;
+                while((n = it->NextBatch(entries, kBatchSize)) > 0){
+                    for(uint32_t i = 0; i < n; i++){
+                        bytes += entries[i].fname.size();
+                        check += entries[i].value;
+                    }
+                    num += n;
+                }
+            } else {
+                for(it->SeekToFirst(); it->Valid(); it->Next()){
+                    fname = it->fname();
+                    bytes += fname.size();
+                    check += it->value();
+                    num++;
+                }
+            }
+            delete it;
+        }
+        found += num;
+        thread->stats.FinishedOp(num, kBenchmarkRangeReadType);
+    }
+    thread->stats.AddBytes(bytes);
+
+    char msg[100];
+    snprintf(msg, sizeof(msg), "(%lu entries in %lu dirs, check %lu)", found, end > begin ? end - begin : 0, check);
+    thread->stats.AddMessage(msg);
+}
+
+void ReadDirIter(ThreadState* thread){
+    ReadDirs(thread, false);
+}
+
+void ReadDirBatch(ThreadState* thread){
+    ReadDirs(thread, true);
+}
+
+void ReadDirsWithInodes(ThreadState* thread, bool use_multiget){   //每个目录项连同子inode算一次op
+    static const uint32_t kBatchSize = 64;
+    uint64_t dir_nums = (FLAGS_nums + FLAGS_dir_files - 1) / FLAGS_dir_files;
+    uint64_t per_thread = (dir_nums + FLAGS_threads - 1) / FLAGS_threads;
+    uint64_t begin = thread->tid * per_thread;
+    uint64_t end = std::min(begin + per_thread, dir_nums);
+
+    DirEntryView entries[kBatchSize];
+    inode_id_t keys[kBatchSize];
+    string values[kBatchSize];
+    int rets[kBatchSize];
+    uint64_t found = 0;
+    uint64_t missing = 0;
+    uint64_t bytes = 0;
+    for(inode_id_t parent = begin; parent < end; parent++){
+        uint64_t num = 0;
+        Iterator *it = thread->db->DirGetIterator(parent);
+        if(it != nullptr){
+            it->SeekToFirst();
+            uint32_t n;
+            while((n = it->NextBatch(entries, kBatchSize)) > 0){
+                for(uint32_t i = 0; i < n; i++){
+                    keys[i] = entries[i].value;
+                }
+                if(use_multiget){
+                    thread->db->InodeMultiGet(keys, n, values, rets);
+                } else {
+                    for(uint32_t i = 0; i < n; i++){
+                        rets[i] = thread->db->InodeGet(keys[i], values[i]);
+                    }
+                }
+                for(uint32_t i = 0; i < n; i++){
+                    if(rets[i] == 0){
+                        bytes += entries[i].fname.size() + values[i].size();
+                    } else {
+                        missing++;
+                    }
+                }
+                num += n;
+            }
+            delete it;
+        }
+        found += num;
+        thread->stats.FinishedOp(num, kBenchmarkRangeReadType);
+    }
+    thread->stats.AddBytes(bytes);
+
+    char msg[100];
+    snprintf(msg, sizeof(msg), "(%lu entries in %lu dirs, %lu inodes missing)", found, end > begin ? end - begin : 0, missing);
+    thread->stats.AddMessage(msg);
+}
+
+void ReadDirStat(ThreadState* thread){
+    ReadDirsWithInodes(thread, false);
+}
+
+void ReadDirPlus(ThreadState* thread){
+    ReadDirsWithInodes(thread, true);
+}
+
 void DirRandomRead(ThreadState* thread){
     uint32_t seed = thread->tid + 1000;
     uint64_t nums = (FLAGS_reads == 0) ? FLAGS_nums / FLAGS_threads : FLAGS_reads / FLAGS_threads;
@@ -531,7 +840,7 @@ void DirRandomRead(ThreadState* thread){
     for(int i = 0; i < nums; i++){
         //id = Random64(&seed);
         id = Random64(&seed) % FLAGS_nums;
-        key = id;
+        key = id / FLAGS_dir_files;
         value = 0;
         snprintf(fname, FLAGS_value_size + 1, "%0*llu", FLAGS_value_size, id);
 
@@ -558,7 +867,7 @@ void DirRandomRead(ThreadState* thread){
     thread->stats.AddMessage(msg);
 }
 
-void InodeRandomRead(ThreadState* thread){
+static void InodeRead(ThreadState* thread, bool attr_only){
     uint32_t seed = thread->tid + 1000;
     uint64_t nums = (FLAGS_reads == 0) ? FLAGS_nums / FLAGS_threads : FLAGS_reads / FLAGS_threads;
 
@@ -572,7 +881,7 @@ void InodeRandomRead(ThreadState* thread){
         id = Random64(&seed) % FLAGS_nums;
         key = id;
 
-        ret = thread->db->InodeGet(key, value);
+        ret = attr_only ? thread->db->InodeGetAttr(key, value) : thread->db->InodeGet(key, value);
         if(ret != 0 && ret != 2){
             fprintf(stderr, "inode get error! key:%lu \n", key);
             fflush(stderr);
@@ -592,6 +901,40 @@ void InodeRandomRead(ThreadState* thread){
     thread->stats.AddMessage(msg);
 }
 
+void InodeRandomRead(ThreadState* thread){
+    InodeRead(thread, false);
+}
+
+void InodeRandomGetAttr(ThreadState* thread){
+    InodeRead(thread, true);
+}
+
+void InodeHotRead(ThreadState* thread){
+    uint32_t seed = thread->tid + 1000;
+    uint64_t nums = (FLAGS_reads == 0) ? FLAGS_nums / FLAGS_threads : FLAGS_reads / FLAGS_threads;
+    uint64_t hot_nums = std::max(static_cast<uint64_t>(FLAGS_nums * FLAGS_hot_ratio), 1UL);
+
+    string value;
+    uint64_t found = 0;
+    int ret = 0;
+    for(int i = 0; i < nums; i++){
+        uint64_t r = Random64(&seed);
+        inode_id_t key = (r % 10 != 0) ? (r / 10) % hot_nums : (r / 10) % FLAGS_nums;
+        ret = thread->db->InodeGet(key, value);
+        if(ret != 0 && ret != 2){
+            fprintf(stderr, "inode get error! key:%lu \n", key);
+            fflush(stderr);
+            exit(1);
+        }
+        if(ret == 0) found++;
+        thread->stats.FinishedOp(1, kBenchmarkReadType);
+    }
+
+    char msg[100];
+    snprintf(msg, sizeof(msg), "(%lu of %lu found, %lu hot keys)", found, nums, hot_nums);
+    thread->stats.AddMessage(msg);
+}
+
 void DirRandomDelete(ThreadState* thread){
     uint32_t seed = thread->tid + 1000;
     uint64_t nums = (FLAGS_deletes == 0) ? FLAGS_nums / FLAGS_threads : FLAGS_deletes / FLAGS_threads;
@@ -603,7 +946,7 @@ void DirRandomDelete(ThreadState* thread){
     for(int i = 0; i < nums; i++){
         //id = Random64(&seed);
         id = Random64(&seed) % FLAGS_nums;
-        key = id;
+        key = id / FLAGS_dir_files;
         snprintf(fname, FLAGS_value_size + 1, "%0*llu", FLAGS_value_size, id);
 
         ret = thread->db->DirDelete(key, Slice(fname, FLAGS_value_size));
@@ -652,7 +995,7 @@ void DirRandomUpdate(ThreadState* thread){
     for(int i = 0; i < nums; i++){
         //id = Random64(&seed);
         id = Random64(&seed) % FLAGS_nums;
-        key = id;
+        key = id / FLAGS_dir_files;
         value = id + 1;
         snprintf(fname, FLAGS_value_size + 1, "%0*llu", FLAGS_value_size, id);
 
@@ -697,6 +1040,59 @@ void InodeRandomUpdate(ThreadState* thread){
     thread->stats.AddBytes(bytes);
 }
 
+static void InodePatch(ThreadState* thread, bool range){   //随机选key，把value中随机位置的patch_size字节改为新内容
+    uint32_t seed = thread->tid + 1000;
+    uint64_t nums = (FLAGS_updates == 0) ? FLAGS_nums / FLAGS_threads : FLAGS_updates / FLAGS_threads;
+    uint32_t patch_range = (FLAGS_attr_size > 0) ? std::min(FLAGS_attr_size, FLAGS_value_size) : FLAGS_value_size;   //修改落在的范围
+    uint32_t patch_size = std::min(static_cast<uint32_t>(FLAGS_patch_size), patch_range);
+
+    inode_id_t key;
+    std::string value;
+    char *patch = new char[patch_size + 1];
+    uint64_t id = 0;
+    uint64_t bytes = 0;
+    uint64_t found = 0;
+    int ret = 0;
+    for(int i = 0; i < nums; i++){
+        id = Random64(&seed) % FLAGS_nums;
+        key = id;
+        uint32_t offset = Random64(&seed) % (patch_range - patch_size + 1);
+        snprintf(patch, patch_size + 1, "%0*llu", patch_size, id + i);
+
+        if(range){
+            ret = thread->db->InodeUpdateRange(key, offset, Slice(patch, patch_size));
+        } else {
+            ret = thread->db->InodeGet(key, value);
+            if(ret == 0){
+                value.replace(offset, patch_size, patch, patch_size);
+                ret = (FLAGS_attr_size > 0) ? thread->db->InodePut(key, value, FLAGS_attr_size) : thread->db->InodePut(key, value);
+                ret = (ret == -1) ? -1 : 0;
+            }
+        }
+        if(ret == -1){
+            fprintf(stderr, "inode patch error! key:%lu offset:%u \n", key, offset);
+            fflush(stderr);
+            exit(1);
+        }
+        if(ret == 0) found++;
+        bytes += (FLAGS_key_size + patch_size);
+        thread->stats.FinishedOp(1, kBenchmarkUpdateType);
+    }
+    delete patch;
+    thread->stats.AddBytes(bytes);
+    char msg[100];
+    snprintf(msg, sizeof(msg), "(%lu of %lu found)", found, nums);
+    thread->stats.AddMessage(msg);
+}
+
+void InodePatchFull(ThreadState* thread){
+    InodePatch(thread, false);
+}
+
+void InodePatchRange(ThreadState* thread){
+    InodePatch(thread, true);
+}
+
 void DirRangeWrite(ThreadState* thread){
     uint32_t seed = thread->tid + 1000;
     uint32_t seed2 = thread->tid + 2000;
@@ -762,6 +1158,158 @@ void DirRandomRange(ThreadState* thread){
     thread->stats.AddMessage(msg);
 }
 
+//node pool逐渐写满时的分配延迟，按使用率分10档统计；每分配4个节点随机释放1个制造碎片，结束时全部释放
+void NodeAllocFill(ThreadState* thread){
+    uint32_t seed = thread->tid + 1000;
+    uint64_t nums = FLAGS_nums / FLAGS_threads;
+    uint64_t capacity = node_allocator->GetCapacity();
+    static const uint32_t batch = 256;
+    static const uint32_t levels = 10;
+    void *addrs[batch];
+    uint64_t sizes[batch];
+    uint64_t micros[levels] = {0};
+    uint64_t counts[levels] = {0};
+    vector<pair<void *, uint64_t>> nodes;
+    uint64_t done = 0;
+    while(done < nums){
+        uint64_t free_space = node_allocator->GetFreeSpace();
+        if(free_space < capacity / levels) break;   //剩余10%时停止，避免分配失败退出
+        uint32_t level = (capacity - free_space) * levels / capacity;
+        for(uint32_t i = 0; i < batch; i++){
+            uint64_t r = Random64(&seed) % 16;
+            if(r < 15){   //线程缓存的定长节点
+                sizes[i] = NODE_BASE_SIZE << (r % 3);
+            } else {      //走全局位图的变长节点，如hash的buckets
+                sizes[i] = NODE_BASE_SIZE * (3 + Random64(&seed) % 62);
+            }
+        }
+        uint64_t start = get_now_micros();
+        for(uint32_t i = 0; i < batch; i++){
+            addrs[i] = node_allocator->Allocate(sizes[i]);
+        }
+        micros[level] += get_now_micros() - start;
+        counts[level] += batch;
+        for(uint32_t i = 0; i < batch; i++){
+            nodes.push_back(pair<void *, uint64_t>(addrs[i], sizes[i]));
+            if(Random64(&seed) % 4 == 0){
+                uint64_t k = Random64(&seed) % nodes.size();
+                node_allocator->Free(nodes[k].first, nodes[k].second);
+                nodes[k] = nodes.back();
+                nodes.pop_back();
+            }
+        }
+        done += batch;
+        thread->stats.FinishedOp(batch, kBenchmarkWriteType);
+    }
+    for(auto &it : nodes){
+        node_allocator->Free(it.first, it.second);
+    }
+
+    string msg("(alloc micros/op by fill");
+    char buf[100];
+    for(uint32_t i = 0; i < levels; i++){
+        if(counts[i] == 0) continue;
+        snprintf(buf, sizeof(buf), " %u%%:%.3f", i * 100 / levels, 1.0 * micros[i] / counts[i]);
+        msg.append(buf);
+    }
+    msg.append(")");
+    thread->stats.AddMessage(msg);
+}
+
+static uint64_t NodeSearchByScan(NvmInodeHashEntryNode *node, inode_id_t key, uint64_t &reads){   //原来的查找，每个存在的entry都读key
+    for(uint16_t i = 0; i < INODE_HASH_ENTRY_NODE_CAPACITY; i++){
+        if(!((node->slot >> i) & 1)) continue;
+        reads++;
+        if(node->entry[i].key == key) return 1;
+    }
+    return 0;
+}
+
+static uint64_t NodeSearchByFingerprint(NvmInodeHashEntryNode *node, inode_id_t key, uint64_t &reads){
+    uint16_t candidate = node->GetCandidateSlot(fingerprint_u64(key));
+    while(candidate != 0){
+        uint16_t i = __builtin_ctz(candidate);
+        candidate &= candidate - 1;
+        reads++;
+        if(node->entry[i].key == key) return 1;
+    }
+    return 0;
+}
+
+void InodeNodeSearch(ThreadState* thread){   //一半命中一半不命中，两种查找用同样的key序列
+    uint32_t seed = thread->tid + 1000;
+    uint64_t nums = (FLAGS_reads == 0) ? FLAGS_nums / FLAGS_threads : FLAGS_reads / FLAGS_threads;
+    static const uint64_t node_nums = 4096;
+    NvmInodeHashEntryNode *nodes = static_cast<NvmInodeHashEntryNode *>(malloc(node_nums * sizeof(NvmInodeHashEntryNode)));
+    memset(nodes, 0, node_nums * sizeof(NvmInodeHashEntryNode));
+    for(uint64_t n = 0; n < node_nums; n++){   //满节点，只在DRAM中构造，不经过nvm接口
+        for(uint32_t i = 0; i < INODE_HASH_ENTRY_NODE_CAPACITY; i++){
+            nodes[n].entry[i].key = Random64(&seed);
+            if(i < INODE_HASH_FINGERPRINT_NUM) nodes[n].fingerprint[i] = fingerprint_u64(nodes[n].entry[i].key);
+        }
+        nodes[n].num = INODE_HASH_ENTRY_NODE_CAPACITY;
+        nodes[n].slot = (1 << INODE_HASH_ENTRY_NODE_CAPACITY) - 1;
+    }
+
+    uint64_t (*search[2])(NvmInodeHashEntryNode *, inode_id_t, uint64_t &) = {NodeSearchByScan, NodeSearchByFingerprint};
+    uint64_t micros[2] = {0};
+    uint64_t reads[2] = {0};
+    uint64_t found[2] = {0};
+    uint32_t begin_seed = seed;
+    for(int k = 0; k < 2; k++){
+        seed = begin_seed;
+        uint64_t start = get_now_micros();
+        for(uint64_t i = 0; i < nums; i++){
+            NvmInodeHashEntryNode *node = &nodes[Random64(&seed) % node_nums];
+            inode_id_t key = (i & 1) ? node->entry[Random64(&seed) % INODE_HASH_ENTRY_NODE_CAPACITY].key : Random64(&seed);
+            found[k] += search[k](node, key, reads[k]);
+            thread->stats.FinishedOp(1, kBenchmarkReadType);
+        }
+        micros[k] = get_now_micros() - start;
+    }
+    free(nodes);
+
+    char msg[200];
+    snprintf(msg, sizeof(msg), "(scan:%.3f micros/op %.2f keys/op, fingerprint:%.3f micros/op %.2f keys/op, %lu of %lu found)", 
+        1.0 * micros[0] / nums, 1.0 * reads[0] / nums, 1.0 * micros[1] / nums, 1.0 * reads[1] / nums, found[1], nums);
+    thread->stats.AddMessage(msg);
+}
+
+void ReadScaling(DB *db, const char *name, void (*method)(ThreadState*)){   //每个线程数报告一次吞吐，总读次数不变
+    int threads = FLAGS_threads;
+    char run_name[100];
+    for(int n = 1; n <= FLAGS_scaling_max_threads; n *= 2){
+        FLAGS_threads = n;   //读函数按FLAGS_threads划分读次数
+        snprintf(run_name, sizeof(run_name), "%s_t%d", name, n);
+        RunBenchmark(db, n, run_name, method);
+    }
+    FLAGS_threads = threads;
+}
+
+static void GetInodeWriteBytes(DB *db, uint64_t &user_bytes, uint64_t &copied_bytes){   //从PrintInodeStats的输出中取累计写入NVM的字节数
+    std::string stats;
+    db->PrintInodeStats(stats);
+    user_bytes = 0;
+    copied_bytes = 0;
+    size_t pos = stats.find("user_write_bytes:");
+    if(pos != std::string::npos) user_bytes = strtoull(stats.c_str() + pos + strlen("user_write_bytes:"), nullptr, 10);
+    pos = stats.find("copied_bytes:");
+    if(pos != std::string::npos) copied_bytes = strtoull(stats.c_str() + pos + strlen("copied_bytes:"), nullptr, 10);
+}
+
+void PatchWrite(DB *db, char *name, void (*method)(ThreadState*)){   //报告每次修改持久化的字节数，包括后台回收搬移的字节
+    uint64_t user_begin, copied_begin, user_end, copied_end;
+    GetInodeWriteBytes(db, user_begin, copied_begin);
+    RunBenchmark(db, FLAGS_threads, name, method);
+    GetInodeWriteBytes(db, user_end, copied_end);
+    uint64_t nums = ((FLAGS_updates == 0) ? FLAGS_nums : FLAGS_updates) / FLAGS_threads * FLAGS_threads;
+    fprintf(stdout, "%-12s : %.1f bytes persisted/update (user:%.1f gc copied:%.1f), patch_size:%d value_size:%d attr_size:%d\n", name, \
+        1.0 * (user_end - user_begin + copied_end - copied_begin) / nums, 1.0 * (user_end - user_begin) / nums, \
+        1.0 * (copied_end - copied_begin) / nums, std::min(FLAGS_patch_size, FLAGS_attr_size > 0 ? std::min(FLAGS_attr_size, FLAGS_value_size) : FLAGS_value_size), \
+        FLAGS_value_size, FLAGS_attr_size);
+    fflush(stdout);
+}
+
 void PrintStats(DB *db) {
     std::string stats;
     db->PrintAllStats(stats);
@@ -811,6 +1359,12 @@ void RunTest(){
         else if (strcmp(name, "inode_readrandom") == 0){
             method = InodeRandomRead;
         }
+        else if (strcmp(name, "inode_getattr") == 0){
+            method = InodeRandomGetAttr;
+        }
+        else if (strcmp(name, "inode_readhot") == 0){
+            method = InodeHotRead;
+        }
         else if (strcmp(name, "dir_deleterandom") == 0){
             method = DirRandomDelete;
         }
@@ -823,12 +1377,60 @@ void RunTest(){
         else if (strcmp(name, "inode_updaterandom") == 0){
             method = InodeRandomUpdate;
         }
+        else if (strcmp(name, "inode_patchfull") == 0){
+            PatchWrite(db, name, InodePatchFull);
+        }
+        else if (strcmp(name, "inode_patchrange") == 0){
+            PatchWrite(db, name, InodePatchRange);
+        }
         else if (strcmp(name, "dir_rangewrite") == 0){
             method = DirRangeWrite;
         }
         else if (strcmp(name, "dir_rangeread") == 0){
             method = DirRandomRange;
         }
+        else if (strcmp(name, "node_allocfill") == 0){
+            method = NodeAllocFill;
+        }
+        else if (strcmp(name, "dir_readscaling") == 0){
+            ReadScaling(db, name, DirRandomRead);
+        }
+        else if (strcmp(name, "inode_readscaling") == 0){
+            ReadScaling(db, name, InodeRandomRead);
+        }
+        else if (strcmp(name, "inode_nodesearch") == 0){
+            method = InodeNodeSearch;
+        }
+        else if (strcmp(name, "create_separate") == 0){
+            method = CreateSeparate;
+        }
+        else if (strcmp(name, "create_batch") == 0){
+            method = CreateBatch;
+        }
+        else if (strcmp(name, "rename_separate") == 0){
+            method = RenameSeparate;
+        }
+        else if (strcmp(name, "rename_native") == 0){
+            method = RenameNative;
+        }
+        else if (strcmp(name, "drop_separate") == 0){
+            method = DropSeparate;
+        }
+        else if (strcmp(name, "drop_native") == 0){
+            method = DropNative;
+        }
+        else if (strcmp(name, "readdir_iter") == 0){
+            method = ReadDirIter;
+        }
+        else if (strcmp(name, "readdir_batch") == 0){
+            method = ReadDirBatch;
+        }
+        else if (strcmp(name, "readdir_stat") == 0){
+            method = ReadDirStat;
+        }
+        else if (strcmp(name, "readdir_plus") == 0){
+            method = ReadDirPlus;
+        }
         else if (strcmp(name, "stats") == 0){
             PrintStats(db);
         }
@@ -876,10 +1478,20 @@ int main(int argc, char** argv){
             FLAGS_updates = nums;
         } else if (sscanf(argv[i], "--range_len=%llu%c", &nums, &junk) == 1) {
             FLAGS_range_len = nums;
+        } else if (sscanf(argv[i], "--dir_files=%llu%c", &nums, &junk) == 1) {
+            FLAGS_dir_files = (nums == 0) ? 1 : nums;
+        } else if (sscanf(argv[i], "--hot_ratio=%lf%c", &d, &junk) == 1) {
+            FLAGS_hot_ratio = d;
         } else if (sscanf(argv[i], "--threads=%d%c", &n, &junk) == 1) {
             FLAGS_threads = n;
         } else if (sscanf(argv[i], "--value_size=%d%c", &n, &junk) == 1) {
             FLAGS_value_size = n;
+        } else if (sscanf(argv[i], "--patch_size=%d%c", &n, &junk) == 1) {
+            FLAGS_patch_size = n;
+        } else if (sscanf(argv[i], "--attr_size=%d%c", &n, &junk) == 1) {
+            FLAGS_attr_size = n;
+        } else if (sscanf(argv[i], "--scaling_max_threads=%d%c", &n, &junk) == 1) {
+            FLAGS_scaling_max_threads = n;
         } else if (sscanf(argv[i], "--histogram=%d%c", &n, &junk) == 1) {
             FLAGS_histogram = n;
         } else if (sscanf(argv[i], "--k_DIR_FIRST_HASH_MAX_CAPACITY=%llu%c", &nums, &junk) == 1) {
@@ -896,6 +1508,14 @@ int main(int argc, char** argv){
             FLAGS_k_INODE_HASHTABLE_INIT_SIZE = nums;
         } else if (sscanf(argv[i], "--k_INODE_HASHTABLE_TRIG_REHASH_TIMES=%lf%c", &d, &junk) == 1) {
             FLAGS_k_INODE_HASHTABLE_TRIG_REHASH_TIMES = d;
+        } else if (sscanf(argv[i], "--k_INODE_GC_INVALID_RATIO=%lf%c", &d, &junk) == 1) {
+            FLAGS_k_INODE_GC_INVALID_RATIO = d;
+        } else if (sscanf(argv[i], "--k_INODE_GC_RATE_LIMIT_MB=%lf%c", &d, &junk) == 1) {
+            FLAGS_k_INODE_GC_RATE_LIMIT_MB = d;
+        } else if (sscanf(argv[i], "--k_INODE_CACHE_CAPACITY_MB=%llu%c", &nums, &junk) == 1) {
+            FLAGS_k_INODE_CACHE_CAPACITY_MB = nums;
+        } else if (sscanf(argv[i], "--k_INODE_DELTA_CHAIN_MAX=%d%c", &n, &junk) == 1) {
+            FLAGS_k_INODE_DELTA_CHAIN_MAX = n;
         } else if (sscanf(argv[i], "--k_node_allocator_path=%100s%c", (char *)&buff, &junk) == 1) {
             FLAGS_k_node_allocator_path.assign(buff, strlen(buff));
         } else if (sscanf(argv[i], "--k_node_allocator_size=%llu%c", &nums, &junk) == 1) {
@@ -906,6 +1526,12 @@ int main(int argc, char** argv){
             FLAGS_k_file_allocator_size = nums;
         } else if (sscanf(argv[i], "--k_thread_pool_count=%llu%c", &nums, &junk) == 1) {
             FLAGS_k_thread_pool_count = nums;
+        } else if (sscanf(argv[i], "--k_recovery_thread_count=%llu%c", &nums, &junk) == 1) {
+            FLAGS_k_recovery_thread_count = nums;
+        } else if (sscanf(argv[i], "--k_recovery_scan_nodes=%d%c", &n, &junk) == 1) {
+            FLAGS_k_recovery_scan_nodes = n;
+        } else if (sscanf(argv[i], "--use_existing_db=%d%c", &n, &junk) == 1) {
+            FLAGS_use_existing_db = n;
         } else {
             fprintf(stderr, "Invalid flag '%s'\n", argv[i]);
             exit(1);
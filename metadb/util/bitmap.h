@@ -8,6 +8,7 @@
 #define _METADB_BITMAP_H_
 
 #include <cstring>
+#include <stdint.h>
 
 namespace metadb {
 
@@ -21,7 +22,7 @@ public:
         memset(bitmap, 0, gsize);
     };
 
-    BitMap(int n){
+    BitMap(uint64_t n){
         gsize = (n >> 3) + 1;
         bitmap = new char[gsize];
         memset(bitmap, 0, gsize);
@@ -31,26 +32,26 @@ public:
         delete[] bitmap;
     };
 
-    int get(int x){
-        int cur = x >> 3;
-        int remainder = x & (7);
-        if (cur > gsize) return -1;
+    int get(uint64_t x){
+        uint64_t cur = x >> 3;
+        uint64_t remainder = x & (7);
+        if (cur >= gsize) return -1;
 
         return (bitmap[cur] >> remainder) & 1;
     };
 
-    int set(int x){
-        int cur = x >> 3;
-        int remainder = x & (7);
-        if (cur > gsize) return 0;
+    int set(uint64_t x){
+        uint64_t cur = x >> 3;
+        uint64_t remainder = x & (7);
+        if (cur >= gsize) return 0;
         bitmap[cur] |= (1 << remainder);
         return 1;
     };
 
-    int clr(int x){
-        int cur = x >> 3;
-        int remainder = x & (7);
-        if (cur > gsize)return 0;
+    int clr(uint64_t x){
+        uint64_t cur = x >> 3;
+        uint64_t remainder = x & (7);
+        if (cur >= gsize)return 0;
         bitmap[cur] &= (~(1 << remainder));
         return 1;
     };
@@ -60,11 +61,27 @@ public:
         return 1;
     };
 
-    int get_capacity() { return gsize; }
+    uint64_t get_capacity() { return gsize; }
+
+    char *get_bitmap() { return bitmap; }   //底层字节数组，用于和NVM中的持久化位图互相拷贝
+
+    uint64_t count(){   //已置位的个数
+        uint64_t res = 0;
+        uint64_t i = 0;
+        for(; i + 8 <= gsize; i += 8){
+            uint64_t word;
+            memcpy(&word, bitmap + i, 8);
+            res += __builtin_popcountll(word);
+        }
+        for(; i < gsize; i++){
+            res += __builtin_popcount(static_cast<unsigned char>(bitmap[i]));
+        }
+        return res;
+    }
         
 private:
     char *bitmap;
-    int gsize;
+    uint64_t gsize;
 }; 
 
 
@@ -0,0 +1,317 @@
+/**
+ * @Description : 64叉位图树，叶子是位图本身（1表示已分配），上层记录空闲块数和空闲段长度，O(log n)查找连续空闲块
+ */
+#ifndef _METADB_BITMAP_TREE_H_
+#define _METADB_BITMAP_TREE_H_
+
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+
+namespace metadb {
+
+#define BITMAP_TREE_NOT_FOUND UINT64_MAX
+
+class BitMapTree {
+public:
+    //位图有n位，只有[begin, end)可分配，范围外的位在上层看作已分配，end为0表示n
+    BitMapTree(uint64_t n, uint64_t begin = 0, uint64_t end = 0) : n_(n), begin_(begin), end_((end == 0 || end > n) ? n : end) {
+        gsize_ = (n >> 3) + 1;
+        word_num_ = (gsize_ + 7) >> 3;
+        words_ = new uint64_t[word_num_];
+        word_infos_ = new WordInfo[word_num_];
+        memset(words_, 0, word_num_ * 8);
+
+        uint64_t num = word_num_;
+        uint64_t span = 64;
+        do {
+            num = (num + 63) >> 6;
+            span <<= 6;
+            levels_.push_back(new Summary[num]);
+            level_nums_.push_back(num);
+            level_spans_.push_back(span);
+        } while (num > 1);
+        Rebuild();
+    }
+
+    ~BitMapTree() {
+        for(auto it : levels_){
+            delete[] it;
+        }
+        delete[] word_infos_;
+        delete[] words_;
+    }
+
+    int get(uint64_t x){
+        if(x >= n_) return -1;
+        return (words_[x >> 6] >> (x & 63)) & 1;
+    }
+
+    int set(uint64_t x){
+        if(x >= n_) return 0;
+        set_range(x, 1);
+        return 1;
+    }
+
+    int clr(uint64_t x){
+        if(x >= n_) return 0;
+        clr_range(x, 1);
+        return 1;
+    }
+
+    void set_range(uint64_t x, uint64_t num){
+        ModifyRange(x, num, true);
+    }
+
+    void clr_range(uint64_t x, uint64_t num){
+        ModifyRange(x, num, false);
+    }
+
+    int reset(){
+        memset(words_, 0, word_num_ * 8);
+        Rebuild();
+        return 1;
+    }
+
+    void load(const char *src, uint64_t len){   //从NVM中的持久化位图整体加载
+        memcpy(words_, src, (len < gsize_) ? len : gsize_);
+        Rebuild();
+    }
+
+    //最低地址的need个连续空闲块，不修改位图，没有时返回BITMAP_TREE_NOT_FOUND
+    uint64_t find(uint64_t need){
+        if(need == 0 || levels_.back()[0].max < need) return BITMAP_TREE_NOT_FOUND;
+        return FindInNode(levels_.size() - 1, 0, need);
+    }
+
+    uint64_t get_capacity() { return gsize_; }   //字节数，和NVM中的持久化位图大小一致
+
+    char *get_bitmap() { return reinterpret_cast<char *>(words_); }   //只读，修改需通过set/clr/load
+
+    uint64_t count(){   //已置位的个数
+        uint64_t res = 0;
+        for(uint64_t i = 0; i < word_num_; i++){
+            res += __builtin_popcountll(words_[i]);
+        }
+        return res;
+    }
+
+    uint64_t free_count() { return levels_.back()[0].free; }   //[begin, end)中的空闲块数
+
+    uint64_t max_free_run() { return levels_.back()[0].max; }   //最长连续空闲块数
+
+    uint32_t get_depth() { return levels_.size(); }
+
+private:
+    struct WordInfo {     //叶子字的摘要，避免更新上层时重新统计64个字
+        uint8_t free;
+        uint8_t prefix;
+        uint8_t suffix;
+        uint8_t max;
+    };
+
+    struct Summary {
+        uint64_t free;     //空闲块数
+        uint64_t prefix;   //从低地址开始的连续空闲块数
+        uint64_t suffix;   //到高地址结束的连续空闲块数
+        uint64_t max;      //最长连续空闲块数
+    };
+
+    uint64_t n_;
+    uint64_t begin_;
+    uint64_t end_;
+    uint64_t gsize_;
+    uint64_t word_num_;
+    uint64_t *words_;     //叶子，小端下和按字节的位图布局一致
+    WordInfo *word_infos_;
+    std::vector<Summary *> levels_;     //levels_[0]每个节点管理64个字，最后一层只有根
+    std::vector<uint64_t> level_nums_;
+    std::vector<uint64_t> level_spans_;   //每层一个节点覆盖的位数
+
+    uint64_t MaskedWord(uint64_t w){   //不可分配的位置1
+        uint64_t lo = w << 6;
+        uint64_t word = words_[w];
+        if(lo < begin_){
+            word |= (begin_ - lo >= 64) ? ~0ULL : ((1ULL << (begin_ - lo)) - 1);
+        }
+        if(lo + 64 > end_){
+            word |= (end_ <= lo) ? ~0ULL : ~((1ULL << (end_ - lo)) - 1);
+        }
+        return word;
+    }
+
+    static uint8_t WordMaxRun(uint64_t word){
+        if(word == 0) return 64;
+        uint64_t y = ~word;
+        uint8_t k = 0;
+        while(y){
+            y &= (y >> 1);
+            k++;
+        }
+        return k;
+    }
+
+    void UpdateWordInfo(uint64_t w){
+        uint64_t word = MaskedWord(w);
+        WordInfo &info = word_infos_[w];
+        info.free = 64 - __builtin_popcountll(word);
+        info.prefix = (word == 0) ? 64 : __builtin_ctzll(word);
+        info.suffix = (word == 0) ? 64 : __builtin_clzll(word);
+        info.max = WordMaxRun(word);
+    }
+
+    Summary WordSummary(uint64_t w){
+        Summary s;
+        if(w >= word_num_){
+            s.free = s.prefix = s.suffix = s.max = 0;
+            return s;
+        }
+        const WordInfo &info = word_infos_[w];
+        s.free = info.free;
+        s.prefix = info.prefix;
+        s.suffix = info.suffix;
+        s.max = info.max;
+        return s;
+    }
+
+    Summary ChildSummary(int level, uint64_t index){   //level为-1表示叶子的字
+        if(level < 0) return WordSummary(index);
+        if(index >= level_nums_[level]){
+            Summary s;
+            s.free = s.prefix = s.suffix = s.max = 0;
+            return s;
+        }
+        return levels_[level][index];
+    }
+
+    template <typename T>
+    static Summary CombineChildren(const T *children, uint64_t num, uint64_t span){   //num个孩子，不足64个时后面看作已分配
+        Summary res;
+        res.free = 0;
+        res.prefix = 0;
+        res.max = 0;
+        uint64_t run = 0;
+        bool all_free = true;
+        for(uint64_t c = 0; c < num; c++){
+            const T &s = children[c];
+            res.free += s.free;
+            if(s.prefix == span){
+                run += span;
+                continue;
+            }
+            if(all_free){
+                res.prefix = run + s.prefix;
+                all_free = false;
+            }
+            if(run + s.prefix > res.max) res.max = run + s.prefix;
+            if(s.max > res.max) res.max = s.max;
+            run = s.suffix;
+        }
+        if(all_free) res.prefix = run;
+        if(run > res.max) res.max = run;
+        res.suffix = (num == 64) ? run : 0;
+        return res;
+    }
+
+    Summary Combine(int level, uint64_t index){   //由孩子计算levels_[level][index]
+        uint64_t first = index << 6;
+        if(level == 0){
+            uint64_t num = (word_num_ - first < 64) ? word_num_ - first : 64;
+            return CombineChildren(word_infos_ + first, num, 64);
+        }
+        uint64_t num = (level_nums_[level - 1] - first < 64) ? level_nums_[level - 1] - first : 64;
+        return CombineChildren(levels_[level - 1] + first, num, level_spans_[level - 1]);
+    }
+
+    void Rebuild(){
+        for(uint64_t w = 0; w < word_num_; w++){
+            UpdateWordInfo(w);
+        }
+        for(uint32_t l = 0; l < levels_.size(); l++){
+            for(uint64_t i = 0; i < level_nums_[l]; i++){
+                levels_[l][i] = Combine(l, i);
+            }
+        }
+    }
+
+    void ModifyRange(uint64_t x, uint64_t num, bool is_set){
+        if(num == 0) return ;
+        uint64_t first = x >> 6;
+        uint64_t last = (x + num - 1) >> 6;
+        bool changed = false;
+        for(uint64_t w = first; w <= last; w++){
+            uint64_t lo = (w == first) ? (x & 63) : 0;
+            uint64_t hi = (w == last) ? ((x + num - 1) & 63) : 63;
+            uint64_t mask = ((hi == 63) ? ~0ULL : ((1ULL << (hi + 1)) - 1)) & ~((1ULL << lo) - 1);
+            if(is_set){
+                words_[w] |= mask;
+            } else {
+                words_[w] &= ~mask;
+            }
+            WordInfo old = word_infos_[w];
+            UpdateWordInfo(w);
+            const WordInfo &info = word_infos_[w];
+            if(info.free != old.free){   //空闲块数直接加到所有祖先
+                int64_t delta = static_cast<int64_t>(info.free) - static_cast<int64_t>(old.free);
+                uint64_t i = w;
+                for(uint32_t l = 0; l < levels_.size(); l++){
+                    i >>= 6;
+                    levels_[l][i].free += delta;
+                }
+            }
+            if(info.prefix != old.prefix || info.suffix != old.suffix || info.max != old.max) changed = true;
+        }
+        for(uint32_t l = 0; l < levels_.size() && changed; l++){   //空闲段长度逐层向上更新，没有变化时提前结束
+            first >>= 6;
+            last >>= 6;
+            changed = false;
+            for(uint64_t i = first; i <= last; i++){
+                Summary s = Combine(l, i);
+                Summary &old = levels_[l][i];
+                if(s.prefix != old.prefix || s.suffix != old.suffix || s.max != old.max){
+                    old = s;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    uint64_t FindInWord(uint64_t w, uint64_t need){
+        uint64_t z = ~MaskedWord(w);
+        uint64_t len = 1;
+        while(len < need){   //z的第i位表示从i开始有len个空闲块
+            uint64_t shift = (need - len < len) ? need - len : len;
+            z &= (z >> shift);
+            len += shift;
+        }
+        if(z == 0) return BITMAP_TREE_NOT_FOUND;
+        return (w << 6) + __builtin_ctzll(z);
+    }
+
+    uint64_t FindInNode(int level, uint64_t index, uint64_t need){   //该节点内有need个连续空闲块
+        uint64_t span = (level == 0) ? 64 : level_spans_[level - 1];
+        uint64_t run = 0;
+        for(uint64_t c = index << 6; c < (index + 1) << 6; c++){
+            Summary s = ChildSummary(level - 1, c);
+            if(run + s.prefix >= need){   //跨越孩子边界的空闲段
+                return c * span - run;
+            }
+            if(s.max >= need){
+                return (level == 0) ? FindInWord(c, need) : FindInNode(level - 1, c, need);
+            }
+            run = (s.prefix == span) ? run + span : s.suffix;
+        }
+        return BITMAP_TREE_NOT_FOUND;
+    }
+};
+
+} // namespace name
+
+
+
+
+
+
+
+
+#endif
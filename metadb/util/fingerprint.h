@@ -0,0 +1,54 @@
+/**
+ * @Description : 1字节key指纹，查找时一次比较16个指纹，只有指纹相同的entry才需要读完整的key
+ */
+#ifndef _METADB_FINGERPRINT_H_
+#define _METADB_FINGERPRINT_H_
+
+#include <stdint.h>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace metadb {
+
+#define FINGERPRINT_UNKNOWN 0    //没有指纹（旧数据或未写入），必须比较key
+
+//取hash的高8位作为指纹，0保留给FINGERPRINT_UNKNOWN
+static inline uint8_t fingerprint_from_hash(uint64_t hash){
+    uint8_t fp = static_cast<uint8_t>(hash >> 56);
+    return (fp == FINGERPRINT_UNKNOWN) ? 1 : fp;
+}
+
+static inline uint8_t fingerprint_u64(uint64_t key){   //inode id等整数key，乘法散列后高位分布均匀
+    return fingerprint_from_hash(key * 0x9E3779B97F4A7C15ULL);
+}
+
+//比较p开始的16个字节，第i位为1表示第i个字节等于fp或为FINGERPRINT_UNKNOWN
+static inline uint32_t fingerprint_match16(const void *p, uint8_t fp){
+#ifdef __SSE2__
+    __m128i v = _mm_loadu_si128(static_cast<const __m128i *>(p));
+    __m128i eq = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(static_cast<char>(fp))), _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+    return static_cast<uint32_t>(_mm_movemask_epi8(eq));
+#else
+    uint8_t buf[16];
+    memcpy(buf, p, 16);
+    uint32_t mask = 0;
+    for(uint32_t i = 0; i < 16; i++){
+        if(buf[i] == fp || buf[i] == FINGERPRINT_UNKNOWN) mask |= (1U << i);
+    }
+    return mask;
+#endif
+}
+
+} // namespace name
+
+
+
+
+
+
+
+
+#endif
@@ -0,0 +1,49 @@
+/**
+ * @Description : 多个线程共享的限速器，按字节数排队，调用者超出配额时睡眠
+ */
+#ifndef _METADB_RATE_LIMITER_H_
+#define _METADB_RATE_LIMITER_H_
+
+#include <stdint.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "lock.h"
+
+namespace metadb {
+
+class RateLimiter {
+public:
+    explicit RateLimiter(uint64_t bytes_per_sec) : rate_(bytes_per_sec), next_micros_(0) {}
+    ~RateLimiter() {}
+
+    void Request(uint64_t bytes){   //rate_为0不限速
+        if(rate_ == 0 || bytes == 0) return;
+        uint64_t now = NowMicros();
+        uint64_t wait_micros = 0;
+        mu_.Lock();
+        if(next_micros_ < now) next_micros_ = now;   //空闲期间的配额不累积
+        wait_micros = next_micros_ - now;
+        next_micros_ += bytes * 1000000 / rate_;
+        mu_.Unlock();
+        if(wait_micros > 1000) usleep(wait_micros);   //不足1ms的不睡，之后的请求会补上
+    }
+
+private:
+    const uint64_t rate_;   //每秒字节数
+    uint64_t next_micros_;  //下一个请求可以开始的时间，mu_保护
+    Mutex mu_;
+
+    static uint64_t NowMicros(){
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        return static_cast<uint64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+    }
+
+    RateLimiter(const RateLimiter&) = delete;
+    RateLimiter& operator=(const RateLimiter&) = delete;
+};
+
+} // namespace metadb
+
+#endif
@@ -0,0 +1,57 @@
+/**
+ * @Description : 顺序锁，读者不加锁，读前后序号不同则重试；写者之间的互斥由调用者的锁保证
+ */
+#ifndef _METADB_SEQLOCK_H_
+#define _METADB_SEQLOCK_H_
+
+#include <stdint.h>
+#include <sched.h>
+#include <atomic>
+
+namespace metadb {
+
+class SeqLock {
+public:
+    SeqLock() : seq_(0) {}
+    ~SeqLock() {}
+
+    void WriteBegin(){   //序号变为奇数，之后的修改对读者不可靠
+        seq_.store(seq_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void WriteEnd(){
+        seq_.store(seq_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    uint32_t ReadBegin() const {   //等待写者结束，返回偶数序号
+        uint32_t seq;
+        uint32_t spins = 0;
+        while((seq = seq_.load(std::memory_order_acquire)) & 1){
+            if(++spins > 64) sched_yield();
+        }
+        return seq;
+    }
+
+    bool ReadRetry(uint32_t seq) const {   //true表示读的过程中有写者，需要重读
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return seq_.load(std::memory_order_relaxed) != seq;
+    }
+
+private:
+    std::atomic<uint32_t> seq_;
+
+    SeqLock(const SeqLock&) = delete;
+    SeqLock& operator=(const SeqLock&) = delete;
+};
+
+} // namespace name
+
+
+
+
+
+
+
+
+#endif
@@ -18,13 +18,15 @@ DBAdaptor::~DBAdaptor(){
 
 }
 
-int DBAdaptor::Init(const std::string & path){
+int DBAdaptor::Init(const std::string & path, void (*drop_callback)(void *, const inode_id_t, const std::string &), void *drop_arg){
 
     Option option;
     option.node_allocator_path = path + "/" + "node.pool";
     option.node_allocator_size = 40ULL * 1024 * 1024 * 1024;
     option.file_allocator_path = path + "/" + "file.pool";
     option.file_allocator_size = 40ULL * 1024 * 1024 * 1024;
+    option.drop_inode_callback = drop_callback;
+    option.drop_inode_callback_arg = drop_arg;
     
 
     if( path == "")
@@ -51,8 +53,8 @@ void DBAdaptor::Cleanup(){
     db_ = nullptr;
 }
 
-int DBAdaptor::DirPut(const inode_id_t key, const Slice &fname, const inode_id_t value){
-    int ret = db_->DirPut(key, fname, value);
+int DBAdaptor::DirPut(const inode_id_t key, const Slice &fname, const inode_id_t value, const uint8_t type){
+    int ret = db_->DirPut(key, fname, value, type);
     if(ret == 0){
         return 0;
     } else {
@@ -77,12 +79,42 @@ int DBAdaptor::DirDelete(const inode_id_t key, const Slice &fname){
         return -1;
     }
 }
+int DBAdaptor::DirRename(const inode_id_t old_key, const Slice &old_fname, const inode_id_t new_key, const Slice &new_fname){
+    int ret = db_->DirRename(old_key, old_fname, new_key, new_fname);
+    if(ret == 0){
+        return 0;
+    } else if (ret == 2){  //未找到
+        return 1;
+    } else {
+        return -1;
+    }
+}
+int DBAdaptor::DirRename(const inode_id_t old_key, const Slice &old_fname, const inode_id_t new_key, const Slice &new_fname, inode_id_t &replaced, bool delete_replaced){
+    int ret = db_->DirRename(old_key, old_fname, new_key, new_fname, replaced, delete_replaced);
+    if(ret == 0){
+        return 0;
+    } else if (ret == 2){  //未找到
+        return 1;
+    } else {
+        return -1;
+    }
+}
+int DBAdaptor::DirDropAll(const inode_id_t key){
+    int ret = db_->DirDropAll(key);
+    if(ret == 0){
+        return 0;
+    } else if (ret == 2){  //空目录
+        return 1;
+    } else {
+        return -1;
+    }
+}
 Iterator* DBAdaptor::DirGetIterator(const inode_id_t target){
     return db_->DirGetIterator(target);
 }
 
 int DBAdaptor::InodePut(const inode_id_t key, const Slice &value){
-    int ret = db_->InodePut(key, value);
+    int ret = db_->InodePut(key, value, TFS_INODE_HEADER_SIZE);   //inode头和inline数据分开存放
     if(ret == 0 || ret == 2){
         return 0;
     } else {
@@ -91,13 +123,45 @@ int DBAdaptor::InodePut(const inode_id_t key, const Slice &value){
 }
 int DBAdaptor::InodeGet(const inode_id_t key, std::string &value){
     int ret = db_->InodeGet(key, value);
-    if(ret == 0 || ret == 2){
+    if(ret == 0){
         return 0;
+    } else if (ret == 2){  //未找到
+        return 1;
     } else {
         return -1;
     }
 
 }
+int DBAdaptor::InodeUpdateRange(const inode_id_t key, uint32_t offset, const Slice &data){
+    int ret = db_->InodeUpdateRange(key, offset, data);
+    if(ret == 0){
+        return 0;
+    } else if (ret == 2){  //未找到
+        return 1;
+    } else {
+        return -1;
+    }
+}
+int DBAdaptor::InodeGetAttr(const inode_id_t key, std::string &attr){
+    int ret = db_->InodeGetAttr(key, attr);
+    if(ret == 0){
+        return 0;
+    } else if (ret == 2){  //未找到
+        return 1;
+    } else {
+        return -1;
+    }
+}
+void DBAdaptor::InodeMultiGet(const inode_id_t *keys, uint32_t num, std::string *values, int *rets){
+    db_->InodeMultiGet(keys, num, values, rets);
+    for(uint32_t i = 0; i < num; i++){
+        if(rets[i] == 2){  //未找到
+            rets[i] = 1;
+        } else if(rets[i] != 0){
+            rets[i] = -1;
+        }
+    }
+}
 int DBAdaptor::InodeDelete(const inode_id_t key){
     int ret = db_->InodeDelete(key);
     if(ret == 0 || ret == 2){
@@ -107,4 +171,13 @@ int DBAdaptor::InodeDelete(const inode_id_t key){
     }
 }
 
+int DBAdaptor::Write(const WriteBatch &batch){
+    int ret = db_->Write(batch);
+    if(ret == 0){
+        return 0;
+    } else {
+        return -1;
+    }
+}
+
 } // namespace name
\ No newline at end of file
@@ -10,6 +10,7 @@
 
 #include "metadb/db.h"
 #include <string>
+#include <dirent.h>
 #include "inode_format.h"
 
 namespace nsfs {
@@ -24,18 +25,28 @@ public:
 
     void Cleanup();
 
-    int DirPut(const inode_id_t key, const Slice &fname, const inode_id_t value);
+    int DirPut(const inode_id_t key, const Slice &fname, const inode_id_t value, const uint8_t type = DT_UNKNOWN);
     int DirGet(const inode_id_t key, const Slice &fname, inode_id_t &value);
     int DirDelete(const inode_id_t key, const Slice &fname);
+    int DirRename(const inode_id_t old_key, const Slice &old_fname, const inode_id_t new_key, const Slice &new_fname);
+    //replaced返回被覆盖的inode，没有覆盖时为INVALID_INODE_ID_KEY；delete_replaced时和改名一起原子删除该inode
+    int DirRename(const inode_id_t old_key, const Slice &old_fname, const inode_id_t new_key, const Slice &new_fname, inode_id_t &replaced, bool delete_replaced);
+    int DirDropAll(const inode_id_t key);   //删除目录下所有目录项，子树后台回收
     Iterator* DirGetIterator(const inode_id_t target);
 
     int InodePut(const inode_id_t key, const Slice &value);
     int InodeGet(const inode_id_t key, std::string &value);
+    int InodeGetAttr(const inode_id_t key, std::string &attr);   //只读inode头，不读inline数据，1不存在
+    int InodeUpdateRange(const inode_id_t key, uint32_t offset, const Slice &data);   //只写入value中修改的部分，1不存在
+    void InodeMultiGet(const inode_id_t *keys, uint32_t num, std::string *values, int *rets);   //rets[i]：0找到，1不存在，-1出错
     int InodeDelete(const inode_id_t key);
 
+    int Write(const WriteBatch &batch);   //batch中的修改原子生效
+
     int Sync();
 
-    int Init(const std::string & path = "");
+    //drop_callback在后台回收DirDropAll的子inode时调用，见Option::drop_inode_callback
+    int Init(const std::string & path = "", void (*drop_callback)(void *, const inode_id_t, const std::string &) = nullptr, void *drop_arg = nullptr);
 
 
 protected:
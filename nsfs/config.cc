@@ -18,7 +18,7 @@ const std::string KVFSConfig :: config_file_name = "config.dat";
 
 
 KVFSConfig::KVFSConfig():
-    threshold(4096),current_inode_size(0)
+    threshold(4096),current_inode_size(0),dentry_cache_size(1 << 20),attr_flush_ms(1000)
 {
 }
 
@@ -29,6 +29,14 @@ void KVFSConfig::Init(const kvfs_args & args)
     assert(args.find("data_dir") != args.end());
     assert(args.find("mount_dir") != args.end());
     char ans[4096];
+    if(args.find("dentry_cache_size") != args.end())
+    {
+        dentry_cache_size = strtoull(args.at("dentry_cache_size").c_str(), nullptr, 10);
+    }
+    if(args.find("attr_flush_ms") != args.end())
+    {
+        attr_flush_ms = strtoull(args.at("attr_flush_ms").c_str(), nullptr, 10);
+    }
     
     if(nullptr != realpath(( args.at("meta_dir")).c_str(),ans))
     {
@@ -75,14 +83,16 @@ void KVFSConfig::Init(const kvfs_args & args)
         // write open
         fs.open(data_dir +"/" + config_file_name, std::ios::out);
         current_inode_size = 0 ;
-        fs << current_inode_size ;
+        fs << current_inode_size.load() ;
         fs.close();
         // TODO: how big data place ?
     }
     else  //find config file
     {
         KVFS_LOG("find a config file ...");
-        fs >> current_inode_size ;
+        uint64_t inode_size = 0;
+        fs >> inode_size ;
+        current_inode_size = inode_size;
         fs.close();
     }
 }
@@ -10,6 +10,7 @@
 
 #include <stdint.h>
 #include <string>
+#include <atomic>
 #include <unordered_map>
 #include <sys/stat.h>
 
@@ -23,7 +24,7 @@ public :
     KVFSConfig();
     void Init(const kvfs_args & args);
     inline bool IsEmpty() { 
-        return 0 == current_inode_size;  }
+        return 0 == current_inode_size.load();  }
     inline std::string GetDataDir()
     {
         return data_dir;
@@ -40,9 +41,16 @@ public :
     {
         return threshold;
     }
-    inline uint64_t NewInode(){
-        ++current_inode_size;
-        return current_inode_size;
+    inline uint64_t GetDentryCacheSize()
+    {
+        return dentry_cache_size;
+    }
+    inline uint64_t GetAttrFlushNanos()
+    {
+        return attr_flush_ms * 1000000;
+    }
+    inline uint64_t NewInode(){   //多个FUSE线程并发创建文件
+        return current_inode_size.fetch_add(1) + 1;
     }
 
 protected:
@@ -54,9 +62,11 @@ protected:
     std::string meta_dir;
     std::string data_dir;
     std::string mount_dir;
-    uint64_t current_inode_size;
+    std::atomic<uint64_t> current_inode_size;
 
     uint64_t threshold;
+    uint64_t dentry_cache_size;   //目录项缓存的最大项数，0表示不缓存
+    uint64_t attr_flush_ms;   //打开文件的inode修改在handle中滞留的毫秒数，后台线程每半个周期写回到期的修改，0表示每次修改都写回
 
 
 
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "dentry_cache.h"
+#include "inode_format.h"
+
+namespace nsfs {
+
+DentryCache::DentryCache(uint64_t capacity) : capacity_(capacity), shards_(nullptr){
+    hit_nanos_.store(0);
+    miss_nanos_.store(0);
+    if(capacity_ == 0) return;
+    shards_ = new DentryCacheShard[DENTRY_CACHE_SHARD_NUM];
+    uint64_t per_shard = (capacity_ + DENTRY_CACHE_SHARD_NUM - 1) / DENTRY_CACHE_SHARD_NUM;
+    for(uint32_t i = 0; i < DENTRY_CACHE_SHARD_NUM; i++){
+        shards_[i].slots.resize(per_shard);
+        for(uint64_t j = 0; j < per_shard; j++){
+            shards_[i].slots[j].used = false;
+        }
+        shards_[i].index.reserve(per_shard);
+    }
+}
+
+DentryCache::~DentryCache(){
+    delete[] shards_;
+}
+
+inline DentryCacheShard *DentryCache::GetShard(const DentryCacheKey &key){
+    return &shards_[DentryCacheKeyHash()(key) >> 32 & (DENTRY_CACHE_SHARD_NUM - 1)];
+}
+
+int DentryCache::Lookup(const inode_id_t parent, const Slice &name, inode_id_t &value, uint64_t &seq){
+    if(capacity_ == 0) return 2;
+    DentryCacheKey key = {parent, murmur64(name.data(), name.size())};
+    DentryCacheShard *shard = GetShard(key);
+    std::lock_guard<std::mutex> lock(shard->mu);
+    auto it = shard->index.find(key);
+    if(it != shard->index.end()){
+        DentryCacheSlot &slot = shard->slots[it->second];
+        if(slot.name.size() == name.size() && memcmp(slot.name.data(), name.data(), name.size()) == 0){
+            slot.referenced = true;
+            if(slot.negative){
+                shard->negative_hits++;
+                return 1;
+            }
+            shard->hits++;
+            value = slot.value;
+            return 0;
+        }
+        //hash冲突的其他文件名，当作未命中
+    }
+    shard->misses++;
+    seq = shard->seq;
+    return 2;
+}
+
+uint32_t DentryCache::AllocateSlot(DentryCacheShard *shard){
+    uint32_t num = shard->slots.size();
+    while(true){
+        DentryCacheSlot &slot = shard->slots[shard->hand];
+        uint32_t cur = shard->hand;
+        shard->hand = (shard->hand + 1) % num;
+        if(!slot.used) return cur;
+        if(slot.referenced){   //最近访问过，给第二次机会
+            slot.referenced = false;
+            continue;
+        }
+        shard->index.erase(slot.key);
+        slot.used = false;
+        shard->evictions++;
+        return cur;
+    }
+}
+
+void DentryCache::Insert(const inode_id_t parent, const Slice &name, const inode_id_t value, bool negative, uint64_t seq){
+    if(capacity_ == 0) return;
+    DentryCacheKey key = {parent, murmur64(name.data(), name.size())};
+    DentryCacheShard *shard = GetShard(key);
+    std::lock_guard<std::mutex> lock(shard->mu);
+    if(shard->seq != seq) return;   //DirGet期间有目录项被修改，结果可能已过期
+    uint32_t index;
+    auto it = shard->index.find(key);
+    if(it != shard->index.end()){   //并发填入或hash冲突，直接覆盖
+        index = it->second;
+    } else {
+        index = AllocateSlot(shard);
+        shard->index[key] = index;
+    }
+    DentryCacheSlot &slot = shard->slots[index];
+    slot.key = key;
+    slot.name.assign(name.data(), name.size());
+    slot.value = value;
+    slot.negative = negative;
+    slot.referenced = false;
+    slot.used = true;
+    shard->inserts++;
+}
+
+void DentryCache::Invalidate(const inode_id_t parent, const Slice &name){
+    if(capacity_ == 0) return;
+    DentryCacheKey key = {parent, murmur64(name.data(), name.size())};
+    DentryCacheShard *shard = GetShard(key);
+    std::lock_guard<std::mutex> lock(shard->mu);
+    shard->seq++;
+    auto it = shard->index.find(key);
+    if(it != shard->index.end()){   //hash相同的其他文件名也一起删除，下次重新读
+        shard->slots[it->second].used = false;
+        shard->index.erase(it);
+        shard->invalidations++;
+    }
+}
+
+void DentryCache::PrintStats(std::string &stats){
+    stats.append("--------Dentry Cache--------\n");
+    char buf[1024];
+    uint64_t hits = 0, negative_hits = 0, misses = 0, inserts = 0, evictions = 0, invalidations = 0, entries = 0;
+    for(uint32_t i = 0; capacity_ > 0 && i < DENTRY_CACHE_SHARD_NUM; i++){
+        std::lock_guard<std::mutex> lock(shards_[i].mu);
+        hits += shards_[i].hits;
+        negative_hits += shards_[i].negative_hits;
+        misses += shards_[i].misses;
+        inserts += shards_[i].inserts;
+        evictions += shards_[i].evictions;
+        invalidations += shards_[i].invalidations;
+        entries += shards_[i].index.size();
+    }
+    uint64_t lookups = hits + negative_hits + misses;
+    snprintf(buf, sizeof(buf), "capacity:%lu entries:%lu lookups:%lu hits:%lu negative_hits:%lu misses:%lu hit_rate:%.2f%%\n",
+        capacity_, entries, lookups, hits, negative_hits, misses, lookups == 0 ? 0.0 : 100.0 * (hits + negative_hits) / lookups);
+    stats.append(buf);
+    snprintf(buf, sizeof(buf), "inserts:%lu evictions:%lu invalidations:%lu avg_hit_latency:%.1f ns avg_miss_latency:%.1f ns\n",
+        inserts, evictions, invalidations,
+        (hits + negative_hits) == 0 ? 0.0 : 1.0 * hit_nanos_.load() / (hits + negative_hits),
+        misses == 0 ? 0.0 : 1.0 * miss_nanos_.load() / misses);
+    stats.append(buf);
+}
+
+}
@@ -0,0 +1,96 @@
+/**
+ * @Description : DRAM中的目录项缓存，以(父目录inode, 文件名hash)为key，缓存路径解析每一级DirGet的结果，包括不存在的负项
+ */
+#ifndef _NSFS_DENTRY_CACHE_H_
+#define _NSFS_DENTRY_CACHE_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+
+#include "metadb/slice.h"
+#include "metadb/inode.h"
+
+using namespace metadb;
+
+namespace nsfs {
+
+static const uint32_t DENTRY_CACHE_SHARD_NUM = 64;   //分片数，必须为2的幂次，每个分片一把锁
+
+struct DentryCacheKey {
+    inode_id_t parent;
+    uint64_t hash;   //文件名的hash，相同时再比较slot中的文件名
+
+    bool operator==(const DentryCacheKey &other) const {
+        return parent == other.parent && hash == other.hash;
+    }
+};
+
+struct DentryCacheKeyHash {
+    size_t operator()(const DentryCacheKey &key) const {
+        return key.hash ^ (key.parent * 0x9e3779b97f4a7c15ULL);
+    }
+};
+
+struct DentryCacheSlot {
+    DentryCacheKey key;
+    std::string name;
+    inode_id_t value;
+    bool negative;     //目录项不存在
+    bool referenced;   //CLOCK的访问位，命中时置位
+    bool used;
+};
+
+struct DentryCacheShard {
+    std::mutex mu;
+    std::unordered_map<DentryCacheKey, uint32_t, DentryCacheKeyHash> index;   //key -> slot下标
+    std::vector<DentryCacheSlot> slots;   //容量固定，满了按CLOCK淘汰
+    uint32_t hand;    //CLOCK指针
+    uint64_t seq;     //每次失效加1，查找未命中到填入期间有失效则放弃填入
+
+    //统计，在mu内修改
+    uint64_t hits;
+    uint64_t negative_hits;
+    uint64_t misses;
+    uint64_t inserts;
+    uint64_t evictions;
+    uint64_t invalidations;
+
+    DentryCacheShard() : hand(0), seq(0), hits(0), negative_hits(0), misses(0), inserts(0), evictions(0), invalidations(0) {}
+};
+
+class DentryCache {
+public:
+    explicit DentryCache(uint64_t capacity);   //最多缓存capacity个目录项，0表示不缓存
+    ~DentryCache();
+
+    //返回0命中且value有效，1命中负项，2未命中；未命中时seq用于之后的Insert
+    int Lookup(const inode_id_t parent, const Slice &name, inode_id_t &value, uint64_t &seq);
+    //填入DirGet的结果，seq为Lookup返回的值，期间有失效则不填入，避免缓存已被修改的旧结果
+    void Insert(const inode_id_t parent, const Slice &name, const inode_id_t value, bool negative, uint64_t seq);
+    //目录项被创建、删除或改名后调用，必须在修改生效之后调用
+    void Invalidate(const inode_id_t parent, const Slice &name);
+
+    void AddHitNanos(uint64_t nanos) { hit_nanos_.fetch_add(nanos, std::memory_order_relaxed); }
+    void AddMissNanos(uint64_t nanos) { miss_nanos_.fetch_add(nanos, std::memory_order_relaxed); }   //未命中时包括DirGet的时间
+
+    bool Enabled() { return capacity_ > 0; }
+    void PrintStats(std::string &stats);
+
+private:
+    uint64_t capacity_;
+    DentryCacheShard *shards_;
+    std::atomic<uint64_t> hit_nanos_;
+    std::atomic<uint64_t> miss_nanos_;
+
+    inline DentryCacheShard *GetShard(const DentryCacheKey &key);
+    uint32_t AllocateSlot(DentryCacheShard *shard);   //返回空闲slot，没有时按CLOCK淘汰一个
+};
+
+}
+
+
+#endif
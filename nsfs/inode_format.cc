@@ -13,40 +13,71 @@ namespace nsfs{
 //uint64_t kvfs_inode_meta_key ::current_index = 0;
 
 
-std::unordered_map <inode_id_t ,kvfs_file_handle *> kvfs_file_handle :: handle_map = 
-    std::unordered_map <inode_id_t ,kvfs_file_handle *>();
+kvfs_file_handle::handle_shard kvfs_file_handle :: shards_[kvfs_file_handle::kHandleShardNum];
 
 kvfs_file_handle * kvfs_file_handle::GetHandle(const inode_id_t key)
 {
-    if(handle_map .find(key) != handle_map.end())
-        return handle_map.at(key);
+    handle_shard &shard = GetShard(key);
+    std::lock_guard<std::mutex> lock(shard.mu);
+    auto it = shard.handle_map.find(key);
+    if(it != shard.handle_map.end())
+        return it->second;
     else return nullptr;
 }
-bool kvfs_file_handle :: InsertHandle(const inode_id_t key , kvfs_file_handle * handle)
+kvfs_file_handle * kvfs_file_handle :: OpenHandle(const inode_id_t key , bool &created)
 {
-    if(handle_map.find(key) != handle_map.end())
+    handle_shard &shard = GetShard(key);
+    std::lock_guard<std::mutex> lock(shard.mu);
+    kvfs_file_handle *&handle = shard.handle_map[key];
+    created = (handle == nullptr);
+    if(created)
+    {
+        handle = new kvfs_file_handle(key);
+    }
+    handle->refs++;
+    return handle;
+}
+bool kvfs_file_handle :: ReleaseHandle(kvfs_file_handle * handle)
+{
+    handle_shard &shard = GetShard(handle->key);
+    std::lock_guard<std::mutex> lock(shard.mu);
+    if(--handle->refs > 0)
     {
         return false;
     }
-    else 
+    if(!handle->unlinked)
     {
-        handle_map[key] = handle;
-        return true;
+        shard.handle_map.erase(handle->key);
     }
+    return true;
 }
 bool kvfs_file_handle :: DeleteHandle(const inode_id_t key)
 {
-    auto it = handle_map .find(key) ;
-    if(it!= handle_map.end())
+    handle_shard &shard = GetShard(key);
+    std::lock_guard<std::mutex> lock(shard.mu);
+    auto it = shard.handle_map.find(key) ;
+    if(it!= shard.handle_map.end())
     {
-        delete it->second;
-        handle_map.erase(it);
+        it->second->unlinked = true;
+        shard.handle_map.erase(it);
         return true;
     }
     else return false;
 
 }
 
+void kvfs_file_handle :: GetOpenKeys(std::vector<inode_id_t> &keys)
+{
+    for(uint32_t i = 0; i < kHandleShardNum; i++)
+    {
+        std::lock_guard<std::mutex> lock(shards_[i].mu);
+        for(auto &it : shards_[i].handle_map)
+        {
+            keys.push_back(it.first);
+        }
+    }
+}
+
 uint64_t murmur64( const void * key, int len, uint64_t seed )
 {
   const uint64_t m = 0xc6a4a7935bd1e995;
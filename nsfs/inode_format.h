@@ -10,6 +10,8 @@
 #include <sys/stat.h>
 #include <map>
 #include <unordered_map>
+#include <vector>
+#include <mutex>
 #include <stdarg.h>
 
 #include "metadb/db.h"
@@ -53,6 +55,8 @@ enum kvfs_inode_mode {
 // file handle use in memory 
 // for fuse 
 // global reference 
+// 文件的handle按inode共享，同一文件的多次open引用同一个handle；目录的handle每次opendir独占，不进入全局表
+// handle的value、fd、mode由NSFS中该inode的锁保护，全局表的查找、插入和摘除也要在持有该锁时调用
 struct kvfs_file_handle
 {
     inode_id_t key;
@@ -61,21 +65,43 @@ struct kvfs_file_handle
     // file descriptor for big file
     int fd; 
     std::string value;
+    // directory snapshot for readdir, taken at offset 0 and reused by later pages
+    Iterator * dir_iter;
+    uint32_t refs;   //未release的open次数
+    bool unlinked;   //文件已被删除，最后一次release时不再写回inode
+    bool dirty;      //value有未写回DB的修改，fsync、release或超过滞留时间时写回
+    uint64_t dirty_nanos;   //value变脏的时间
 
     kvfs_file_handle(inode_id_t key) :
-        flags(0),fd(-1)//,offset(-1)
+        key(key),flags(0),fd(-1),dir_iter(nullptr),refs(0),unlinked(false),dirty(false),dirty_nanos(0)//,offset(-1)
     {
-        InsertHandle(key,this);
+    }
+
+    ~kvfs_file_handle()
+    {
+        delete dir_iter;
     }
 
 
 
     static kvfs_file_handle * GetHandle(const inode_id_t key);
-    static bool InsertHandle(const inode_id_t key, kvfs_file_handle * handle);
+    //返回key已有的handle，没有则新建，created表示是否新建；引用计数加1
+    static kvfs_file_handle * OpenHandle(const inode_id_t key, bool &created);
+    //引用计数减1，返回true表示是最后一个引用，handle已从全局表摘除，由调用者释放
+    static bool ReleaseHandle(kvfs_file_handle * handle);
+    //文件被删除时摘除，仍在使用的open在release时释放handle
     static bool DeleteHandle (const inode_id_t key);
+    //所有已打开且未删除的文件，后台写回时遍历
+    static void GetOpenKeys(std::vector<inode_id_t> &keys);
     protected :
-    // global hash map for query
-    static std::unordered_map <inode_id_t /*path*/, kvfs_file_handle * > handle_map ; 
+    static const uint32_t kHandleShardNum = 64;
+    struct handle_shard {
+        std::mutex mu;
+        std::unordered_map <inode_id_t, kvfs_file_handle * > handle_map;
+    };
+    // global hash map for query，按inode分片加锁，多个FUSE线程并发open/release
+    static handle_shard shards_[kHandleShardNum];
+    static handle_shard & GetShard(const inode_id_t key) { return shards_[key % kHandleShardNum]; }
 
 };
 
@@ -10,11 +10,18 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <limits>
+#include <limits.h>
 #include <algorithm>
 #include <errno.h>
+#include <dirent.h>
+#include <time.h>
+#include <chrono>
+#include <stdio.h>
+
+#ifndef RENAME_NOREPLACE
+#define RENAME_NOREPLACE (1 << 0)
+#endif
 
-#define EDBERROR 188  //DB错误
-#define ENOTIMPLEMENT 189  //未实现
 
 using namespace std;
 namespace nsfs {
@@ -112,7 +119,13 @@ void NSFS::InitStat(tfs_stat_t &statbuf,
 }
 
 
-NSFS::NSFS(const kvfs_args & args) : args_(args), db_(nullptr),config_(nullptr),use_fuse(false)
+static inline uint64_t NowNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+NSFS::NSFS(const kvfs_args & args) : args_(args), db_(nullptr),config_(nullptr),dcache_(nullptr),use_fuse(false),flusher_stop_(false)
 {
 
     config_  = new KVFSConfig();
@@ -122,7 +135,8 @@ NSFS::NSFS(const kvfs_args & args) : args_(args), db_(nullptr),config_(nullptr),
 
     KVFS_LOG("init metadb adaptor ..\n");
     db_ = new DBAdaptor();
-    db_->Init(config_->GetMetaDir());
+    db_->Init(config_->GetMetaDir(), &NSFS::DropInodeCallback, this);
+    dcache_ = new DentryCache(config_->GetDentryCacheSize());
     cfg_ = nullptr;
 }
 
@@ -131,6 +145,25 @@ NSFS::~NSFS(){
 
 }
 
+int NSFS::LookupEntry(const inode_id_t parent, const Slice &name, inode_id_t &key) {
+  if (!dcache_->Enabled()) {
+    return db_->DirGet(parent, name, key);
+  }
+  uint64_t start = NowNanos();
+  uint64_t seq;
+  int ret = dcache_->Lookup(parent, name, key, seq);
+  if (ret != 2) {
+    dcache_->AddHitNanos(NowNanos() - start);
+    return ret;
+  }
+  ret = db_->DirGet(parent, name, key);
+  if (ret == 0 || ret == 1) {   //DB出错不缓存
+    dcache_->Insert(parent, name, key, ret == 1, seq);
+  }
+  dcache_->AddMissNanos(NowNanos() - start);
+  return ret;
+}
+
 bool NSFS::PathLookup(const char *path,
                          inode_id_t &key) {
 
@@ -140,17 +173,17 @@ bool NSFS::PathLookup(const char *path,
   inode_id_t inode_in_search = ROOT_INODE_ID;
   while ((rpos = strchr(lpos+1, PATH_DELIMITER)) != NULL) {
       if (rpos - lpos > 0) {
-          string fname(lpos+1, rpos-lpos-1);
+          Slice fname(lpos+1, rpos-lpos-1);   //只查找不保存，不拷贝文件名
           
-          int ret = db_->DirGet(inode_in_search, fname, key);
+          int ret = LookupEntry(inode_in_search, fname, key);
           if (ret == 0) {
               inode_in_search = key;
           } else if (ret == 1){
-              KVFS_LOG("PathLookup not find:inode:%d %s %d ptr:%s\n", inode_in_search, fname.c_str(), key, lpos);
+              KVFS_LOG("PathLookup not find:inode:%d %s %d ptr:%s\n", inode_in_search, fname.ToString().c_str(), key, lpos);
               errno = ENOENT;
               flag_found = false;
           } else{
-              KVFS_LOG("PathLookup db error:inode:%d %s %d ptr:%s\n", inode_in_search, fname.c_str(), key, lpos);
+              KVFS_LOG("PathLookup db error:inode:%d %s %d ptr:%s\n", inode_in_search, fname.ToString().c_str(), key, lpos);
               errno = EDBERROR;
               flag_found = false;
           }
@@ -163,17 +196,17 @@ bool NSFS::PathLookup(const char *path,
   }
   rpos = strchr(lpos, '\0');
   if (rpos != NULL && rpos-lpos > 1) {  //最后一个文件名
-    string fname(lpos+1, rpos-lpos-1);
-    int ret = db_->DirGet(inode_in_search, fname, key);
+    Slice fname(lpos+1, rpos-lpos-1);
+    int ret = LookupEntry(inode_in_search, fname, key);
     if (ret == 0) {
         return true;
     } else if (ret == 1){
-        KVFS_LOG("PathLookup not find:inode:%d %s %d ptr:%s\n", inode_in_search, fname.c_str(), key, lpos);
+        KVFS_LOG("PathLookup not find:inode:%d %s %d ptr:%s\n", inode_in_search, fname.ToString().c_str(), key, lpos);
 
         errno = ENOENT;
         flag_found = false;
     } else{
-        KVFS_LOG("PathLookup db error:inode:%d %s %d ptr:%s\n", inode_in_search, fname.c_str(), key, lpos);
+        KVFS_LOG("PathLookup db error:inode:%d %s %d ptr:%s\n", inode_in_search, fname.ToString().c_str(), key, lpos);
 
         errno = EDBERROR;
         flag_found = false;
@@ -200,7 +233,7 @@ bool NSFS::PathLookup(const char *path, inode_id_t &key, inode_id_t &parent_id,
       if (rpos - lpos > 0) {
           fname.assign(lpos+1, rpos-lpos-1);
           
-          int ret = db_->DirGet(parent_id, fname, key);
+          int ret = LookupEntry(parent_id, fname, key);
           if (ret == 0) {
               parent_id = key;
           } else if (ret == 1){
@@ -220,7 +253,7 @@ bool NSFS::PathLookup(const char *path, inode_id_t &key, inode_id_t &parent_id,
   rpos = strchr(lpos, '\0');
   if (rpos != NULL && rpos-lpos > 1) {  //最后一个文件名
     fname.assign(lpos+1, rpos-lpos-1);
-    int ret = db_->DirGet(parent_id, fname, key);
+    int ret = LookupEntry(parent_id, fname, key);
     if (ret == 0) {
         return true;
     } else if (ret == 1){
@@ -254,7 +287,7 @@ bool NSFS::ParentPathLookup(const char *path, inode_id_t &parent_id, string &fna
       if (rpos - lpos > 0) {
           fname.assign(lpos+1, rpos-lpos-1);
           
-          int ret = db_->DirGet(parent_id, fname, key);
+          int ret = LookupEntry(parent_id, fname, key);
           if (ret == 0) {
               parent_id = key;
           } else if (ret == 1){
@@ -352,6 +385,10 @@ void* NSFS::Init(struct fuse_conn_info *conn, struct fuse_config *cfg){
     {
         KVFS_LOG("use fuse .. true");
         use_fuse = true;
+        //readdir直接带回子inode的属性，ls -l时内核不再逐个getattr
+        if(conn->capable & FUSE_CAP_READDIRPLUS){
+            conn->want |= FUSE_CAP_READDIRPLUS;
+        }
     }
     //
     if (config_->IsEmpty()) {
@@ -367,11 +404,31 @@ void* NSFS::Init(struct fuse_conn_info *conn, struct fuse_config *cfg){
     } else {
         KVFS_LOG("not empty ..  ");
     }
+    if (config_->GetAttrFlushNanos() > 0) {   //为0时每次修改都已写回
+        flusher_ = std::thread(&NSFS::FlushLoop, this);
+    }
     return config_;
 }
 
+void NSFS::PrintStats(std::string &stats){
+  dcache_->PrintStats(stats);
+}
+
 void NSFS::Destroy(void * data){
   KVFS_LOG("FS Destroy\n");
+  if (flusher_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(flusher_mu_);
+      flusher_stop_ = true;
+    }
+    flusher_cv_.notify_all();
+    flusher_.join();
+  }
+  std::string stats;
+  PrintStats(stats);
+  fprintf(stdout, "%s", stats.c_str());
+  delete dcache_;
+  dcache_ = nullptr;
   db_->Cleanup();
   delete db_;
   delete config_;
@@ -384,9 +441,12 @@ int NSFS::GetAttr(const char *path, struct stat *statbuf, struct fuse_file_info
         KVFS_LOG("GetAttr Path Lookup: No such file or directory: %s\n", path);
         return -errno;
     }
+    if (GetOpenAttr(key, statbuf)) {
+        return 0;
+    }
     int ret = 0;
     std::string value;
-    ret = db_->InodeGet(key, value);
+    ret = db_->InodeGetAttr(key, value);
     if (ret == 0) {
         *statbuf = *(GetAttribute(value));
         return 0;
@@ -397,15 +457,33 @@ int NSFS::GetAttr(const char *path, struct stat *statbuf, struct fuse_file_info
     }
 }
 
+//调用者持有该inode的锁
 kvfs_file_handle * NSFS::InitFileHandle(const char * path, struct fuse_file_info * fi, const inode_id_t & key , const std::string & value )
 {
-       kvfs_file_handle * handle = new kvfs_file_handle(key); 
-       handle->key = key;
+       bool created;
+       kvfs_file_handle * handle = kvfs_file_handle::OpenHandle(key, created);
+       fi->fh = reinterpret_cast <uint64_t >(handle);
+       bool write = (fi->flags & O_RDWR) >0 ||
+               (fi->flags & O_WRONLY) > 0 || 
+               (fi->flags & O_TRUNC) > 0;
+       if(!created) // file already opened, share its handle
+       {
+           if(write && handle->mode != INODE_WRITE)
+           {
+               //之前只有只读的open，大文件的fd按读写重新打开
+               handle->mode = INODE_WRITE;
+               handle->flags = (handle->flags & ~O_ACCMODE) | O_RDWR;
+               if(handle->fd >= 0)
+               {
+                   close(handle->fd);
+                   handle->fd = -1;
+               }
+           }
+           return handle;
+       }
        handle->value = value;
        handle->flags = fi->flags;
-       if( (fi->flags & O_RDWR) >0 ||
-               (fi->flags & O_WRONLY) > 0 || 
-               (fi->flags & O_TRUNC) > 0)
+       if(write)
        {
            handle->mode = INODE_WRITE;
        }
@@ -430,7 +508,6 @@ kvfs_file_handle * NSFS::InitFileHandle(const char * path, struct fuse_file_info
 
            
        }
-       fi->fh = reinterpret_cast <uint64_t >(handle);
 
        return handle;
 }
@@ -442,6 +519,7 @@ int NSFS::Open(const char *path, struct fuse_file_info *fi) {
         KVFS_LOG("Open: No such file or directory %s\n", path);
         return -errno;
     }
+    std::lock_guard<std::mutex> lock(InodeLock(key));
     string value;
     int ret = db_->InodeGet(key, value);
     if(ret == 0){  //该文件存在
@@ -458,6 +536,7 @@ int NSFS::Read(const char * path,char * buf , size_t size ,off_t offset ,struct
     KVFS_LOG("Read: %s size : %d , offset %d \n",path,size,offset);
     kvfs_file_handle *handle = reinterpret_cast<kvfs_file_handle *>(fi->fh);
     inode_id_t key = handle->key;
+    std::lock_guard<std::mutex> lock(InodeLock(key));   //同一文件的其他open可能正在写inline数据
     const tfs_inode_header *header = reinterpret_cast<const tfs_inode_header *>(handle->value.data());
     int ret = 0;
     if (header->has_blob > 0) {  //大文件
@@ -480,6 +559,7 @@ int NSFS::Write(const char * path , const char * buf,size_t size ,off_t offset ,
     KVFS_LOG("Write : %s %lld %d\n",path,offset ,size);
     kvfs_file_handle *handle = reinterpret_cast<kvfs_file_handle *>(fi->fh);
     inode_id_t key = handle->key;
+    std::lock_guard<std::mutex> lock(InodeLock(key));
     const tfs_inode_header *header = reinterpret_cast<const tfs_inode_header *>(handle->value.data());
     bool has_larger_size = (header->fstat.st_size < offset + size);
     int ret = 0;
@@ -496,9 +576,9 @@ int NSFS::Write(const char * path , const char * buf,size_t size ,off_t offset ,
         tfs_inode_header new_iheader = *GetInodeHeader(handle->value);
         new_iheader.fstat.st_size = offset + size;
         UpdateInodeHeader(handle->value, new_iheader);
-        int res = db_->InodePut(key, handle->value);
+        int res = MarkDirty(handle);   //追加写只改文件大小，不必每次写回inode
         if(res != 0){
-          return -EDBERROR;
+          return res;
         }
       }
 
@@ -531,9 +611,10 @@ int NSFS::Write(const char * path , const char * buf,size_t size ,off_t offset ,
         new_iheader.fstat.st_size = offset + size;
         new_iheader.has_blob = 1;
         UpdateInodeHeader(handle->value, new_iheader);
-        int res = db_->InodePut(key, handle->value);
+        handle->dirty = true;   //inline数据已移到磁盘文件，立即写回
+        int res = FlushHandle(handle);
         if(res != 0){
-          return -EDBERROR;
+          return res;
         }
         ret = size;
       }
@@ -547,9 +628,9 @@ int NSFS::Write(const char * path , const char * buf,size_t size ,off_t offset ,
         new_iheader.fstat.st_size = offset + size;
         UpdateInodeHeader(handle->value, new_iheader);
       }
-      int res = db_->InodePut(key, handle->value);
+      int res = MarkDirty(handle);
       if(res != 0){
-        return -EDBERROR;
+        return res;
       }
     }
     return ret;
@@ -557,6 +638,112 @@ int NSFS::Write(const char * path , const char * buf,size_t size ,off_t offset ,
   return ret;
 }
 
+//调用者持有该inode的锁，截断后的value由调用者写回
+int NSFS::TruncateValue(const inode_id_t &key, string &value, off_t new_size){
+  int ret = 0;
+  const tfs_inode_header *iheader = GetInodeHeader(value);
+  off_t old_size = iheader->fstat.st_size;   //value改变后iheader可能失效
+
+  if (iheader->has_blob > 0) {
+    if (new_size > config_->GetThreshold()) {
+      TruncateDiskFile(key,new_size);
+    } else {
+      char* buffer = new char[new_size];
+      MigrateDiskFileToBuffer(key, buffer, new_size);
+      UpdateInlineData(value, buffer, 0, new_size);
+      delete [] buffer;
+    }
+  } else {
+    if (new_size > config_->GetThreshold()) {
+      int fd = -1;
+      if (MigrateToDiskFile(key, value, fd, O_TRUNC|O_WRONLY) == 0) {
+        if ((ret = ftruncate(fd, new_size)) == 0) {
+          fsync(fd);
+        }
+        close(fd);
+      }
+    } else {
+      TruncateInlineData(value, new_size);
+    }
+  }
+  if (new_size != old_size) {
+    tfs_inode_header new_iheader = *GetInodeHeader(value);
+    new_iheader.fstat.st_size = new_size;
+    if (new_size > config_->GetThreshold()) {
+      new_iheader.has_blob = 1;
+    } else {
+      new_iheader.has_blob = 0;
+    }
+    UpdateInodeHeader(value, new_iheader);
+  }
+  return ret;
+}
+
+int NSFS::MarkDirty(kvfs_file_handle * handle){
+  if (!handle->dirty) {
+    handle->dirty = true;
+    handle->dirty_nanos = NowNanos();
+  }
+  if (NowNanos() - handle->dirty_nanos >= config_->GetAttrFlushNanos()) {
+    return FlushHandle(handle);
+  }
+  return 0;
+}
+
+int NSFS::FlushHandle(kvfs_file_handle * handle){
+  if (!handle->dirty) {
+    return 0;
+  }
+  if (!handle->unlinked) {   //已删除的文件不能再写回inode
+    if (db_->InodePut(handle->key, handle->value) != 0) {
+      return -EDBERROR;
+    }
+  }
+  handle->dirty = false;
+  return 0;
+}
+
+void NSFS::FlushLoop(){
+  //每半个滞留时间检查一次，修改最多滞留1.5倍attr_flush_ms
+  std::chrono::nanoseconds period(config_->GetAttrFlushNanos() / 2);
+  std::unique_lock<std::mutex> lock(flusher_mu_);
+  while (!flusher_stop_) {
+    flusher_cv_.wait_for(lock, period);
+    if (flusher_stop_) {
+      break;
+    }
+    lock.unlock();
+    FlushExpired();
+    lock.lock();
+  }
+}
+
+void NSFS::FlushExpired(){
+  std::vector<inode_id_t> keys;
+  kvfs_file_handle::GetOpenKeys(keys);
+  uint64_t now = NowNanos();
+  for (auto key : keys) {
+    //release在inode锁内写回并摘除handle，持锁时还能查到的handle不会被释放
+    std::lock_guard<std::mutex> lock(InodeLock(key));
+    kvfs_file_handle * handle = kvfs_file_handle::GetHandle(key);
+    if (handle != nullptr && handle->dirty && now - handle->dirty_nanos >= config_->GetAttrFlushNanos()) {
+      if (FlushHandle(handle) != 0) {
+        KVFS_LOG("FlushExpired: flush inode %lu error", key);
+      }
+    }
+  }
+}
+
+bool NSFS::GetOpenAttr(const inode_id_t key, struct stat * statbuf){
+  std::lock_guard<std::mutex> lock(InodeLock(key));
+  kvfs_file_handle * handle = kvfs_file_handle::GetHandle(key);
+  if (handle == nullptr) {   //release先写回再摘除handle，此后读到的DB不会比handle旧
+    return false;
+  }
+  *statbuf = *(GetAttribute(handle->value));
+  return true;
+}
+
 int NSFS::Truncate(const char * path ,off_t offset, struct fuse_file_info *fi){
   KVFS_LOG("Truncate:%s %d\n", path, offset);
   inode_id_t key;
@@ -564,45 +751,23 @@ int NSFS::Truncate(const char * path ,off_t offset, struct fuse_file_info *fi){
       KVFS_LOG("Truncate: No such file or directory %s\n", path);
       return -errno;
   }
-    off_t new_size = offset;
+    std::lock_guard<std::mutex> lock(InodeLock(key));
     string value;
     int ret = db_->InodeGet(key, value);
     if(ret == 0){  //该文件存在
-      const tfs_inode_header *iheader = reinterpret_cast<const tfs_inode_header *>(value.data());
-
-      if (iheader->has_blob > 0) {
-        if (new_size > config_->GetThreshold()) {
-          TruncateDiskFile(key,new_size);
-        } else {
-          char* buffer = new char[new_size];
-          MigrateDiskFileToBuffer(key, buffer, new_size);
-          UpdateInlineData(value, buffer, 0, new_size);
-          delete [] buffer;
-        }
+      kvfs_file_handle * handle = kvfs_file_handle::GetHandle(key);   //文件已打开时改handle中的value
+      string *mu_value = (handle != nullptr) ? &(handle->value) : &value;
+      bool had_blob = GetInodeHeader(*mu_value)->has_blob > 0;
+      ret = TruncateValue(key, *mu_value, offset);
+      int res = 0;
+      if (handle == nullptr) {
+        res = db_->InodePut(key, value);
+      } else if ((GetInodeHeader(*mu_value)->has_blob > 0) != had_blob) {
+        handle->dirty = true;   //数据已在inline和磁盘文件之间迁移，和Write一样立即写回
+        res = FlushHandle(handle);
       } else {
-        if (new_size > config_->GetThreshold()) {
-          int fd;
-          if (MigrateToDiskFile(key, value, fd, O_TRUNC|O_WRONLY) == 0) {
-            if ((ret = ftruncate(fd, new_size)) == 0) {
-              fsync(fd);
-            }
-            close(fd);
-          }
-        } else {
-          TruncateInlineData(value, new_size);
-        }
-      }
-      if (new_size != iheader->fstat.st_size) {
-        tfs_inode_header new_iheader = *GetInodeHeader(value);
-        new_iheader.fstat.st_size = new_size;
-        if (new_size > config_->GetThreshold()) {
-          new_iheader.has_blob = 1;
-        } else {
-          new_iheader.has_blob = 0;
-        }
-        UpdateInodeHeader(value, new_iheader);
+        res = MarkDirty(handle);   //只改了大小
       }
-      int res = db_->InodePut(key, value);
       if(res != 0){
         return -EDBERROR;
       }
@@ -619,7 +784,12 @@ int NSFS::Fsync(const char * path,int datasync ,struct fuse_file_info * fi){
     KVFS_LOG("Fsync: %s\n",path);
 
     kvfs_file_handle * handle = reinterpret_cast <kvfs_file_handle *>(fi->fh);
+    std::lock_guard<std::mutex> lock(InodeLock(handle->key));
     int ret = 0 ;
+    if(FlushHandle(handle) != 0)
+    {
+        return -EDBERROR;
+    }
     if(handle->mode == INODE_WRITE)
     {
         if(handle->fd >=0 )
@@ -641,32 +811,37 @@ int NSFS::Release(const char * path ,struct fuse_file_info * fi){
   KVFS_LOG("Release:%s \n", path);
   kvfs_file_handle* handle = reinterpret_cast<kvfs_file_handle*>(fi->fh);
   inode_id_t key = handle->key;
-
-  if (handle->mode == INODE_WRITE) {
-    const tfs_stat_t *value = GetAttribute(handle->value);
-    tfs_stat_t new_value = *value;
-    new_value.st_atim.tv_sec = time(NULL);
-    new_value.st_atim.tv_nsec = 0;
-    new_value.st_mtim.tv_sec = time(NULL);
-    new_value.st_mtim.tv_nsec = 0;
-    UpdateAttribute(handle->value, new_value);
-  }
-
   int ret = 0;
-  if (handle->fd >= 0) {
-    ret = close(handle->fd);
+  int res = 0;
+  bool last;
+  {
+    std::lock_guard<std::mutex> lock(InodeLock(key));
+    if (handle->mode == INODE_WRITE) {
+      const tfs_stat_t *value = GetAttribute(handle->value);
+      tfs_stat_t new_value = *value;
+      new_value.st_atim.tv_sec = time(NULL);
+      new_value.st_atim.tv_nsec = 0;
+      new_value.st_mtim.tv_sec = time(NULL);
+      new_value.st_mtim.tv_nsec = 0;
+      UpdateAttribute(handle->value, new_value);
+      handle->dirty = true;
+    }
+    res = FlushHandle(handle);   //只读打开的文件没有修改，不写回
+    last = kvfs_file_handle::ReleaseHandle(handle);
+    if (last && handle->fd >= 0) {   //fd由同一文件的所有open共享，最后一次release时关闭
+      ret = close(handle->fd);
+      if (ret != 0) {
+        ret = -errno;
+      }
+    }
   }
-  int res = db_->InodePut(key, handle->value);
-  if(res != 0){
-    return -EDBERROR;
+  if (last) {
+    delete handle;
   }
-  kvfs_file_handle::DeleteHandle(key);
-
-  if (ret != 0) {
-    return -errno;
-  } else {
-    return 0;
+  if(res != 0){
+    return res;
   }
+  return ret;
 }
 int NSFS::Readlink(const char * path ,char * buf,size_t size){
   KVFS_LOG("Readlink:%s \n", path);
@@ -704,6 +879,7 @@ int NSFS::Unlink(const char * path){
     KVFS_LOG("Unlink: No such file or directory %s\n", path);
     return -errno;
   }
+  std::lock_guard<std::mutex> lock(InodeLock(key));   //和仍打开该文件的release互斥
   std::string value;
   int ret = 0;
   ret = db_->InodeGet(key, value);
@@ -715,14 +891,14 @@ int NSFS::Unlink(const char * path){
       unlink(fpath.c_str());
     }
     kvfs_file_handle::DeleteHandle(key);
-    int res = db_->DirDelete(parent_id, fname);
-    if(res != 0){
-      return -EDBERROR;
-    }
-    res = db_->InodeDelete(key);
+    WriteBatch batch;   //目录项和inode一起删除
+    batch.DirDelete(parent_id, fname);
+    batch.InodeDelete(key);
+    int res = db_->Write(batch);
     if(res != 0){
       return -EDBERROR;
     }
+    dcache_->Invalidate(parent_id, fname);
 
     return 0;
   } else if(ret == 1){
@@ -744,17 +920,42 @@ int NSFS::MakeNode(const char * path,mode_t mode ,dev_t dev){
 
   string value = InitInodeValue(key, mode | S_IFREG, dev);
   
-  int ret=db_->DirPut(parent_id, filename, key);
+  WriteBatch batch;   //目录项和inode同时生效
+  batch.DirPut(parent_id, filename, key, IFTODT(mode | S_IFREG));
+  batch.InodePut(key, value, TFS_INODE_HEADER_SIZE);
+  int ret = db_->Write(batch);
   if(ret != 0){
-    KVFS_LOG("MakeNode dirput error: %d %s %d\n", parent_id, filename.c_str(), key);
+    KVFS_LOG("MakeNode write error: %d %s %d\n", parent_id, filename.c_str(), key);
     return -EDBERROR;
   }
-  ret = db_->InodePut(key, value);
+  dcache_->Invalidate(parent_id, filename);   //删除可能存在的负项
+
+  return 0;
+}
+
+int NSFS::Create(const char * path, mode_t mode, struct fuse_file_info * fi){
+  KVFS_LOG("Create:%s", path);
+  inode_id_t parent_id;
+  string filename;
+  if (!ParentPathLookup(path, parent_id, filename)) {
+    KVFS_LOG("Create: No such file or directory %s\n", path);
+    return -errno;
+  }
+  //内核持有父目录的锁并已确认文件不存在，和MakeNode一样直接写入
+  inode_id_t key = config_->NewInode();
+  string value = InitInodeValue(key, mode | S_IFREG, 0);
+
+  std::lock_guard<std::mutex> lock(InodeLock(key));
+  WriteBatch batch;   //目录项和inode同时生效
+  batch.DirPut(parent_id, filename, key, DT_REG);
+  batch.InodePut(key, value, TFS_INODE_HEADER_SIZE);
+  int ret = db_->Write(batch);
   if(ret != 0){
-    KVFS_LOG("MakeNode inodeput error: %d %s %d\n", parent_id, filename.c_str(), key);
+    KVFS_LOG("Create write error: %d %s %d\n", parent_id, filename.c_str(), key);
     return -EDBERROR;
   }
-
+  dcache_->Invalidate(parent_id, filename);   //删除可能存在的负项
+  InitFileHandle(path, fi, key, value);   //直接用刚写入的value，不再读inode
   return 0;
 }
 
@@ -771,14 +972,14 @@ int NSFS::MakeDir(const char * path,mode_t mode){
 
   string value = InitInodeValue(key, mode | S_IFDIR, 0);
 
-  int ret=db_->DirPut(parent_id, filename, key);
-  if(ret != 0){
-    return -EDBERROR;
-  }
-  ret = db_->InodePut(key, value);
+  WriteBatch batch;
+  batch.DirPut(parent_id, filename, key, DT_DIR);
+  batch.InodePut(key, value, TFS_INODE_HEADER_SIZE);
+  int ret = db_->Write(batch);
   if(ret != 0){
     return -EDBERROR;
   }
+  dcache_->Invalidate(parent_id, filename);   //删除可能存在的负项
 
   return 0;
 }
@@ -794,9 +995,8 @@ int NSFS::OpenDir(const char * path,struct fuse_file_info *fi){
   int ret = 0;
   ret = db_->InodeGet(key, value);
   if(ret == 0){
-    kvfs_file_handle * handle = new kvfs_file_handle(key);
+    kvfs_file_handle * handle = new kvfs_file_handle(key);   //每次opendir独占，保存自己的目录快照
     handle->fd = -1;
-    handle->key = key;
     handle->flags = fi->flags;
     handle->mode = INODE_READ;
     handle->value = value;
@@ -811,47 +1011,84 @@ int NSFS::OpenDir(const char * path,struct fuse_file_info *fi){
   
 }
 
+//offset为0时创建iterator存在handle中，之后的续读都在同一个iterator上；大目录按段拷贝，每段是同一时刻的目录项
 int NSFS::ReadDir(const char * path,void * buf ,fuse_fill_dir_t filler,off_t offset ,struct fuse_file_info * fi, enum fuse_readdir_flags flag){
-  KVFS_LOG("ReadDir:%s", path);
+  KVFS_LOG("ReadDir:%s offset:%ld", path, offset);
   kvfs_file_handle * handle = reinterpret_cast <kvfs_file_handle *>(fi->fh);
   inode_id_t key = handle->key;
-  int ret = 0;
-  
-  Iterator* iter = db_->DirGetIterator(key);
-  if (filler(buf, ".", NULL, 0, (enum fuse_fill_dir_flags) 0) < 0) {
-    KVFS_LOG("filler . error\n");
-    return -errno;
+  uint64_t pos = static_cast<uint64_t>(offset);
+  if (pos == kDirCookieEnd) {
+    return 0;
   }
-  if (filler(buf, "..", NULL, 0, (enum fuse_fill_dir_flags) 0) < 0) {
-    KVFS_LOG("filler .. error\n");
-    return -errno;
+  if (pos < 1 && filler(buf, ".", NULL, 1, (enum fuse_fill_dir_flags) 0) != 0) {
+    return 0;
+  }
+  if (pos < 2 && filler(buf, "..", NULL, 2, (enum fuse_fill_dir_flags) 0) != 0) {
+    return 0;
   }
+
+  if (pos == 0 || handle->dir_iter == nullptr) {
+    delete handle->dir_iter;
+    handle->dir_iter = db_->DirGetIterator(key);
+  }
+  Iterator* iter = handle->dir_iter;
   if(iter == nullptr){
     return 0;
   }
-  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
-    string fname = iter->fname();
-    fname += '\0';
-    const char* name_buffer = fname.data();
-    if (name_buffer[0] == '\0') {
-        continue;
-    }
-    if (filler(buf, name_buffer, NULL, 0, (enum fuse_fill_dir_flags) 0) < 0) {
-      ret = -1;
+  if (pos <= kDirCookieBase) {
+    iter->SeekToFirst();
+  } else {
+    iter->Seek(pos - kDirCookieBase);
+  }
+  static const uint32_t kReadDirBatch = 64;
+  DirEntryView entries[kReadDirBatch];
+  char name_buffer[NAME_MAX + 1];   //fname没有结尾的'\0'，拷贝到栈上
+  struct stat stbuf;   //非plus时filler只用到st_ino和st_mode中的类型，不需要读inode
+  memset(&stbuf, 0, sizeof(stbuf));
+  bool plus = (flag & FUSE_READDIR_PLUS) != 0;
+  inode_id_t keys[kReadDirBatch];
+  std::string values[kReadDirBatch];   //跨批复用，避免每批重新分配
+  int rets[kReadDirBatch];
+  uint32_t n;
+  bool full = false;
+  while (!full && (n = iter->NextBatch(entries, kReadDirBatch)) > 0) {
+    if (plus) {   //整批子inode一起读，批内预取
+      for (uint32_t i = 0; i < n; i++) {
+        keys[i] = entries[i].value;
+      }
+      db_->InodeMultiGet(keys, n, values, rets);
     }
-    if (ret < 0) {
-      break;
+    for (uint32_t i = 0; i < n; i++) {
+      size_t len = std::min(entries[i].fname.size(), static_cast<size_t>(NAME_MAX));
+      if (len == 0) {
+        continue;
+      }
+      memcpy(name_buffer, entries[i].fname.data(), len);
+      name_buffer[len] = '\0';
+      enum fuse_fill_dir_flags fill_flag = (enum fuse_fill_dir_flags) 0;
+      if (plus && rets[i] == 0 && values[i].size() >= TFS_INODE_ATTR_SIZE) {
+        if (!GetOpenAttr(entries[i].value, &stbuf)) {   //打开的文件以handle中的属性为准
+          stbuf = *(GetAttribute(values[i]));
+        }
+        fill_flag = FUSE_FILL_DIR_PLUS;
+      } else {   //读inode失败时退回只带类型，内核之后会单独getattr
+        memset(&stbuf, 0, sizeof(stbuf));
+        stbuf.st_ino = entries[i].value;
+        stbuf.st_mode = DTTOIF(entries[i].type);   //旧目录项的类型为DT_UNKNOWN
+      }
+      if (filler(buf, name_buffer, &stbuf, DirEntryCookie(entries[i].hash_fname), fill_flag) != 0) {
+        full = true;   //缓冲区已满，内核会带着最后一个目录项的offset再次调用
+        break;
+      }
     }
   }
-  delete iter;
-  return ret;
+  return 0;
 }
 
 int NSFS::ReleaseDir(const char * path,struct fuse_file_info * fi){
   KVFS_LOG("ReleaseDir:%s", path);
   kvfs_file_handle * handle = reinterpret_cast <kvfs_file_handle *>(fi->fh);
-  inode_id_t key = handle->key;
-  kvfs_file_handle::DeleteHandle(key);
+  delete handle;
   return 0;
 }
 
@@ -869,15 +1106,22 @@ int NSFS::RemoveDir(const char * path){
   int ret = 0;
   ret = db_->InodeGet(key, value);
   if(ret == 0){
-    kvfs_file_handle::DeleteHandle(key);
-    int res = db_->DirDelete(parent_id, fname);
-    if(res != 0){
+    if(!IsDirEmpty(key)){
+      return -ENOTEMPTY;
+    }
+    //目录已空，DirDropAll只回收目录自身的结构；并发创建的子项由后台和子inode一起删除
+    if(db_->DirDropAll(key) < 0){
       return -EDBERROR;
     }
-    res = db_->InodeDelete(key);
+    WriteBatch batch;
+    batch.DirDelete(parent_id, fname);
+    batch.InodeDelete(key);
+    int res = db_->Write(batch);
     if(res != 0){
       return -EDBERROR;
     }
+    //以该目录为父目录的缓存项已无法从路径到达，由CLOCK淘汰
+    dcache_->Invalidate(parent_id, fname);
 
     return 0;
   } else if(ret == 1){
@@ -887,8 +1131,64 @@ int NSFS::RemoveDir(const char * path){
   }
 }
 
+bool NSFS::IsDirEmpty(const inode_id_t key){
+  Iterator *it = db_->DirGetIterator(key);
+  if(it == nullptr){
+    return false;
+  }
+  it->SeekToFirst();
+  bool empty = !it->Valid();
+  delete it;
+  return empty;
+}
+
+int NSFS::CheckRenameTarget(const inode_id_t source, const inode_id_t target){
+  if(source == target){   //同一inode的两个名字，rename不做修改
+    return 0;
+  }
+  std::string source_attr, target_attr;
+  int ret = db_->InodeGetAttr(source, source_attr);
+  if(ret == 1){
+    return -ENOENT;
+  } else if(ret != 0){
+    return -EDBERROR;
+  }
+  ret = db_->InodeGetAttr(target, target_attr);
+  if(ret == 1){   //目标已被并发删除，按不存在处理
+    return 0;
+  } else if(ret != 0){
+    return -EDBERROR;
+  }
+  bool source_dir = S_ISDIR(GetAttribute(source_attr)->st_mode);
+  bool target_dir = S_ISDIR(GetAttribute(target_attr)->st_mode);
+  if(source_dir && !target_dir){
+    return -ENOTDIR;
+  }
+  if(!source_dir && target_dir){
+    return -EISDIR;
+  }
+  if(target_dir && !IsDirEmpty(target)){
+    return -ENOTEMPTY;
+  }
+  return 0;
+}
+
+void NSFS::DropInodeCallback(void *arg, const inode_id_t key, const std::string &value){
+  NSFS *fs = static_cast<NSFS *>(arg);
+  std::lock_guard<std::mutex> lock(fs->InodeLock(key));   //和仍打开该文件的release互斥
+  kvfs_file_handle::DeleteHandle(key);   //已打开的handle不再写回inode
+  if(value.size() >= sizeof(tfs_inode_header) && reinterpret_cast<const tfs_inode_header *>(value.data())->has_blob > 0){
+    string fpath = fs->GetDiskFilePath(key);
+    fpath += '\0';
+    unlink(fpath.c_str());
+  }
+}
+
 int NSFS::Rename(const char *new_path,const char * old_path, unsigned int flags){
   KVFS_LOG("Rename:%s %s", new_path, old_path);
+  if(flags & ~RENAME_NOREPLACE){   //RENAME_EXCHANGE、RENAME_WHITEOUT未实现，不能当作覆盖处理
+    return -EINVAL;
+  }
   inode_id_t old_key;
   inode_id_t old_parent_key;
   string old_fname;
@@ -896,22 +1196,47 @@ int NSFS::Rename(const char *new_path,const char * old_path, unsigned int flags)
     KVFS_LOG("OpenDir: No such file or directory %s\n", old_path);
     return -errno;
   }
-  inode_id_t new_key = old_key;
   inode_id_t new_parent_key;
   string new_fname;
   if (!ParentPathLookup(new_path, new_parent_key, new_fname)) {
     KVFS_LOG("OpenDir: No such file or directory %s\n", new_path);
     return -errno;
   }
-  int ret = db_->DirPut(new_parent_key, new_fname,new_key);
-  if(ret != 0){
-    return -EDBERROR;
+  inode_id_t target = INVALID_INODE_ID_KEY;
+  db_->DirGet(new_parent_key, new_fname, target);
+  if(target != INVALID_INODE_ID_KEY && (flags & RENAME_NOREPLACE)){
+    return -EEXIST;
   }
-  ret = db_->DirDelete(old_parent_key,old_fname);
-  if(ret != 0){
+  if(target != INVALID_INODE_ID_KEY){
+    int res = CheckRenameTarget(old_key, target);
+    if(res != 0){
+      return res;
+    }
+  }
+  //插入和删除写在同一条日志中，crash后不会出现新旧目录项同时存在或同时消失
+  //被覆盖的目标可能在查找后又被并发改名替换，以DirRename返回的为准，之后在其inode锁内删除
+  inode_id_t replaced;
+  int ret = db_->DirRename(old_parent_key, old_fname, new_parent_key, new_fname, replaced, false);
+  if(ret == 1){
+    return -ENOENT;
+  } else if(ret != 0){
     return -EDBERROR;
   }
-  kvfs_file_handle::DeleteHandle(old_key);
+  //目录改名后其子目录项的key不变，只需失效新旧两项
+  dcache_->Invalidate(old_parent_key, old_fname);
+  dcache_->Invalidate(new_parent_key, new_fname);
+  if(replaced != INVALID_INODE_ID_KEY){
+    //和Unlink一样：先摘除handle，之后release和后台写回都不会再写回该inode，再删除inode
+    std::lock_guard<std::mutex> lock(InodeLock(replaced));
+    kvfs_file_handle::DeleteHandle(replaced);
+    if(db_->InodeDelete(replaced) != 0){
+      return -EDBERROR;
+    }
+    string fpath = GetDiskFilePath(replaced);
+    fpath += '\0';
+    unlink(fpath.c_str());   //大文件的数据文件，小文件没有该文件
+  }
+  //inode不变，已打开的handle继续有效
   return 0;
 
 }
@@ -922,6 +1247,11 @@ int NSFS::Access(const char * path,int mask){
   return 0;
 }
 
+int NSFS::PutAttribute(const inode_id_t key, const tfs_stat_t &new_fstat){
+  //属性在value开头，只写入属性，不重写小文件的inline数据
+  return db_->InodeUpdateRange(key, 0, Slice(reinterpret_cast<const char *>(&new_fstat), TFS_INODE_ATTR_SIZE));
+}
+
 int NSFS::Chmod(const char * path , mode_t mode, struct fuse_file_info *fi){
   KVFS_LOG("Chmod:%s", path);
   inode_id_t key;
@@ -929,9 +1259,10 @@ int NSFS::Chmod(const char * path , mode_t mode, struct fuse_file_info *fi){
     KVFS_LOG("Chmod: No such file or directory %s\n", path);
     return -errno;
   }
+  std::lock_guard<std::mutex> lock(InodeLock(key));   //和打开的handle及其他属性修改互斥
   std::string value;
   int ret = 0;
-  ret = db_->InodeGet(key, value);
+  ret = db_->InodeGetAttr(key, value);
   if(ret == 0){
     kvfs_file_handle * handle = kvfs_file_handle ::GetHandle(key);
     string *mu_value = nullptr;
@@ -944,7 +1275,7 @@ int NSFS::Chmod(const char * path , mode_t mode, struct fuse_file_info *fi){
     tfs_stat_t new_value = *st_value;
     new_value.st_mode = mode;
     UpdateAttribute(*mu_value, new_value);
-    ret=db_->InodePut(key, *mu_value);
+    ret = (nullptr != handle) ? MarkDirty(handle) : PutAttribute(key, new_value);   //打开的文件在handle中合并多次修改
     if(ret != 0){
       return -EDBERROR;
     }
@@ -964,9 +1295,10 @@ int NSFS::Chown(const char * path, uid_t uid,gid_t gid, struct fuse_file_info *f
     KVFS_LOG("Chown: No such file or directory %s\n", path);
     return -errno;
   }
+  std::lock_guard<std::mutex> lock(InodeLock(key));   //和打开的handle及其他属性修改互斥
   std::string value;
   int ret = 0;
-  ret = db_->InodeGet(key, value);
+  ret = db_->InodeGetAttr(key, value);
   if(ret == 0){
     kvfs_file_handle * handle = kvfs_file_handle ::GetHandle(key);
     string *mu_value = nullptr;
@@ -980,7 +1312,7 @@ int NSFS::Chown(const char * path, uid_t uid,gid_t gid, struct fuse_file_info *f
     new_value.st_uid = uid;
     new_value.st_gid = gid;
     UpdateAttribute(*mu_value, new_value);
-    ret=db_->InodePut(key, *mu_value);
+    ret = (nullptr != handle) ? MarkDirty(handle) : PutAttribute(key, new_value);   //打开的文件在handle中合并多次修改
     if(ret != 0){
       return -EDBERROR;
     }
@@ -999,9 +1331,10 @@ int NSFS::UpdateTimens(const char * path ,const struct timespec tv[2], struct fu
     KVFS_LOG("Chown: No such file or directory %s\n", path);
     return -errno;
   }
+  std::lock_guard<std::mutex> lock(InodeLock(key));   //和打开的handle及其他属性修改互斥
   std::string value;
   int ret = 0;
-  ret = db_->InodeGet(key, value);
+  ret = db_->InodeGetAttr(key, value);
   if(ret == 0){
     kvfs_file_handle * handle = kvfs_file_handle ::GetHandle(key);
     string *mu_value = nullptr;
@@ -1017,7 +1350,7 @@ int NSFS::UpdateTimens(const char * path ,const struct timespec tv[2], struct fu
     new_value.st_mtim.tv_sec = tv[1].tv_sec;
     new_value.st_mtim.tv_nsec = tv[1].tv_nsec;
     UpdateAttribute(*mu_value, new_value);
-    ret=db_->InodePut(key, *mu_value);
+    ret = (nullptr != handle) ? MarkDirty(handle) : PutAttribute(key, new_value);   //打开的文件在handle中合并多次修改
     if(ret != 0){
       return -EDBERROR;
     }
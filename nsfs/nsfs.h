@@ -10,9 +10,13 @@
 #define FUSE_USE_VERSION 35
 
 #include <fuse.h>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
 #include "inode_format.h"
 #include "adaptor.h"
 #include "config.h"
+#include "dentry_cache.h"
 #include "metadb/db.h"
 
 using namespace metadb;
@@ -20,6 +24,30 @@ using namespace metadb;
 namespace nsfs {
 
 using namespace std;
+
+#define EDBERROR 188  //DB错误
+#define ENOTIMPLEMENT 189  //未实现
+
+//inode value的访问，value以tfs_inode_header开头，之后是小文件的inline数据
+const tfs_inode_header *GetInodeHeader(const std::string &value);
+const tfs_stat_t *GetAttribute(std::string &value);
+size_t GetInlineData(std::string &value, char* buf, size_t offset, size_t size);
+void UpdateInodeHeader(std::string &value, tfs_inode_header &new_header);
+void UpdateAttribute(std::string &value, const tfs_stat_t &new_fstat);
+void UpdateInlineData(std::string &value, const char* buf, size_t offset, size_t size);
+
+//readdir的offset是下一次续读的位置：1、2分别表示.和..之后，其余为下一个目录项的hash_fname + 2
+//目录项按hash_fname有序，并发插入和rehash不会改变已返回目录项的位置，续读时Seek即可
+static const uint64_t kDirCookieBase = 2;
+static const uint64_t kDirCookieEnd = UINT64_MAX;   //hash_fname太大无法编码，视为读完
+
+static inline off_t DirEntryCookie(uint64_t hash_fname) {
+  if (hash_fname >= kDirCookieEnd - kDirCookieBase - 1) {
+    return static_cast<off_t>(kDirCookieEnd);
+  }
+  return static_cast<off_t>(hash_fname + 1 + kDirCookieBase);
+}
+
 class NSFS {
 public :
     NSFS(const kvfs_args & arg);
@@ -51,6 +79,9 @@ public :
 
     int MakeNode(const char * path,mode_t mode ,dev_t dev);
 
+    //创建并打开普通文件，一次完成MakeNode和Open
+    int Create(const char * path, mode_t mode, struct fuse_file_info * fi);
+
     int MakeDir(const char * path,mode_t mode);
 
     int OpenDir(const char * path,struct fuse_file_info *fi);
@@ -72,29 +103,59 @@ public :
 
     int UpdateTimens(const char * path ,const struct timespec tv[2], struct fuse_file_info *fi);
 
+    void PrintStats(std::string &stats);
+
 protected:
     inline void InitStat(struct stat &statbuf, inode_id_t inode, mode_t mode, dev_t dev);
                 
+    int LookupEntry(const inode_id_t parent, const Slice &name, inode_id_t &key);   //先查目录项缓存，返回值同DBAdaptor::DirGet
     inline bool PathLookup(const char *path, inode_id_t &key);
     inline bool PathLookup(const char *path, inode_id_t &key, inode_id_t &parent_id, string &fname);
     inline bool ParentPathLookup(const char *path, inode_id_t &parent_id, string &fname);
     string InitInodeValue(inode_id_t inum, mode_t mode, dev_t dev);
 
+    //同一inode的读-改-写和文件handle都在该锁内进行，不同inode按key分到不同的锁
+    inline std::mutex & InodeLock(const inode_id_t key) { return inode_locks_[key % kInodeLockNum]; }
     kvfs_file_handle * InitFileHandle(const char * path, struct fuse_file_info * fi, const inode_id_t & key , const std::string & value );
     string GetDiskFilePath(const inode_id_t &inode_id);
     int OpenDiskFile(const inode_id_t &key, const tfs_inode_header* iheader, int flags);
     int TruncateDiskFile(const inode_id_t &key, off_t new_size);
     ssize_t MigrateDiskFileToBuffer(const inode_id_t &key, char* buffer, size_t size);
     int MigrateToDiskFile(const inode_id_t &key, string &value, int &fd, int flags);
+    int TruncateValue(const inode_id_t &key, string &value, off_t new_size);
+    //调用者持有该inode的锁，未打开的文件只修改了属性时调用，返回值同DBAdaptor::InodeUpdateRange
+    int PutAttribute(const inode_id_t key, const tfs_stat_t &new_fstat);
+    //以下两个调用者持有该inode的锁。打开文件的value修改后先只标记脏，超过滞留时间才写回DB
+    int MarkDirty(kvfs_file_handle * handle);
+    int FlushHandle(kvfs_file_handle * handle);
+    //后台线程定期写回超过滞留时间的handle，之后没有新修改的打开文件也不会一直滞留
+    void FlushLoop();
+    void FlushExpired();
+    //文件已打开时从handle取属性，其中可能有未写回的修改；未打开时返回false，由调用者读DB
+    bool GetOpenAttr(const inode_id_t key, struct stat * statbuf);
+    bool IsDirEmpty(const inode_id_t key);   //出错时也返回false
+    //rename覆盖已有目标前检查：目录只能覆盖空目录，文件不能覆盖目录；返回0或-errno
+    int CheckRenameTarget(const inode_id_t source, const inode_id_t target);
+    //DirDropAll后台删除子inode前调用，摘除已打开的handle并删除大文件的数据文件
+    static void DropInodeCallback(void *arg, const inode_id_t key, const std::string &value);
 
 
     DBAdaptor * db_;
     KVFSConfig * config_;
+    DentryCache * dcache_;
     kvfs_args args_;
     bool use_fuse;
 
     struct fuse_config *cfg_;
 
+    static const uint32_t kInodeLockNum = 1024;
+    std::mutex inode_locks_[kInodeLockNum];
+
+    std::thread flusher_;
+    std::mutex flusher_mu_;
+    std::condition_variable flusher_cv_;
+    bool flusher_stop_;   //flusher_mu_保护
+
 };
 
 
@@ -0,0 +1,505 @@
+#include "nsfs_ll.h"
+#include <cstring>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <dirent.h>
+#include <time.h>
+#include <algorithm>
+
+namespace nsfs {
+
+static const double kEntryTimeout = 1.0;   //内核缓存目录项和属性的秒数，所有修改都经过本进程
+
+NSFSLL::NSFSLL(const kvfs_args & args) : NSFS(args)
+{
+}
+
+NSFSLL::~NSFSLL(){
+}
+
+void NSFSLL::Init(struct fuse_conn_info * conn){
+  NSFS::Init(nullptr, nullptr);   //只创建根目录，属主取请求者的uid/gid
+  if(conn != nullptr && (conn->capable & FUSE_CAP_READDIRPLUS)){
+    conn->want |= FUSE_CAP_READDIRPLUS;
+  }
+}
+
+void NSFSLL::Destroy(){
+  NSFS::Destroy(nullptr);
+}
+
+void NSFSLL::AddLookup(const inode_id_t key){
+  lookup_shard &shard = GetLookupShard(key);
+  std::lock_guard<std::mutex> lock(shard.mu);
+  kvfs_lookup_count &count = shard.counts[key];
+  count.nlookup++;
+}
+
+bool NSFSLL::SetUnlinked(const inode_id_t key, bool unlinked){
+  lookup_shard &shard = GetLookupShard(key);
+  std::lock_guard<std::mutex> lock(shard.mu);
+  auto it = shard.counts.find(key);
+  if(it == shard.counts.end()){
+    return false;
+  }
+  it->second.unlinked = unlinked;
+  return true;
+}
+
+void NSFSLL::FillEntry(const inode_id_t key, std::string & value, struct fuse_entry_param * e){
+  memset(e, 0, sizeof(*e));
+  e->ino = ToFuseIno(key);
+  e->attr = *GetAttribute(value);
+  e->attr.st_ino = e->ino;
+  e->attr_timeout = kEntryTimeout;
+  e->entry_timeout = kEntryTimeout;
+}
+
+int NSFSLL::DeleteInode(const inode_id_t key){
+  std::string value;
+  int ret = db_->InodeGet(key, value);
+  if(ret == 1){
+    return 0;
+  } else if(ret != 0){
+    return -EDBERROR;
+  }
+  if(db_->InodeDelete(key) != 0){
+    return -EDBERROR;
+  }
+  if(GetInodeHeader(value)->has_blob > 0){
+    string fpath = GetDiskFilePath(key);
+    unlink(fpath.c_str());
+  }
+  kvfs_file_handle::DeleteHandle(key);
+  return 0;
+}
+
+int NSFSLL::RemoveEntry(const inode_id_t parent_id, const char * name, const inode_id_t key, std::string & value){
+  bool deferred = SetUnlinked(key, true);
+  WriteBatch batch;   //内核不再引用时目录项和inode一起删除
+  batch.DirDelete(parent_id, name);
+  if(!deferred){
+    batch.InodeDelete(key);
+  }
+  if(db_->Write(batch) != 0){
+    if(deferred){
+      SetUnlinked(key, false);
+    }
+    return -EDBERROR;
+  }
+  if(!deferred){
+    if(GetInodeHeader(value)->has_blob > 0){
+      string fpath = GetDiskFilePath(key);
+      unlink(fpath.c_str());
+    }
+    kvfs_file_handle::DeleteHandle(key);
+  }
+  return 0;
+}
+
+int NSFSLL::Lookup(fuse_ino_t parent, const char * name, struct fuse_entry_param * e){
+  KVFS_LOG("LL Lookup:%lu %s", parent, name);
+  inode_id_t key;
+  int ret = db_->DirGet(ToInodeKey(parent), name, key);
+  if(ret == 1){
+    return -ENOENT;
+  } else if(ret != 0){
+    return -EDBERROR;
+  }
+  std::string value;
+  ret = db_->InodeGetAttr(key, value);
+  if(ret == 1){
+    return -ENOENT;
+  } else if(ret != 0){
+    return -EDBERROR;
+  }
+  FillEntry(key, value, e);
+  if(GetOpenAttr(key, &e->attr)){   //打开的文件以handle中的属性为准
+    e->attr.st_ino = e->ino;
+  }
+  AddLookup(key);
+  return 0;
+}
+
+void NSFSLL::Forget(fuse_ino_t ino, uint64_t nlookup){
+  inode_id_t key = ToInodeKey(ino);
+  std::lock_guard<std::mutex> inode_lock(InodeLock(key));   //和Unlink互斥，删除标记和引用数一起判断
+  bool unlinked = false;
+  {
+    lookup_shard &shard = GetLookupShard(key);
+    std::lock_guard<std::mutex> lock(shard.mu);
+    auto it = shard.counts.find(key);
+    if(it == shard.counts.end()){
+      return;
+    }
+    if(it->second.nlookup > nlookup){
+      it->second.nlookup -= nlookup;
+      return;
+    }
+    unlinked = it->second.unlinked;
+    shard.counts.erase(it);
+  }
+  if(unlinked){
+    DeleteInode(key);
+  }
+}
+
+int NSFSLL::GetAttr(fuse_ino_t ino, struct stat * statbuf){
+  KVFS_LOG("LL GetAttr:%lu", ino);
+  if(GetOpenAttr(ToInodeKey(ino), statbuf)){
+    statbuf->st_ino = ino;
+    return 0;
+  }
+  std::string value;
+  int ret = db_->InodeGetAttr(ToInodeKey(ino), value);
+  if(ret == 0){
+    *statbuf = *(GetAttribute(value));
+    statbuf->st_ino = ino;
+    return 0;
+  } else if(ret == 1){
+    return -ENOENT;
+  } else {
+    return -EDBERROR;
+  }
+}
+
+int NSFSLL::SetAttr(fuse_ino_t ino, struct stat * attr, int to_set, struct stat * statbuf){
+  KVFS_LOG("LL SetAttr:%lu %d", ino, to_set);
+  inode_id_t key = ToInodeKey(ino);
+  std::lock_guard<std::mutex> lock(InodeLock(key));
+  std::string value;
+  //截断要改inline数据，读完整值，否则只读inode头
+  int ret = (to_set & FUSE_SET_ATTR_SIZE) ? db_->InodeGet(key, value) : db_->InodeGetAttr(key, value);
+  if(ret == 1){
+    return -ENOENT;
+  } else if(ret != 0){
+    return -EDBERROR;
+  }
+  kvfs_file_handle * handle = kvfs_file_handle::GetHandle(key);   //文件已打开时改handle中的value，release时不会覆盖
+  string *mu_value = (handle != nullptr) ? &(handle->value) : &value;
+  bool migrated = false;   //数据在inline和磁盘文件之间迁移
+  if(to_set & FUSE_SET_ATTR_SIZE){
+    bool had_blob = GetInodeHeader(*mu_value)->has_blob > 0;
+    ret = TruncateValue(key, *mu_value, attr->st_size);
+    migrated = ((GetInodeHeader(*mu_value)->has_blob > 0) != had_blob);
+    if(ret != 0){
+      return -errno;
+    }
+  }
+  tfs_stat_t new_value = *GetAttribute(*mu_value);
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  if(to_set & FUSE_SET_ATTR_MODE){
+    new_value.st_mode = (new_value.st_mode & S_IFMT) | (attr->st_mode & ~S_IFMT);
+  }
+  if(to_set & FUSE_SET_ATTR_UID){
+    new_value.st_uid = attr->st_uid;
+  }
+  if(to_set & FUSE_SET_ATTR_GID){
+    new_value.st_gid = attr->st_gid;
+  }
+  if(to_set & FUSE_SET_ATTR_ATIME_NOW){
+    new_value.st_atim = now;
+  } else if(to_set & FUSE_SET_ATTR_ATIME){
+    new_value.st_atim = attr->st_atim;
+  }
+  if(to_set & FUSE_SET_ATTR_MTIME_NOW){
+    new_value.st_mtim = now;
+  } else if(to_set & FUSE_SET_ATTR_MTIME){
+    new_value.st_mtim = attr->st_mtim;
+  }
+  new_value.st_ctim = now;
+  UpdateAttribute(*mu_value, new_value);
+  if(handle != nullptr && migrated){
+    handle->dirty = true;   //旧的数据文件或inline数据已不在，和NSFS::Write一样立即写回
+    ret = FlushHandle(handle);
+  } else if(handle != nullptr){
+    ret = MarkDirty(handle);   //打开的文件在handle中合并多次修改
+  } else if(to_set & FUSE_SET_ATTR_SIZE){
+    ret = db_->InodePut(key, value);   //截断可能改变inline数据
+  } else {
+    ret = PutAttribute(key, new_value);
+  }
+  if(ret != 0){
+    return -EDBERROR;
+  }
+  *statbuf = new_value;
+  statbuf->st_ino = ino;
+  return 0;
+}
+
+int NSFSLL::Readlink(fuse_ino_t ino, char * buf, size_t size){
+  KVFS_LOG("LL Readlink:%lu", ino);
+  std::string result;
+  int ret = db_->InodeGet(ToInodeKey(ino), result);
+  if(ret == 0){
+    size_t data_size = GetInlineData(result, buf, 0, size-1);
+    buf[data_size] = '\0';
+    return 0;
+  } else if(ret == 1){
+    return -ENOENT;
+  } else {
+    return -EDBERROR;
+  }
+}
+
+int NSFSLL::NewEntry(const inode_id_t parent_id, const char * name, mode_t mode, dev_t rdev, const struct fuse_ctx * ctx, const inode_id_t key, std::string & value){
+  value = InitInodeValue(key, mode, rdev);
+  if(ctx != nullptr){
+    tfs_inode_header header = *GetInodeHeader(value);
+    header.fstat.st_uid = ctx->uid;
+    header.fstat.st_gid = ctx->gid;
+    UpdateInodeHeader(value, header);
+  }
+
+  WriteBatch batch;   //目录项和inode同时生效
+  batch.DirPut(parent_id, name, key, IFTODT(mode));
+  batch.InodePut(key, value, TFS_INODE_HEADER_SIZE);
+  if(db_->Write(batch) != 0){
+    return -EDBERROR;
+  }
+  return 0;
+}
+
+int NSFSLL::MakeNode(fuse_ino_t parent, const char * name, mode_t mode, dev_t rdev, const struct fuse_ctx * ctx, struct fuse_entry_param * e){
+  KVFS_LOG("LL MakeNode:%lu %s", parent, name);
+  inode_id_t key = config_->NewInode();
+  std::string value;
+  int ret = NewEntry(ToInodeKey(parent), name, mode, rdev, ctx, key, value);
+  if(ret != 0){
+    return ret;
+  }
+  FillEntry(key, value, e);
+  AddLookup(key);
+  return 0;
+}
+
+int NSFSLL::Create(fuse_ino_t parent, const char * name, mode_t mode, const struct fuse_ctx * ctx, struct fuse_file_info * fi, struct fuse_entry_param * e){
+  KVFS_LOG("LL Create:%lu %s", parent, name);
+  inode_id_t key = config_->NewInode();
+  std::lock_guard<std::mutex> lock(InodeLock(key));
+  std::string value;
+  int ret = NewEntry(ToInodeKey(parent), name, (mode & ~S_IFMT) | S_IFREG, 0, ctx, key, value);
+  if(ret != 0){
+    return ret;
+  }
+  InitFileHandle(nullptr, fi, key, value);   //直接用刚写入的value，不再读inode
+  FillEntry(key, value, e);
+  AddLookup(key);
+  return 0;
+}
+
+int NSFSLL::Unlink(fuse_ino_t parent, const char * name){
+  KVFS_LOG("LL Unlink:%lu %s", parent, name);
+  inode_id_t parent_id = ToInodeKey(parent);
+  inode_id_t key;
+  int ret = db_->DirGet(parent_id, name, key);
+  if(ret == 1){
+    return -ENOENT;
+  } else if(ret != 0){
+    return -EDBERROR;
+  }
+  std::lock_guard<std::mutex> lock(InodeLock(key));
+  std::string value;
+  ret = db_->InodeGet(key, value);
+  if(ret == 1){
+    return -ENOENT;
+  } else if(ret != 0){
+    return -EDBERROR;
+  }
+  return RemoveEntry(parent_id, name, key, value);
+}
+
+int NSFSLL::RemoveDir(fuse_ino_t parent, const char * name){
+  KVFS_LOG("LL RemoveDir:%lu %s", parent, name);
+  inode_id_t parent_id = ToInodeKey(parent);
+  inode_id_t key;
+  int ret = db_->DirGet(parent_id, name, key);
+  if(ret == 1){
+    return -ENOENT;
+  } else if(ret != 0){
+    return -EDBERROR;
+  }
+  std::lock_guard<std::mutex> lock(InodeLock(key));
+  std::string value;
+  ret = db_->InodeGet(key, value);
+  if(ret == 1){
+    return -ENOENT;
+  } else if(ret != 0){
+    return -EDBERROR;
+  }
+  if(!IsDirEmpty(key)){
+    return -ENOTEMPTY;
+  }
+  //和NSFS::RemoveDir一致，DirDropAll回收空目录的结构
+  if(db_->DirDropAll(key) < 0){
+    return -EDBERROR;
+  }
+  return RemoveEntry(parent_id, name, key, value);
+}
+
+int NSFSLL::Rename(fuse_ino_t parent, const char * name, fuse_ino_t new_parent, const char * new_name, unsigned int flags){
+  KVFS_LOG("LL Rename:%lu %s %lu %s", parent, name, new_parent, new_name);
+  if(flags != 0){   //RENAME_NOREPLACE、RENAME_EXCHANGE
+    return -EINVAL;
+  }
+  inode_id_t old_parent_key = ToInodeKey(parent);
+  inode_id_t new_parent_key = ToInodeKey(new_parent);
+  inode_id_t source;
+  int ret = db_->DirGet(old_parent_key, name, source);
+  if(ret == 1){
+    return -ENOENT;
+  } else if(ret != 0){
+    return -EDBERROR;
+  }
+  inode_id_t target;
+  ret = db_->DirGet(new_parent_key, new_name, target);
+  if(ret == 0){
+    ret = CheckRenameTarget(source, target);
+    if(ret != 0){
+      return ret;
+    }
+  } else if(ret != 1){
+    return -EDBERROR;
+  }
+  inode_id_t replaced;   //内核可能仍引用被覆盖的inode，由lookup计数决定何时删除，不和改名一起删除
+  ret = db_->DirRename(old_parent_key, name, new_parent_key, new_name, replaced, false);
+  if(ret == 1){
+    return -ENOENT;
+  } else if(ret != 0){
+    return -EDBERROR;
+  }
+  if(replaced != INVALID_INODE_ID_KEY){   //被覆盖的目标已没有目录项，按unlink处理
+    std::lock_guard<std::mutex> lock(InodeLock(replaced));
+    if(!SetUnlinked(replaced, true)){
+      DeleteInode(replaced);
+    }
+  }
+  return 0;
+}
+
+int NSFSLL::Open(fuse_ino_t ino, struct fuse_file_info * fi){
+  KVFS_LOG("LL Open:%lu", ino);
+  inode_id_t key = ToInodeKey(ino);
+  std::lock_guard<std::mutex> lock(InodeLock(key));
+  string value;
+  int ret = db_->InodeGet(key, value);
+  if(ret == 0){
+    InitFileHandle(nullptr, fi, key, value);
+    return 0;
+  } else if(ret == 1){
+    return -ENOENT;
+  } else {
+    return -EDBERROR;
+  }
+}
+
+int NSFSLL::OpenDir(fuse_ino_t ino, struct fuse_file_info * fi){
+  KVFS_LOG("LL OpenDir:%lu", ino);
+  inode_id_t key = ToInodeKey(ino);
+  std::string value;
+  int ret = db_->InodeGet(key, value);
+  if(ret == 0){
+    kvfs_file_handle * handle = new kvfs_file_handle(key);   //每次opendir独占，保存自己的目录快照
+    handle->fd = -1;
+    handle->flags = fi->flags;
+    handle->mode = INODE_READ;
+    handle->value = value;
+    fi->fh = reinterpret_cast<uint64_t>(handle);
+    return 0;
+  } else if(ret == 1){
+    return -ENOENT;
+  } else {
+    return -EDBERROR;
+  }
+}
+
+ssize_t NSFSLL::ReadDir(fuse_req_t req, char * buf, size_t size, off_t offset, struct fuse_file_info * fi, bool plus){
+  KVFS_LOG("LL ReadDir offset:%ld", offset);
+  kvfs_file_handle * handle = reinterpret_cast <kvfs_file_handle *>(fi->fh);
+  inode_id_t key = handle->key;
+  uint64_t pos = static_cast<uint64_t>(offset);
+  if (pos == kDirCookieEnd) {
+    return 0;
+  }
+  size_t used = 0;
+  size_t entsize;
+  struct fuse_entry_param e;   //非plus时只用到其中的attr
+  memset(&e, 0, sizeof(e));
+  e.attr.st_ino = ToFuseIno(key);
+  e.attr.st_mode = S_IFDIR;
+  //.和..不增加lookup引用，ino为0时内核不会为它们建立inode
+  const char * dots[2] = {".", ".."};
+  for (uint64_t i = pos; i < kDirCookieBase; i++) {
+    entsize = plus ? fuse_add_direntry_plus(req, buf + used, size - used, dots[i], &e, i + 1)
+                   : fuse_add_direntry(req, buf + used, size - used, dots[i], &e.attr, i + 1);
+    if (entsize > size - used) {
+      return used;
+    }
+    used += entsize;
+  }
+
+  if (pos == 0 || handle->dir_iter == nullptr) {
+    delete handle->dir_iter;
+    handle->dir_iter = db_->DirGetIterator(key);
+  }
+  Iterator* iter = handle->dir_iter;
+  if(iter == nullptr){
+    return used;
+  }
+  if (pos <= kDirCookieBase) {
+    iter->SeekToFirst();
+  } else {
+    iter->Seek(pos - kDirCookieBase);
+  }
+  static const uint32_t kReadDirBatch = 64;
+  DirEntryView entries[kReadDirBatch];
+  char name_buffer[NAME_MAX + 1];
+  inode_id_t keys[kReadDirBatch];
+  std::string values[kReadDirBatch];
+  int rets[kReadDirBatch];
+  uint32_t n;
+  bool full = false;
+  while (!full && (n = iter->NextBatch(entries, kReadDirBatch)) > 0) {
+    if (plus) {
+      for (uint32_t i = 0; i < n; i++) {
+        keys[i] = entries[i].value;
+      }
+      db_->InodeMultiGet(keys, n, values, rets);
+    }
+    for (uint32_t i = 0; i < n; i++) {
+      size_t len = std::min(entries[i].fname.size(), static_cast<size_t>(NAME_MAX));
+      if (len == 0) {
+        continue;
+      }
+      memcpy(name_buffer, entries[i].fname.data(), len);
+      name_buffer[len] = '\0';
+      off_t next = DirEntryCookie(entries[i].hash_fname);
+      bool has_entry = plus && rets[i] == 0 && values[i].size() >= TFS_INODE_ATTR_SIZE;
+      if (has_entry) {
+        FillEntry(entries[i].value, values[i], &e);
+        if (GetOpenAttr(entries[i].value, &e.attr)) {
+          e.attr.st_ino = e.ino;
+        }
+      } else {   //读inode失败时ino为0，内核之后会单独lookup
+        memset(&e, 0, sizeof(e));
+        e.attr.st_ino = ToFuseIno(entries[i].value);
+        e.attr.st_mode = DTTOIF(entries[i].type);
+      }
+      entsize = plus ? fuse_add_direntry_plus(req, buf + used, size - used, name_buffer, &e, next)
+                     : fuse_add_direntry(req, buf + used, size - used, name_buffer, &e.attr, next);
+      if (entsize > size - used) {
+        full = true;   //缓冲区已满，内核会带着最后一个目录项的offset再次调用
+        break;
+      }
+      used += entsize;
+      if (has_entry) {
+        AddLookup(entries[i].value);
+      }
+    }
+  }
+  return used;
+}
+
+}
@@ -0,0 +1,88 @@
+/**
+ * @Description : 基于FUSE low-level接口的NSFS，请求直接带inode号，路径由内核的dcache逐级解析，每次操作最多查一级目录项
+ */
+#ifndef _NSFS_NSFS_LL_H_
+#define _NSFS_NSFS_LL_H_
+
+#include <fuse_lowlevel.h>
+#include <mutex>
+#include <unordered_map>
+
+#include "nsfs.h"
+
+namespace nsfs {
+
+//FUSE的根目录inode号固定为FUSE_ROOT_ID(1)，NSFS的根目录为0，整体加1映射
+static inline inode_id_t ToInodeKey(fuse_ino_t ino) { return ino - FUSE_ROOT_ID + ROOT_INODE_ID; }
+static inline fuse_ino_t ToFuseIno(inode_id_t key) { return key - ROOT_INODE_ID + FUSE_ROOT_ID; }
+
+struct kvfs_lookup_count {
+    uint64_t nlookup;   //内核持有的引用数，回复entry时加1，forget时减去
+    bool unlinked;      //目录项已删除，引用归零时再删除inode
+};
+
+class NSFSLL : public NSFS {
+public :
+    NSFSLL(const kvfs_args & args);
+    virtual ~NSFSLL();
+
+    void Init(struct fuse_conn_info * conn);
+
+    void Destroy();
+
+    //以下返回0或-errno，回复由调用者完成；返回entry的操作成功时已为该inode增加一次lookup引用
+    int Lookup(fuse_ino_t parent, const char * name, struct fuse_entry_param * e);
+
+    void Forget(fuse_ino_t ino, uint64_t nlookup);
+
+    int GetAttr(fuse_ino_t ino, struct stat * statbuf);
+
+    int SetAttr(fuse_ino_t ino, struct stat * attr, int to_set, struct stat * statbuf);
+
+    int Readlink(fuse_ino_t ino, char * buf, size_t size);
+
+    //mode中带文件类型，uid和gid取自请求者
+    int MakeNode(fuse_ino_t parent, const char * name, mode_t mode, dev_t rdev, const struct fuse_ctx * ctx, struct fuse_entry_param * e);
+
+    //创建并打开普通文件，成功时fi->fh为新文件的handle
+    int Create(fuse_ino_t parent, const char * name, mode_t mode, const struct fuse_ctx * ctx, struct fuse_file_info * fi, struct fuse_entry_param * e);
+
+    int Unlink(fuse_ino_t parent, const char * name);
+
+    int RemoveDir(fuse_ino_t parent, const char * name);
+
+    int Rename(fuse_ino_t parent, const char * name, fuse_ino_t new_parent, const char * new_name, unsigned int flags);
+
+    int Open(fuse_ino_t ino, struct fuse_file_info * fi);
+
+    int OpenDir(fuse_ino_t ino, struct fuse_file_info * fi);
+
+    //把目录项填入buf，返回填入的字节数或-errno；plus时同时带回属性，并为每个子inode增加一次lookup引用
+    ssize_t ReadDir(fuse_req_t req, char * buf, size_t size, off_t offset, struct fuse_file_info * fi, bool plus);
+
+protected:
+    static const uint32_t kLookupShardNum = 64;
+    struct lookup_shard {
+        std::mutex mu;
+        std::unordered_map <inode_id_t, kvfs_lookup_count> counts;
+    };
+    lookup_shard lookup_shards_[kLookupShardNum];
+
+    inline lookup_shard & GetLookupShard(const inode_id_t key) { return lookup_shards_[key % kLookupShardNum]; }
+    void AddLookup(const inode_id_t key);
+    //内核仍引用该inode时设置删除标记并返回true，否则返回false
+    bool SetUnlinked(const inode_id_t key, bool unlinked);
+
+    void FillEntry(const inode_id_t key, std::string & value, struct fuse_entry_param * e);
+    //写入新inode及其目录项，value返回新inode的值
+    int NewEntry(const inode_id_t parent_id, const char * name, mode_t mode, dev_t rdev, const struct fuse_ctx * ctx, const inode_id_t key, std::string & value);
+    //调用者持有该inode的锁。内核仍引用该inode时只删除目录项，inode等到forget时再删除
+    int RemoveEntry(const inode_id_t parent_id, const char * name, const inode_id_t key, std::string & value);
+    //目录项已不存在，内核也不再引用，删除inode及大文件的数据
+    int DeleteInode(const inode_id_t key);
+
+};
+
+}
+
+#endif
@@ -0,0 +1,261 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <unistd.h>
+#include <limits.h>
+
+#include "nsfs_ll.h"
+
+using namespace nsfs;
+
+static NSFSLL *fs;
+
+static void reply_entry(fuse_req_t req, int ret, const struct fuse_entry_param *e)
+{
+    if(ret == 0) fuse_reply_entry(req, e);
+    else fuse_reply_err(req, -ret);
+}
+
+static void ll_init(void *userdata, struct fuse_conn_info *conn)
+{
+    fs->Init(conn);
+}
+static void ll_destroy(void *userdata)
+{
+    fs->Destroy();
+}
+static void ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    struct fuse_entry_param e;
+    int ret = fs->Lookup(parent, name, &e);
+    reply_entry(req, ret, &e);
+}
+static void ll_forget(fuse_req_t req, fuse_ino_t ino, uint64_t nlookup)
+{
+    fs->Forget(ino, nlookup);
+    fuse_reply_none(req);
+}
+static void ll_forget_multi(fuse_req_t req, size_t count, struct fuse_forget_data *forgets)
+{
+    for(size_t i = 0; i < count; i++)
+    {
+        fs->Forget(forgets[i].ino, forgets[i].nlookup);
+    }
+    fuse_reply_none(req);
+}
+static void ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    struct stat statbuf;
+    int ret = fs->GetAttr(ino, &statbuf);
+    if(ret == 0) fuse_reply_attr(req, &statbuf, 1.0);
+    else fuse_reply_err(req, -ret);
+}
+static void ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set, struct fuse_file_info *fi)
+{
+    struct stat statbuf;
+    int ret = fs->SetAttr(ino, attr, to_set, &statbuf);
+    if(ret == 0) fuse_reply_attr(req, &statbuf, 1.0);
+    else fuse_reply_err(req, -ret);
+}
+static void ll_readlink(fuse_req_t req, fuse_ino_t ino)
+{
+    char buf[PATH_MAX + 1];
+    int ret = fs->Readlink(ino, buf, sizeof(buf));
+    if(ret == 0) fuse_reply_readlink(req, buf);
+    else fuse_reply_err(req, -ret);
+}
+static void ll_mknod(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, dev_t rdev)
+{
+    struct fuse_entry_param e;
+    int ret = fs->MakeNode(parent, name, mode, rdev, fuse_req_ctx(req), &e);
+    reply_entry(req, ret, &e);
+}
+static void ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode)
+{
+    struct fuse_entry_param e;
+    int ret = fs->MakeNode(parent, name, mode | S_IFDIR, 0, fuse_req_ctx(req), &e);
+    reply_entry(req, ret, &e);
+}
+static void ll_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    fuse_reply_err(req, -fs->Unlink(parent, name));
+}
+static void ll_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    fuse_reply_err(req, -fs->RemoveDir(parent, name));
+}
+static void ll_rename(fuse_req_t req, fuse_ino_t parent, const char *name, fuse_ino_t newparent, const char *newname, unsigned int flags)
+{
+    fuse_reply_err(req, -fs->Rename(parent, name, newparent, newname, flags));
+}
+static void ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    int ret = fs->Open(ino, fi);
+    if(ret == 0) fuse_reply_open(req, fi);
+    else fuse_reply_err(req, -ret);
+}
+static void ll_create(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, struct fuse_file_info *fi)
+{
+    struct fuse_entry_param e;
+    int ret = fs->Create(parent, name, mode, fuse_req_ctx(req), fi, &e);
+    if(ret == 0) fuse_reply_create(req, &e, fi);
+    else fuse_reply_err(req, -ret);
+}
+static void ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi)
+{
+    char *buf = new char[size];
+    int ret = fs->Read("", buf, size, off, fi);
+    if(ret >= 0) fuse_reply_buf(req, buf, ret);
+    else fuse_reply_err(req, -ret);
+    delete [] buf;
+}
+static void ll_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size, off_t off, struct fuse_file_info *fi)
+{
+    int ret = fs->Write("", buf, size, off, fi);
+    if(ret >= 0) fuse_reply_write(req, ret);
+    else fuse_reply_err(req, -ret);
+}
+static void ll_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    fuse_reply_err(req, -fs->Release("", fi));
+}
+static void ll_fsync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi)
+{
+    fuse_reply_err(req, -fs->Fsync("", datasync, fi));
+}
+static void ll_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    int ret = fs->OpenDir(ino, fi);
+    if(ret == 0) fuse_reply_open(req, fi);
+    else fuse_reply_err(req, -ret);
+}
+static void do_readdir(fuse_req_t req, size_t size, off_t off, struct fuse_file_info *fi, bool plus)
+{
+    char *buf = new char[size];
+    ssize_t ret = fs->ReadDir(req, buf, size, off, fi, plus);
+    if(ret >= 0) fuse_reply_buf(req, buf, ret);
+    else fuse_reply_err(req, -ret);
+    delete [] buf;
+}
+static void ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi)
+{
+    do_readdir(req, size, off, fi, false);
+}
+static void ll_readdirplus(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi)
+{
+    do_readdir(req, size, off, fi, true);
+}
+static void ll_releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    fuse_reply_err(req, -fs->ReleaseDir("", fi));
+}
+static void ll_access(fuse_req_t req, fuse_ino_t ino, int mask)
+{
+    fuse_reply_err(req, 0);
+}
+
+void parse_args(int argc , char * argv[],kvfs_args & args)
+{
+    for(int i = 1; i < argc ;++ i)
+    {
+        if(argv[i][0] == '-')
+        {
+            args[argv[i] +1] = argv[i+1];
+        }
+        printf("option : %s value %s \n",argv[i],argv[i+1]);
+        ++i;
+    }
+}
+
+static struct fuse_lowlevel_ops kvfs_ll_operations;
+
+bool FileExists(const std::string& fname) {
+    return access(fname.c_str(), F_OK) == 0;
+}
+
+int main(int argc , char * argv[])
+{
+    kvfs_args args;
+    parse_args(argc,argv,args);
+    //路径由内核的dcache解析，默认不再使用NSFS自己的目录项缓存
+    if(args.find("dentry_cache_size") == args.end())
+    {
+        args["dentry_cache_size"] = "0";
+    }
+    fs = new NSFSLL(args);
+
+    std::string mountdir = args.at("mount_dir");
+    std::string datadir = args.at("data_dir");
+    std::string metadir = args.at("meta_dir");
+    if( !(FileExists(mountdir) &&
+        FileExists(datadir) &&
+       FileExists(metadir)))
+    {
+        fprintf(stderr, "Some input directories cannot be found.\n");
+    }
+    int fuse_threads = 0;   //0为libfuse默认的多线程，1为单线程
+    if(args.find("fuse_threads") != args.end())
+    {
+        fuse_threads = atoi(args.at("fuse_threads").c_str());
+    }
+
+    kvfs_ll_operations.init         = ll_init;
+    kvfs_ll_operations.destroy      = ll_destroy;
+    kvfs_ll_operations.lookup       = ll_lookup;
+    kvfs_ll_operations.forget       = ll_forget;
+    kvfs_ll_operations.forget_multi = ll_forget_multi;
+    kvfs_ll_operations.getattr      = ll_getattr;
+    kvfs_ll_operations.setattr      = ll_setattr;
+    kvfs_ll_operations.readlink     = ll_readlink;
+    kvfs_ll_operations.mknod        = ll_mknod;
+    kvfs_ll_operations.mkdir        = ll_mkdir;
+    kvfs_ll_operations.unlink       = ll_unlink;
+    kvfs_ll_operations.rmdir        = ll_rmdir;
+    kvfs_ll_operations.rename       = ll_rename;
+    kvfs_ll_operations.open         = ll_open;
+    kvfs_ll_operations.create       = ll_create;
+    kvfs_ll_operations.read         = ll_read;
+    kvfs_ll_operations.write        = ll_write;
+    kvfs_ll_operations.release      = ll_release;
+    kvfs_ll_operations.fsync        = ll_fsync;
+    kvfs_ll_operations.opendir      = ll_opendir;
+    kvfs_ll_operations.readdir      = ll_readdir;
+    kvfs_ll_operations.readdirplus  = ll_readdirplus;
+    kvfs_ll_operations.releasedir   = ll_releasedir;
+    kvfs_ll_operations.access       = ll_access;
+
+    char * fuse_argv[1] = {argv[0]};
+    struct fuse_args fuse_args = FUSE_ARGS_INIT(1, fuse_argv);
+    struct fuse_session *se = fuse_session_new(&fuse_args, &kvfs_ll_operations, sizeof(kvfs_ll_operations), NULL);
+    if(se == NULL)
+    {
+        fprintf(stderr, "create fuse session failed\n");
+        return 1;
+    }
+    int ret = 1;
+    if(fuse_set_signal_handlers(se) == 0)
+    {
+        if(fuse_session_mount(se, mountdir.c_str()) == 0)
+        {
+            fprintf(stdout,"start to run fuse lowlevel loop at %s %s \n",argv[0],mountdir.c_str());
+            fuse_daemonize(0);
+            if(fuse_threads == 1)
+            {
+                ret = fuse_session_loop(se);
+            }
+            else
+            {
+                struct fuse_loop_config config;
+                config.clone_fd = 0;
+                config.max_idle_threads = fuse_threads > 1 ? fuse_threads : 10;
+                ret = fuse_session_loop_mt(se, &config);
+            }
+            fuse_session_unmount(se);
+        }
+        fuse_remove_signal_handlers(se);
+    }
+    fuse_session_destroy(se);
+    return ret;
+
+}
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <iostream>
 #include <unistd.h>
+#include <stdlib.h>
 
 #include "nsfs.h"
 
@@ -54,6 +55,9 @@ int wrap_truncate(const char *path, off_t newSize, struct fuse_file_info *fi) {
 int wrap_open(const char *path, struct fuse_file_info *fileInfo) {
       return fs->Open(path, fileInfo);
 }
+int wrap_create(const char *path, mode_t mode, struct fuse_file_info *fileInfo) {
+      return fs->Create(path, mode, fileInfo);
+}
 int wrap_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo) {
       return fs->Read(path, buf, size, offset, fileInfo);
 }
@@ -129,8 +133,31 @@ int main(int argc , char * argv[])
     char fuse_mount_dir[100];
     strcpy(fuse_mount_dir , mountdir.c_str());
     fuse_argv[fuse_argc++] = fuse_mount_dir;
+    //FUSE默认多线程处理请求，-fuse_threads指定线程数，为1时退回单线程
+    int fuse_threads = 0;
+    if(args.find("fuse_threads") != args.end())
+    {
+        fuse_threads = atoi(args.at("fuse_threads").c_str());
+    }
     char fuse_opt_s[20] = "-s";  //-s disable multi-threaded operation
-    fuse_argv[fuse_argc++] = fuse_opt_s;
+    char fuse_opt_o[20] = "-o";
+    char fuse_opt_threads[100];
+    if(fuse_threads == 1)
+    {
+        fuse_argv[fuse_argc++] = fuse_opt_s;
+    }
+    else if(fuse_threads > 1)
+    {
+        //3.12之前的libfuse按需创建线程，只能限制空闲线程数；之后默认最多10个线程
+        snprintf(fuse_opt_threads, sizeof(fuse_opt_threads), "max_idle_threads=%d", fuse_threads);
+#ifdef FUSE_MAKE_VERSION
+#if FUSE_VERSION >= FUSE_MAKE_VERSION(3, 12)
+        snprintf(fuse_opt_threads, sizeof(fuse_opt_threads), "max_threads=%d,max_idle_threads=%d", fuse_threads, fuse_threads);
+#endif
+#endif
+        fuse_argv[fuse_argc++] = fuse_opt_o;
+        fuse_argv[fuse_argc++] = fuse_opt_threads;
+    }
 
     kvfs_operations.init = wrap_init;
     kvfs_operations.getattr = wrap_getattr;
@@ -145,6 +172,7 @@ int main(int argc , char * argv[])
     kvfs_operations.readlink = wrap_readlink;
 
     kvfs_operations.open = wrap_open;
+    kvfs_operations.create = wrap_create;
     kvfs_operations.read = wrap_read;
     kvfs_operations.write = wrap_write;
 
@@ -0,0 +1,55 @@
+#! /bin/bash
+# FUSE线程数从1到32时create、stat、readdir的吞吐，每轮重新格式化并挂载
+# 用法: ./scale_nsfs.sh [客户端进程数] [每个进程的文件数]
+
+mountdir="/pmem0/fs/mnt"
+metadir="/pmem0/fs/meta"
+datadir="/pmem0/fs/data"
+
+clients=${1:-32}
+files=${2:-10000}
+
+now() {
+    date +%s.%N
+}
+
+# $1阶段名 $2开始时间 $3操作数
+report() {
+    end=$(now)
+    echo "$1" "$2" "$end" "$3" | awk '{printf "%-8s threads:%-3s ops:%d time:%.3f s %.0f ops/sec\n", $1, threads, $4, $3 - $2, $4 / ($3 - $2)}' threads=$threads
+}
+
+for threads in 1 2 4 8 16 32
+do
+    rm -f $metadir/* $datadir/*
+    ./nsfs_main -mount_dir $mountdir -meta_dir $metadir -data_dir $datadir -fuse_threads $threads > /dev/null
+    sleep 1
+
+    for c in $(seq 1 $clients); do mkdir $mountdir/d$c; done
+
+    # 每个客户端在自己的目录下创建，用shell内建命令，不为每个文件fork
+    start=$(now)
+    for c in $(seq 1 $clients); do
+        ( for ((i = 0; i < files; i++)); do : > $mountdir/d$c/f$i; done ) &
+    done
+    wait
+    report create $start $((clients * files))
+
+    start=$(now)
+    for c in $(seq 1 $clients); do
+        ( for ((i = 0; i < files; i++)); do [ -e $mountdir/d$c/f$i ]; done ) &
+    done
+    wait
+    report stat $start $((clients * files))
+
+    # 读出每个目录的全部目录项，按目录项计数
+    start=$(now)
+    for c in $(seq 1 $clients); do
+        ( for f in $mountdir/d$c/*; do :; done ) &
+    done
+    wait
+    report readdir $start $((clients * files))
+
+    umount $mountdir
+    killall -w nsfs_main 2> /dev/null
+done